@@ -235,6 +235,7 @@ TESTSRC = \
   $(TOP)/src/test_async.c \
   $(TOP)/src/test_backup.c \
   $(TOP)/src/test_btree.c \
+  $(TOP)/src/test_compress.c \
   $(TOP)/src/test_config.c \
   $(TOP)/src/test_demovfs.c \
   $(TOP)/src/test_devsym.c \
@@ -123,31 +123,33 @@ const char *sqlite3OpcodeName(int i){
      /* 118 */ "Checkpoint",
      /* 119 */ "JournalMode",
      /* 120 */ "Vacuum",
-     /* 121 */ "IncrVacuum",
-     /* 122 */ "Expire",
-     /* 123 */ "TableLock",
-     /* 124 */ "VBegin",
-     /* 125 */ "VCreate",
-     /* 126 */ "VDestroy",
-     /* 127 */ "VOpen",
-     /* 128 */ "VFilter",
-     /* 129 */ "VColumn",
+     /* 121 */ "CompressDictionary",
+     /* 122 */ "CompressPolicy",
+     /* 123 */ "CompressSetting",
+     /* 124 */ "CompressStats",
+     /* 125 */ "IncrVacuum",
+     /* 126 */ "Expire",
+     /* 127 */ "TableLock",
+     /* 128 */ "VBegin",
+     /* 129 */ "VCreate",
      /* 130 */ "Real",
-     /* 131 */ "VNext",
-     /* 132 */ "VRename",
-     /* 133 */ "VUpdate",
-     /* 134 */ "Pagecount",
-     /* 135 */ "MaxPgcnt",
-     /* 136 */ "Trace",
-     /* 137 */ "Noop",
-     /* 138 */ "Explain",
-     /* 139 */ "NotUsed_139",
-     /* 140 */ "NotUsed_140",
+     /* 131 */ "VDestroy",
+     /* 132 */ "VOpen",
+     /* 133 */ "VFilter",
+     /* 134 */ "VColumn",
+     /* 135 */ "VNext",
+     /* 136 */ "VRename",
+     /* 137 */ "VUpdate",
+     /* 138 */ "Pagecount",
+     /* 139 */ "MaxPgcnt",
+     /* 140 */ "Trace",
      /* 141 */ "ToText",
      /* 142 */ "ToBlob",
      /* 143 */ "ToNumeric",
      /* 144 */ "ToInt",
      /* 145 */ "ToReal",
+     /* 146 */ "Noop",
+     /* 147 */ "Explain",
   };
   return azName[i];
 }
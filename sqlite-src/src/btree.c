@@ -2057,6 +2057,7 @@ int sqlite3BtreeClose(Btree *p){
     }
     sqlite3DbFree(0, pBt->pSchema);
     freeTempSpace(pBt);
+    sqlite3_free(pBt->aPolicy);
     sqlite3_free(pBt);
   }
 
@@ -2095,6 +2096,79 @@ int sqlite3BtreeSetCacheSize(Btree *p, int mxPage){
   return SQLITE_OK;
 }
 
+/*
+** Return the compression policy of a page for the pager to pass on to
+** the VFS. See sqlite3BtreeSetPolicy().
+*/
+static int pagePolicy(DbPage *pData){
+  MemPage *pPage = (MemPage *)sqlite3PagerGetExtra(pData);
+  return pPage->policy;
+}
+
+/*
+** Return the compression policy of the b-tree rooted at page iRoot.
+*/
+static u8 btreePolicy(BtShared *pBt, Pgno iRoot){
+  int i;
+  for(i=0; i<pBt->nPolicy; i++){
+    if( pBt->aPolicy[i].iRoot==iRoot ) return (u8)pBt->aPolicy[i].policy;
+  }
+  return 0;
+}
+
+/*
+** The b-tree rooted at page iFrom is now rooted at page iTo, or was
+** dropped if iTo is 0. Move its compression policy with it.
+*/
+static void btreeMovePolicy(BtShared *pBt, Pgno iFrom, Pgno iTo){
+  int i;
+  assert( sqlite3_mutex_held(pBt->mutex) );
+  for(i=0; i<pBt->nPolicy; i++){
+    if( pBt->aPolicy[i].iRoot==iFrom ){
+      if( iTo ){
+        pBt->aPolicy[i].iRoot = iTo;
+      }else{
+        pBt->aPolicy[i] = pBt->aPolicy[--pBt->nPolicy];
+      }
+      break;
+    }
+  }
+}
+
+/*
+** Compress the pages of the b-tree rooted at page iTable with a policy of
+** the VFS, or with its default one if policy is 0. See PRAGMA
+** compress_policy. The pages take it as they are next written.
+*/
+int sqlite3BtreeSetPolicy(Btree *p, int iTable, int policy){
+  BtShared *pBt = p->pBt;
+  int rc = SQLITE_OK;
+  int i;
+  assert( sqlite3_mutex_held(p->db->mutex) );
+  assert( policy>=0 && policy<=255 );
+  sqlite3BtreeEnter(p);
+  for(i=0; i<pBt->nPolicy && pBt->aPolicy[i].iRoot!=(Pgno)iTable; i++){}
+  if( i==pBt->nPolicy ){
+    BtPolicy *aNew;
+    aNew = sqlite3_realloc(pBt->aPolicy, (i+1)*sizeof(BtPolicy));
+    if( aNew==0 ){
+      rc = SQLITE_NOMEM;
+    }else{
+      pBt->aPolicy = aNew;
+      pBt->aPolicy[i].iRoot = (Pgno)iTable;
+      pBt->nPolicy++;
+    }
+  }
+  if( rc==SQLITE_OK ){
+    /* Keep the entries of the policies set back to the default, so the
+    ** VFS learns about the pages that no longer have one. */
+    pBt->aPolicy[i].policy = policy;
+    sqlite3PagerSetPolicy(pBt->pPager, pagePolicy);
+  }
+  sqlite3BtreeLeave(p);
+  return rc;
+}
+
 /*
 ** Change the way data is synced to disk in order to increase or decrease
 ** how well the database resists damage due to OS crashes and power
@@ -2806,6 +2880,9 @@ static int relocatePage(
     return rc;
   }
   pDbPage->pgno = iFreePage;
+  if( eType==PTRMAP_ROOTPAGE ){
+    btreeMovePolicy(pBt, iDbPage, iFreePage);
+  }
 
   /* If pDbPage was a btree-page, then it may have child pages and/or cells
   ** that point to overflow pages. The pointer map entries for all these
@@ -4121,6 +4198,7 @@ static int moveToChild(BtCursor *pCur, u32 newPgno){
   }
   rc = getAndInitPage(pBt, newPgno, &pNewPage);
   if( rc ) return rc;
+  pNewPage->policy = pCur->apPage[i]->policy;
   pCur->apPage[i+1] = pNewPage;
   pCur->aiIdx[i+1] = 0;
   pCur->iPage++;
@@ -4249,6 +4327,7 @@ static int moveToRoot(BtCursor *pCur){
   pRoot = pCur->apPage[0];
   assert( pRoot->pgno==pCur->pgnoRoot );
   assert( pRoot->isInit && (pCur->pKeyInfo==0)==pRoot->intKey );
+  pRoot->policy = pBt->nPolicy ? btreePolicy(pBt, pRoot->pgno) : 0;
 
   pCur->aiIdx[0] = 0;
   pCur->info.nSize = 0;
@@ -5012,6 +5091,7 @@ end_allocate_page:
       return SQLITE_CORRUPT_BKPT;
     }
     (*ppPage)->isInit = 0;
+    (*ppPage)->policy = 0;
   }else{
     *ppPage = 0;
   }
@@ -5345,6 +5425,7 @@ static int fillInCell(
       put4byte(pPrior, pgnoOvfl);
       releasePage(pToRelease);
       pToRelease = pOvfl;
+      pOvfl->policy = pPage->policy;
       pPrior = pOvfl->aData;
       put4byte(pPrior, 0);
       pPayload = &pOvfl->aData[4];
@@ -5647,6 +5728,7 @@ static int balance_quick(MemPage *pParent, MemPage *pPage, u8 *pSpace){
     assert( pPage->aData[0]==(PTF_INTKEY|PTF_LEAFDATA|PTF_LEAF) );
     zeroPage(pNew, PTF_INTKEY|PTF_LEAFDATA|PTF_LEAF);
     assemblePage(pNew, 1, &pCell, &szCell);
+    pNew->policy = pPage->policy;
 
     /* If this is an auto-vacuum database, update the pointer map
     ** with entries for the new page, and any pointer from the 
@@ -6241,6 +6323,7 @@ static int balance_nonroot(
     assert( j<nMaxCells );
     zeroPage(pNew, pageFlags);
     assemblePage(pNew, cntNew[i]-j, &apCell[j], &szCell[j]);
+    pNew->policy = pParent->policy;
     assert( pNew->nCell>0 || (nNew==1 && cntNew[0]==0) );
     assert( pNew->nOverflow==0 );
 
@@ -6492,6 +6575,7 @@ static int balance_deeper(MemPage *pRoot, MemPage **ppChild){
   if( rc==SQLITE_OK ){
     rc = allocateBtreePage(pBt,&pChild,&pgnoChild,pRoot->pgno,0);
     copyNodeContent(pRoot, pChild, &rc);
+    if( rc==SQLITE_OK ) pChild->policy = pRoot->policy;
     if( ISAUTOVACUUM ){
       ptrmapPut(pBt, pgnoChild, PTRMAP_BTREE, pRoot->pgno, &rc);
     }
@@ -7201,6 +7285,7 @@ static int btreeDropTable(Btree *p, Pgno iTable, int *piMoved){
     releasePage(pPage);
     return rc;
   }
+  btreeMovePolicy(pBt, iTable, 0);
 
   *piMoved = 0;
 
@@ -230,6 +230,7 @@
 /* Forward declarations */
 typedef struct MemPage MemPage;
 typedef struct BtLock BtLock;
+typedef struct BtPolicy BtPolicy;
 
 /*
 ** This is a magic string that appears at the beginning of every
@@ -277,6 +278,7 @@ struct MemPage {
   u8 hasData;          /* True if this page stores data */
   u8 hdrOffset;        /* 100 for page 1.  0 otherwise */
   u8 childPtrSize;     /* 0 if leaf==1.  4 if leaf==0 */
+  u8 policy;           /* Compression policy of its b-tree, see BtPolicy */
   u16 maxLocal;        /* Copy of BtShared.maxLocal or BtShared.maxLeaf */
   u16 minLocal;        /* Copy of BtShared.minLocal or BtShared.minLeaf */
   u16 cellOffset;      /* Index in aData of first cell pointer */
@@ -437,6 +439,23 @@ struct BtShared {
   u8 isPending;         /* If waiting for read-locks to clear */
 #endif
   u8 *pTmpSpace;        /* BtShared.pageSize bytes of space for tmp use */
+  BtPolicy *aPolicy;    /* Compression policies of b-trees */
+  int nPolicy;          /* Number of entries in aPolicy[] */
+};
+
+/*
+** The compression policy of a b-tree, set by PRAGMA compress_policy to an
+** id the VFS handed out. Cursors tag the pages of the b-tree with it in
+** MemPage.policy as they visit them, and the pager passes it on to the VFS
+** as the pages are written, see sqlite3PagerSetPolicy(). The entry of a
+** dropped b-tree is removed, and the entry of a root page that autovacuum
+** moves follows it. A rollback of the DROP TABLE doesn't undo either, so
+** the b-trees involved may compress with the wrong policy until it is set
+** again, which affects only how well they compress.
+*/
+struct BtPolicy {
+  Pgno iRoot;           /* Root page of the b-tree */
+  int policy;           /* The id of the policy, 0 for the default */
 };
 
 /*
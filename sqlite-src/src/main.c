@@ -2247,6 +2247,13 @@ static int openDatabase(
   }
 #endif
 
+#ifndef SQLITE_OMIT_VIRTUALTABLE
+  if( !db->mallocFailed && rc==SQLITE_OK ){
+    extern int sqlite3CompressVtabInit(sqlite3*);
+    rc = sqlite3CompressVtabInit(db);
+  }
+#endif
+
   sqlite3Error(db, rc, 0);
 
   /* -DSQLITE_DEFAULT_LOCKING_MODE=1 makes EXCLUSIVE the default locking
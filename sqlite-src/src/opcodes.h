@@ -126,27 +126,27 @@
 #define OP_Checkpoint                         118
 #define OP_JournalMode                        119
 #define OP_Vacuum                             120
-#define OP_IncrVacuum                         121
-#define OP_Expire                             122
-#define OP_TableLock                          123
-#define OP_VBegin                             124
-#define OP_VCreate                            125
-#define OP_VDestroy                           126
-#define OP_VOpen                              127
-#define OP_VFilter                            128
-#define OP_VColumn                            129
-#define OP_VNext                              131
-#define OP_VRename                            132
-#define OP_VUpdate                            133
-#define OP_Pagecount                          134
-#define OP_MaxPgcnt                           135
-#define OP_Trace                              136
-#define OP_Noop                               137
-#define OP_Explain                            138
-
-/* The following opcode values are never used */
-#define OP_NotUsed_139                        139
-#define OP_NotUsed_140                        140
+#define OP_CompressDictionary                 121
+#define OP_CompressPolicy                     122
+#define OP_CompressSetting                    123
+#define OP_CompressStats                      124
+#define OP_IncrVacuum                         125
+#define OP_Expire                             126
+#define OP_TableLock                          127
+#define OP_VBegin                             128
+#define OP_VCreate                            129
+#define OP_VDestroy                           131
+#define OP_VOpen                              132
+#define OP_VFilter                            133
+#define OP_VColumn                            134
+#define OP_VNext                              135
+#define OP_VRename                            136
+#define OP_VUpdate                            137
+#define OP_Pagecount                          138
+#define OP_MaxPgcnt                           139
+#define OP_Trace                              140
+#define OP_Noop                               146
+#define OP_Explain                            147
 
 
 /* Properties such as "out2" or "jump" that are specified in
@@ -176,7 +176,7 @@
 /*  96 */ 0x00, 0x02, 0x02, 0x00, 0x00, 0x00, 0x00, 0x00,\
 /* 104 */ 0x00, 0x0c, 0x45, 0x15, 0x01, 0x02, 0x00, 0x01,\
 /* 112 */ 0x08, 0x05, 0x05, 0x05, 0x00, 0x00, 0x00, 0x02,\
-/* 120 */ 0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,\
-/* 128 */ 0x01, 0x00, 0x02, 0x01, 0x00, 0x00, 0x02, 0x02,\
-/* 136 */ 0x00, 0x00, 0x00, 0x00, 0x00, 0x04, 0x04, 0x04,\
-/* 144 */ 0x04, 0x04,}
+/* 120 */ 0x00, 0x02, 0x00, 0x02, 0x00, 0x01, 0x00, 0x00,\
+/* 128 */ 0x00, 0x00, 0x02, 0x00, 0x00, 0x01, 0x00, 0x01,\
+/* 136 */ 0x00, 0x00, 0x02, 0x02, 0x00, 0x04, 0x04, 0x04,\
+/* 144 */ 0x04, 0x04, 0x00, 0x00,}
@@ -245,6 +245,14 @@ int sqlite3OsUnlock(sqlite3_file*, int);
 int sqlite3OsCheckReservedLock(sqlite3_file *id, int *pResOut);
 int sqlite3OsFileControl(sqlite3_file*,int,void*);
 #define SQLITE_FCNTL_DB_UNCHANGED 0xca093fa0
+#define SQLITE_FCNTL_OS_HANDLE    0xca093fa1
+#define SQLITE_FCNTL_COMPRESS_DICTIONARY 0xca093fa2
+#define SQLITE_FCNTL_COMPRESS_POLICY 0xca093fa3
+#define SQLITE_FCNTL_COMPRESS_PAGE 0xca093fa4
+#define SQLITE_FCNTL_COMPRESS_LEVEL 0xca093fa5
+#define SQLITE_FCNTL_COMPRESS_CACHE_SIZE 0xca093fa6
+#define SQLITE_FCNTL_COMPRESS_STATS 0xca093fa7  /* i64[3]: op, value, highwater */
+#define SQLITE_FCNTL_OPEN_COUNT   0xca093fa8
 int sqlite3OsSectorSize(sqlite3_file *id);
 int sqlite3OsDeviceCharacteristics(sqlite3_file *id);
 int sqlite3OsShmMap(sqlite3_file *,int,int,int,void volatile **);
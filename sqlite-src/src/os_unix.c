@@ -3478,6 +3478,25 @@ static int unixFileControl(sqlite3_file *id, int op, void *pArg){
     case SQLITE_FCNTL_SYNC_OMITTED: {
       return SQLITE_OK;  /* A no-op */
     }
+    /* Return the underlying file descriptor. Used by the compression
+    ** shim in vfs_compress.c, which must not open (and later close) a
+    ** second descriptor on the same file as that would drop the POSIX
+    ** advisory locks held through this one.
+    */
+    case SQLITE_FCNTL_OS_HANDLE: {
+      *(int*)pArg = ((unixFile*)id)->h;
+      return SQLITE_OK;
+    }
+    /* Return the number of files open on the same inode in this process,
+    ** through any VFS. The compression shim refuses to replace a database
+    ** file that another connection still has open.
+    */
+    case SQLITE_FCNTL_OPEN_COUNT: {
+      unixInodeInfo *pInode = ((unixFile*)id)->pInode;
+      if( pInode==0 ) return SQLITE_NOTFOUND;
+      *(int*)pArg = pInode->nRef;
+      return SQLITE_OK;
+    }
   }
   return SQLITE_NOTFOUND;
 }
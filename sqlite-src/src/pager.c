@@ -675,6 +675,7 @@ struct Pager {
   int nRead, nWrite;          /* Database pages read/written */
 #endif
   void (*xReiniter)(DbPage*); /* Call this routine when reloading pages */
+  int (*xPolicy)(DbPage*);    /* Compression policy of a page, or NULL */
 #ifdef SQLITE_HAS_CODEC
   void *(*xCodec)(void*,void*,Pgno,int); /* Routine for en/decoding data */
   void (*xCodecSizeChng)(void*,int,int); /* Notify of page size changes */
@@ -2943,6 +2944,20 @@ static int pagerRollbackWal(Pager *pPager){
   return rc;
 }
 
+/*
+** Tell the VFS the compression policy of page pPg, which is about to be
+** written to the database file or the WAL. See sqlite3PagerSetPolicy().
+*/
+static void pagerPolicyHint(Pager *pPager, PgHdr *pPg){
+  if( pPager->xPolicy ){
+    int aArg[3];
+    aArg[0] = pPg->pgno;
+    aArg[1] = pPager->pageSize;
+    aArg[2] = pPager->xPolicy(pPg);
+    sqlite3OsFileControl(pPager->fd, SQLITE_FCNTL_COMPRESS_PAGE, aArg);
+  }
+}
+
 /*
 ** This function is a wrapper around sqlite3WalFrames(). As well as logging
 ** the contents of the list of pages headed by pList (connected by pDirty),
@@ -2986,6 +3001,12 @@ static int pagerWalFrames(
   }
 
   if( pList->pgno==1 ) pager_write_changecounter(pList);
+  if( pPager->xPolicy ){
+    PgHdr *p;
+    for(p=pList; p; p=p->pDirty){
+      pagerPolicyHint(pPager, p);
+    }
+  }
   rc = sqlite3WalFrames(pPager->pWal, 
       pPager->pageSize, pList, nTruncate, isCommit, syncFlags
   );
@@ -3294,6 +3315,15 @@ void sqlite3PagerSetCachesize(Pager *pPager, int mxPage){
   sqlite3PcacheSetCachesize(pPager->pPCache, mxPage);
 }
 
+/*
+** Set the callback that returns the compression policy of a page, which
+** the pager passes on to the VFS with SQLITE_FCNTL_COMPRESS_PAGE before
+** writing the page out. See PRAGMA compress_policy.
+*/
+void sqlite3PagerSetPolicy(Pager *pPager, int (*xPolicy)(DbPage*)){
+  pPager->xPolicy = xPolicy;
+}
+
 /*
 ** Adjust the robustness of the database to damage due to OS crashes
 ** or power failures by changing the number of syncs()s when writing
@@ -4030,6 +4060,7 @@ static int pager_write_pagelist(Pager *pPager, PgHdr *pList){
       CODEC2(pPager, pList->pData, pgno, 6, return SQLITE_NOMEM, pData);
 
       /* Write out the page data. */
+      pagerPolicyHint(pPager, pList);
       rc = sqlite3OsWrite(pPager->fd, pData, pPager->pageSize, offset);
 
       /* If page 1 was just written, update Pager.dbFileVers to match
@@ -817,7 +817,174 @@ void sqlite3Pragma(
     }
   }else
 #endif /* SQLITE_ENABLE_LOCKING_STYLE */      
+
+  /*
+  **   PRAGMA [database.]compress_train_dictionary
+  **   PRAGMA [database.]compress_train_dictionary = N
+  **
+  ** Train a compression dictionary of N bytes on the pages of a database
+  ** opened with the compressed VFS, and compress the database again with
+  ** it. N defaults to the size the VFS prefers, and 0 drops the
+  ** dictionary. Returns the size of the dictionary. Like VACUUM, it
+  ** can't run within a transaction, and locks the database exclusively.
+  */
+  if( sqlite3StrICmp(zLeft, "compress_train_dictionary")==0 ){
+    if( sqlite3ReadSchema(pParse) ) goto pragma_out;
+    sqlite3VdbeSetNumCols(v, 1);
+    sqlite3VdbeSetColName(v, 0, COLNAME_NAME, "compress_train_dictionary",
+                          SQLITE_STATIC);
+    sqlite3VdbeUsesBtree(v, iDb);
+    sqlite3VdbeAddOp3(v, OP_CompressDictionary, iDb, 1,
+                      zRight ? sqlite3Atoi(zRight) : -1);
+    sqlite3VdbeAddOp2(v, OP_ResultRow, 1, 1);
+  }else
     
+  /*
+  **   PRAGMA [database.]compress_policy = 'NAME=CODEC[:LEVEL]'
+  **
+  ** Compress the pages of table or index NAME of a database opened with the
+  ** compressed VFS and compress_layout=page with another codec or level
+  ** than the rest, for example 'hot_idx=none' to leave an index
+  ** uncompressed, 'archive=zstd:19', or 'archive=default' to go back. The pages take the policy as they are
+  ** next written. It lasts while the database is open, and is set again
+  ** after a VACUUM, which moves the tables.
+  */
+  if( sqlite3StrICmp(zLeft, "compress_policy")==0 ){
+    const char *zSpec = zRight ? strchr(zRight, '=') : 0;
+    char *zName;
+    Table *pTab;
+    Index *pIdx;
+    int iRoot = 0;
+    if( sqlite3ReadSchema(pParse) ) goto pragma_out;
+    if( zSpec==0 ){
+      sqlite3ErrorMsg(pParse, "expected NAME=CODEC[:LEVEL]");
+      goto pragma_out;
+    }
+    zName = sqlite3DbStrNDup(db, zRight, (int)(zSpec - zRight));
+    if( zName==0 ) goto pragma_out;
+    pTab = sqlite3FindTable(db, zName, pDb->zName);
+    pIdx = pTab ? 0 : sqlite3FindIndex(db, zName, pDb->zName);
+    if( pTab ){
+      iRoot = pTab->tnum;
+    }else if( pIdx ){
+      iRoot = pIdx->tnum;
+    }
+    sqlite3DbFree(db, zName);
+    if( iRoot==0 ){
+      sqlite3ErrorMsg(pParse, "no such table or index: %.*s",
+                      (int)(zSpec - zRight), zRight);
+      goto pragma_out;
+    }
+    /* The root page is only good while the schema is the same. */
+    sqlite3CodeVerifySchema(pParse, iDb);
+    sqlite3VdbeUsesBtree(v, iDb);
+    sqlite3VdbeAddOp4(v, OP_CompressPolicy, iDb, iRoot, 0, &zSpec[1], 0);
+  }else
+
+  /*
+  **   PRAGMA [database.]compress_level
+  **   PRAGMA [database.]compress_level = N
+  **   PRAGMA [database.]compress_cache_size
+  **   PRAGMA [database.]compress_cache_size = N
+  **
+  ** Return or set the compression level, or the size of the chunk cache
+  ** in KBytes, of a database opened with the compressed VFS. The level
+  ** applies to the chunks written from then on, -1 is the default of the
+  ** codec and 0 stores them uncompressed. The cache is shared by all the
+  ** connections to the database. Like the policies, both last while the
+  ** database is open.
+  */
+  if( sqlite3StrICmp(zLeft, "compress_level")==0
+   || sqlite3StrICmp(zLeft, "compress_cache_size")==0
+  ){
+    int isLevel = sqlite3StrICmp(zLeft, "compress_level")==0;
+    int level = -2;
+    i64 size = -1;
+    if( zRight ){
+      if( isLevel ){
+        level = sqlite3Atoi(zRight);
+      }else{
+        sqlite3Atoi64(zRight, &size, sqlite3Strlen30(zRight), SQLITE_UTF8);
+      }
+      if( level<-1 && size<0 ){
+        sqlite3ErrorMsg(pParse, "invalid value for %s: %s", zLeft, zRight);
+        goto pragma_out;
+      }
+    }
+    sqlite3VdbeSetNumCols(v, 1);
+    sqlite3VdbeSetColName(v, 0, COLNAME_NAME,
+        isLevel ? "compress_level" : "compress_cache_size", SQLITE_STATIC);
+    sqlite3VdbeUsesBtree(v, iDb);
+    sqlite3VdbeAddOp3(v, OP_CompressSetting, iDb, 1,
+                      isLevel ? level : (int)(size>0x7fffffff ? 0x7fffffff : size));
+    sqlite3VdbeChangeP5(v, isLevel ? 0 : 1);
+    sqlite3VdbeAddOp2(v, OP_ResultRow, 1, 1);
+  }else
+
+  /*
+  **   PRAGMA [database.]compress_stats
+  **
+  ** Return a row of (name, bucket, value, highwater) for each of the
+  ** sqlite3_compress_status() counters of a database opened with the
+  ** compressed VFS. The bucket is NULL except for the rows of the
+  ** histograms, one per bucket. The names are those of the compress_stats
+  ** virtual table.
+  */
+  if( sqlite3StrICmp(zLeft, "compress_stats")==0 ){
+    static const struct {
+      const char *zName;   /* Name of the counter */
+      int op;              /* SQLITE_COMPRESS_STATUS_* */
+      int nBucket;         /* Number of buckets, or 0 for a scalar */
+    } aStat[] = {
+      { "cache_hits",           SQLITE_COMPRESS_STATUS_CACHE_HIT,            0 },
+      { "cache_misses",         SQLITE_COMPRESS_STATUS_CACHE_MISS,           0 },
+      { "cache_used",           SQLITE_COMPRESS_STATUS_CACHE_USED,           0 },
+      { "cache_dirty",          SQLITE_COMPRESS_STATUS_CACHE_DIRTY,          0 },
+      { "dirtied_chunks",       SQLITE_COMPRESS_STATUS_DIRTIED,              0 },
+      { "evicted_chunks",       SQLITE_COMPRESS_STATUS_EVICTED,              0 },
+      { "evicted_dirty_chunks", SQLITE_COMPRESS_STATUS_EVICTED_DIRTY,        0 },
+      { "compressed_chunks",    SQLITE_COMPRESS_STATUS_COMPRESSED,           0 },
+      { "compress_bytes_in",    SQLITE_COMPRESS_STATUS_COMPRESSED_IN,        0 },
+      { "compress_bytes_out",   SQLITE_COMPRESS_STATUS_COMPRESSED_OUT,       0 },
+      { "compress_us",          SQLITE_COMPRESS_STATUS_COMPRESS_TIME,        0 },
+      { "decompressed_chunks",  SQLITE_COMPRESS_STATUS_DECOMPRESSED,         0 },
+      { "decompress_bytes_in",  SQLITE_COMPRESS_STATUS_DECOMPRESSED_IN,      0 },
+      { "decompress_bytes_out", SQLITE_COMPRESS_STATUS_DECOMPRESSED_OUT,     0 },
+      { "decompress_us",        SQLITE_COMPRESS_STATUS_DECOMPRESS_TIME,      0 },
+      { "reads",                SQLITE_COMPRESS_STATUS_READS,                0 },
+      { "read_bytes",           SQLITE_COMPRESS_STATUS_READ_BYTES,           0 },
+      { "writes",               SQLITE_COMPRESS_STATUS_WRITES,               0 },
+      { "write_bytes",          SQLITE_COMPRESS_STATUS_WRITE_BYTES,          0 },
+      { "compress_ratio",       SQLITE_COMPRESS_STATUS_RATIO_HISTOGRAM,
+                                SQLITE_COMPRESS_RATIO_BUCKETS },
+      { "compress_latency",     SQLITE_COMPRESS_STATUS_COMPRESS_HISTOGRAM,
+                                SQLITE_COMPRESS_LATENCY_BUCKETS },
+      { "decompress_latency",   SQLITE_COMPRESS_STATUS_DECOMPRESS_HISTOGRAM,
+                                SQLITE_COMPRESS_LATENCY_BUCKETS },
+    };
+    int i, b;
+    sqlite3VdbeSetNumCols(v, 4);
+    pParse->nMem = 4;
+    sqlite3VdbeSetColName(v, 0, COLNAME_NAME, "name", SQLITE_STATIC);
+    sqlite3VdbeSetColName(v, 1, COLNAME_NAME, "bucket", SQLITE_STATIC);
+    sqlite3VdbeSetColName(v, 2, COLNAME_NAME, "value", SQLITE_STATIC);
+    sqlite3VdbeSetColName(v, 3, COLNAME_NAME, "highwater", SQLITE_STATIC);
+    sqlite3VdbeUsesBtree(v, iDb);
+    for(i=0; i<ArraySize(aStat); i++){
+      b = 0;
+      do{
+        sqlite3VdbeAddOp4(v, OP_String8, 0, 1, 0, aStat[i].zName, 0);
+        if( aStat[i].nBucket ){
+          sqlite3VdbeAddOp2(v, OP_Integer, b, 2);
+        }else{
+          sqlite3VdbeAddOp2(v, OP_Null, 0, 2);
+        }
+        sqlite3VdbeAddOp3(v, OP_CompressStats, iDb, 3, aStat[i].op+b);
+        sqlite3VdbeAddOp2(v, OP_ResultRow, 1, 4);
+      }while( ++b<aStat[i].nBucket );
+    }
+  }else
+
   /*
   **   PRAGMA [database.]synchronous
   **   PRAGMA [database.]synchronous=OFF|ON|NORMAL|FULL
@@ -1311,6 +1311,7 @@ static int run_schema_dump_query(
 static char zHelp[] =
   ".backup ?DB? FILE      Backup DB (default \"main\") to FILE\n"
   ".bail ON|OFF           Stop after hitting an error.  Default OFF\n"
+  ".convert FILE ON|OFF   Compress database FILE in place, or decompress it\n"
   ".databases             List names and files of attached databases\n"
   ".dump ?TABLE? ...      Dump the database in an SQL text format\n"
   "                         If TABLE specified, only dump tables matching\n"
@@ -1446,6 +1447,56 @@ static int booleanValue(char *zArg){
   return val;
 }
 
+/*
+** Progress callback for the ".convert" command.
+*/
+static int convert_progress(void *pArg, sqlite3_int64 nDone, sqlite3_int64 nTotal){
+  UNUSED_PARAMETER(pArg);
+  fprintf(stderr, "\r%3d%%", (int)(nDone*100/nTotal));
+  fflush(stderr);
+  return 0;
+}
+
+/*
+** Check whether database file zFile, a filename or a URI, is open in
+** connection db.  Return 1 if it's the main database, 2 if it's another
+** one, and 0 if it isn't open.
+*/
+static int convert_file_in_use(sqlite3 *db, const char *zFile){
+  sqlite3_vfs *pVfs = sqlite3_vfs_find(0);
+  sqlite3_stmt *pStmt = 0;
+  char *zName;
+  char *zFull;
+  int n;
+  int res = 0;
+
+  if( db==0 || pVfs==0 ) return 0;
+  zName = sqlite3_mprintf("%s", zFile);
+  zFull = sqlite3_malloc(pVfs->mxPathname+1);
+  if( zName && zFull && strncmp(zName, "file:", 5)==0 ){
+    /* Drop the scheme, an empty authority and the parameters. */
+    memmove(zName, &zName[5], strlen(zName)-4);
+    if( strncmp(zName, "///", 3)==0 ) memmove(zName, &zName[2], strlen(zName)-1);
+    for(n=0; zName[n] && zName[n]!='?' && zName[n]!='#'; n++){}
+    zName[n] = 0;
+  }
+  if( zName && zFull
+   && pVfs->xFullPathname(pVfs, zName, pVfs->mxPathname+1, zFull)==SQLITE_OK
+   && sqlite3_prepare(db, "PRAGMA database_list", -1, &pStmt, 0)==SQLITE_OK ){
+    while( res==0 && sqlite3_step(pStmt)==SQLITE_ROW ){
+      const char *zDbFile = (const char*)sqlite3_column_text(pStmt, 2);
+      if( zDbFile && strcmp(zDbFile, zFull)==0 ){
+        res = strcmp((const char*)sqlite3_column_text(pStmt, 1), "main")==0
+              ? 1 : 2;
+      }
+    }
+  }
+  sqlite3_finalize(pStmt);
+  sqlite3_free(zFull);
+  sqlite3_free(zName);
+  return res;
+}
+
 /*
 ** If an input line begins with "." then invoke this routine to
 ** process that line.
@@ -1525,6 +1576,31 @@ static int do_meta_command(char *zLine, struct callback_data *p){
     bail_on_error = booleanValue(azArg[1]);
   }else
 
+  if( c=='c' && n>1 && strncmp(azArg[0], "convert", n)==0 && nArg==3 ){
+    int inUse;
+    sqlite3_initialize();
+    inUse = convert_file_in_use(p->db, azArg[1]);
+    if( inUse==2 ){
+      fprintf(stderr, "Error: \"%s\" is attached, detach it first\n",
+              azArg[1]);
+      rc = 1;
+    }else{
+      if( inUse==1 ){
+        /* The converted copy replaces the file.  The next command opens
+        ** it again. */
+        sqlite3_close(p->db);
+        p->db = db = 0;
+      }
+      rc = sqlite3_compress_convert(azArg[1], booleanValue(azArg[2]),
+                                    convert_progress, 0);
+      fprintf(stderr, "\n");
+      if( rc!=SQLITE_OK ){
+        fprintf(stderr, "Error: cannot convert \"%s\" (%d)\n", azArg[1], rc);
+        rc = 1;
+      }
+    }
+  }else
+
   if( c=='d' && n>1 && strncmp(azArg[0], "databases", n)==0 && nArg==1 ){
     struct callback_data data;
     char *zErrMsg = 0;
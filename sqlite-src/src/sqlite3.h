@@ -6660,7 +6660,8 @@ SQLITE_API int sqlite3_vtab_on_conflict(sqlite3 *);
 
 /*
 ** This function enables built-in, online compression.
-** It's only available on Windows.
+** It's available on Windows (NTFS) and Linux (file-systems that support
+** hole punching).
 */
 SQLITE_API int sqlite3_compress(
     int trace,                  /* See TraceLevel. 0 to disable. */
@@ -6669,6 +6670,189 @@ SQLITE_API int sqlite3_compress(
     int cacheSize               /* The number of chunks to cache: -1 for default. */
 );
 
+/*
+** This function limits the memory used by the chunk caches of all the
+** compressed databases together, in bytes. Each database can still cache
+** two chunks. Zero removes the limit and a negative value only queries it.
+** Returns the previous limit.
+*/
+SQLITE_API sqlite3_int64 sqlite3_compress_memory_limit(sqlite3_int64 nByte);
+
+/*
+** This function sets the pages the chunk caches of the compressed
+** databases are mapped in, for the memory mapped from then on. The caches
+** are carved from large segments, which SQLITE_COMPRESS_HUGE_PAGES_ADVISE,
+** the default, advises to back with transparent huge pages on Linux.
+** SQLITE_COMPRESS_HUGE_PAGES_RESERVED takes them from the reserved huge
+** pages of the system (MAP_HUGETLB, or MEM_LARGE_PAGES on Windows with
+** the privilege to lock pages), with normal pages when there are not
+** enough. A negative value only queries the setting. Returns the previous
+** setting.
+*/
+SQLITE_API int sqlite3_compress_huge_pages(int eMode);
+
+#define SQLITE_COMPRESS_HUGE_PAGES_OFF       0   /* Normal pages */
+#define SQLITE_COMPRESS_HUGE_PAGES_ADVISE    1   /* Transparent huge pages */
+#define SQLITE_COMPRESS_HUGE_PAGES_RESERVED  2   /* Reserved huge pages */
+
+/*
+** This function sets the number of background threads that compress the
+** dirty chunks of all the compressed databases, ahead of their eviction
+** and in parallel on sync. Zero compresses on the calling threads and -1,
+** the default, uses one thread less than the number of processors. Other
+** negative values only query the setting. Returns the previous setting.
+*/
+SQLITE_API int sqlite3_compress_threads(int nThread);
+
+/*
+** These functions compress a database that uses the compression VFS again,
+** a few chunks at a time, with the codec zCodec (NULL keeps the current
+** one) at the given level (below -1 keeps the current one). The database
+** writes new chunks with them too from then on. Like
+** [sqlite3_backup_step()], each step locks the database against other
+** writers only while it runs, so the database stays online:
+**
+**   p = sqlite3_recompress_init(db, "main", "zstd", 19);
+**   do{
+**     rc = sqlite3_recompress_step(p, 64);
+**   }while( rc==SQLITE_OK || rc==SQLITE_BUSY || rc==SQLITE_LOCKED );
+**   sqlite3_recompress_finish(p);
+**
+** sqlite3_recompress_step() returns SQLITE_DONE once all the chunks are
+** done, and a negative nChunk does them all at once. SQLITE_BUSY and
+** SQLITE_LOCKED leave the step to retry, other errors are final. The
+** remaining and chunkcount functions report the progress as of the last
+** step. sqlite3_recompress_finish() frees the object and returns the error
+** that stopped it, or SQLITE_OK.
+*/
+typedef struct sqlite3_recompress sqlite3_recompress;
+SQLITE_API sqlite3_recompress *sqlite3_recompress_init(
+  sqlite3 *db,                /* The database connection */
+  const char *zDb,            /* The database name, "main" if NULL */
+  const char *zCodec,         /* The codec to compress with, or NULL */
+  int level                   /* The level to compress at, or -2 */
+);
+SQLITE_API int sqlite3_recompress_step(sqlite3_recompress *p, int nChunk);
+SQLITE_API int sqlite3_recompress_finish(sqlite3_recompress *p);
+SQLITE_API int sqlite3_recompress_remaining(sqlite3_recompress *p);
+SQLITE_API int sqlite3_recompress_chunkcount(sqlite3_recompress *p);
+
+/*
+** This function converts the database file zFilename in place, from the
+** plain format to the compressed one, or back with compress set to zero.
+** zFilename may be a URI, whose parameters (compress_layout,
+** compress_codec...) apply to the compressed file. The database must not
+** be in use, and it's locked while converted. A hot journal is rolled
+** back first, and a WAL database uses a rollback journal until converted.
+**
+** The file is read and written a large step at a time, compressed or
+** decompressed in parallel, into zFilename with "-convert" appended, which
+** then replaces it. Each step is synced, and calls xProgress, if not NULL,
+** with the bytes done and the total. A non-zero return interrupts the
+** conversion with SQLITE_INTERRUPT. Calling it again resumes from the last
+** step synced, unless the database has changed since.
+**
+** Returns SQLITE_OK, also when the file already is in the format asked,
+** SQLITE_BUSY if the database is in use, SQLITE_MISUSE if the compressed
+** VFS isn't registered with compression enabled (see sqlite3_compress),
+** or another error code.
+*/
+SQLITE_API int sqlite3_compress_convert(
+  const char *zFilename,      /* The database, a filename or a URI */
+  int compress,               /* 1 to compress, 0 to decompress */
+  int (*xProgress)(void*,sqlite3_int64,sqlite3_int64), /* Or NULL */
+  void *pArg                  /* First argument to xProgress */
+);
+
+/*
+** This function reads a counter of a database that uses the compression
+** VFS, like [sqlite3_db_status()]. The counters belong to the database
+** file, so they add up the work of all the connections to it, and they
+** start from zero when the file is first opened. zDb is the database
+** name, "main" if NULL, and op one of the SQLITE_COMPRESS_STATUS values.
+**
+** *pCurrent is set to the value of the counter. *pHighwater is set to the
+** highest value of the gauges (CACHE_USED and CACHE_DIRTY), and to the
+** value of the other counters. A non-zero resetFlag sets the counter back
+** to zero, or the highwater of a gauge to its current value.
+**
+** The histograms take a counter per bucket, op being their first counter
+** plus the bucket. The compression ratio buckets are tenths of the size
+** of the chunks, the last one for the chunks that didn't shrink. The
+** latency buckets are powers of two microseconds: bucket 0 is below 1us,
+** bucket i from 2^(i-1) to 2^i us, and the last one has the rest.
+**
+** Each connection also has a compress_stats virtual table module with the
+** counters of all its compressed databases, one row per counter or bucket:
+**
+**   CREATE VIRTUAL TABLE temp.compress_stats USING compress_stats;
+**   SELECT db, name, bucket, value, highwater FROM compress_stats;
+**
+** Returns SQLITE_OK, or SQLITE_ERROR if the database doesn't exist or
+** isn't compressed or op is unknown.
+*/
+SQLITE_API int sqlite3_compress_status(
+  sqlite3 *db,                /* The database connection */
+  const char *zDb,            /* The database name, "main" if NULL */
+  int op,                     /* The counter, SQLITE_COMPRESS_STATUS_... */
+  sqlite3_int64 *pCurrent,    /* OUT: its value */
+  sqlite3_int64 *pHighwater,  /* OUT: its highest value */
+  int resetFlag               /* Reset it */
+);
+
+/*
+** The counters of [sqlite3_compress_status()].
+*/
+#define SQLITE_COMPRESS_STATUS_CACHE_HIT              0   /* Chunks found in cache */
+#define SQLITE_COMPRESS_STATUS_CACHE_MISS             1   /* Chunks loaded */
+#define SQLITE_COMPRESS_STATUS_CACHE_USED             2   /* Bytes cached, a gauge */
+#define SQLITE_COMPRESS_STATUS_CACHE_DIRTY            3   /* Dirty chunks, a gauge */
+#define SQLITE_COMPRESS_STATUS_DIRTIED                4   /* Chunks made dirty */
+#define SQLITE_COMPRESS_STATUS_EVICTED                5   /* Chunks evicted */
+#define SQLITE_COMPRESS_STATUS_EVICTED_DIRTY          6   /* Of which written out */
+#define SQLITE_COMPRESS_STATUS_COMPRESSED             7   /* Chunks compressed */
+#define SQLITE_COMPRESS_STATUS_COMPRESSED_IN          8   /* Bytes compressed */
+#define SQLITE_COMPRESS_STATUS_COMPRESSED_OUT         9   /* Bytes they took */
+#define SQLITE_COMPRESS_STATUS_COMPRESS_TIME         10   /* Microseconds */
+#define SQLITE_COMPRESS_STATUS_DECOMPRESSED          11   /* Chunks decompressed */
+#define SQLITE_COMPRESS_STATUS_DECOMPRESSED_IN       12   /* Bytes decompressed */
+#define SQLITE_COMPRESS_STATUS_DECOMPRESSED_OUT      13   /* Bytes they gave */
+#define SQLITE_COMPRESS_STATUS_DECOMPRESS_TIME       14   /* Microseconds */
+#define SQLITE_COMPRESS_STATUS_READS                 15   /* Reads of the file */
+#define SQLITE_COMPRESS_STATUS_READ_BYTES            16   /* Bytes read */
+#define SQLITE_COMPRESS_STATUS_WRITES                17   /* Writes to the file */
+#define SQLITE_COMPRESS_STATUS_WRITE_BYTES           18   /* Bytes written */
+#define SQLITE_COMPRESS_STATUS_COUNT                 19   /* Number of the above */
+#define SQLITE_COMPRESS_STATUS_RATIO_HISTOGRAM       32   /* Chunks by ratio */
+#define SQLITE_COMPRESS_STATUS_COMPRESS_HISTOGRAM    48   /* By latency */
+#define SQLITE_COMPRESS_STATUS_DECOMPRESS_HISTOGRAM  64   /* By latency */
+#define SQLITE_COMPRESS_RATIO_BUCKETS                11
+#define SQLITE_COMPRESS_LATENCY_BUCKETS              16
+
+/*
+** This function turns the binary I/O trace of the compression VFS on or
+** off. The reads, writes, syncs, chunk loads and flushes of all the
+** compressed files are recorded, with their offset, length, chunk, time
+** and latency, into a ring of the last nEvent events, rounded up to a
+** power of two. The ring is allocated by the first call and kept, later
+** calls only turn the trace on again or, with zero, off. A negative
+** nEvent only queries it.
+**
+** Recording an event takes no lock, so the trace can stay on in
+** production. [sqlite3_compress_trace_dump()] writes the ring to a file,
+** which tool/showtrace.c prints.
+**
+** Returns the size of the ring if the trace was on, or zero.
+*/
+SQLITE_API int sqlite3_compress_trace(int nEvent);
+
+/*
+** This function writes the events of the trace ring to the file
+** zFilename, oldest first, while the trace goes on. Returns SQLITE_OK,
+** SQLITE_CANTOPEN, SQLITE_IOERR_WRITE or SQLITE_NOMEM.
+*/
+SQLITE_API int sqlite3_compress_trace_dump(const char *zFilename);
+
 /*
 ** Undo the hack that converts floating point types to integer for
 ** builds on processors without floating point support.
@@ -0,0 +1,442 @@
+/*
+** 2026 October 16
+**
+** The author disclaims copyright to this source code.  In place of
+** a legal notice, here is a blessing:
+**
+**    May you do good and not evil.
+**    May you find forgiveness for yourself and forgive others.
+**    May you share freely, never taking more than you give.
+**
+*************************************************************************
+**
+** Code for testing the compression VFS (see vfs_compress.c). This file
+** contains the Tcl bindings of sqlite3_compress() and the functions
+** that tune it.
+*/
+#include "sqliteInt.h"
+#include "tcl.h"
+#include <string.h>
+
+extern const char *sqlite3TestErrorName(int);
+extern int getDbPointer(Tcl_Interp*, const char*, sqlite3**);
+
+/*
+** The script of sqlite3_compress_convert, called with the bytes done and
+** the total after each step.
+*/
+typedef struct ConvertProgress ConvertProgress;
+struct ConvertProgress {
+  Tcl_Interp *interp;
+  Tcl_Obj *pScript;
+};
+
+static int convertProgress(
+  void *pCtx,
+  sqlite3_int64 nDone,
+  sqlite3_int64 nTotal
+){
+  ConvertProgress *p = (ConvertProgress*)pCtx;
+  Tcl_Obj *pEval;
+  int rc;
+  int ret = 1;
+
+  pEval = Tcl_DuplicateObj(p->pScript);
+  Tcl_IncrRefCount(pEval);
+  Tcl_ListObjAppendElement(p->interp, pEval, Tcl_NewWideIntObj(nDone));
+  Tcl_ListObjAppendElement(p->interp, pEval, Tcl_NewWideIntObj(nTotal));
+  rc = Tcl_EvalObjEx(p->interp, pEval, TCL_EVAL_GLOBAL);
+  if( rc==TCL_OK ){
+    Tcl_GetIntFromObj(p->interp, Tcl_GetObjResult(p->interp), &ret);
+  }else{
+    Tcl_BackgroundError(p->interp);
+  }
+  Tcl_DecrRefCount(pEval);
+  return ret;
+}
+
+/*
+** Usage: sqlite3_compress TRACE LEVEL CHUNK-KB CACHE-KB
+**
+** Registers the compression VFS as the default, or sets its options for
+** the databases opened from then on. A LEVEL of 0 disables compression.
+*/
+static int test_compress(
+  void * clientData,
+  Tcl_Interp *interp,
+  int objc,
+  Tcl_Obj *CONST objv[]
+){
+  int aArg[4];
+  int i;
+  int rc;
+
+  if( objc!=5 ){
+    Tcl_WrongNumArgs(interp, 1, objv, "TRACE LEVEL CHUNK-KB CACHE-KB");
+    return TCL_ERROR;
+  }
+  for(i=0; i<4; i++){
+    if( Tcl_GetIntFromObj(interp, objv[i+1], &aArg[i]) ) return TCL_ERROR;
+  }
+
+  rc = sqlite3_compress(aArg[0], aArg[1], aArg[2], aArg[3]);
+  Tcl_SetResult(interp, (char *)sqlite3TestErrorName(rc), TCL_VOLATILE);
+  return TCL_OK;
+}
+
+/*
+** Usage: sqlite3_compress_convert FILENAME COMPRESS ?SCRIPT?
+**
+** Converts FILENAME in place, see sqlite3_compress_convert(). SCRIPT is
+** called after each step with the bytes done and the total appended, a
+** non-zero result interrupts the conversion.
+*/
+static int test_compress_convert(
+  void * clientData,
+  Tcl_Interp *interp,
+  int objc,
+  Tcl_Obj *CONST objv[]
+){
+  ConvertProgress ctx;
+  int bCompress;
+  int rc;
+
+  if( objc!=3 && objc!=4 ){
+    Tcl_WrongNumArgs(interp, 1, objv, "FILENAME COMPRESS ?SCRIPT?");
+    return TCL_ERROR;
+  }
+  if( Tcl_GetBooleanFromObj(interp, objv[2], &bCompress) ) return TCL_ERROR;
+
+  ctx.interp = interp;
+  ctx.pScript = objc==4 ? objv[3] : 0;
+  rc = sqlite3_compress_convert(Tcl_GetString(objv[1]), bCompress,
+      ctx.pScript ? convertProgress : 0, (void *)&ctx
+  );
+  Tcl_SetResult(interp, (char *)sqlite3TestErrorName(rc), TCL_VOLATILE);
+  return TCL_OK;
+}
+
+/*
+** Usage: sqlite3_compress_status DB PARAMETER RESETFLAG
+**
+** Reads a counter of the main database of DB, as sqlite3_db_status does
+** (see test_malloc.c). PARAMETER is the name of the counter, or the
+** number of a histogram bucket. Returns the error code, the value and
+** the highwater.
+*/
+static int test_compress_status(
+  void * clientData,
+  Tcl_Interp *interp,
+  int objc,
+  Tcl_Obj *CONST objv[]
+){
+  static const struct {
+    const char *zName;
+    int op;
+  } aOp[] = {
+    { "CACHE_HIT",        SQLITE_COMPRESS_STATUS_CACHE_HIT        },
+    { "CACHE_MISS",       SQLITE_COMPRESS_STATUS_CACHE_MISS       },
+    { "CACHE_USED",       SQLITE_COMPRESS_STATUS_CACHE_USED       },
+    { "CACHE_DIRTY",      SQLITE_COMPRESS_STATUS_CACHE_DIRTY      },
+    { "DIRTIED",          SQLITE_COMPRESS_STATUS_DIRTIED          },
+    { "EVICTED",          SQLITE_COMPRESS_STATUS_EVICTED          },
+    { "EVICTED_DIRTY",    SQLITE_COMPRESS_STATUS_EVICTED_DIRTY    },
+    { "COMPRESSED",       SQLITE_COMPRESS_STATUS_COMPRESSED       },
+    { "COMPRESSED_IN",    SQLITE_COMPRESS_STATUS_COMPRESSED_IN    },
+    { "COMPRESSED_OUT",   SQLITE_COMPRESS_STATUS_COMPRESSED_OUT   },
+    { "COMPRESS_TIME",    SQLITE_COMPRESS_STATUS_COMPRESS_TIME    },
+    { "DECOMPRESSED",     SQLITE_COMPRESS_STATUS_DECOMPRESSED     },
+    { "DECOMPRESSED_IN",  SQLITE_COMPRESS_STATUS_DECOMPRESSED_IN  },
+    { "DECOMPRESSED_OUT", SQLITE_COMPRESS_STATUS_DECOMPRESSED_OUT },
+    { "DECOMPRESS_TIME",  SQLITE_COMPRESS_STATUS_DECOMPRESS_TIME  },
+    { "READS",            SQLITE_COMPRESS_STATUS_READS            },
+    { "READ_BYTES",       SQLITE_COMPRESS_STATUS_READ_BYTES       },
+    { "WRITES",           SQLITE_COMPRESS_STATUS_WRITES           },
+    { "WRITE_BYTES",      SQLITE_COMPRESS_STATUS_WRITE_BYTES      }
+  };
+  sqlite3_int64 iValue = 0;
+  sqlite3_int64 mxValue = 0;
+  const char *zOpName;
+  Tcl_Obj *pResult;
+  sqlite3 *db;
+  int op = 0;
+  int resetFlag;
+  int rc;
+  int i;
+
+  if( objc!=4 ){
+    Tcl_WrongNumArgs(interp, 1, objv, "DB PARAMETER RESETFLAG");
+    return TCL_ERROR;
+  }
+  if( getDbPointer(interp, Tcl_GetString(objv[1]), &db) ) return TCL_ERROR;
+  zOpName = Tcl_GetString(objv[2]);
+  if( memcmp(zOpName, "SQLITE_", 7)==0 ) zOpName += 7;
+  if( memcmp(zOpName, "COMPRESS_STATUS_", 16)==0 ) zOpName += 16;
+  for(i=0; i<ArraySize(aOp); i++){
+    if( strcmp(aOp[i].zName, zOpName)==0 ){
+      op = aOp[i].op;
+      break;
+    }
+  }
+  if( i>=ArraySize(aOp) ){
+    if( Tcl_GetIntFromObj(interp, objv[2], &op) ) return TCL_ERROR;
+  }
+  if( Tcl_GetBooleanFromObj(interp, objv[3], &resetFlag) ) return TCL_ERROR;
+
+  rc = sqlite3_compress_status(db, "main", op, &iValue, &mxValue, resetFlag);
+  pResult = Tcl_NewObj();
+  Tcl_ListObjAppendElement(0, pResult, Tcl_NewIntObj(rc));
+  Tcl_ListObjAppendElement(0, pResult, Tcl_NewWideIntObj(iValue));
+  Tcl_ListObjAppendElement(0, pResult, Tcl_NewWideIntObj(mxValue));
+  Tcl_SetObjResult(interp, pResult);
+  return TCL_OK;
+}
+
+/*
+** Usage: sqlite3_compress_huge_pages MODE
+**
+** Sets the pages the chunk caches are mapped in, 0 for normal pages, 1
+** to advise huge pages, 2 for reserved huge pages, or queries it with -1,
+** see sqlite3_compress_huge_pages(). Returns the previous setting.
+*/
+static int test_compress_huge_pages(
+  void * clientData,
+  Tcl_Interp *interp,
+  int objc,
+  Tcl_Obj *CONST objv[]
+){
+  int eMode;
+
+  if( objc!=2 ){
+    Tcl_WrongNumArgs(interp, 1, objv, "MODE");
+    return TCL_ERROR;
+  }
+  if( Tcl_GetIntFromObj(interp, objv[1], &eMode) ) return TCL_ERROR;
+
+  eMode = sqlite3_compress_huge_pages(eMode);
+  Tcl_SetObjResult(interp, Tcl_NewIntObj(eMode));
+  return TCL_OK;
+}
+
+/*
+** Usage: sqlite3_compress_threads N
+**
+** Sets the number of background compression threads, see
+** sqlite3_compress_threads(). Returns the previous setting.
+*/
+static int test_compress_threads(
+  void * clientData,
+  Tcl_Interp *interp,
+  int objc,
+  Tcl_Obj *CONST objv[]
+){
+  int nThread;
+
+  if( objc!=2 ){
+    Tcl_WrongNumArgs(interp, 1, objv, "N");
+    return TCL_ERROR;
+  }
+  if( Tcl_GetIntFromObj(interp, objv[1], &nThread) ) return TCL_ERROR;
+
+  nThread = sqlite3_compress_threads(nThread);
+  Tcl_SetObjResult(interp, Tcl_NewIntObj(nThread));
+  return TCL_OK;
+}
+
+/*
+** Usage: sqlite3_compress_trace NEVENT
+**
+** Turns the binary I/O trace on with a ring of NEVENT events, or off with
+** zero, see sqlite3_compress_trace(). Returns the size of the ring if the
+** trace was on, or zero.
+*/
+static int test_compress_trace(
+  void * clientData,
+  Tcl_Interp *interp,
+  int objc,
+  Tcl_Obj *CONST objv[]
+){
+  int nEvent;
+
+  if( objc!=2 ){
+    Tcl_WrongNumArgs(interp, 1, objv, "NEVENT");
+    return TCL_ERROR;
+  }
+  if( Tcl_GetIntFromObj(interp, objv[1], &nEvent) ) return TCL_ERROR;
+
+  nEvent = sqlite3_compress_trace(nEvent);
+  Tcl_SetObjResult(interp, Tcl_NewIntObj(nEvent));
+  return TCL_OK;
+}
+
+/*
+** Usage: sqlite3_compress_trace_dump FILENAME
+**
+** Writes the trace ring to FILENAME, see sqlite3_compress_trace_dump().
+** Returns the name of the result code.
+*/
+static int test_compress_trace_dump(
+  void * clientData,
+  Tcl_Interp *interp,
+  int objc,
+  Tcl_Obj *CONST objv[]
+){
+  int rc;
+
+  if( objc!=2 ){
+    Tcl_WrongNumArgs(interp, 1, objv, "FILENAME");
+    return TCL_ERROR;
+  }
+
+  rc = sqlite3_compress_trace_dump(Tcl_GetString(objv[1]));
+  Tcl_SetResult(interp, (char *)sqlite3TestErrorName(rc), TCL_VOLATILE);
+  return TCL_OK;
+}
+
+/*
+** The methods of the command that sqlite3_recompress creates, as for
+** sqlite3_backup (see test_backup.c).
+*/
+static int recompressTestCmd(
+  ClientData clientData,
+  Tcl_Interp *interp,
+  int objc,
+  Tcl_Obj *const*objv
+){
+  enum RecompressSubCommandEnum {
+    RECOMPRESS_STEP, RECOMPRESS_FINISH, RECOMPRESS_REMAINING,
+    RECOMPRESS_CHUNKCOUNT
+  };
+  struct RecompressSubCommand {
+    const char *zCmd;
+    enum RecompressSubCommandEnum eCmd;
+    int nArg;
+    const char *zArg;
+  } aSub[] = {
+    {"step",       RECOMPRESS_STEP       , 1, "nchunk" },
+    {"finish",     RECOMPRESS_FINISH     , 0, ""       },
+    {"remaining",  RECOMPRESS_REMAINING  , 0, ""       },
+    {"chunkcount", RECOMPRESS_CHUNKCOUNT , 0, ""       },
+    {0, 0, 0, 0}
+  };
+
+  sqlite3_recompress *p = (sqlite3_recompress *)clientData;
+  int iCmd;
+  int rc;
+
+  rc = Tcl_GetIndexFromObjStruct(
+      interp, objv[1], aSub, sizeof(aSub[0]), "option", 0, &iCmd
+  );
+  if( rc!=TCL_OK ){
+    return rc;
+  }
+  if( objc!=(2 + aSub[iCmd].nArg) ){
+    Tcl_WrongNumArgs(interp, 2, objv, aSub[iCmd].zArg);
+    return TCL_ERROR;
+  }
+
+  switch( aSub[iCmd].eCmd ){
+
+    case RECOMPRESS_FINISH: {
+      const char *zCmdName;
+      Tcl_CmdInfo cmdInfo;
+      zCmdName = Tcl_GetString(objv[0]);
+      Tcl_GetCommandInfo(interp, zCmdName, &cmdInfo);
+      cmdInfo.deleteProc = 0;
+      Tcl_SetCommandInfo(interp, zCmdName, &cmdInfo);
+      Tcl_DeleteCommand(interp, zCmdName);
+
+      rc = sqlite3_recompress_finish(p);
+      Tcl_SetResult(interp, (char *)sqlite3TestErrorName(rc), TCL_STATIC);
+      break;
+    }
+
+    case RECOMPRESS_STEP: {
+      int nChunk;
+      if( TCL_OK!=Tcl_GetIntFromObj(interp, objv[2], &nChunk) ){
+        return TCL_ERROR;
+      }
+      rc = sqlite3_recompress_step(p, nChunk);
+      Tcl_SetResult(interp, (char *)sqlite3TestErrorName(rc), TCL_STATIC);
+      break;
+    }
+
+    case RECOMPRESS_REMAINING:
+      Tcl_SetObjResult(interp, Tcl_NewIntObj(sqlite3_recompress_remaining(p)));
+      break;
+
+    case RECOMPRESS_CHUNKCOUNT:
+      Tcl_SetObjResult(interp,
+          Tcl_NewIntObj(sqlite3_recompress_chunkcount(p)));
+      break;
+  }
+
+  return TCL_OK;
+}
+
+static void recompressTestFinish(ClientData clientData){
+  sqlite3_recompress *p = (sqlite3_recompress *)clientData;
+  sqlite3_recompress_finish(p);
+}
+
+/*
+** Usage: sqlite3_recompress CMDNAME DB DBNAME CODEC LEVEL
+**
+** Starts compressing database DBNAME of connection DB again, see
+** sqlite3_recompress_init(). An empty CODEC keeps the current one.
+*/
+static int test_recompress(
+  void * clientData,
+  Tcl_Interp *interp,
+  int objc,
+  Tcl_Obj *CONST objv[]
+){
+  sqlite3_recompress *p;
+  sqlite3 *db;
+  const char *zCodec;
+  int level;
+
+  if( objc!=6 ){
+    Tcl_WrongNumArgs(interp, 1, objv, "CMDNAME DB DBNAME CODEC LEVEL");
+    return TCL_ERROR;
+  }
+  if( getDbPointer(interp, Tcl_GetString(objv[2]), &db) ) return TCL_ERROR;
+  if( Tcl_GetIntFromObj(interp, objv[5], &level) ) return TCL_ERROR;
+  zCodec = Tcl_GetString(objv[4]);
+
+  p = sqlite3_recompress_init(db, Tcl_GetString(objv[3]),
+      zCodec[0] ? zCodec : 0, level
+  );
+  if( !p ){
+    Tcl_AppendResult(interp, sqlite3_errmsg(db), 0);
+    return TCL_ERROR;
+  }
+
+  Tcl_CreateObjCommand(interp, Tcl_GetString(objv[1]), recompressTestCmd, p,
+      recompressTestFinish
+  );
+  Tcl_SetObjResult(interp, objv[1]);
+  return TCL_OK;
+}
+
+int Sqlitetestcompress_Init(Tcl_Interp *interp){
+  static struct {
+     char *zName;
+     Tcl_ObjCmdProc *xProc;
+  } aCmd[] = {
+    { "sqlite3_compress", test_compress },
+    { "sqlite3_compress_convert", test_compress_convert },
+    { "sqlite3_compress_huge_pages", test_compress_huge_pages },
+    { "sqlite3_compress_status", test_compress_status },
+    { "sqlite3_compress_threads", test_compress_threads },
+    { "sqlite3_compress_trace", test_compress_trace },
+    { "sqlite3_compress_trace_dump", test_compress_trace_dump },
+    { "sqlite3_recompress", test_recompress },
+  };
+  int i;
+
+  for(i=0; i<sizeof(aCmd)/sizeof(aCmd[0]); i++){
+    Tcl_CreateObjCommand(interp, aCmd[i].zName, aCmd[i].xProc, 0, 0);
+  }
+  return TCL_OK;
+}
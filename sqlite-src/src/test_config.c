@@ -225,6 +225,12 @@ static void set_options(Tcl_Interp *interp){
   Tcl_SetVar2(interp, "sqlite_options", "compound", "1", TCL_GLOBAL_ONLY);
 #endif
 
+#ifdef VFSC_ENABLE_ZSTD
+  Tcl_SetVar2(interp, "sqlite_options", "compress_zstd", "1", TCL_GLOBAL_ONLY);
+#else
+  Tcl_SetVar2(interp, "sqlite_options", "compress_zstd", "0", TCL_GLOBAL_ONLY);
+#endif
+
   Tcl_SetVar2(interp, "sqlite_options", "conflict", "1", TCL_GLOBAL_ONLY);
 
 #if SQLITE_OS_UNIX
@@ -5410,6 +5410,185 @@ case OP_Vacuum: {
 }
 #endif
 
+#ifndef SQLITE_OMIT_PRAGMA
+/* Opcode: CompressDictionary P1 P2 P3 * *
+**
+** Train a compression dictionary of P3 bytes, or of the default size if
+** P3 is negative, on the pages of database P1, and compress the database
+** again with it. P3 of zero drops the dictionary. The database must be
+** opened with the compressed VFS. Write the size of the new dictionary
+** to register P2. Like Vacuum, this may not be called from within a
+** transaction.
+*/
+case OP_CompressDictionary: {    /* out2-prerelease */
+  Btree *pBt;
+  sqlite3_file *pFile;
+  int aArg[2];
+  int rc2;
+
+  assert( pOp->p1>=0 && pOp->p1<db->nDb );
+  assert( (p->btreeMask & (((yDbMask)1)<<pOp->p1))!=0 );
+  pBt = db->aDb[pOp->p1].pBt;
+  if( !db->autoCommit ){
+    sqlite3SetString(&p->zErrMsg, db,
+        "cannot train a dictionary from within a transaction");
+    rc = SQLITE_ERROR;
+    break;
+  }
+  if( db->activeVdbeCnt>1 ){
+    sqlite3SetString(&p->zErrMsg, db,
+        "cannot train a dictionary - SQL statements in progress");
+    rc = SQLITE_ERROR;
+    break;
+  }
+  pFile = sqlite3PagerFile(sqlite3BtreePager(pBt));
+  aArg[0] = sqlite3BtreeGetPageSize(pBt);
+  aArg[1] = pOp->p3;
+
+  /* The VFS writes the whole database again, so no other connection
+  ** may be writing meanwhile. */
+  rc = sqlite3BtreeBeginTrans(pBt, 2);
+  if( rc==SQLITE_OK ){
+    rc = SQLITE_NOTFOUND;
+    if( pFile->pMethods ){
+      rc = sqlite3OsFileControl(pFile, SQLITE_FCNTL_COMPRESS_DICTIONARY, aArg);
+    }
+    rc2 = sqlite3BtreeCommit(pBt);
+    if( rc==SQLITE_OK ) rc = rc2;
+  }
+  if( rc==SQLITE_NOTFOUND ){
+    sqlite3SetString(&p->zErrMsg, db,
+        "database does not support compression dictionaries");
+    rc = SQLITE_ERROR;
+  }else if( rc!=SQLITE_OK ){
+    sqlite3SetString(&p->zErrMsg, db,
+        "unable to train a dictionary: %s", sqlite3ErrStr(rc));
+  }
+  pOut->u.i = aArg[1];
+  break;
+}
+#endif /* SQLITE_OMIT_PRAGMA */
+
+#ifndef SQLITE_OMIT_PRAGMA
+/* Opcode: CompressPolicy P1 P2 * P4 *
+**
+** Compress the pages of the b-tree rooted at page P2 of database P1 with
+** the policy P4, a CODEC[:LEVEL] string, or with the codec of the
+** database if P4 is "default". The database must be opened with the
+** compressed VFS.
+*/
+case OP_CompressPolicy: {
+  Btree *pBt;
+  sqlite3_file *pFile;
+  void *apArg[2];
+  int policy;
+
+  assert( pOp->p1>=0 && pOp->p1<db->nDb );
+  assert( (p->btreeMask & (((yDbMask)1)<<pOp->p1))!=0 );
+  pBt = db->aDb[pOp->p1].pBt;
+  pFile = sqlite3PagerFile(sqlite3BtreePager(pBt));
+  policy = 0;
+  apArg[0] = (void*)pOp->p4.z;
+  apArg[1] = (void*)&policy;
+  rc = SQLITE_NOTFOUND;
+  if( pFile->pMethods ){
+    rc = sqlite3OsFileControl(pFile, SQLITE_FCNTL_COMPRESS_POLICY, apArg);
+  }
+  if( rc==SQLITE_OK ){
+    rc = sqlite3BtreeSetPolicy(pBt, pOp->p2, policy);
+  }
+  if( rc==SQLITE_NOTFOUND ){
+    sqlite3SetString(&p->zErrMsg, db,
+        "database does not support compression policies");
+    rc = SQLITE_ERROR;
+  }else if( rc==SQLITE_ERROR ){
+    sqlite3SetString(&p->zErrMsg, db,
+        "invalid compression policy: %s", pOp->p4.z);
+  }else if( rc!=SQLITE_OK ){
+    sqlite3SetString(&p->zErrMsg, db,
+        "unable to set the compression policy: %s", sqlite3ErrStr(rc));
+  }
+  break;
+}
+#endif /* SQLITE_OMIT_PRAGMA */
+
+#ifndef SQLITE_OMIT_PRAGMA
+/* Opcode: CompressSetting P1 P2 P3 * P5
+**
+** Set the compression level of database P1 to P3 if P5 is zero, unless
+** P3 is less than -1, or else set the size of its chunk cache to P3
+** KBytes, unless P3 is negative. Write the setting after the change to
+** register P2. The database must be opened with the compressed VFS.
+*/
+case OP_CompressSetting: {    /* out2-prerelease */
+  sqlite3_file *pFile;
+  i64 size;
+  int level;
+
+  assert( pOp->p1>=0 && pOp->p1<db->nDb );
+  assert( (p->btreeMask & (((yDbMask)1)<<pOp->p1))!=0 );
+  pFile = sqlite3PagerFile(sqlite3BtreePager(db->aDb[pOp->p1].pBt));
+  level = size = pOp->p3;
+  rc = SQLITE_NOTFOUND;
+  if( pFile->pMethods ){
+    if( pOp->p5==0 ){
+      rc = sqlite3OsFileControl(pFile, SQLITE_FCNTL_COMPRESS_LEVEL, &level);
+      size = level;
+    }else{
+      rc = sqlite3OsFileControl(pFile, SQLITE_FCNTL_COMPRESS_CACHE_SIZE, &size);
+    }
+  }
+  if( rc==SQLITE_NOTFOUND ){
+    sqlite3SetString(&p->zErrMsg, db, "database is not compressed");
+    rc = SQLITE_ERROR;
+  }else if( rc!=SQLITE_OK ){
+    sqlite3SetString(&p->zErrMsg, db, "unable to set %s: %s",
+        pOp->p5==0 ? "compress_level" : "compress_cache_size",
+        sqlite3ErrStr(rc));
+  }
+  pOut->u.i = size;
+  break;
+}
+
+/* Opcode: CompressStats P1 P2 P3 * *
+**
+** Write the SQLITE_COMPRESS_STATUS counter P3 of database P1, which must
+** be opened with the compressed VFS, to register P2 and its highwater
+** to register P2+1. See sqlite3_compress_status().
+*/
+case OP_CompressStats: {
+  sqlite3_file *pFile;
+  i64 aArg[3];
+
+  assert( pOp->p1>=0 && pOp->p1<db->nDb );
+  assert( (p->btreeMask & (((yDbMask)1)<<pOp->p1))!=0 );
+  assert( pOp->p2>0 && pOp->p2+1<=p->nMem );
+  pFile = sqlite3PagerFile(sqlite3BtreePager(db->aDb[pOp->p1].pBt));
+  aArg[0] = pOp->p3;
+  aArg[1] = aArg[2] = 0;
+  rc = SQLITE_NOTFOUND;
+  if( pFile->pMethods ){
+    rc = sqlite3OsFileControl(pFile, SQLITE_FCNTL_COMPRESS_STATS, aArg);
+  }
+  if( rc==SQLITE_NOTFOUND ){
+    sqlite3SetString(&p->zErrMsg, db, "database is not compressed");
+    rc = SQLITE_ERROR;
+    break;
+  }else if( rc!=SQLITE_OK ){
+    sqlite3SetString(&p->zErrMsg, db, "unable to read the statistics: %s",
+        sqlite3ErrStr(rc));
+    break;
+  }
+  pOut = &aMem[pOp->p2];
+  memAboutToChange(p, pOut);
+  sqlite3VdbeMemSetInt64(pOut, aArg[1]);
+  pOut = &aMem[pOp->p2+1];
+  memAboutToChange(p, pOut);
+  sqlite3VdbeMemSetInt64(pOut, aArg[2]);
+  break;
+}
+#endif /* SQLITE_OMIT_PRAGMA */
+
 #if !defined(SQLITE_OMIT_AUTOVACUUM)
 /* Opcode: IncrVacuum P1 P2 * * *
 **
@@ -25,18 +25,183 @@
 **		 int cacheSizeKBytes         // The size of the cache in KBytes: -1 for default.
 **   );
 **
+** Each open database has its own cache of cacheSizeKBytes, shared by all
+** the connections to it. The total can be capped with:
+**
+**   sqlite3_int64 sqlite3_compress_memory_limit(sqlite3_int64 nByte);
+**
+** The caches are carved from large segments of memory, backed by huge
+** pages to spare the TLB, see:
+**
+**   int sqlite3_compress_huge_pages(int eMode);
+**
+** Dirty chunks are compressed in parallel by a pool of background threads
+** shared by all the databases, sized with:
+**
+**   int sqlite3_compress_threads(int nThread);
+**
+** The same threads decompress the chunks that a scan reads ahead of time.
+**
+** LAYOUT:
+**
+** A new database uses the sparse layout when the file-system supports it,
+** and the packed layout (see PackedOpen) otherwise. The packed layout can
+** also be requested with a URI filename:
+**
+**   file:data.db?compress_layout=packed
+**
+** OLTP workloads that update scattered pages can instead compress each
+** page on its own, so that an update recompresses and rewrites one page
+** rather than a whole chunk, at some cost in compression ratio:
+**
+**   file:data.db?compress_layout=page
+**
+** This is the packed layout with a chunk per page, the page size is taken
+** from the first write to the new file.
+** While a single connection has the database open, the pages it reads are
+** decompressed straight into the pager's cache rather than into the chunk
+** cache too, so a larger PRAGMA cache_size is the better use of memory.
+**
+** The layout of an existing database is detected from its first bytes.
+**
+** CODECS:
+**
+** Chunks are compressed with zlib unless another codec is requested:
+**
+**   file:data.db?compress_codec=lz4
+**
+** LZ4, Zstandard and Snappy are compiled in with VFSC_ENABLE_LZ4,
+** VFSC_ENABLE_ZSTD and VFSC_ENABLE_SNAPPY, and linking their libraries.
+** Each chunk records its codec, so a file may mix them and is readable by
+** any build that has its codecs.
+**
+** DICTIONARIES:
+**
+** Small chunks compress better with a Zstandard dictionary trained on the
+** pages of the database, stored in the file and used for all its chunks:
+**
+**   PRAGMA compress_train_dictionary;          -- the default size
+**   PRAGMA compress_train_dictionary = 65536;  -- the size, 0 drops it
+**
+** This needs the packed layout and VFSC_ENABLE_ZSTD, see TrainDictionary.
+**
+** POLICIES:
+**
+** Tables and indexes of a database of the page layout can be compressed
+** with another codec or level than the rest of it, or not at all, for as
+** long as it's open:
+**
+**   PRAGMA compress_policy = 'hot_idx=none';
+**   PRAGMA compress_policy = 'archive=zstd:19';
+**
+** The pager tells the shim which policy each page it writes has, and the
+** chunk of the page takes it, see ChunkPolicy. The other layouts refuse
+** policies, as their chunks hold the pages of more than one b-tree.
+**
+** TUNING:
+**
+** The compression level and the cache size of a database can be changed
+** while it's open, say to trade CPU for ratio when the load drops:
+**
+**   PRAGMA compress_level = 9;           -- the chunks written from now on
+**   PRAGMA compress_cache_size = 65536;  -- in KBytes, for all connections
+**   PRAGMA compress_stats;               -- the counters, see below
+**
+** These last while the database is open, see SetLevel and SetCacheSize.
+**
+** RECOMPRESSION:
+**
+** The chunks written before such a change, or before a new dictionary,
+** keep how they were compressed until they are written again. They can be
+** compressed again a few at a time, with the database online, much like
+** sqlite3_backup_step() copies it:
+**
+**   sqlite3_recompress *p = sqlite3_recompress_init(db, "main", "zstd", 19);
+**   while (sqlite3_recompress_step(p, 64) != SQLITE_DONE) ...
+**   sqlite3_recompress_finish(p);
+**
+** Each step keeps other writers out for its duration, and the last one
+** gives the space the old chunks left in a packed file back.
+**
+** CONVERSION:
+**
+** An existing plain database is opened as it is. It can be converted in
+** place to the compressed format, in the layout and with the codec of the
+** URI, and back to the plain one with compress set to zero:
+**
+**   sqlite3_compress_convert("file:data.db?compress_codec=lz4", 1, xProgress, pArg);
+**
+** This copies the database a step at a time, with large sequential reads
+** and writes, and the pool compresses or decompresses each step. Steps are
+** recorded, so an interrupted conversion resumes where it stopped.
+**
+** MONITORING:
+**
+** Each database counts its cache hits, evictions, dirty chunks, bytes read
+** and written, and times its codecs, with histograms of the compression
+** ratio and of the codec latencies. The counters are read one at a time,
+** or all together from the compress_stats virtual table:
+**
+**   sqlite3_compress_status(db, "main", SQLITE_COMPRESS_STATUS_CACHE_HIT, &cur, &hi, 0);
+**   CREATE VIRTUAL TABLE temp.compress_stats USING compress_stats;
+**   SELECT db, name, bucket, value, highwater FROM compress_stats;
+**
+** The compress_chunks virtual table lists the chunks, with their codec,
+** compressed size, last write time and cache state. Joined with the pages
+** of the dbstat table, it shows which tables and indexes take the most
+** disk, and which would gain from compressing again.
+**
+**   CREATE VIRTUAL TABLE temp.compress_chunks USING compress_chunks;
+**
+** The reads, writes, chunk loads and flushes of all the compressed files
+** can be traced too, into a ring of binary events that is cheap enough to
+** leave on, and dumped when needed, to decode with tool/showtrace:
+**
+**   sqlite3_compress_trace(65536);
+**   sqlite3_compress_trace_dump("vfsc.trace");
+**
+** JOURNALS:
+**
+** The rollback journal and the WAL of a compressed database are compressed
+** too, a record per write (see LogOpen), unless disabled with:
+**
+**   file:data.db?compress_journal=0
+**
 ** BUILD:
 **
 ** Compile this file and link with Zlib library to Sqlite3. 
 **
+** On Windows the shim wraps the "win32" VFS and relies on NTFS sparse files
+** (FSCTL_SET_SPARSE/FSCTL_SET_ZERO_DATA) to release the unused tail of each
+** compressed chunk. On Linux it wraps the "unix" VFS and punches holes with
+** fallocate(FALLOC_FL_PUNCH_HOLE|FALLOC_FL_KEEP_SIZE) instead. The file-system
+** must support hole punching (ext4, xfs, btrfs, tmpfs...), otherwise files are
+** opened uncompressed.
+**
 */
+#if !defined(_WIN32) && !defined(_GNU_SOURCE)
+# define _GNU_SOURCE 1          /* For fallocate(), SEEK_DATA and SEEK_HOLE. */
+#endif
 #include "sqliteInt.h"
-#if SQLITE_OS_WIN               /* This file is used for windows only */
+#if SQLITE_OS_WIN || SQLITE_OS_UNIX /* Sparse files are needed for compression */
 
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
 #include "zlib.h"
+#ifdef VFSC_ENABLE_LZ4
+# include "lz4.h"
+#endif
+#ifdef VFSC_ENABLE_ZSTD
+# include "zstd.h"
+# include "zdict.h"
+#endif
+#ifdef VFSC_ENABLE_SNAPPY
+# include "snappy-c.h"
+#endif
+
+#if SQLITE_OS_WIN
 #include <Windows.h>
 #include <WinIoCtl.h>
 
@@ -46,6 +211,87 @@
 
 extern void *convertUtf8Filename(const char *zFilename);
 
+#else /* SQLITE_OS_UNIX */
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#ifdef __linux__
+# include <linux/falloc.h>
+#endif
+#if SQLITE_THREADSAFE
+# include <pthread.h>
+#endif
+#endif
+
+/*
+** The OS-level handle used to manipulate the sparse ranges of a file.
+*/
+#if SQLITE_OS_WIN
+typedef HANDLE vfsc_handle;
+# define VFSC_INVALID_HANDLE    INVALID_HANDLE_VALUE
+# define vfscLastError()        ((int)GetLastError())
+#else
+typedef int vfsc_handle;
+# define VFSC_INVALID_HANDLE    (-1)
+# define vfscLastError()        (errno)
+#endif
+
+#ifndef MIN
+# define MIN(a,b)   ((a) < (b) ? (a) : (b))
+#endif
+#ifndef MAX
+# define MAX(a,b)   ((a) > (b) ? (a) : (b))
+#endif
+
+/*
+** Adds to a counter shared by concurrent connections and returns the sum.
+*/
+#if defined(_MSC_VER)
+# define AtomicAdd(v, n)        (InterlockedExchangeAdd64(&(v), (n)) + (n))
+#else
+# define AtomicAdd(v, n)        __sync_add_and_fetch(&(v), (n))
+#endif
+#define AtomicGet(v)            AtomicAdd(v, 0)
+
+/*
+** Orders the memory accesses before it with those after it.
+*/
+#if defined(_MSC_VER)
+# define AtomicBarrier()        MemoryBarrier()
+#else
+# define AtomicBarrier()        __sync_synchronize()
+#endif
+
+/*
+** The primitives of the background compression threads.
+*/
+#if SQLITE_THREADSAFE
+# if SQLITE_OS_WIN
+typedef CRITICAL_SECTION vfsc_lock;
+typedef CONDITION_VARIABLE vfsc_cond;
+typedef HANDLE vfsc_thread;
+#  define NativeLockInit(p)       InitializeCriticalSection(p)
+#  define NativeLock(p)           EnterCriticalSection(p)
+#  define NativeUnlock(p)         LeaveCriticalSection(p)
+#  define NativeCondInit(p)       InitializeConditionVariable(p)
+#  define NativeCondWait(p, l)    SleepConditionVariableCS(p, l, INFINITE)
+#  define NativeCondBroadcast(p)  WakeAllConditionVariable(p)
+# else
+typedef pthread_mutex_t vfsc_lock;
+typedef pthread_cond_t vfsc_cond;
+typedef pthread_t vfsc_thread;
+#  define NativeLockInit(p)       pthread_mutex_init(p, NULL)
+#  define NativeLock(p)           pthread_mutex_lock(p)
+#  define NativeUnlock(p)         pthread_mutex_unlock(p)
+#  define NativeCondInit(p)       pthread_cond_init(p, NULL)
+#  define NativeCondWait(p, l)    pthread_cond_wait(p, l)
+#  define NativeCondBroadcast(p)  pthread_cond_broadcast(p)
+# endif
+#endif
+
 /*
 ** The chunk size is the compression unit.
 ** It must be in multiple of max-page-size.
@@ -54,11 +300,88 @@ extern void *convertUtf8Filename(const char *zFilename);
 */
 #define COMPRESION_UNIT_SIZE_BYTES  (64 * 1024)
 #define DEF_CHUNK_SIZE_BYTES        (4 * COMPRESION_UNIT_SIZE_BYTES)
+#define MAX_CHUNK_SIZE_BYTES        (256 * COMPRESION_UNIT_SIZE_BYTES)
+
+/*
+** Chunks written by a codec start with a header of CHUNK_HEADER_SIZE bytes:
+**
+**   Offset  Size  Description
+**   0       1     CHUNK_MAGIC
+**   1       1     The id of the codec, see aCodec
+**   2       1     Flags, see CHUNK_FLAG_BLOCKS and CHUNK_FLAG_RAW
+**   3       1     The log2 of the block size, if in blocks
+**   4       4     The compressed size, excluding the header
+**   8       4     The uncompressed size
+**   12      4     The id of the dictionary, zero if none
+**
+** Chunks of older files are bare zlib streams, whose first byte always has
+** 8 in the low nibble, so they can't be confused with the magic.
+*/
+#define CHUNK_HEADER_SIZE           (16)
+#define CHUNK_MAGIC                 (0xC5)
+
+/*
+** A chunk with CHUNK_FLAG_BLOCKS is compressed in blocks, each one on its
+** own, so that a read decompresses only the blocks it needs. The header
+** is followed by the compressed size of each block, 4 bytes each, then by
+** the blocks. Blocks are CHUNK_BLOCK_SIZE bytes or larger, such that a
+** chunk has at most CHUNK_MAX_BLOCKS of them, and chunks with fewer than
+** two blocks, and the records of the log layout, are compressed whole.
+*/
+#define CHUNK_FLAG_BLOCKS           (1)
+#define CHUNK_BLOCK_SHIFT           (15)
+#define CHUNK_BLOCK_SIZE            (1 << CHUNK_BLOCK_SHIFT)
+#define CHUNK_MAX_BLOCKS            (32)
+
+/*
+** A chunk, or a block of one, that compressing doesn't shrink by at least
+** 1/CHUNK_RAW_SAVING is stored as is, with CHUNK_FLAG_RAW in the header,
+** or CHUNK_BLOCK_RAW in the size of the block. When it's written again,
+** its first CHUNK_RAW_PROBE bytes are compressed first, and the rest only
+** if those shrink, so data that doesn't compress costs little to write
+** and only a copy to read. Smaller ones are always compressed, as that's
+** cheap, and the header and the extent alignment of the packed layout
+** would eat the space a raw page gives up.
+*/
+#define CHUNK_FLAG_RAW              (2)
+#define CHUNK_BLOCK_RAW             (0x80000000)
+#define CHUNK_RAW_SAVING            (8)
+#define CHUNK_RAW_PROBE             (4096)
+
+/*
+** A sparse chunk is read in two steps: a guess of its compressed size,
+** rounded up to SPARSE_READ_ALIGN bytes, then the rest its header asks.
+*/
+#define SPARSE_READ_ALIGN           (4096)
+
+/*
+** The maximum number of background compression threads.
+*/
+#define MAX_WORKER_THREADS			(64)
+
+/*
+** The number of chunks at the least recently used end of a cache that
+** are compressed in the background ahead of their eviction.
+*/
+#define WRITE_BEHIND_CHUNKS			(8)
 
 /*
-** The maximum number of chunks to cache.
+** Once a file reads READ_AHEAD_TRIGGER chunks in a row, it reads the next
+** READ_AHEAD_CHUNKS ahead, leaving them to decompress in the background.
 */
-#define MAX_CACHE_SIZE				(5000)
+#define READ_AHEAD_TRIGGER			(2)
+#define READ_AHEAD_CHUNKS			(4)
+
+/*
+** The cached chunks are carved from segments of memory mapped for them,
+** see ArenaAlloc. The segments start at ARENA_HUGE_PAGE bytes, the size
+** of a huge page, and double up to ARENA_SEGMENT_MAX. The slots of each
+** size, up to ARENA_CLASSES sizes, are rounded up to ARENA_ALIGN bytes.
+*/
+#define ARENA_HUGE_PAGE             (2 * 1024 * 1024)
+#define ARENA_SEGMENT_MAX           (64 * 1024 * 1024)
+#define ARENA_CLASSES               (8)
+#define ARENA_ALIGN                 (64)
 
 /*
 ** The minimum number of chunks to cache.
@@ -70,8 +393,20 @@ extern void *convertUtf8Filename(const char *zFilename);
 */
 #define DEF_CACHE_KBYTES			(10 * 1024)
 
+/*
+** The initial number of buckets in the chunk hash table of a database.
+** The table doubles whenever the cache outgrows it.
+*/
+#define MIN_HASH_SIZE				(256)
+
 #define ENABLE_STATISTICS			1
 
+/*
+** The number of counters of a database, indexed by the
+** SQLITE_COMPRESS_STATUS_* operations of sqlite3_compress_status.
+*/
+#define VFSC_STATUS_SIZE            (SQLITE_COMPRESS_STATUS_DECOMPRESS_HISTOGRAM + SQLITE_COMPRESS_LATENCY_BUCKETS)
+
 /*
 ** The default compression level.
 ** Must be 1-9 or -1 for library default.
@@ -86,6 +421,18 @@ enum State
     Cached          //< compressed data flushed.
 };
 
+typedef enum TraceOp
+{
+    TraceOpen = 1,
+    TraceClose,
+    TraceRead,
+    TraceWrite,
+    TraceSync,
+    TraceTruncate,
+    TraceLoad,      //< a chunk read from the file.
+    TraceFlush      //< a chunk written to the file.
+} TraceOp;
+
 typedef enum TraceLevel
 {
     Error = -1,
@@ -105,6 +452,145 @@ typedef enum TraceLevel
 */
 #define DEFAULT_TRACE_LEVEL		Registeration
 
+/*
+** The on-disk layout of a compressed file.
+**
+** Sparse: each chunk is written at its logical offset and the unused tail
+**         of its slot is released by the file-system (sparse/hole punching).
+** Packed: a header, a chunk index and variable-length compressed extents.
+**         Works on any file-system and reads only the compressed bytes.
+** Log:    an append-only sequence of compressed records, for the journals
+**         and the WAL of compressed databases (see LogOpen).
+*/
+typedef enum Layout
+{
+    LayoutPlain = 0,    //< not compressed.
+    LayoutSparse,
+    LayoutPacked,
+    LayoutLog
+
+} Layout;
+
+/*
+** The packed layout starts with two header slots, written alternately
+** so that a torn header write leaves the previous one intact.
+** Extents are allocated in multiples of PACKED_ALIGN bytes.
+** Compacting a file moves its extents up to PACKED_COMPACT_PASSES times.
+*/
+#define PACKED_MAGIC                "vfscompress pk1"
+#define PACKED_MAGIC_SIZE           16
+#define PACKED_SLOT_SIZE            512
+#define PACKED_DATA_START           (2 * PACKED_SLOT_SIZE)
+#define PACKED_ALIGN                512
+#define PACKED_INDEX_ENTRY_SIZE     16
+#define PACKED_ROUND(n)             (((n) + PACKED_ALIGN - 1) & ~(sqlite_int64)(PACKED_ALIGN - 1))
+#define PACKED_INDEX_BLOCK_ENTRIES  (1024)
+#define PACKED_FLAG_DICTIONARY      (1)
+#define PACKED_FLAG_INDEX_BLOCKS    (2)
+#define PACKED_FLAG_PAGES           (4)
+#define PACKED_COMPACT_PASSES       (3)
+
+/*
+** The smallest chunk of a file in page mode, the smallest page size.
+*/
+#define MIN_PAGE_CHUNK_SIZE         (512)
+
+/*
+** The default, minimum and maximum sizes of a trained dictionary.
+** Training samples DICTIONARY_SAMPLE_FACTOR times the size of the
+** dictionary.
+*/
+#define DEF_DICTIONARY_SIZE         (32 * 1024)
+#define MIN_DICTIONARY_SIZE         (1024)
+#define MAX_DICTIONARY_SIZE         (256 * 1024)
+#define DICTIONARY_SAMPLE_FACTOR    (100)
+
+/*
+** The log layout also starts with two alternating header slots, followed
+** by the records. A record holds at most LOG_RECORD_MAX bytes, and writes
+** smaller than LOG_MIN_COMPRESS bytes are stored as they are.
+*/
+#define LOG_MAGIC                   "vfscompress lg1"
+#define LOG_MAGIC_SIZE              16
+#define LOG_SLOT_SIZE               256
+#define LOG_DATA_START              (2 * LOG_SLOT_SIZE)
+#define LOG_RECORD_HEADER_SIZE      32
+#define LOG_RECORD_MAGIC            (0xC7)
+#define LOG_RECORD_MAX              COMPRESION_UNIT_SIZE_BYTES
+#define LOG_MIN_COMPRESS            (128)
+
+/*
+** A log is compacted once its records take more than LOG_COMPACT_FACTOR
+** times the live ones, plus LOG_COMPACT_MIN bytes.
+*/
+#define LOG_COMPACT_FACTOR          (2)
+#define LOG_COMPACT_MIN             (256 * 1024)
+
+/*
+** A conversion (see sqlite3_compress_convert) copies CONVERT_STEP_BYTES
+** at a time, rounded down to whole chunks, and syncs each step. The
+** progress is recorded in a file of its own, named after the database
+** with CONVERT_STATE_SUFFIX, so that an interrupted conversion resumes:
+**
+**   Offset  Size  Description
+**   0       16    CONVERT_MAGIC
+**   16      4     Flags, see CONVERT_FLAG_COMPRESS and CONVERT_FLAG_WAL
+**   20      4     The checksum of the database header, its first 100 bytes
+**   24      8     The size of the database
+**   32      8     The bytes converted and synced
+**   40      8     The offset of the last step
+**   48      4     The checksum of the database bytes of the last step
+**   52      4     The checksum of the bytes above
+*/
+#define CONVERT_MAGIC               "vfscompress cv1"
+#define CONVERT_MAGIC_SIZE          16
+#define CONVERT_STATE_SIZE          56
+#define CONVERT_FLAG_COMPRESS       (1)
+#define CONVERT_FLAG_WAL            (2)
+#define CONVERT_STEP_BYTES          (16 * 1024 * 1024)
+#define CONVERT_SUFFIX              "-convert"
+#define CONVERT_STATE_SUFFIX        "-convert-state"
+
+/*
+** The binary trace, see sqlite3_compress_trace. The events go to a ring
+** in memory, and sqlite3_compress_trace_dump writes the ring out, a
+** header then the events, oldest first, all integers big-endian:
+**
+**   Offset  Size  Description
+**   0       16    TRACE_MAGIC
+**   16      4     The size of an event, TRACE_EVENT_SIZE
+**   20      4     The number of events
+**   24      8     The time of the dump, in ms since 1970
+**   32      8     The time of the dump, on the clock of the events in us
+**
+** And each event:
+**
+**   0       8     Its number, from 1
+**   8       8     When it started, in us on a monotonic clock
+**   16      8     The offset in the file
+**   24      4     The bytes read or written
+**   28      4     The chunk, or -1
+**   32      4     How long it took, in us
+**   36      1     The operation, one of the TraceOp values
+**   37      1     The primary result code
+**   38      2     The file, numbered as opened
+**
+** An open event has the open flags for length and the layout for chunk.
+** tool/showtrace.c decodes a dump.
+*/
+#define TRACE_MAGIC                 "vfscompress tr1"
+#define TRACE_MAGIC_SIZE            16
+#define TRACE_HEADER_SIZE           40
+#define TRACE_EVENT_SIZE            40
+#define TRACE_MAX_EVENTS            (1 << 24)
+
+/*
+** A cached chunk. The chunk's mutex guards its data and is only held by a
+** file that pinned the chunk, so a chunk with nPin == 0 is never locked.
+** The offset, nPin and the hash and LRU links are guarded by the
+** database mutex. A chunk is in the hash table whenever its offset
+** isn't -1.
+*/
 typedef struct vfsc_chunk vfsc_chunk;
 struct vfsc_chunk {
     sqlite_int64 offset;
@@ -112,6 +598,316 @@ struct vfsc_chunk {
     int compSize;
     char* pOrigData;
     char state;
+    int nPin;                   /* Number of files using the chunk */
+    sqlite3_mutex *mutex;       /* Guards the data */
+    char *pCompData;            /* The compressed data while Unwritten, or
+                                ** while Cached with blocks not decoded */
+    u32 missing;                /* The blocks not decoded yet, see FillChunk */
+    u32 raw;                    /* The blocks stored raw, see EncodeChunk */
+    int diskSize;               /* Bytes of its sparse slot in use on disk */
+    vfsc_chunk *pHashNext;      /* Next in the same hash bucket */
+    vfsc_chunk *pLruNext;       /* Next less recently used */
+    vfsc_chunk *pLruPrev;       /* Previous, more recently used */
+};
+
+/*
+** A dictionary trained on the pages of a database, see TrainDictionary.
+** Dictionaries are immutable and kept until the database is freed, so the
+** chunks compressed with a replaced one remain readable meanwhile.
+** An id of 0 marks the dictionary dropped.
+*/
+typedef struct vfsc_dict vfsc_dict;
+struct vfsc_dict {
+    vfsc_dict *pNext;           /* The dictionary this one replaced */
+    u32 id;                     /* Stored in the chunks it compressed */
+    int nData;                  /* Size of pData */
+    char *pData;                /* The dictionary as stored in the file */
+    void *pEncoder;             /* Digested for compression */
+    int level;                  /* The level pEncoder compresses at */
+    void *pDecoder;             /* Digested for decompression */
+};
+
+/*
+** A compression algorithm. The contexts are created as needed, one per
+** codec of each vfsc_codec, and are only used by one thread at a time.
+** xCompress and xDecompress return the size of the output, or -1.
+** Codecs that can't use a dictionary have no xCompressDict and
+** xDecompressDict.
+*/
+typedef struct vfsc_compressor vfsc_compressor;
+struct vfsc_compressor {
+    int id;                     /* Stored in the chunks, never reuse */
+    const char *zName;          /* The name for the compress_codec parameter */
+    int (*xBound)(int nByte);   /* The maximum compressed size of nByte */
+    void *(*xCreate)(void);
+    void (*xDestroy)(void *pCtx);
+    int (*xCompress)(void *pCtx, int level, const char *pIn, int nIn, char *pOut, int nOut);
+    int (*xDecompress)(void *pCtx, const char *pIn, int nIn, char *pOut, int nOut);
+    int (*xCompressDict)(void *pCtx, const vfsc_dict *pDict, const char *pIn, int nIn, char *pOut, int nOut);
+    int (*xDecompressDict)(void *pCtx, const vfsc_dict *pDict, const char *pIn, int nIn, char *pOut, int nOut);
+};
+
+/*
+** The number of entries in aCodec, compiled in or not.
+*/
+#define CODEC_COUNT                 (4)
+
+/*
+** The maximum number of compression policies of a database, the default
+** one included. See SetPolicy.
+*/
+#define POLICY_COUNT                (16)
+
+/*
+** A compression policy, the codec and level of the chunks of some tables
+** and indexes. Level 0 stores them uncompressed.
+*/
+typedef struct vfsc_policy vfsc_policy;
+struct vfsc_policy {
+    int codec;                  /* Index in aCodec */
+    int level;                  /* The compression level, 0 for none */
+};
+
+/*
+** A compression context. Each thread that compresses or decompresses
+** takes one from the pool of the database, so codecs run in parallel.
+** It compresses with the codec and dictionary the database had when it
+** was taken.
+*/
+typedef struct vfsc_codec vfsc_codec;
+struct vfsc_codec {
+    vfsc_codec *pNext;          /* Next free codec */
+    int codec;                  /* Index in aCodec to compress with */
+    int level;                  /* The level to compress with, 0 for none */
+    const vfsc_dict *pDict;     /* The dictionaries, the current one first */
+    char* pCompData;            /* Compressed data temporary area. */
+    int compDataSize;           /* Compressed data temporary area size. */
+    void *apCtx[CODEC_COUNT];   /* The context of each compressor */
+};
+
+/*
+** A range of bytes in the underlying file.
+*/
+typedef struct vfsc_range vfsc_range;
+struct vfsc_range {
+    sqlite_int64 offset;
+    sqlite_int64 size;
+};
+
+/*
+** A sorted list of non-overlapping ranges.
+*/
+typedef struct vfsc_ranges vfsc_ranges;
+struct vfsc_ranges {
+    vfsc_range *a;
+    int n;
+    int nAlloc;
+};
+
+/*
+** The location of a compressed chunk in the packed layout.
+** An offset of 0 means the chunk was never written.
+*/
+typedef struct vfsc_extent vfsc_extent;
+struct vfsc_extent {
+    sqlite_int64 offset;
+    int compSize;
+    int origSize;
+};
+
+/*
+** A block of the packed index, a zero offset if it must be written.
+*/
+typedef struct vfsc_block vfsc_block;
+struct vfsc_block {
+    vfsc_extent extent;
+    u32 checksum;                   /* The crc32 of the stored block. */
+};
+
+/*
+** The state of a file in the packed layout.
+*/
+typedef struct vfsc_packed vfsc_packed;
+struct vfsc_packed {
+    sqlite_int64 logicalSize;       /* The uncompressed size of the file. */
+    sqlite_int64 generation;        /* Incremented on each header write. */
+    sqlite_int64 fileEnd;           /* The end of the allocated area. */
+    vfsc_extent indexExtent;        /* Where the index root is stored. */
+    u32 indexChecksum;              /* The crc32 of the stored index root. */
+    vfsc_block *aBlock;             /* The stored blocks of the index. */
+    int nBlock;                     /* Number of blocks in aBlock. */
+    int nBlockAlloc;                /* Allocated entries in aBlock. */
+    int pageChunks;                 /* Each chunk is a page of the database. */
+    vfsc_extent dictExtent;         /* Where the dictionary is stored, if any. */
+    u32 dictId;                     /* The id of the stored dictionary. */
+    u32 dictChecksum;               /* The crc32 of the stored dictionary. */
+    vfsc_extent *aIndex;            /* The chunk index. */
+    int nIndex;                     /* Number of chunks in aIndex. */
+    int nIndexAlloc;                /* Allocated entries in aIndex. */
+    vfsc_ranges free;               /* Unused ranges, available to allocate. */
+    vfsc_ranges pending;            /* Freed since the last header write. */
+    vfsc_ranges unsynced;           /* Freed by the last header write, until it's synced. */
+    int dirty;                      /* The header/index must be written. */
+    int truncated;                  /* Shrunk since the last sync. */
+};
+
+/*
+** The live part of a record in the log layout: length bytes at offset
+** in the file, found skip bytes into the data of the record.
+*/
+typedef struct vfsc_logext vfsc_logext;
+struct vfsc_logext {
+    sqlite_int64 offset;            /* The logical offset */
+    sqlite_int64 record;            /* Where the record starts in the file */
+    int length;                     /* Number of live bytes */
+    int skip;                       /* Data of the record before offset */
+    int origSize;                   /* Size of the record's data */
+    int stored;                     /* Size of the record's payload */
+    int raw;                        /* The payload isn't compressed */
+};
+
+/*
+** The state of a file in the sparse layout.
+*/
+typedef struct vfsc_sparse vfsc_sparse;
+struct vfsc_sparse {
+    sqlite_int64 logicalSize;       /* The uncompressed size of the file. */
+    int readSize;                   /* The bytes to read of a chunk first. */
+};
+
+/*
+** The state of a file in the log layout. The index maps the logical
+** bytes to the records that wrote them last. It isn't stored, LogOpen
+** rebuilds it by replaying the records.
+*/
+typedef struct vfsc_log vfsc_log;
+struct vfsc_log {
+    sqlite_int64 logicalSize;       /* The uncompressed size of the file. */
+    sqlite_int64 generation;        /* Incremented on each header write. */
+    sqlite_int64 start;             /* The first record. */
+    sqlite_int64 end;               /* The next record, 0 before the header. */
+    sqlite_int64 startSeq;          /* The sequence number of the first record. */
+    sqlite_int64 seq;               /* The sequence number of the next record. */
+    sqlite_int64 checkAt;           /* The end at which to consider compacting. */
+    int epoch;                      /* Incremented when records move. */
+    int trim;                       /* Garbage follows end, drop it before appending. */
+    vfsc_logext *aExt;              /* The index, sorted by offset. */
+    int nExt;                       /* Number of entries in aExt. */
+    int nExtAlloc;                  /* Allocated entries in aExt. */
+};
+
+/*
+** The state of a compressed database, shared by all the files that have
+** it open. Each database has its own cache and codecs, so databases never
+** evict each other's chunks, and connections to the same database see
+** each other's writes. The journals and the WAL of a database have their
+** own, in the log layout, without a cache.
+**
+** The mutex guards the cache list, the codec pool, the codec and the
+** dictionaries, and the layout state.
+** It may be held while locking a chunk only if the chunk isn't pinned.
+*/
+typedef struct vfsc_db vfsc_db;
+struct vfsc_db {
+  vfsc_db *pNext;                     /* Next in the list of open databases */
+  vfsc_db *pPrev;                     /* Previous in the list */
+  char *zPath;                        /* The full path of the database */
+  int nRef;                           /* Number of files using this */
+  int layout;                         /* One of the Layout values */
+  int chunkSize;                      /* The chunk size in bytes */
+  int cacheSize;                      /* The maximum number of chunks to cache */
+  sqlite3_int64 cacheBytes;           /* The size of the cache, see SetCacheSize */
+  int level;                          /* The compression level, see SetLevel */
+  int blockShift;                     /* log2 of the chunk block size, or 0 */
+  int nCache;                         /* Number of chunks allocated */
+  vfsc_chunk *pLruFirst;              /* Most recently used chunk */
+  vfsc_chunk *pLruLast;               /* Least recently used chunk */
+  vfsc_chunk **apHash;                /* Cached chunks by chunk number */
+  int nHash;                          /* Number of buckets in apHash */
+  int codec;                          /* Index in aCodec to write chunks with */
+  vfsc_dict *pDict;                   /* Dictionaries, the current one first */
+  vfsc_codec *pFreeCodec;             /* Codecs not in use */
+  int nJob;                           /* Queued compression jobs, see Pool */
+  int compressLogs;                   /* Compress the journal and the WAL */
+  vfsc_policy aPolicy[POLICY_COUNT];  /* Compression policies, see SetPolicy */
+  int nPolicy;                        /* Entries of aPolicy in use, or 0 */
+  u8 *aPagePolicy;                    /* The policy of each page, see HintPage */
+  int nPagePolicy;                    /* Number of entries in aPagePolicy */
+  int policyPageSize;                 /* The page size of aPagePolicy */
+  sqlite3_mutex *mutex;               /* Guards the shared state */
+  vfsc_sparse sparse;                 /* Sparse layout state */
+  vfsc_packed packed;                 /* Packed layout state */
+  vfsc_log log;                       /* Log layout state */
+  sqlite3_int64 aStatus[VFSC_STATUS_SIZE]; /* Counters, see ReadStatus */
+  u32 *aWriteTime;                    /* When each chunk was written, see StampChunk */
+  int nWriteTime;                     /* Number of entries in aWriteTime */
+};
+
+/*
+** A chunk to compress in the background, or to decompress ahead of a
+** sequential read. The job holds a pin on it.
+*/
+typedef struct vfsc_job vfsc_job;
+struct vfsc_job {
+    vfsc_job *pNext;                /* Next in the queue */
+    vfsc_db *pDb;                   /* The database of the chunk */
+    vfsc_chunk *pChunk;             /* The chunk to compress */
+    int fill;                       /* Decompress it instead, see FillChunk */
+};
+
+/*
+** The background compression threads, shared by all the databases.
+** Workers only compress, leaving the data Unwritten in the chunk, since
+** the underlying files may not be written from several threads at once.
+** The files that own the chunks write them out on eviction or sync.
+** Likewise, they decompress the chunks a file has read ahead.
+**
+** The lock guards the queue and the nJob count of each database.
+*/
+#if SQLITE_THREADSAFE
+typedef struct vfsc_pool vfsc_pool;
+struct vfsc_pool {
+    int isInit;                     /* The lock and conditions are ready */
+    int nThread;                    /* Number of running threads */
+    int shutdown;                   /* The threads must exit */
+    vfsc_job *pFirst;               /* The next job to run */
+    vfsc_job *pLast;                /* The last queued job */
+    vfsc_lock lock;                 /* Guards the queue */
+    vfsc_cond work;                 /* Signaled when a job is queued */
+    vfsc_cond done;                 /* Signaled when a job is done */
+    vfsc_thread aThread[MAX_WORKER_THREADS];
+};
+#endif
+
+/*
+** A segment of the chunk arena. Slots are carved from its start, the
+** segments are unmapped once none is used.
+*/
+typedef struct vfsc_segment vfsc_segment;
+struct vfsc_segment {
+    vfsc_segment *pNext;            /* The previous segment */
+    char *pBase;                    /* The mapped memory */
+    size_t size;                    /* Its size */
+    size_t used;                    /* The bytes carved so far */
+    int isHuge;                     /* In reserved huge pages */
+};
+
+/*
+** The arena the chunks of all the databases are allocated from. A chunk
+** is a slot of the size class of its database, freed slots are kept on
+** the list of their class for the next chunk of that size.
+*/
+typedef struct vfsc_arena vfsc_arena;
+struct vfsc_arena {
+    sqlite3_mutex *mutex;           /* Guards the arena */
+    vfsc_segment *pSegment;         /* The last segment, slots come from */
+    int eHugePages;                 /* SQLITE_COMPRESS_HUGE_PAGES_... */
+    int nSlot;                      /* Slots in use */
+    sqlite3_int64 nMapped;          /* Bytes in segments */
+    struct {
+        int size;                   /* Slot size, 0 if unused */
+        void *pFree;                /* Freed slots, linked by their start */
+    } aClass[ARENA_CLASSES];
 };
 
 /*
@@ -125,12 +921,6 @@ struct vfsc_info {
   void *pOutArg;                      /* First argument to xOut */
   const char *zVfsName;               /* Name of this trace-VFS */
   sqlite3_vfs *pTraceVfs;             /* Pointer back to the trace VFS */
-  void* pCacheChunks;                 /* The cache chunks allocated in one block. */
-  vfsc_chunk* pCache[MAX_CACHE_SIZE]; /* The chunk cache. */
-  char* pCompData;                    /* Compressed data temporary area. */
-  int compDataSize;                   /* Compressed data temporary area size. */
-  z_stream strmDeflate;			      /* Zlib Compression stream. */
-  z_stream strmInflate;			      /* Zlib Decompression stream. */
   int trace;
 };
 
@@ -144,7 +934,31 @@ struct vfsc_file {
   const char *zFName;       /* Base name of the file */
   sqlite3_file *pReal;      /* The real underlying file */
   int flags;				/* Sqlite flags passed to vfscOpen() */
-  HANDLE hFile;             /* The underlying file handle */
+  int layout;               /* One of the Layout values */
+  vfsc_handle hFile;        /* The underlying sparse file handle */
+  vfsc_db *pDb;             /* Shared state, NULL if not compressed */
+  sqlite_int64 lastChunk;   /* The last chunk of a run of reads in order */
+  int nSequential;          /* Chunks in the run before it, see ReadAhead */
+  int traceId;              /* The file number in the binary trace */
+  const char *zPath;        /* The full path of a plain main database */
+  vfsc_file *pNextPlain;    /* The next in PlainList */
+};
+
+/*
+** An event of the binary trace, see TRACE_MAGIC. The writer claims the
+** slot with TraceNext, fills it, then sets seq, which is 0 meanwhile.
+*/
+typedef struct vfsc_event vfsc_event;
+struct vfsc_event {
+    sqlite3_int64 seq;              /* Its number from 1, or 0 */
+    sqlite3_int64 time;             /* When it started, see GetTimerMicros */
+    sqlite3_int64 offset;           /* The offset in the file */
+    int length;                     /* The bytes read or written */
+    int chunk;                      /* The chunk number, or -1 */
+    int latency;                    /* How long it took, in us */
+    unsigned char op;               /* One of the TraceOp values */
+    unsigned char rc;               /* The primary result code */
+    unsigned short file;            /* See vfsc_file.traceId */
 };
 
 /*
@@ -191,28 +1005,56 @@ static int CompressionLevel = DEFAULT_COMPRESSION_LEVEL;
 static int ChunkSizeBytes = DEF_CHUNK_SIZE_BYTES;
 
 /*
-** The number of chunks to cache.
-** MUST be at least 1 slot.
+** The cache size of each database in bytes.
+*/
+static sqlite3_int64 CacheSizeBytes = DEF_CACHE_KBYTES * 1024;
+
+/*
+** The limit on the memory used by the caches of all the databases, in bytes.
+** Zero for no limit. A database can always cache MIN_CACHE_SIZE chunks.
 */
-static int CacheSize = MIN_CACHE_SIZE;
+static sqlite3_int64 CacheMemoryLimit = 0;
+static sqlite3_int64 CacheMemoryUsed = 0;
 
+/*
+** All the open compressed databases. Protected by the master mutex.
+*/
+static vfsc_db *DbList = NULL;
 
-#ifdef ENABLE_STATISTICS
+/*
+** All the open plain main databases, so that sqlite3_compress_convert
+** can tell whether one is in use. Protected by the master mutex.
+*/
+static vfsc_file *PlainList = NULL;
+
+/*
+** The number of background compression threads, -1 for one less than
+** the number of processors. Protected by the master mutex.
+*/
+static int WorkerThreads = -1;
+#if SQLITE_THREADSAFE
+static vfsc_pool Pool;
+#endif
+
+/*
+** The chunk arena. The mutex is allocated with the first database and
+** kept, the rest is protected by it.
+*/
+static vfsc_arena Arena = { NULL, NULL, SQLITE_COMPRESS_HUGE_PAGES_ADVISE };
 
-static int CacheHits = 0;
-static int TotalHits = 0;
+/*
+** The ring of the binary trace, allocated when first enabled and kept.
+** Events are added without locks, see TraceRecord.
+*/
+static vfsc_event *TraceRing = NULL;
+static int TraceMask = 0;
+static volatile int TraceEnabled = 0;
+static sqlite3_int64 TraceNext = 0;
+static int TraceFiles = 0;
 
-static int WriteCount = 0;
-static int ReadCount = 0;
-static sqlite_int64 WriteBytes = 0;
-static sqlite_int64 ReadBytes = 0;
 
-static int CompressCount = 0;
-static int DecompressCount = 0;
-static sqlite_int64 CompressBytes = 0;
-static sqlite_int64 DecompressBytes = 0;
 
-#endif // ENABLE_STATISTICS
+#if SQLITE_OS_WIN
 
 /*
 ** Core Windows API Wrappers.
@@ -266,38 +1108,18 @@ BOOL IsSparse(HANDLE hFile)
 }
 
 /*
-** Checks whether or not a database file is compressed by us.
+** Opens a file in sparse-mode.
+** The real file isn't used, we open a new handle by name.
 */
 static
-BOOL IsCompressed(HANDLE hFile)
+HANDLE OpenSparseFile(sqlite3_file *pReal, const char *zName)
 {
-    char buffer[100];
-    DWORD read = 0;
-    LONG upper = 0;
+    DWORD dwTemp;
+    DWORD res;
+    void *zConverted;              /* Filename in OS encoding */
+    HANDLE hSparseFile;
 
-    ReadFile(hFile, buffer, 14, &read, NULL);
-    SetFilePointer(hFile, 0, &upper, FILE_BEGIN);
-    if (read == 0)
-    {
-        // Empty file, just start supporting compression.
-        return 1;
-    }
-
-	//TODO: We must avoid relying on the header for this check.
-    buffer[read] = 0;
-    return (strcmp(buffer, "SQLite format ") != 0);
-}
-
-/*
-** Opens a file in sparse-mode.
-*/
-static
-HANDLE OpenSparseFile(const char *zName)
-{
-    DWORD dwTemp;
-    DWORD res;
-    void *zConverted;              /* Filename in OS encoding */
-    HANDLE hSparseFile;
+    UNUSED_PARAMETER(pReal);
 
     /* Convert the filename to the system encoding. */
     zConverted = convertUtf8Filename(zName);
@@ -313,6 +1135,7 @@ HANDLE OpenSparseFile(const char *zName)
         OPEN_EXISTING, // We expect the default VFS to have opened the file already.
 		FILE_ATTRIBUTE_NORMAL,
         NULL);
+    free(zConverted);
 
     if (hSparseFile == INVALID_HANDLE_VALUE)
     {
@@ -337,11 +1160,24 @@ HANDLE OpenSparseFile(const char *zName)
     return hSparseFile;
 }
 
+/*
+** Closes a handle returned by OpenSparseFile.
+*/
+static
+void CloseSparseFile(HANDLE hSparseFile)
+{
+    if (hSparseFile != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(hSparseFile);
+    }
+}
+
 /*
 ** Marks a range of bytes as sparse.
+** Returns 0 on success, the OS error otherwise.
 */
 static
-DWORD SetSparseRange(HANDLE hSparseFile, LONGLONG start, LONGLONG size)
+int SetSparseRange(HANDLE hSparseFile, sqlite3_int64 start, sqlite3_int64 size)
 {
     typedef struct _FILE_ZERO_DATA_INFORMATION {
 
@@ -383,7 +1219,42 @@ DWORD SetSparseRange(HANDLE hSparseFile, LONGLONG start, LONGLONG size)
     }
 
     // return the error value
-    return GetLastError();
+    return (int)GetLastError();
+}
+
+/*
+** Flushes the OS buffers of a sparse file to disk.
+*/
+static
+void SyncSparseFile(HANDLE hSparseFile)
+{
+    FlushFileBuffers(hSparseFile);
+}
+
+/*
+** Replaces the file zTo with zFrom, which takes its name.
+** Returns 0 on success, the OS error otherwise.
+*/
+static
+int ReplaceFileByName(const char *zFrom, const char *zTo)
+{
+    void *zConvFrom = convertUtf8Filename(zFrom);
+    void *zConvTo = convertUtf8Filename(zTo);
+    int err = 0;
+
+    if (zConvFrom == NULL || zConvTo == NULL)
+    {
+        err = ERROR_NOT_ENOUGH_MEMORY;
+    }
+    else if (!MoveFileExW((WCHAR*)zConvFrom, (WCHAR*)zConvTo,
+                          MOVEFILE_REPLACE_EXISTING|MOVEFILE_WRITE_THROUGH))
+    {
+        err = (int)GetLastError();
+    }
+
+    free(zConvFrom);
+    free(zConvTo);
+    return err;
 }
 
 /*
@@ -391,19 +1262,20 @@ DWORD SetSparseRange(HANDLE hSparseFile, LONGLONG start, LONGLONG size)
 ** sizes of a given file.
 */
 static
-LARGE_INTEGER GetSparseFileSize(HANDLE hFile, LPCSTR filename, PLARGE_INTEGER actualSize)
+sqlite3_int64 GetSparseFileSize(HANDLE hFile, LPCSTR filename, sqlite3_int64 *pActualSize)
 {
     // Retrieves the file's actual size on disk, in bytes. The size does not
     // include the sparse ranges.
     LARGE_INTEGER liSparseFileCompressedSize;
+    LARGE_INTEGER liActualSize;
 	liSparseFileCompressedSize.LowPart = GetCompressedFileSizeA(
 					filename, (LPDWORD)&liSparseFileCompressedSize.HighPart);
 
 	if (hFile != INVALID_HANDLE_VALUE)
 	{
-		if (GetFileSizeEx(hFile, actualSize) == FALSE)
+		if (GetFileSizeEx(hFile, &liActualSize) == FALSE)
 		{
-			*actualSize = liSparseFileCompressedSize;
+			liActualSize = liSparseFileCompressedSize;
 		}
 	}
 	else
@@ -416,17 +1288,294 @@ LARGE_INTEGER GetSparseFileSize(HANDLE hFile, LPCSTR filename, PLARGE_INTEGER ac
 							FILE_ATTRIBUTE_NORMAL,
 							NULL);
 
-		if (GetFileSizeEx(hFile, actualSize) == FALSE)
+		if (GetFileSizeEx(hFile, &liActualSize) == FALSE)
 		{
-			*actualSize = liSparseFileCompressedSize;
+			liActualSize = liSparseFileCompressedSize;
 		}
 
 		CloseHandle(hFile);
 	}
 
-	return liSparseFileCompressedSize;
+	*pActualSize = liActualSize.QuadPart;
+	return liSparseFileCompressedSize.QuadPart;
+}
+
+/*
+** Returns a monotonic time in microseconds, to time the codecs.
+*/
+static
+sqlite3_int64 GetTimerMicros(void)
+{
+    static LARGE_INTEGER liFrequency;
+    LARGE_INTEGER liNow;
+
+    if (liFrequency.QuadPart == 0)
+    {
+        QueryPerformanceFrequency(&liFrequency);
+    }
+    QueryPerformanceCounter(&liNow);
+    return liNow.QuadPart / liFrequency.QuadPart * 1000000
+         + liNow.QuadPart % liFrequency.QuadPart * 1000000 / liFrequency.QuadPart;
+}
+
+/*
+** Maps nByte of memory for the chunk arena, in large pages if reserved
+** ones are asked for and the process may lock them. Windows has no
+** transparent huge pages, the other modes map normal pages.
+** Sets *pHuge if it's in large pages. Returns NULL if out of memory.
+*/
+static void *MapArena(size_t nByte, int eHugePages, int *pHuge)
+{
+    void *p = NULL;
+    SIZE_T large = GetLargePageMinimum();
+
+    *pHuge = 0;
+    if (eHugePages == SQLITE_COMPRESS_HUGE_PAGES_RESERVED && large > 0 && nByte % large == 0)
+    {
+        p = VirtualAlloc(NULL, nByte, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+        *pHuge = p != NULL;
+    }
+
+    if (p == NULL)
+    {
+        p = VirtualAlloc(NULL, nByte, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+    }
+
+    return p;
+}
+
+static void UnmapArena(void *p, size_t nByte)
+{
+    VirtualFree(p, 0, MEM_RELEASE);
+}
+
+#else /* SQLITE_OS_UNIX */
+
+/*
+** Core POSIX API Wrappers.
+**
+** The descriptor used here belongs to the unix VFS (see OpenSparseFile),
+** so it must never be closed by us: closing any descriptor on a file
+** releases all the POSIX advisory locks the process holds on it.
+*/
+
+/*
+** Checks whether or not a volume supports sparse files.
+** This can only be known once the file is open, see OpenSparseFile.
+*/
+static
+int SparseFileSuppored(const char *zPath)
+{
+    UNUSED_PARAMETER(zPath);
+#if defined(__linux__) && defined(FALLOC_FL_PUNCH_HOLE)
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+/*
+** Marks a range of bytes as sparse, releasing the disk blocks backing it.
+** Returns 0 on success, errno otherwise.
+*/
+static
+int SetSparseRange(int fd, sqlite3_int64 start, sqlite3_int64 size)
+{
+    if (size <= 0)
+    {
+        return 0;
+    }
+
+#if defined(__linux__) && defined(FALLOC_FL_PUNCH_HOLE)
+    if (fallocate(fd, FALLOC_FL_PUNCH_HOLE|FALLOC_FL_KEEP_SIZE, (off_t)start, (off_t)size) == 0)
+    {
+        return 0; // Success
+    }
+
+    return errno;
+#else
+    return ENOTSUP;
+#endif
+}
+
+/*
+** Gets the file descriptor of the real file and checks that it supports
+** hole punching. Returns -1 if the file can't be used in sparse-mode.
+*/
+static
+int OpenSparseFile(sqlite3_file *pReal, const char *zName)
+{
+    int fd = -1;
+    struct stat buf;
+
+    UNUSED_PARAMETER(zName);
+    if (pReal->pMethods->xFileControl(pReal, SQLITE_FCNTL_OS_HANDLE, &fd) != SQLITE_OK ||
+        fd < 0 || fstat(fd, &buf) != 0)
+    {
+        return -1;
+    }
+
+    // Probe past the end-of-file, which doesn't change anything but fails
+    // with EOPNOTSUPP when the file-system can't punch holes.
+    errno = 0;
+    if (SetSparseRange(fd, buf.st_size + 1, 1) != 0)
+    {
+        return -1;
+    }
+
+    return fd;
+}
+
+/*
+** Closes a handle returned by OpenSparseFile.
+** The descriptor is owned by the unix VFS, nothing to do.
+*/
+static
+void CloseSparseFile(int fd)
+{
+    UNUSED_PARAMETER(fd);
+}
+
+/*
+** Flushes the OS buffers of a sparse file to disk.
+*/
+static
+void SyncSparseFile(int fd)
+{
+#if defined(_POSIX_SYNCHRONIZED_IO) && _POSIX_SYNCHRONIZED_IO > 0
+    fdatasync(fd);
+#else
+    fsync(fd);
+#endif
+}
+
+/*
+** Replaces the file zTo with zFrom, which takes its name, then syncs the
+** directory so that the new name is durable.
+** Returns 0 on success, errno otherwise.
+*/
+static
+int ReplaceFileByName(const char *zFrom, const char *zTo)
+{
+    char zDir[FILENAME_MAX + 1];
+    const char *zSlash = strrchr(zTo, '/');
+    int fd;
+
+    if (rename(zFrom, zTo) != 0)
+    {
+        return errno;
+    }
+
+    if (zSlash == NULL)
+    {
+        memcpy(zDir, ".", 2);
+    }
+    else
+    {
+        int n = (int)MIN(zSlash - zTo, FILENAME_MAX);
+        memcpy(zDir, zTo, n);
+        zDir[n == 0 ? 1 : n] = '\0';
+        zDir[0] = n == 0 ? '/' : zDir[0];
+    }
+
+    fd = open(zDir, O_RDONLY);
+    if (fd >= 0)
+    {
+        fsync(fd);
+        close(fd);
+    }
+
+    return 0;
+}
+
+/*
+** Gets the actual size (after decompression) and the compressed/physical
+** sizes of a given file.
+*/
+static
+sqlite3_int64 GetSparseFileSize(int fd, const char *filename, sqlite3_int64 *pActualSize)
+{
+    struct stat buf;
+    int rc;
+
+    if (fd >= 0)
+    {
+        rc = fstat(fd, &buf);
+    }
+    else
+    {
+        rc = stat(filename, &buf);
+    }
+
+    if (rc != 0)
+    {
+        *pActualSize = 0;
+        return 0;
+    }
+
+    // st_blocks is always in 512-byte units, regardless of st_blksize.
+    *pActualSize = buf.st_size;
+    return (sqlite3_int64)buf.st_blocks * 512;
+}
+
+/*
+** Returns a monotonic time in microseconds, to time the codecs.
+*/
+static
+sqlite3_int64 GetTimerMicros(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (sqlite3_int64)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/*
+** Maps nByte of memory for the chunk arena. Reserved huge pages come from
+** the pool of the system (MAP_HUGETLB), and fall back to normal pages if
+** it's short. Normal pages are advised to be backed by transparent huge
+** pages, unless they are off.
+** Sets *pHuge if it's in reserved huge pages. Returns NULL if out of memory.
+*/
+static void *MapArena(size_t nByte, int eHugePages, int *pHuge)
+{
+    void *p = MAP_FAILED;
+
+    *pHuge = 0;
+#ifdef MAP_HUGETLB
+    if (eHugePages == SQLITE_COMPRESS_HUGE_PAGES_RESERVED)
+    {
+        p = mmap(NULL, nByte, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        *pHuge = p != MAP_FAILED;
+    }
+#endif
+
+    if (p == MAP_FAILED)
+    {
+        p = mmap(NULL, nByte, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED)
+        {
+            return NULL;
+        }
+
+#ifdef MADV_HUGEPAGE
+        if (eHugePages != SQLITE_COMPRESS_HUGE_PAGES_OFF)
+        {
+            madvise(p, nByte, MADV_HUGEPAGE);
+        }
+#endif
+    }
+
+    return p;
+}
+
+static void UnmapArena(void *p, size_t nByte)
+{
+    munmap(p, nByte);
 }
 
+#endif /* SQLITE_OS_UNIX */
+
 /*
 ** Return a pointer to the tail of the pathname.  Examples:
 **
@@ -546,33 +1695,34 @@ static void strappend(char *z, int *pI, const char *zAppend){
 }
 
 /*
-** Decompression interface.
-** Returns the output size in bytes.
+** Decompression interface. The input must hold the whole stream, as all
+** the callers read a chunk or a block whole.
+** Returns the output size in bytes, or -1 if the stream is corrupt, cut
+** short, or larger than the output.
 */
-static int Decompress(z_stream strm, const void* input, int* input_length, void* output, int max_output_length)
+static int Decompress(z_stream *strm, const void* input, int* input_length, void* output, int max_output_length)
 {
     int ret;
     unsigned output_length;
 
-    if (inflateReset(&strm) != Z_OK)
+    if (inflateReset(strm) != Z_OK)
     {
         return -1;
     }
 
-    strm.avail_in = *input_length;
-    strm.next_in = (Bytef*)input;
-    strm.avail_out = max_output_length;
-    strm.next_out = (Bytef*)output;
-	ret = inflate(&strm, Z_FULL_FLUSH);
-
-    *input_length = strm.total_in;
-    output_length = max_output_length - strm.avail_out;
-
-#ifdef ENABLE_STATISTICS
-	++DecompressCount;
-	DecompressBytes += *input_length;
-#endif
+    strm->avail_in = *input_length;
+    strm->next_in = (Bytef*)input;
+    strm->avail_out = max_output_length;
+    strm->next_out = (Bytef*)output;
+	ret = inflate(strm, Z_FULL_FLUSH);
+    if (ret != Z_STREAM_END)
+    {
+        // Corrupt, truncated, or the output is too small for it.
+        return -1;
+    }
 
+    *input_length = strm->total_in;
+    output_length = max_output_length - strm->avail_out;
     return output_length;
 }
 
@@ -580,1114 +1730,8283 @@ static int Decompress(z_stream strm, const void* input, int* input_length, void*
 ** Compression interface.
 ** Returns the output size in bytes.
 */
-static int Compress(z_stream strm, const void* input, int input_length, void* output, int max_output_length)
+static int Compress(z_stream *strm, const void* input, int input_length, void* output, int max_output_length)
 {
     int ret;
     int output_length;
 
-	ret = deflateReset(&strm);
+	ret = deflateReset(strm);
 	if (ret != Z_OK)
 	{
 		return -1;
 	}
 
-	strm.avail_in = input_length;
-    strm.next_in = (Bytef*)input;
-    strm.avail_out = max_output_length;
-    strm.next_out = (Bytef*)output;
-    ret = deflate(&strm, Z_FINISH);
+	strm->avail_in = input_length;
+    strm->next_in = (Bytef*)input;
+    strm->avail_out = max_output_length;
+    strm->next_out = (Bytef*)output;
+    ret = deflate(strm, Z_FINISH);
 	if (ret != Z_STREAM_END)
 	{
-		printf("Shooot");
+		return -1;
 	}
 
-    output_length = max_output_length - strm.avail_out;
-
-#ifdef ENABLE_STATISTICS
-	++CompressCount;
-	CompressBytes += input_length;
-#endif
-
+    output_length = max_output_length - strm->avail_out;
     return output_length;
 }
 
-static
-void LogSparseFileSize(vfsc_file *pFile)
-{
-    LARGE_INTEGER liSparseFileSize;
-    LARGE_INTEGER liSparseFileCompressedSize;
+/*
+** The zlib codec. The streams are initialized on first use, as a thread
+** that only reads doesn't need the large deflate state.
+*/
+typedef struct vfsc_zlib vfsc_zlib;
+struct vfsc_zlib {
+    int level;                  /* The level strmDeflate was made for */
+    int hasDeflate;
+    int hasInflate;
+    z_stream strmDeflate;       /* Zlib Compression stream. */
+    z_stream strmInflate;       /* Zlib Decompression stream. */
+};
 
-	if (pFile->hFile == INVALID_HANDLE_VALUE ||
-		pFile->pInfo->trace < Compression)
-	{
-		return;
-	}
+static int ZlibBound(int nByte)
+{
+    return (int)compressBound(nByte);
+}
 
-	liSparseFileCompressedSize = GetSparseFileSize(pFile->hFile, pFile->zFName, &liSparseFileSize);
+static void *ZlibCreate(void)
+{
+    vfsc_zlib *pZlib = (vfsc_zlib*)sqlite3_malloc(sizeof(vfsc_zlib));
+    if (pZlib != NULL)
+    {
+        memset(pZlib, 0, sizeof(vfsc_zlib));
+    }
 
-	// Print the result
-    vfsc_printf(pFile->pInfo, Compression, " > File total size: %lld KB, Actual size on disk: %lld KB, Compression Ratio: %.2f%%\n",
-		liSparseFileSize.QuadPart / 1024,
-        liSparseFileCompressedSize.QuadPart / 1024,
-        100.0 * liSparseFileCompressedSize.QuadPart / (double)liSparseFileSize.QuadPart);
+    return pZlib;
 }
 
-static
-BOOL LogSparseRanges(vfsc_file *pFile)
+static void ZlibDestroy(void *pCtx)
 {
-	typedef struct _FILE_ALLOCATED_RANGE_BUFFER {
-	  LARGE_INTEGER FileOffset;
-	  LARGE_INTEGER Length;
-	} FILE_ALLOCATED_RANGE_BUFFER, *PFILE_ALLOCATED_RANGE_BUFFER;
-
-    LARGE_INTEGER liFileSize;
-    FILE_ALLOCATED_RANGE_BUFFER queryRange;
-    FILE_ALLOCATED_RANGE_BUFFER allocRanges[1024];
-    DWORD nbytes;
-    BOOL bFinished;
-	DWORD dwAllocRangeCount;
-	DWORD i;
+    vfsc_zlib *pZlib = (vfsc_zlib*)pCtx;
+    if (pZlib->hasDeflate)
+    {
+        (void)deflateEnd(&pZlib->strmDeflate);
+    }
 
-	if (pFile->hFile == INVALID_HANDLE_VALUE ||
-		pFile->pInfo->trace < Trace)
+    if (pZlib->hasInflate)
     {
-		return FALSE;
-	}
+        (void)inflateEnd(&pZlib->strmInflate);
+    }
 
-    GetFileSizeEx(pFile->hFile, &liFileSize);
+    sqlite3_free(pZlib);
+}
 
-    // Range to be examined (the whole file)
-    queryRange.FileOffset.QuadPart = 0;
-    queryRange.Length = liFileSize;
+static int ZlibCompress(void *pCtx, int level, const char *pIn, int nIn, char *pOut, int nOut)
+{
+    vfsc_zlib *pZlib = (vfsc_zlib*)pCtx;
+    level = MIN(level, Z_BEST_COMPRESSION);
+    if (pZlib->hasDeflate && pZlib->level != level)
+    {
+        (void)deflateEnd(&pZlib->strmDeflate);
+        pZlib->hasDeflate = 0;
+    }
 
-	vfsc_printf(pFile->pInfo, Trace, " Allocated ranges in the file:\n");
-    do
+    if (!pZlib->hasDeflate)
     {
-#define FSCTL_QUERY_ALLOCATED_RANGES    CTL_CODE(FILE_DEVICE_FILE_SYSTEM, 51,  METHOD_NEITHER, FILE_READ_DATA)  // FILE_ALLOCATED_RANGE_BUFFER, FILE_ALLOCATED_RANGE_BUFFER
+        if (deflateInit2(&pZlib->strmDeflate, level, Z_DEFLATED, MAX_WBITS, MAX_MEM_LEVEL, Z_DEFAULT_STRATEGY) != Z_OK)
+        {
+            return -1;
+        }
 
-        bFinished = DeviceIoControl(pFile->hFile, FSCTL_QUERY_ALLOCATED_RANGES, 
-            &queryRange, sizeof(queryRange), allocRanges, 
-            sizeof(allocRanges), &nbytes, NULL);
+        pZlib->hasDeflate = 1;
+        pZlib->level = level;
+    }
 
-        if (!bFinished)
-        {
-            DWORD dwError = GetLastError();
+    return Compress(&pZlib->strmDeflate, pIn, nIn, pOut, nOut);
+}
 
-            // ERROR_MORE_DATA is the only error that is normal
-            if (dwError != ERROR_MORE_DATA)
-            {
-                vfsc_printf(pFile->pInfo, Error, "DeviceIoControl failed w/err 0x%8lx\n", dwError);
-                return FALSE;
-            }
+/*
+** Inflates a zlib stream, setting *pnIn to the size of the stream.
+*/
+static int ZlibInflate(void *pCtx, const char *pIn, int *pnIn, char *pOut, int nOut)
+{
+    vfsc_zlib *pZlib = (vfsc_zlib*)pCtx;
+    if (!pZlib->hasInflate)
+    {
+        if (inflateInit2(&pZlib->strmInflate, MAX_WBITS) != Z_OK)
+        {
+            return -1;
         }
 
-        // Calculate the number of records returned
-        dwAllocRangeCount = nbytes / sizeof(FILE_ALLOCATED_RANGE_BUFFER);
+        pZlib->hasInflate = 1;
+    }
 
-        // Print each allocated range
-        for (i = 0; i < dwAllocRangeCount; ++i)
-        {
-            vfsc_printf(pFile->pInfo, Trace, "  allocated range: [%lld]->[%lld] (%lld bytes)\n",
-					allocRanges[i].FileOffset.QuadPart,
-					allocRanges[i].FileOffset.QuadPart + allocRanges[i].Length.QuadPart,
-					allocRanges[i].Length.QuadPart);
-        }
+    return Decompress(&pZlib->strmInflate, pIn, pnIn, pOut, nOut);
+}
 
-        // Set starting address and size for the next query
-        if (!bFinished && dwAllocRangeCount > 0)
-        {
-            queryRange.FileOffset.QuadPart = 
-                allocRanges[dwAllocRangeCount - 1].FileOffset.QuadPart + 
-                allocRanges[dwAllocRangeCount - 1].Length.QuadPart;
-            
-            queryRange.Length.QuadPart = liFileSize.QuadPart - 
-                queryRange.FileOffset.QuadPart;
-        }
+static int ZlibDecompress(void *pCtx, const char *pIn, int nIn, char *pOut, int nOut)
+{
+    return ZlibInflate(pCtx, pIn, &nIn, pOut, nOut);
+}
+
+#ifdef VFSC_ENABLE_LZ4
+/*
+** The LZ4 codec, for when latency matters more than the ratio.
+** It ignores the level.
+*/
+static int Lz4Bound(int nByte)
+{
+    return LZ4_compressBound(nByte);
+}
+
+static void *Lz4Create(void)
+{
+    return sqlite3_malloc(LZ4_sizeofState());
+}
+
+static void Lz4Destroy(void *pCtx)
+{
+    sqlite3_free(pCtx);
+}
+
+static int Lz4Compress(void *pCtx, int level, const char *pIn, int nIn, char *pOut, int nOut)
+{
+    int n = LZ4_compress_fast_extState(pCtx, pIn, pOut, nIn, nOut, 1);
+    UNUSED_PARAMETER(level);
+    return n > 0 ? n : -1;
+}
+
+static int Lz4Decompress(void *pCtx, const char *pIn, int nIn, char *pOut, int nOut)
+{
+    int n = LZ4_decompress_safe(pIn, pOut, nIn, nOut);
+    UNUSED_PARAMETER(pCtx);
+    return n >= 0 ? n : -1;
+}
+#endif /* VFSC_ENABLE_LZ4 */
+
+#ifdef VFSC_ENABLE_ZSTD
+/*
+** The Zstandard codec. The zlib levels map to the same zstd levels.
+*/
+typedef struct vfsc_zstd vfsc_zstd;
+struct vfsc_zstd {
+    ZSTD_CCtx *pCCtx;
+    ZSTD_DCtx *pDCtx;
+};
+
+static int ZstdBound(int nByte)
+{
+    return (int)ZSTD_compressBound(nByte);
+}
 
+static void *ZstdCreate(void)
+{
+    vfsc_zstd *pZstd = (vfsc_zstd*)sqlite3_malloc(sizeof(vfsc_zstd));
+    if (pZstd != NULL)
+    {
+        memset(pZstd, 0, sizeof(vfsc_zstd));
     }
-	while (!bFinished);
 
-    return TRUE;
+    return pZstd;
 }
 
-static int FlushChunk(vfsc_file *pFile, vfsc_chunk *pChunk)
+static void ZstdDestroy(void *pCtx)
 {
-    vfsc_info *pInfo = pFile->pInfo;
-    int rc = SQLITE_OK;
+    vfsc_zstd *pZstd = (vfsc_zstd*)pCtx;
+    ZSTD_freeCCtx(pZstd->pCCtx);
+    ZSTD_freeDCtx(pZstd->pDCtx);
+    sqlite3_free(pZstd);
+}
 
-	assert(pChunk != NULL);
-    if (pChunk->origSize > 0 && pChunk->state != Empty && pChunk->state != Cached)
+static int ZstdCompress(void *pCtx, int level, const char *pIn, int nIn, char *pOut, int nOut)
+{
+    vfsc_zstd *pZstd = (vfsc_zstd*)pCtx;
+    size_t n;
+
+    if (pZstd->pCCtx == NULL && (pZstd->pCCtx = ZSTD_createCCtx()) == NULL)
     {
-        if (pChunk->state == Uncompressed)
-        {
-            // Compress...
-            pChunk->compSize = Compress(pInfo->strmDeflate, pChunk->pOrigData, pChunk->origSize, pInfo->pCompData, pInfo->compDataSize);
-			pChunk->state = Unwritten;
-            vfsc_printf(pInfo, Compression, "Compressed %d into %d bytes from offset %lld.\n", pChunk->origSize, pChunk->compSize, pChunk->offset);
-        }
+        return -1;
+    }
 
-        // Write the chunk.
-        vfsc_printf(pInfo, Compression, "> %s.Flush(%s,n=%d,ofst=%lld)  Chunk=%lld",
-            pInfo->zVfsName, pFile->zFName, pChunk->compSize, pChunk->offset, pChunk->offset);
-        rc = pFile->pReal->pMethods->xWrite(pFile->pReal, pInfo->pCompData, ChunkSizeBytes, pChunk->offset);
-        vfsc_print_errcode(pInfo, Compression, " -> %s\n", rc);
+    n = ZSTD_compressCCtx(pZstd->pCCtx, pOut, nOut, pIn, nIn, level < 0 ? ZSTD_CLEVEL_DEFAULT : level);
+    return ZSTD_isError(n) ? -1 : (int)n;
+}
 
-#ifdef ENABLE_STATISTICS
-		++WriteCount;
-		WriteBytes += pChunk->compSize;
-#endif
+static int ZstdDecompress(void *pCtx, const char *pIn, int nIn, char *pOut, int nOut)
+{
+    vfsc_zstd *pZstd = (vfsc_zstd*)pCtx;
+    size_t n;
 
-		SetSparseRange(pFile->hFile, pChunk->offset + pChunk->compSize, ChunkSizeBytes - pChunk->compSize);
-        pChunk->state = Cached;
+    if (pZstd->pDCtx == NULL && (pZstd->pDCtx = ZSTD_createDCtx()) == NULL)
+    {
+        return -1;
+    }
 
-		vfsc_printf(pInfo, Trace, "> Sparse Range(%s, ofst=%lld, sz=%d)\n",
-					pFile->zFName, pChunk->offset + pChunk->compSize, ChunkSizeBytes - pChunk->compSize);
+    n = ZSTD_decompressDCtx(pZstd->pDCtx, pOut, nOut, pIn, nIn);
+    return ZSTD_isError(n) ? -1 : (int)n;
+}
 
-		FlushFileBuffers(pFile->hFile);
-		LogSparseFileSize(pFile);
-		LogSparseRanges(pFile);
+/*
+** The level of a dictionary is set when it's digested, see DictCreate.
+*/
+static int ZstdCompressDict(void *pCtx, const vfsc_dict *pDict, const char *pIn, int nIn, char *pOut, int nOut)
+{
+    vfsc_zstd *pZstd = (vfsc_zstd*)pCtx;
+    size_t n;
 
+    if (pZstd->pCCtx == NULL && (pZstd->pCCtx = ZSTD_createCCtx()) == NULL)
+    {
+        return -1;
     }
-    else
+
+    n = ZSTD_compress_usingCDict(pZstd->pCCtx, pOut, nOut, pIn, nIn, (const ZSTD_CDict*)pDict->pEncoder);
+    return ZSTD_isError(n) ? -1 : (int)n;
+}
+
+static int ZstdDecompressDict(void *pCtx, const vfsc_dict *pDict, const char *pIn, int nIn, char *pOut, int nOut)
+{
+    vfsc_zstd *pZstd = (vfsc_zstd*)pCtx;
+    size_t n;
+
+    if (pZstd->pDCtx == NULL && (pZstd->pDCtx = ZSTD_createDCtx()) == NULL)
     {
-        //vfsc_printf(pInfo, Trace, "> SKIPPED %s.Flush(%s,n=%d,ofst=%lld)\n",
-            //pInfo->zVfsName, pFile->zFName, pChunk->compSize, pChunk->offset);
+        return -1;
     }
 
-    return rc;
+    n = ZSTD_decompress_usingDDict(pZstd->pDCtx, pOut, nOut, pIn, nIn, (const ZSTD_DDict*)pDict->pDecoder);
+    return ZSTD_isError(n) ? -1 : (int)n;
 }
+#endif /* VFSC_ENABLE_ZSTD */
 
-static int FlushCache(vfsc_file *pFile)
+#ifdef VFSC_ENABLE_SNAPPY
+/*
+** The Snappy codec. It has no levels and no state.
+*/
+static int SnappyBound(int nByte)
+{
+    return (int)snappy_max_compressed_length(nByte);
+}
+
+static void *SnappyCreate(void)
+{
+    // Any non-NULL context will do.
+    static int context;
+    return &context;
+}
+
+static void SnappyDestroy(void *pCtx)
+{
+    UNUSED_PARAMETER(pCtx);
+}
+
+static int SnappyCompress(void *pCtx, int level, const char *pIn, int nIn, char *pOut, int nOut)
+{
+    size_t n = nOut;
+    UNUSED_PARAMETER(pCtx);
+    UNUSED_PARAMETER(level);
+    return snappy_compress(pIn, nIn, pOut, &n) == SNAPPY_OK ? (int)n : -1;
+}
+
+static int SnappyDecompress(void *pCtx, const char *pIn, int nIn, char *pOut, int nOut)
+{
+    size_t n = nOut;
+    UNUSED_PARAMETER(pCtx);
+    return snappy_uncompress(pIn, nIn, pOut, &n) == SNAPPY_OK ? (int)n : -1;
+}
+#endif /* VFSC_ENABLE_SNAPPY */
+
+/*
+** The codecs, by index. The ones that aren't compiled in are zeroed,
+** and their chunks can't be read. The first one is the default.
+*/
+static const vfsc_compressor aCodec[CODEC_COUNT] = {
+    { 1, "zlib", ZlibBound, ZlibCreate, ZlibDestroy, ZlibCompress, ZlibDecompress },
+#ifdef VFSC_ENABLE_LZ4
+    { 2, "lz4", Lz4Bound, Lz4Create, Lz4Destroy, Lz4Compress, Lz4Decompress },
+#else
+    { 0 },
+#endif
+#ifdef VFSC_ENABLE_ZSTD
+    { 3, "zstd", ZstdBound, ZstdCreate, ZstdDestroy, ZstdCompress, ZstdDecompress,
+      ZstdCompressDict, ZstdDecompressDict },
+#else
+    { 0 },
+#endif
+#ifdef VFSC_ENABLE_SNAPPY
+    { 4, "snappy", SnappyBound, SnappyCreate, SnappyDestroy, SnappyCompress, SnappyDecompress },
+#else
+    { 0 },
+#endif
+};
+
+/*
+** Returns the index in aCodec of a codec by name, or -1 if it's unknown
+** or not compiled in.
+*/
+static int FindCodec(const char *zName)
 {
-    if (pFile->hFile != INVALID_HANDLE_VALUE)
+    int i;
+    for (i = 0; i < CODEC_COUNT; ++i)
     {
-        // Iterate over the complete cache and flush each chunk.
-		int i;
-        for (i = 0; i < CacheSize; ++i)
+        if (aCodec[i].id != 0 && sqlite3StrICmp(aCodec[i].zName, zName) == 0)
         {
-            int rc = FlushChunk(pFile, pFile->pInfo->pCache[i]);
-            if (rc != SQLITE_OK)
-            {
-                return rc;
-            }
+            return i;
         }
     }
-   
-    return SQLITE_OK;
+
+    return -1;
 }
 
-static int ReadCache(vfsc_file *pFile, sqlite_int64 chunkOffset, vfsc_chunk* pChunk)
+/*
+** Returns the context of a codec in pCodec, creating it if needed.
+*/
+static void *CodecContext(vfsc_codec *pCodec, int iCodec)
 {
-    int rc = pFile->pReal->pMethods->xRead(pFile->pReal, pFile->pInfo->pCompData, ChunkSizeBytes, chunkOffset);
-    if (rc == SQLITE_IOERR_READ || rc == SQLITE_FULL)
+    if (pCodec->apCtx[iCodec] == NULL)
     {
-        return rc;
+        pCodec->apCtx[iCodec] = aCodec[iCodec].xCreate();
     }
 
-#ifdef ENABLE_STATISTICS
-	++ReadCount;
-	ReadBytes += ChunkSizeBytes;
-#endif
+    return pCodec->apCtx[iCodec];
+}
 
-    if (pFile->pInfo->pCompData[0] == 0)
+/*
+** Creates a dictionary from its stored form, or the marker of a dropped
+** one if nData is 0. Returns NULL if out of memory, or if the data isn't
+** a dictionary or dictionaries aren't compiled in.
+*/
+static vfsc_dict *DictCreate(const char *pData, int nData, int level)
+{
+    vfsc_dict *pDict = (vfsc_dict*)sqlite3_malloc(sizeof(vfsc_dict) + nData);
+    if (pDict == NULL)
     {
-        // The first byte should contain the length, hence can't be zero for compressed streams.
-        pChunk->compSize = 0;
-        pChunk->origSize = 0;
-        pChunk->state = Empty;
-        //memset(pChunk->pCompData, 0, ChunkSizeBytes);
+        return NULL;
     }
-    else
+
+    memset(pDict, 0, sizeof(vfsc_dict));
+    pDict->pData = (char*)&pDict[1];
+    pDict->nData = nData;
+    pDict->level = level;
+    if (nData == 0)
     {
-        pChunk->compSize = ChunkSizeBytes; //TODO: Check if we read less.
-		pChunk->origSize = Decompress(pFile->pInfo->strmInflate, pFile->pInfo->pCompData, &pChunk->compSize, pChunk->pOrigData, ChunkSizeBytes);
-        pChunk->state = Cached;
-        vfsc_printf(pFile->pInfo, Compression, "> Decompressed %d bytes from offset %d.\n", pChunk->origSize, chunkOffset);
+        return pDict;
     }
 
-    pChunk->offset = chunkOffset;
-    memset(pChunk->pOrigData + pChunk->origSize, 0, ChunkSizeBytes - pChunk->origSize);
+    memcpy(pDict->pData, pData, nData);
+#ifdef VFSC_ENABLE_ZSTD
+    pDict->id = ZDICT_getDictID(pData, nData);
+    pDict->pEncoder = ZSTD_createCDict(pData, nData, level < 0 ? ZSTD_CLEVEL_DEFAULT : level);
+    pDict->pDecoder = ZSTD_createDDict(pData, nData);
+    if (pDict->id != 0 && pDict->pEncoder != NULL && pDict->pDecoder != NULL)
+    {
+        return pDict;
+    }
 
-    return rc;
+    ZSTD_freeCDict((ZSTD_CDict*)pDict->pEncoder);
+    ZSTD_freeDDict((ZSTD_DDict*)pDict->pDecoder);
+#endif
+
+    sqlite3_free(pDict);
+    return NULL;
 }
 
 /*
-** Moves a cached chunk at index ahead by one position.
+** Frees a list of dictionaries.
 */
-static void MtfCachedChunk(vfsc_info *pInfo, int index)
+static void DictFree(vfsc_dict *pDict)
 {
-	assert(index >= 0 && index < CacheSize);
-    if (index > 0 && index < CacheSize)
+    while (pDict != NULL)
     {
-        // Swap the target with the one ahead of it.
-        vfsc_chunk *temp = pInfo->pCache[index - 1];
-        pInfo->pCache[index - 1] = pInfo->pCache[index];
-        pInfo->pCache[index] = temp;
+        vfsc_dict *pNext = pDict->pNext;
+#ifdef VFSC_ENABLE_ZSTD
+        ZSTD_freeCDict((ZSTD_CDict*)pDict->pEncoder);
+        ZSTD_freeDDict((ZSTD_DDict*)pDict->pDecoder);
+#endif
+        sqlite3_free(pDict);
+        pDict = pNext;
     }
 }
 
 /*
-** Finds the chunk in cache or reads from disk.
+** Compresses nIn bytes with the codec, level and current dictionary of
+** pCodec, setting *pDictId to the id of the dictionary used, or 0.
+** Returns the compressed size, or -1 on failure.
 */
-static int GetCache(vfsc_file *pFile, sqlite_int64 chunkOffset, vfsc_chunk** pChunk)
+static int EncodeBlock(vfsc_codec *pCodec, const char *pIn, int nIn, char *pOut, int nOut, u32 *pDictId)
 {
-    int i;
-    int index = -1;
-    vfsc_info *pInfo = pFile->pInfo;
-    
-#ifdef ENABLE_STATISTICS
-	++TotalHits;
-#endif
+    const vfsc_compressor *pCompressor = &aCodec[pCodec->codec];
+    const vfsc_dict *pDict = pCodec->pDict;
+    void *pCtx = CodecContext(pCodec, pCodec->codec);
+
+    *pDictId = 0;
+    if (pCtx == NULL || nOut <= 0)
+    {
+        return -1;
+    }
+
+    if (pDict != NULL && pDict->id != 0 && pCompressor->xCompressDict != NULL)
+    {
+        *pDictId = pDict->id;
+        return pCompressor->xCompressDict(pCtx, pDict, pIn, nIn, pOut, nOut);
+    }
+
+    return pCompressor->xCompress(pCtx, pCodec->level, pIn, nIn, pOut, nOut);
+}
+
+/*
+** Compresses a block like EncodeBlock, or copies it as is if that saves
+** less than 1/CHUNK_RAW_SAVING of it and it's at least CHUNK_RAW_PROBE
+** bytes, or if the level of pCodec is 0, setting *pIsRaw. One that was raw
+** before (probe) is compressed only if its first bytes shrink.
+** Returns the stored size, or -1 on failure.
+*/
+static int PackBlock(vfsc_codec *pCodec, int probe, const char *pIn, int nIn, char *pOut, int nOut, u32 *pDictId, int *pIsRaw)
+{
+    int isRaw = 0;
+    int n;
 
-    for (i = 0; i < CacheSize; ++i)
+    if (pCodec->level == 0)
     {
-        if (pInfo->pCache[i]->offset == chunkOffset)
+        // The policy of the chunk is not to compress it.
+        isRaw = 1;
+    }
+    else if (nIn < CHUNK_RAW_PROBE)
+    {
+        *pIsRaw = 0;
+        return EncodeBlock(pCodec, pIn, nIn, pOut, nOut, pDictId);
+    }
+    else if (probe && nIn > CHUNK_RAW_PROBE)
+    {
+        n = EncodeBlock(pCodec, pIn, CHUNK_RAW_PROBE, pOut, nOut, pDictId);
+        if (n < 0)
         {
-            // Found.
-#ifdef ENABLE_STATISTICS
-		++CacheHits;
-#endif
-			vfsc_printf(pFile->pInfo, Trace, "> Cache hit @ %lld (block #%d).\n", chunkOffset, i);
-            *pChunk = pInfo->pCache[i];
-            MtfCachedChunk(pInfo, i);
-            return SQLITE_OK;
+            return -1;
         }
 
-		if (index < 0 && pInfo->pCache[i]->state == Empty)
+        isRaw = n > CHUNK_RAW_PROBE - CHUNK_RAW_PROBE / CHUNK_RAW_SAVING;
+    }
+
+    if (!isRaw || nIn > nOut)
+    {
+        // Compressed anyway if there's no room for it raw.
+        n = EncodeBlock(pCodec, pIn, nIn, pOut, nOut, pDictId);
+        if (n < 0 || n <= nIn - nIn / CHUNK_RAW_SAVING || nIn > nOut)
         {
-			// The first free cache.
-            index = i;
+            *pIsRaw = 0;
+            return n;
         }
     }
 
-    // Not cached. If we have no free blocks, free-up one.
-    if (index < 0)
+    memcpy(pOut, pIn, nIn);
+    *pIsRaw = 1;
+    return nIn;
+}
+
+/*
+** Compresses a chunk with the codec and the current dictionary of pCodec
+** into pOut, header included. Chunks of more than one block of
+** 1 << blockShift bytes are compressed in blocks, see CHUNK_FLAG_BLOCKS.
+** If pRaw isn't NULL, the blocks that don't compress are stored raw, and
+** *pRaw has the blocks stored raw before on input (see PackBlock), and
+** those stored raw now on output, bit i for block i, or bit 0 for a chunk
+** not in blocks.
+** Returns the total size, or -1 on failure.
+*/
+static int EncodeChunk(vfsc_codec *pCodec, int blockShift, u32 *pRaw, const char *pIn, int nIn, char *pOut, int nOut)
+{
+    unsigned char *aHdr = (unsigned char*)pOut;
+    u32 probe = pRaw != NULL ? *pRaw : 0;
+    u32 raw = 0;
+    u32 dictId = 0;
+    int isRaw = 0;
+    int n;
+
+    if (nOut <= CHUNK_HEADER_SIZE)
+    {
+        return -1;
+    }
+
+    memset(aHdr, 0, CHUNK_HEADER_SIZE);
+    if (blockShift > 0 && nIn > (1 << blockShift))
     {
-		vfsc_printf(pFile->pInfo, Trace, "> Cache miss @ %lld.\n", chunkOffset);
+        // The sizes of the blocks, then the blocks.
+        int blockSize = 1 << blockShift;
+        int nBlock = (nIn + blockSize - 1) >> blockShift;
+        int i;
 
-        // Flush the last entry since we'll remove it to make room.
-        FlushChunk(pFile, pInfo->pCache[CacheSize - 1]);
+        n = 4 * nBlock;
+        if (nBlock > CHUNK_MAX_BLOCKS || n >= nOut - CHUNK_HEADER_SIZE)
+        {
+            return -1;
+        }
+
+        for (i = 0; i < nBlock; ++i)
+        {
+            const char *pBlock = pIn + i * blockSize;
+            char *pBlockOut = pOut + CHUNK_HEADER_SIZE + n;
+            int nBlockIn = MIN(blockSize, nIn - i * blockSize);
+            int nBlockOut = nOut - CHUNK_HEADER_SIZE - n;
+            int nBlockComp = pRaw != NULL ? PackBlock(pCodec, (probe >> i) & 1, pBlock, nBlockIn, pBlockOut, nBlockOut, &dictId, &isRaw)
+                                          : EncodeBlock(pCodec, pBlock, nBlockIn, pBlockOut, nBlockOut, &dictId);
+            if (nBlockComp < 0)
+            {
+                return -1;
+            }
 
-        // Move the last to the next-to-last position.
-        MtfCachedChunk(pInfo, CacheSize - 1);
+            sqlite3Put4byte(&aHdr[CHUNK_HEADER_SIZE + 4 * i], nBlockComp | (isRaw ? CHUNK_BLOCK_RAW : 0));
+            raw |= (u32)isRaw << i;
+            n += nBlockComp;
+        }
 
-        // New target is the next-to-last.
-        index = CacheSize - 2;
-		if (index < 0)
-		{
-			index = 0;
-		}
+        aHdr[2] = CHUNK_FLAG_BLOCKS;
+        aHdr[3] = (unsigned char)blockShift;
+    }
+    else
+    {
+        n = pRaw != NULL ? PackBlock(pCodec, probe & 1, pIn, nIn, pOut + CHUNK_HEADER_SIZE, nOut - CHUNK_HEADER_SIZE, &dictId, &isRaw)
+                         : EncodeBlock(pCodec, pIn, nIn, pOut + CHUNK_HEADER_SIZE, nOut - CHUNK_HEADER_SIZE, &dictId);
+        if (n < 0)
+        {
+            return -1;
+        }
+
+        if (isRaw)
+        {
+            aHdr[2] = CHUNK_FLAG_RAW;
+            dictId = 0;
+            raw = 1;
+        }
+    }
+
+    if (pRaw != NULL)
+    {
+        *pRaw = raw;
     }
 
-    // Cache the target chunk.
-    *pChunk = pInfo->pCache[index];
-	vfsc_printf(pFile->pInfo, Trace, "> Cache load @ %lld (block #%d).\n", chunkOffset, index);
-    return ReadCache(pFile, chunkOffset, pInfo->pCache[index]);
+    aHdr[0] = CHUNK_MAGIC;
+    aHdr[1] = (unsigned char)aCodec[pCodec->codec].id;
+    sqlite3Put4byte(&aHdr[4], n);
+    sqlite3Put4byte(&aHdr[8], nIn);
+    sqlite3Put4byte(&aHdr[12], dictId);
+    return CHUNK_HEADER_SIZE + n;
 }
 
 /*
-** Close an vfsc-file.
+** Decompresses a block of the chunk whose header is aHdr, with the codec
+** and the dictionary the header names.
+** Returns the uncompressed size, or -1 if the codec isn't compiled in, or
+** the dictionary isn't one of pCodec.
 */
-static int vfscClose(sqlite3_file *pFile){
-  vfsc_file *p = (vfsc_file *)pFile;
-  vfsc_info *pInfo = p->pInfo;
-  int rc;
-  int i;
+static int DecodeBlock(vfsc_codec *pCodec, const unsigned char *aHdr, const char *pIn, int nIn, char *pOut, int nOut)
+{
+    u32 dictId = sqlite3Get4byte(&aHdr[12]);
+    const vfsc_dict *pDict = pCodec->pDict;
+    void *pCtx;
+    int i;
 
-  if (p->hFile != INVALID_HANDLE_VALUE)
-  {
-	  FlushCache(p);
-	  FlushFileBuffers(p->hFile);
-	  for (i = 0; i < CacheSize; ++i)
-	  {
-		sqlite3_free((void*)pInfo->pCache[i]->pOrigData);
-		pInfo->pCache[i] = NULL;
-	  }
+    for (i = 0; i < CODEC_COUNT && (aHdr[1] == 0 || aCodec[i].id != aHdr[1]); ++i);
+    while (dictId != 0 && pDict != NULL && pDict->id != dictId)
+    {
+        pDict = pDict->pNext;
+    }
 
-	  sqlite3_free(pInfo->pCacheChunks);
-  }
-  
-  if (CompressionLevel != 0 &&
-	  (p->flags & 0xFFFFFF00) == SQLITE_OPEN_MAIN_DB)
-  {
-	(void)deflateEnd(&pInfo->strmDeflate);
-	(void)inflateEnd(&pInfo->strmInflate);
-  }
+    pCtx = i < CODEC_COUNT ? CodecContext(pCodec, i) : NULL;
+    if (pCtx != NULL && dictId == 0)
+    {
+        return aCodec[i].xDecompress(pCtx, pIn, nIn, pOut, nOut);
+    }
+    else if (pCtx != NULL && pDict != NULL && aCodec[i].xDecompressDict != NULL)
+    {
+        return aCodec[i].xDecompressDict(pCtx, pDict, pIn, nIn, pOut, nOut);
+    }
 
-#ifdef ENABLE_STATISTICS
-  if ((p->flags & 0xFFFFFF00) == SQLITE_OPEN_MAIN_DB)
-  {
-    LARGE_INTEGER liSparseFileSize;
-    LARGE_INTEGER liSparseFileCompressedSize =
-			GetSparseFileSize(p->hFile, p->zFName, &liSparseFileSize);
-
-    vfsc_printf(pInfo, Registeration, "Compression Chunk Size: %d KBytes, Level: %d, Cache: %d Chunks.\n", ChunkSizeBytes / 1024, CompressionLevel, CacheSize);
-    vfsc_printf(pInfo, Registeration, "Cache Hits: %d, Cache Misses: %d, Total: %d, Ratio: %.3f%%\n", CacheHits, TotalHits - CacheHits, TotalHits, 100.0 * CacheHits / (double)TotalHits);
-    vfsc_printf(pInfo, Registeration, "Compressed: %lld KBytes in %d Chunks, Decompressed: %lld KBytes in %d Chunks\n", CompressBytes / 1024, CompressCount, DecompressBytes / 1024, DecompressCount);
-    vfsc_printf(pInfo, Registeration, "Wrote: %lld KBytes in %d Chunks, Read: %lld KBytes in %d Chunks\n", WriteBytes / 1024, WriteCount, ReadBytes / 1024, ReadCount);
-    vfsc_printf(pInfo, Registeration, "File total size: %lld KB (%lld chunks), Actual size on disk: %lld KB, Compression Ratio: %.2f%%\n",
-		liSparseFileSize.QuadPart / 1024,
-		liSparseFileSize.QuadPart / ChunkSizeBytes,
-        liSparseFileCompressedSize.QuadPart / 1024,
-        100.0 * liSparseFileCompressedSize.QuadPart / (double)liSparseFileSize.QuadPart);
-  }
-#endif
-
-  vfsc_printf(pInfo, OpenClose, "%s.xClose(%s)", pInfo->zVfsName, p->zFName);
-  CloseHandle(p->hFile);
-  p->hFile = INVALID_HANDLE_VALUE;
-  rc = p->pReal->pMethods->xClose(p->pReal);
-  vfsc_print_errcode(pInfo, OpenClose, " -> %s\n", rc);
-  if( rc==SQLITE_OK ){
-    sqlite3_free((void*)p->base.pMethods);
-    p->base.pMethods = 0;
-  }
-
-  return rc;
-}
+    return -1;
+}
 
 /*
-** Read data from an vfsc-file.
+** Decompresses, or copies if raw, the blocks in mask, bit i for block i,
+** of a chunk written in blocks into pOut, which has room for the whole chunk. The chunk must
+** have been read whole.
+** Returns 0, or -1 if it's corrupt or can't be decoded.
 */
-static int vfscRead(
-  sqlite3_file *pFile,
-  void *zBuf,
-  int iAmt,
-  sqlite_int64 iOfst
-){
-  vfsc_file *p = (vfsc_file *)pFile;
-  vfsc_info *pInfo = p->pInfo;
-  int rc = 0;
-  sqlite_int64 chunkOffset;
+static int DecodeBlocks(vfsc_codec *pCodec, const char *pIn, char *pOut, u32 mask)
+{
+    const unsigned char *aHdr = (const unsigned char*)pIn;
+    int nComp = (int)sqlite3Get4byte(&aHdr[4]);
+    int nOrig = (int)sqlite3Get4byte(&aHdr[8]);
+    int blockShift = aHdr[3];
+    int blockSize;
+    int nBlock;
+    int offset;
+    int i;
 
-  if (p->hFile != INVALID_HANDLE_VALUE)
-  {
-      vfsc_chunk *pChunk;
-      chunkOffset = iOfst - (iOfst % ChunkSizeBytes);
-      rc = GetCache(p, chunkOffset, &pChunk);
+    if (blockShift < CHUNK_BLOCK_SHIFT || blockShift > 30 || nComp < 0 || nOrig < 0)
+    {
+        return -1;
+    }
+
+    blockSize = 1 << blockShift;
+    nBlock = (int)(((sqlite3_int64)nOrig + blockSize - 1) >> blockShift);
+    offset = CHUNK_HEADER_SIZE + 4 * nBlock;
+    if (nBlock > CHUNK_MAX_BLOCKS || offset > CHUNK_HEADER_SIZE + nComp)
+    {
+        return -1;
+    }
 
-      // Copy the data from the cache.
-	  assert(iAmt <= ChunkSizeBytes - (iOfst % ChunkSizeBytes));
-      memcpy(zBuf, pChunk->pOrigData + (iOfst % ChunkSizeBytes), iAmt);
+    for (i = 0; i < nBlock; ++i)
+    {
+        u32 entry = sqlite3Get4byte(&aHdr[CHUNK_HEADER_SIZE + 4 * i]);
+        int nBlockComp = (int)(entry & ~(u32)CHUNK_BLOCK_RAW);
+        int nBlockOrig = MIN(blockSize, nOrig - i * blockSize);
+        if (nBlockComp > CHUNK_HEADER_SIZE + nComp - offset ||
+            ((entry & CHUNK_BLOCK_RAW) != 0 && nBlockComp != nBlockOrig))
+        {
+            return -1;
+        }
 
-      vfsc_printf(pInfo, IoOps, "> %s.xRead(%s,n=%d,ofst=%lld)  Chunk=%lld",
-					pInfo->zVfsName, p->zFName, iAmt, iOfst, chunkOffset);
-      vfsc_print_errcode(pInfo, IoOps, " -> %s\n", rc);
-  }
-  else
-  {
-      vfsc_printf(pInfo, IoOps, "%s.xRead(%s,n=%d,ofst=%lld)",
-          pInfo->zVfsName, p->zFName, iAmt, iOfst);
-      rc = p->pReal->pMethods->xRead(p->pReal, zBuf, iAmt, iOfst);
-      vfsc_print_errcode(pInfo, IoOps, " -> %s\n", rc);
-  
-#ifdef ENABLE_STATISTICS
-	++ReadCount;
-	ReadBytes += iAmt;
-#endif
-  }
+        if ((mask & (1u << i)) != 0 && (entry & CHUNK_BLOCK_RAW) != 0)
+        {
+            memcpy(pOut + i * blockSize, pIn + offset, nBlockOrig);
+        }
+        else if ((mask & (1u << i)) != 0 &&
+                 DecodeBlock(pCodec, aHdr, pIn + offset, nBlockComp, pOut + i * blockSize, nBlockOrig) != nBlockOrig)
+        {
+            return -1;
+        }
 
-  return rc;
+        offset += nBlockComp;
+    }
+
+    return 0;
 }
 
 /*
-** Write data to an vfsc-file.
+** Decompresses a chunk written by EncodeChunk, or a bare zlib stream.
+** Sets *pnIn to the size of the compressed chunk.
+** Returns the uncompressed size, or -1 if the chunk is corrupt, or its
+** codec isn't compiled in, or its dictionary isn't one of pCodec.
 */
-static int vfscWrite(
-  sqlite3_file *pFile,
-  const void *zBuf,
-  int iAmt,
-  sqlite_int64 iOfst
-){
-  vfsc_file *p = (vfsc_file *)pFile;
-  vfsc_info *pInfo = p->pInfo;
-  int rc = SQLITE_OK;
-  sqlite_int64 chunkOffset;
-
-  if (p->hFile != INVALID_HANDLE_VALUE)
-  {
-      // Get the cache chunk.
-      vfsc_chunk *pChunk;
-      int offsetInChunk = iOfst % ChunkSizeBytes;
-      chunkOffset = iOfst - offsetInChunk;
-      GetCache(p, chunkOffset, &pChunk);
-
-      // Write the new data.
-      memcpy(pChunk->pOrigData + offsetInChunk, zBuf, iAmt);
-      pChunk->state = Uncompressed;
-      pChunk->origSize = max(pChunk->origSize, offsetInChunk + iAmt);
-      if (pChunk->origSize > ChunkSizeBytes)
-      {
-          printf("ERROR: CHUNK OVERRUN!!!!\n");
-          exit(1);
-      }
+static int DecodeChunk(vfsc_codec *pCodec, const char *pIn, int *pnIn, char *pOut, int nOut)
+{
+    const unsigned char *aHdr = (const unsigned char*)pIn;
+    int nIn = *pnIn;
+    int n = -1;
 
-      vfsc_printf(pInfo, IoOps, "> %s.xWrite(%s,n=%d,ofst=%lld)  Chunk=%lld, Data=%d bytes",
-          pInfo->zVfsName, p->zFName, iAmt, iOfst, chunkOffset, pChunk->origSize);
-      vfsc_print_errcode(pInfo, IoOps, " -> %s\n", rc);
-  }
-  else
-  {
-      vfsc_printf(pInfo, IoOps, "%s.xWrite(%s,n=%d,ofst=%lld)",
-          pInfo->zVfsName, p->zFName, iAmt, iOfst);
-      rc = p->pReal->pMethods->xWrite(p->pReal, zBuf, iAmt, iOfst);
-      vfsc_print_errcode(pInfo, IoOps, " -> %s\n", rc);
+    if (nIn > 0 && aHdr[0] != CHUNK_MAGIC)
+    {
+        // A chunk from before the codecs.
+        void *pCtx = CodecContext(pCodec, 0);
+        n = pCtx != NULL ? ZlibInflate(pCtx, pIn, pnIn, pOut, nOut) : -1;
+    }
+    else if (nIn >= CHUNK_HEADER_SIZE)
+    {
+        int nComp = (int)sqlite3Get4byte(&aHdr[4]);
+        int nOrig = (int)sqlite3Get4byte(&aHdr[8]);
+        if (nComp >= 0 && nComp <= nIn - CHUNK_HEADER_SIZE && nOrig >= 0 && nOrig <= nOut)
+        {
+            if ((aHdr[2] & CHUNK_FLAG_BLOCKS) != 0)
+            {
+                n = DecodeBlocks(pCodec, pIn, pOut, ~(u32)0) == 0 ? nOrig : -1;
+            }
+            else if ((aHdr[2] & CHUNK_FLAG_RAW) != 0)
+            {
+                n = nComp == nOrig ? nOrig : -1;
+                memcpy(pOut, pIn + CHUNK_HEADER_SIZE, MAX(n, 0));
+            }
+            else
+            {
+                n = DecodeBlock(pCodec, aHdr, pIn + CHUNK_HEADER_SIZE, nComp, pOut, nOrig);
+            }
 
-#ifdef ENABLE_STATISTICS
-	++WriteCount;
-	WriteBytes += iAmt;
-#endif
-  }
+            *pnIn = CHUNK_HEADER_SIZE + nComp;
+        }
+    }
 
-  return rc;
+    return n;
 }
 
 /*
-** Truncate an vfsc-file.
+** Statistics.
+**
+** The counters of a database are in its aStatus, indexed by the
+** SQLITE_COMPRESS_STATUS values. They're added to atomically, since the
+** workers compress and decompress without the database mutex, except the
+** highwaters of the gauges, which are kept under it.
 */
-static int vfscTruncate(sqlite3_file *pFile, sqlite_int64 size){
-  vfsc_file *p = (vfsc_file *)pFile;
-  vfsc_info *pInfo = p->pInfo;
-  int rc;
-  vfsc_printf(pInfo, NonIoOps, "%s.xTruncate(%s,%lld)", pInfo->zVfsName, p->zFName,
-                  size);
-  rc = p->pReal->pMethods->xTruncate(p->pReal, size);
-  vfsc_printf(pInfo, NonIoOps, " -> %d\n", rc);
-  return rc;
-}
+#ifdef ENABLE_STATISTICS
+# define StatTimer()            GetTimerMicros()
+#else
+# define StatTimer()            0
+#endif
 
 /*
-** Sync an vfsc-file.
+** Returns the latency histogram bucket of a duration in microseconds.
 */
-static int vfscSync(sqlite3_file *pFile, int flags){
-  vfsc_file *p = (vfsc_file *)pFile;
-  vfsc_info *pInfo = p->pInfo;
-  int rc;
-  int i;
-  char zBuf[100];
-
-  FlushCache(p);
+static int LatencyBucket(sqlite3_int64 us)
+{
+    int i = 0;
+    while (us > 0 && i < SQLITE_COMPRESS_LATENCY_BUCKETS - 1)
+    {
+        us >>= 1;
+        ++i;
+    }
 
-  memcpy(zBuf, "|0", 3);
-  i = 0;
-  if( flags & SQLITE_SYNC_FULL )        strappend(zBuf, &i, "|FULL");
-  else if( flags & SQLITE_SYNC_NORMAL ) strappend(zBuf, &i, "|NORMAL");
-  if( flags & SQLITE_SYNC_DATAONLY )    strappend(zBuf, &i, "|DATAONLY");
-  if( flags & ~(SQLITE_SYNC_FULL|SQLITE_SYNC_DATAONLY) ){
-    sqlite3_snprintf(sizeof(zBuf)-i, &zBuf[i], "|0x%x", flags);
-  }
-  vfsc_printf(pInfo, NonIoOps, "%s.xSync(%s,%s)", pInfo->zVfsName, p->zFName,
-                  &zBuf[1]);
-  rc = p->pReal->pMethods->xSync(p->pReal, flags);
-  vfsc_printf(pInfo, NonIoOps, " -> %d\n", rc);
-  return rc;
+    return i;
 }
 
 /*
-** Return the current file-size of an vfsc-file.
+** Counts nIn bytes compressed into nOut since start, a StatTimer time.
+** nOut is negative if they didn't compress.
 */
-static int vfscFileSize(sqlite3_file *pFile, sqlite_int64 *pSize){
-  vfsc_file *p = (vfsc_file *)pFile;
-  vfsc_info *pInfo = p->pInfo;
-  int rc;
-  vfsc_printf(pInfo, NonIoOps, "%s.xFileSize(%s)", pInfo->zVfsName, p->zFName);
-  rc = p->pReal->pMethods->xFileSize(p->pReal, pSize);
-  vfsc_print_errcode(pInfo, NonIoOps, " -> %s,", rc);
-  vfsc_printf(pInfo, NonIoOps, " size=%lld\n", *pSize);
-  return rc;
+static void StatCompress(vfsc_db *pDb, int nIn, int nOut, sqlite3_int64 start)
+{
+#ifdef ENABLE_STATISTICS
+    sqlite3_int64 us = GetTimerMicros() - start;
+    int ratio = nOut < 0 || nOut >= nIn ? SQLITE_COMPRESS_RATIO_BUCKETS - 1 : (int)((sqlite3_int64)nOut * 10 / nIn);
+
+    AtomicAdd(pDb->aStatus[SQLITE_COMPRESS_STATUS_COMPRESSED], 1);
+    AtomicAdd(pDb->aStatus[SQLITE_COMPRESS_STATUS_COMPRESSED_IN], nIn);
+    AtomicAdd(pDb->aStatus[SQLITE_COMPRESS_STATUS_COMPRESSED_OUT], nOut < 0 ? nIn : nOut);
+    AtomicAdd(pDb->aStatus[SQLITE_COMPRESS_STATUS_COMPRESS_TIME], us);
+    AtomicAdd(pDb->aStatus[SQLITE_COMPRESS_STATUS_RATIO_HISTOGRAM + ratio], 1);
+    AtomicAdd(pDb->aStatus[SQLITE_COMPRESS_STATUS_COMPRESS_HISTOGRAM + LatencyBucket(us)], 1);
+#endif
 }
 
 /*
-** Return the name of a lock.
+** Counts nIn bytes decompressed into nOut since start, a StatTimer time.
 */
-static const char *lockName(int eLock){
-  const char *azLockNames[] = {
-     "NONE", "SHARED", "RESERVED", "PENDING", "EXCLUSIVE"
-  };
-  if( eLock<0 || eLock>=sizeof(azLockNames)/sizeof(azLockNames[0]) ){
-    return "???";
-  }else{
-    return azLockNames[eLock];
-  }
-}
+static void StatDecompress(vfsc_db *pDb, int nIn, int nOut, sqlite3_int64 start)
+{
+#ifdef ENABLE_STATISTICS
+    sqlite3_int64 us = GetTimerMicros() - start;
 
-/*
-** Lock an vfsc-file.
-*/
-static int vfscLock(sqlite3_file *pFile, int eLock){
-  vfsc_file *p = (vfsc_file *)pFile;
-  vfsc_info *pInfo = p->pInfo;
-  int rc;
-  vfsc_printf(pInfo, NonIoOps, "%s.xLock(%s,%s)", pInfo->zVfsName, p->zFName,
-                  lockName(eLock));
-  rc = p->pReal->pMethods->xLock(p->pReal, eLock);
-  vfsc_print_errcode(pInfo, NonIoOps, " -> %s\n", rc);
-  return rc;
+    AtomicAdd(pDb->aStatus[SQLITE_COMPRESS_STATUS_DECOMPRESSED], 1);
+    AtomicAdd(pDb->aStatus[SQLITE_COMPRESS_STATUS_DECOMPRESSED_IN], nIn);
+    AtomicAdd(pDb->aStatus[SQLITE_COMPRESS_STATUS_DECOMPRESSED_OUT], nOut);
+    AtomicAdd(pDb->aStatus[SQLITE_COMPRESS_STATUS_DECOMPRESS_TIME], us);
+    AtomicAdd(pDb->aStatus[SQLITE_COMPRESS_STATUS_DECOMPRESS_HISTOGRAM + LatencyBucket(us)], 1);
+#endif
 }
 
 /*
-** Unlock an vfsc-file.
+** Returns the number of dirty chunks in cache, and keeps their highwater.
+** The caller must hold the database mutex.
 */
-static int vfscUnlock(sqlite3_file *pFile, int eLock){
-  vfsc_file *p = (vfsc_file *)pFile;
-  vfsc_info *pInfo = p->pInfo;
-  int rc;
-  vfsc_printf(pInfo, NonIoOps, "%s.xUnlock(%s,%s)", pInfo->zVfsName, p->zFName,
-                  lockName(eLock));
-  rc = p->pReal->pMethods->xUnlock(p->pReal, eLock);
-  vfsc_print_errcode(pInfo, NonIoOps, " -> %s\n", rc);
-  return rc;
+static int StatDirty(vfsc_db *pDb)
+{
+    vfsc_chunk *pChunk;
+    int nDirty = 0;
+
+    for (pChunk = pDb->pLruFirst; pChunk != NULL; pChunk = pChunk->pLruNext)
+    {
+        if (pChunk->state == Uncompressed || pChunk->state == Unwritten)
+        {
+            ++nDirty;
+        }
+    }
+
+    pDb->aStatus[SQLITE_COMPRESS_STATUS_CACHE_DIRTY] = MAX(pDb->aStatus[SQLITE_COMPRESS_STATUS_CACHE_DIRTY], nDirty);
+    return nDirty;
 }
 
 /*
-** Check if another file-handle holds a RESERVED lock on an vfsc-file.
+** Binary trace.
+**
+** TraceStart returns the start time to give TraceEvent, which records an
+** event if the trace is on. When it's off, both only test TraceEnabled.
+** An operation that started before the trace was on isn't recorded.
 */
-static int vfscCheckReservedLock(sqlite3_file *pFile, int *pResOut){
-  vfsc_file *p = (vfsc_file *)pFile;
-  vfsc_info *pInfo = p->pInfo;
-  int rc;
-  vfsc_printf(pInfo, NonIoOps, "%s.xCheckReservedLock(%s,%d)",
-                  pInfo->zVfsName, p->zFName);
-  rc = p->pReal->pMethods->xCheckReservedLock(p->pReal, pResOut);
-  vfsc_print_errcode(pInfo, NonIoOps, " -> %s", rc);
-  vfsc_printf(pInfo, NonIoOps, ", out=%d\n", *pResOut);
-  return rc;
-}
+#define TraceStart()            (TraceEnabled ? GetTimerMicros() : 0)
+#define TraceEvent(pFile, op, offset, length, start, rc) \
+    do { if (TraceEnabled && (start) != 0) TraceRecord(pFile, op, offset, length, start, rc); } while (0)
 
 /*
-** File control method. For custom operations on an vfsc-file.
+** Adds an event to the ring, overwriting the oldest. The slot is claimed
+** atomically and its seq set last, so that TraceDump skips the events
+** being written. Only a writer lapped by another one, a whole ring of
+** events later, could garble its event.
 */
-static int vfscFileControl(sqlite3_file *pFile, int op, void *pArg){
-  vfsc_file *p = (vfsc_file *)pFile;
-  vfsc_info *pInfo = p->pInfo;
-  int rc;
-  char zBuf[100];
-  char *zOp;
-  switch( op ){
-    case SQLITE_FCNTL_LOCKSTATE:    zOp = "LOCKSTATE";          break;
-    case SQLITE_GET_LOCKPROXYFILE:  zOp = "GET_LOCKPROXYFILE";  break;
-    case SQLITE_SET_LOCKPROXYFILE:  zOp = "SET_LOCKPROXYFILE";  break;
-    case SQLITE_LAST_ERRNO:         zOp = "LAST_ERRNO";         break;
-    case SQLITE_FCNTL_SIZE_HINT: {
-      sqlite3_snprintf(sizeof(zBuf), zBuf, "SIZE_HINT,%lld",
-                       *(sqlite3_int64*)pArg);
-      zOp = zBuf;
-      break;
-    }
-    case SQLITE_FCNTL_CHUNK_SIZE: {
-      sqlite3_snprintf(sizeof(zBuf), zBuf, "CHUNK_SIZE,%d", *(int*)pArg);
-      zOp = zBuf;
-      break;
+static void TraceRecord(vfsc_file *pFile, int op, sqlite_int64 offset, int length, sqlite3_int64 start, int rc)
+{
+    sqlite3_int64 seq = AtomicAdd(TraceNext, 1);
+    vfsc_event *pEvent = &TraceRing[(seq - 1) & TraceMask];
+    vfsc_db *pDb = pFile->pDb;
+
+    pEvent->seq = 0;
+    AtomicBarrier();
+    pEvent->time = start;
+    pEvent->offset = offset;
+    pEvent->length = length;
+    if (op == TraceOpen)
+    {
+        pEvent->chunk = pFile->layout;
     }
-    case SQLITE_FCNTL_FILE_POINTER: zOp = "FILE_POINTER";       break;
-    case SQLITE_FCNTL_SYNC_OMITTED: {
-        FlushCache(p);
-        zOp = "SYNC_OMITTED";
-        break;
+    else if (pDb != NULL && (pFile->layout == LayoutSparse || pFile->layout == LayoutPacked))
+    {
+        pEvent->chunk = (int)(offset / pDb->chunkSize);
     }
-    case 0xca093fa0:                zOp = "DB_UNCHANGED";       break;
-    default: {
-      sqlite3_snprintf(sizeof zBuf, zBuf, "%d", op);
-      zOp = zBuf;
-      break;
+    else
+    {
+        pEvent->chunk = -1;
     }
-  }
-  vfsc_printf(pInfo, NonIoOps, "%s.xFileControl(%s,%s)",
-                  pInfo->zVfsName, p->zFName, zOp);
-  rc = p->pReal->pMethods->xFileControl(p->pReal, op, pArg);
-  vfsc_print_errcode(pInfo, NonIoOps, " -> %s\n", rc);
-  return rc;
+    pEvent->latency = (int)MIN(GetTimerMicros() - start, 0x7fffffff);
+    pEvent->op = (unsigned char)op;
+    pEvent->rc = (unsigned char)(rc & 0xff);
+    pEvent->file = (unsigned short)pFile->traceId;
+    AtomicBarrier();
+    pEvent->seq = seq;
 }
 
-/*
-** Return the sector-size in bytes for an vfsc-file.
-*/
+static
+void LogSparseFileSize(vfsc_file *pFile)
+{
+    sqlite3_int64 sparseFileSize;
+    sqlite3_int64 sparseFileCompressedSize;
+
+	if (pFile->hFile == VFSC_INVALID_HANDLE ||
+		pFile->pInfo->trace < Compression)
+	{
+		return;
+	}
+
+	sparseFileCompressedSize = GetSparseFileSize(pFile->hFile, pFile->zFName, &sparseFileSize);
+
+	// Print the result
+    vfsc_printf(pFile->pInfo, Compression, " > File total size: %lld KB, Actual size on disk: %lld KB, Compression Ratio: %.2f%%\n",
+		sparseFileSize / 1024,
+        sparseFileCompressedSize / 1024,
+        100.0 * sparseFileCompressedSize / (double)sparseFileSize);
+}
+
+#if SQLITE_OS_WIN
+
+static
+BOOL LogSparseRanges(vfsc_file *pFile)
+{
+	typedef struct _FILE_ALLOCATED_RANGE_BUFFER {
+	  LARGE_INTEGER FileOffset;
+	  LARGE_INTEGER Length;
+	} FILE_ALLOCATED_RANGE_BUFFER, *PFILE_ALLOCATED_RANGE_BUFFER;
+
+    LARGE_INTEGER liFileSize;
+    FILE_ALLOCATED_RANGE_BUFFER queryRange;
+    FILE_ALLOCATED_RANGE_BUFFER allocRanges[1024];
+    DWORD nbytes;
+    BOOL bFinished;
+	DWORD dwAllocRangeCount;
+	DWORD i;
+
+	if (pFile->hFile == VFSC_INVALID_HANDLE ||
+		pFile->pInfo->trace < Trace)
+    {
+		return FALSE;
+	}
+
+    GetFileSizeEx(pFile->hFile, &liFileSize);
+
+    // Range to be examined (the whole file)
+    queryRange.FileOffset.QuadPart = 0;
+    queryRange.Length = liFileSize;
+
+	vfsc_printf(pFile->pInfo, Trace, " Allocated ranges in the file:\n");
+    do
+    {
+#define FSCTL_QUERY_ALLOCATED_RANGES    CTL_CODE(FILE_DEVICE_FILE_SYSTEM, 51,  METHOD_NEITHER, FILE_READ_DATA)  // FILE_ALLOCATED_RANGE_BUFFER, FILE_ALLOCATED_RANGE_BUFFER
+
+        bFinished = DeviceIoControl(pFile->hFile, FSCTL_QUERY_ALLOCATED_RANGES, 
+            &queryRange, sizeof(queryRange), allocRanges, 
+            sizeof(allocRanges), &nbytes, NULL);
+
+        if (!bFinished)
+        {
+            DWORD dwError = GetLastError();
+
+            // ERROR_MORE_DATA is the only error that is normal
+            if (dwError != ERROR_MORE_DATA)
+            {
+                vfsc_printf(pFile->pInfo, Error, "DeviceIoControl failed w/err 0x%8lx\n", dwError);
+                return FALSE;
+            }
+        }
+
+        // Calculate the number of records returned
+        dwAllocRangeCount = nbytes / sizeof(FILE_ALLOCATED_RANGE_BUFFER);
+
+        // Print each allocated range
+        for (i = 0; i < dwAllocRangeCount; ++i)
+        {
+            vfsc_printf(pFile->pInfo, Trace, "  allocated range: [%lld]->[%lld] (%lld bytes)\n",
+					allocRanges[i].FileOffset.QuadPart,
+					allocRanges[i].FileOffset.QuadPart + allocRanges[i].Length.QuadPart,
+					allocRanges[i].Length.QuadPart);
+        }
+
+        // Set starting address and size for the next query
+        if (!bFinished && dwAllocRangeCount > 0)
+        {
+            queryRange.FileOffset.QuadPart = 
+                allocRanges[dwAllocRangeCount - 1].FileOffset.QuadPart + 
+                allocRanges[dwAllocRangeCount - 1].Length.QuadPart;
+            
+            queryRange.Length.QuadPart = liFileSize.QuadPart - 
+                queryRange.FileOffset.QuadPart;
+        }
+
+    }
+	while (!bFinished);
+
+    return TRUE;
+}
+
+
+#else /* SQLITE_OS_UNIX */
+
+static
+int LogSparseRanges(vfsc_file *pFile)
+{
+#if defined(SEEK_DATA) && defined(SEEK_HOLE)
+    struct stat buf;
+    off_t dataStart;
+    off_t dataEnd;
+
+	if (pFile->hFile == VFSC_INVALID_HANDLE ||
+		pFile->pInfo->trace < Trace)
+    {
+		return 0;
+	}
+
+    if (fstat(pFile->hFile, &buf) != 0)
+    {
+        return 0;
+    }
+
+	vfsc_printf(pFile->pInfo, Trace, " Allocated ranges in the file:\n");
+
+    // Walk the data ranges, each ends at the next hole (or EOF).
+    dataEnd = 0;
+    while (dataEnd < buf.st_size)
+    {
+        dataStart = lseek(pFile->hFile, dataEnd, SEEK_DATA);
+        if (dataStart < 0)
+        {
+            // ENXIO means no more data past dataEnd.
+            if (errno != ENXIO)
+            {
+                vfsc_printf(pFile->pInfo, Error, "lseek(SEEK_DATA) failed w/err %d\n", errno);
+                return 0;
+            }
+
+            break;
+        }
+
+        dataEnd = lseek(pFile->hFile, dataStart, SEEK_HOLE);
+        if (dataEnd < 0)
+        {
+            vfsc_printf(pFile->pInfo, Error, "lseek(SEEK_HOLE) failed w/err %d\n", errno);
+            return 0;
+        }
+
+        vfsc_printf(pFile->pInfo, Trace, "  allocated range: [%lld]->[%lld] (%lld bytes)\n",
+                (sqlite3_int64)dataStart,
+                (sqlite3_int64)dataEnd,
+                (sqlite3_int64)(dataEnd - dataStart));
+    }
+
+    return 1;
+#else
+    UNUSED_PARAMETER(pFile);
+    return 0;
+#endif
+}
+
+#endif /* SQLITE_OS_UNIX */
+
+/*
+** Packed Layout.
+**
+** Header slot (PACKED_SLOT_SIZE bytes, big-endian):
+**    0  16  Magic: PACKED_MAGIC
+**   16   4  Chunk size in bytes
+**   20   4  Flags: PACKED_FLAG_DICTIONARY, PACKED_FLAG_INDEX_BLOCKS and
+**           PACKED_FLAG_PAGES (a chunk per page, see PackedAdoptPageSize)
+**   24   8  Logical (uncompressed) file size
+**   32   8  Generation, the slot with the highest valid one is current
+**   40   8  Index (root) offset
+**   48   4  Index entries (chunks)
+**   52   4  Index (root) checksum (crc32)
+**   56   4  Header checksum (crc32 of bytes 0-55)
+**
+** With PACKED_FLAG_DICTIONARY, the dictionary the chunks are compressed
+** with follows (see TrainDictionary):
+**   60   8  Dictionary offset
+**   68   4  Dictionary size
+**   72   4  Dictionary id
+**   76   4  Dictionary checksum (crc32)
+**   80   4  Checksum of bytes 60-79 (crc32)
+**
+** Index entry (PACKED_INDEX_ENTRY_SIZE bytes), one per chunk:
+**    0   8  Extent offset, 0 if the chunk was never written
+**    8   4  Compressed size
+**   12   4  Uncompressed size
+**
+** With PACKED_FLAG_INDEX_BLOCKS the entries are stored in blocks of
+** PACKED_INDEX_BLOCK_ENTRIES, the last one possibly shorter, so that a
+** commit only writes the blocks of the chunks it changed. The root lists
+** the blocks, an entry of PACKED_INDEX_ENTRY_SIZE bytes each:
+**    0   8  Block offset
+**    8   4  Block checksum (crc32)
+**   12   4  Reserved, zero
+** Without it, older files, the index is a single array of entries.
+**
+** Extents are never overwritten while a durable header references them:
+** a flushed chunk and the index go to newly allocated space, and the old
+** extents are only reused after the next header write.
+** The free list isn't stored, it's rebuilt from the index on open.
+*/
+
+static sqlite_int64 Get8byte(const unsigned char *p)
+{
+    return (((sqlite_int64)sqlite3Get4byte(p)) << 32) | sqlite3Get4byte(p + 4);
+}
+
+static void Put8byte(unsigned char *p, sqlite_int64 v)
+{
+    sqlite3Put4byte(p, (u32)(v >> 32));
+    sqlite3Put4byte(p + 4, (u32)v);
+}
+
+/*
+** Adds a range to a sorted list, merging it with adjacent ranges.
+*/
+static int RangesAdd(vfsc_ranges *pList, sqlite_int64 offset, sqlite_int64 size)
+{
+    int i;
+
+    if (size <= 0)
+    {
+        return SQLITE_OK;
+    }
+
+    // Find the first range that starts after the new one.
+    for (i = 0; i < pList->n && pList->a[i].offset < offset; ++i)
+    {
+    }
+
+    // Merge with the previous and/or the next range.
+    if (i > 0 && pList->a[i - 1].offset + pList->a[i - 1].size == offset)
+    {
+        pList->a[i - 1].size += size;
+        if (i < pList->n && offset + size == pList->a[i].offset)
+        {
+            pList->a[i - 1].size += pList->a[i].size;
+            memmove(&pList->a[i], &pList->a[i + 1], (pList->n - i - 1) * sizeof(vfsc_range));
+            --pList->n;
+        }
+
+        return SQLITE_OK;
+    }
+
+    if (i < pList->n && offset + size == pList->a[i].offset)
+    {
+        pList->a[i].offset = offset;
+        pList->a[i].size += size;
+        return SQLITE_OK;
+    }
+
+    if (pList->n == pList->nAlloc)
+    {
+        int nNew = pList->nAlloc ? pList->nAlloc * 2 : 16;
+        vfsc_range *aNew = (vfsc_range*)sqlite3_realloc(pList->a, nNew * sizeof(vfsc_range));
+        if (aNew == NULL)
+        {
+            return SQLITE_NOMEM;
+        }
+
+        pList->a = aNew;
+        pList->nAlloc = nNew;
+    }
+
+    memmove(&pList->a[i + 1], &pList->a[i], (pList->n - i) * sizeof(vfsc_range));
+    pList->a[i].offset = offset;
+    pList->a[i].size = size;
+    ++pList->n;
+    return SQLITE_OK;
+}
+
+static void RangesClear(vfsc_ranges *pList)
+{
+    sqlite3_free(pList->a);
+    memset(pList, 0, sizeof(*pList));
+}
+
+/*
+** Allocates space for an extent of nByte bytes.
+** First-fit from the free list, otherwise appends to the end of the file.
+*/
+static sqlite_int64 PackedAllocExtent(vfsc_packed *pPacked, int nByte)
+{
+    sqlite_int64 size = PACKED_ROUND(nByte);
+    sqlite_int64 offset;
+    int i;
+
+    for (i = 0; i < pPacked->free.n; ++i)
+    {
+        vfsc_range *pRange = &pPacked->free.a[i];
+        if (pRange->size >= size)
+        {
+            offset = pRange->offset;
+            pRange->offset += size;
+            pRange->size -= size;
+            if (pRange->size == 0)
+            {
+                memmove(pRange, pRange + 1, (pPacked->free.n - i - 1) * sizeof(vfsc_range));
+                --pPacked->free.n;
+            }
+
+            return offset;
+        }
+    }
+
+    offset = pPacked->fileEnd;
+    pPacked->fileEnd += size;
+    return offset;
+}
+
+/*
+** Releases an extent. It may only be reused once the next header write
+** is synced.
+*/
+static int PackedFreeExtent(vfsc_packed *pPacked, vfsc_extent *pExtent)
+{
+    int rc = SQLITE_OK;
+    if (pExtent->offset != 0)
+    {
+        rc = RangesAdd(&pPacked->pending, pExtent->offset, PACKED_ROUND(pExtent->compSize));
+        pExtent->offset = 0;
+        pExtent->compSize = 0;
+        pExtent->origSize = 0;
+    }
+
+    return rc;
+}
+
+/*
+** Releases the stored block of the index entry of a chunk, so that the
+** next commit writes it.
+*/
+static void PackedTouchBlock(vfsc_packed *pPacked, int iChunk)
+{
+    int iBlock = iChunk / PACKED_INDEX_BLOCK_ENTRIES;
+    if (iBlock < pPacked->nBlock)
+    {
+        // Leaks the extent until the file is reopened if out of memory.
+        PackedFreeExtent(pPacked, &pPacked->aBlock[iBlock].extent);
+    }
+}
+
+/*
+** Returns the index entry of a chunk, growing the index as necessary.
+** The caller is expected to change it.
+*/
+static vfsc_extent *PackedGetExtent(vfsc_packed *pPacked, int iChunk)
+{
+    if (iChunk >= pPacked->nIndexAlloc)
+    {
+        int nNew = MAX(iChunk + 1, pPacked->nIndexAlloc * 2);
+        vfsc_extent *aNew = (vfsc_extent*)sqlite3_realloc(pPacked->aIndex, nNew * sizeof(vfsc_extent));
+        if (aNew == NULL)
+        {
+            return NULL;
+        }
+
+        memset(&aNew[pPacked->nIndexAlloc], 0, (nNew - pPacked->nIndexAlloc) * sizeof(vfsc_extent));
+        pPacked->aIndex = aNew;
+        pPacked->nIndexAlloc = nNew;
+    }
+
+    if (iChunk >= pPacked->nIndex)
+    {
+        // The last block gets longer.
+        PackedTouchBlock(pPacked, pPacked->nIndex);
+        pPacked->nIndex = iChunk + 1;
+    }
+
+    PackedTouchBlock(pPacked, iChunk);
+    return &pPacked->aIndex[iChunk];
+}
+
+/*
+** Checks whether a buffer holds a valid header slot.
+*/
+static int PackedIsHeader(const unsigned char *aSlot)
+{
+    return memcmp(aSlot, PACKED_MAGIC, PACKED_MAGIC_SIZE) == 0 &&
+           sqlite3Get4byte(&aSlot[56]) == (u32)crc32(0, aSlot, 56) &&
+           ((sqlite3Get4byte(&aSlot[20]) & PACKED_FLAG_DICTIONARY) == 0 ||
+            sqlite3Get4byte(&aSlot[80]) == (u32)crc32(0, &aSlot[60], 20));
+}
+
+static int LogIsHeader(const unsigned char *aSlot)
+{
+    return memcmp(aSlot, LOG_MAGIC, LOG_MAGIC_SIZE) == 0 &&
+           sqlite3Get4byte(&aSlot[40]) == (u32)crc32(0, aSlot, 40);
+}
+
+/*
+** Determines the layout of a file from its first bytes.
+** Sets *pIsEmpty if the file has no content at all.
+*/
+static Layout DetectLayout(sqlite3_file *pReal, int *pIsEmpty)
+{
+    unsigned char aBuf[PACKED_DATA_START];
+    sqlite_int64 size = 0;
+    int rc;
+
+    *pIsEmpty = 0;
+    rc = pReal->pMethods->xFileSize(pReal, &size);
+    if (rc != SQLITE_OK || size == 0)
+    {
+        // Empty file, just start supporting compression.
+        *pIsEmpty = (rc == SQLITE_OK);
+        return LayoutPlain;
+    }
+
+    memset(aBuf, 0, sizeof(aBuf));
+    rc = pReal->pMethods->xRead(pReal, aBuf, (int)MIN(size, sizeof(aBuf)), 0);
+    if (rc != SQLITE_OK && rc != SQLITE_IOERR_SHORT_READ)
+    {
+        return LayoutPlain;
+    }
+
+    if (PackedIsHeader(aBuf) || PackedIsHeader(aBuf + PACKED_SLOT_SIZE))
+    {
+        return LayoutPacked;
+    }
+
+    if (LogIsHeader(aBuf) || LogIsHeader(aBuf + LOG_SLOT_SIZE))
+    {
+        return LayoutLog;
+    }
+
+	//TODO: We must avoid relying on the header for this check.
+    if (memcmp(aBuf, "SQLite format ", 14) == 0)
+    {
+        return LayoutPlain;
+    }
+
+    return LayoutSparse;
+}
+
+/*
+** Writes the header into the slot of the current generation.
+*/
+static int PackedWriteHeader(vfsc_file *pFile)
+{
+    vfsc_packed *pPacked = &pFile->pDb->packed;
+    unsigned char aSlot[PACKED_SLOT_SIZE];
+
+    memset(aSlot, 0, sizeof(aSlot));
+    memcpy(aSlot, PACKED_MAGIC, PACKED_MAGIC_SIZE);
+    sqlite3Put4byte(&aSlot[16], pFile->pDb->chunkSize);
+    sqlite3Put4byte(&aSlot[20], PACKED_FLAG_INDEX_BLOCKS |
+                                (pPacked->pageChunks ? PACKED_FLAG_PAGES : 0) |
+                                (pPacked->dictExtent.offset != 0 ? PACKED_FLAG_DICTIONARY : 0));
+    Put8byte(&aSlot[24], pPacked->logicalSize);
+    Put8byte(&aSlot[32], pPacked->generation);
+    Put8byte(&aSlot[40], pPacked->indexExtent.offset);
+    sqlite3Put4byte(&aSlot[48], pPacked->nIndex);
+    sqlite3Put4byte(&aSlot[52], pPacked->indexChecksum);
+    sqlite3Put4byte(&aSlot[56], (u32)crc32(0, aSlot, 56));
+    if (pPacked->dictExtent.offset != 0)
+    {
+        Put8byte(&aSlot[60], pPacked->dictExtent.offset);
+        sqlite3Put4byte(&aSlot[68], pPacked->dictExtent.compSize);
+        sqlite3Put4byte(&aSlot[72], pPacked->dictId);
+        sqlite3Put4byte(&aSlot[76], pPacked->dictChecksum);
+        sqlite3Put4byte(&aSlot[80], (u32)crc32(0, &aSlot[60], 20));
+    }
+
+    return pFile->pReal->pMethods->xWrite(pFile->pReal, aSlot, PACKED_SLOT_SIZE,
+                        (pPacked->generation & 1) * PACKED_SLOT_SIZE);
+}
+
+/*
+** Writes the index blocks that changed into new extents, then the root.
+*/
+static int PackedWriteIndex(vfsc_file *pFile)
+{
+    vfsc_packed *pPacked = &pFile->pDb->packed;
+    int nBlock = (pPacked->nIndex + PACKED_INDEX_BLOCK_ENTRIES - 1) / PACKED_INDEX_BLOCK_ENTRIES;
+    int changed = nBlock != pPacked->nBlock || pPacked->indexExtent.offset == 0;
+    unsigned char *aBuf;
+    int rc = SQLITE_OK;
+    int i;
+    int j;
+
+    if (nBlock > pPacked->nBlockAlloc)
+    {
+        int nNew = MAX(nBlock, pPacked->nBlockAlloc * 2);
+        vfsc_block *aNew = (vfsc_block*)sqlite3_realloc(pPacked->aBlock, nNew * sizeof(vfsc_block));
+        if (aNew == NULL)
+        {
+            return SQLITE_NOMEM;
+        }
+
+        memset(&aNew[pPacked->nBlockAlloc], 0, (nNew - pPacked->nBlockAlloc) * sizeof(vfsc_block));
+        pPacked->aBlock = aNew;
+        pPacked->nBlockAlloc = nNew;
+    }
+
+    // The index has shrunk.
+    for (i = nBlock; rc == SQLITE_OK && i < pPacked->nBlock; ++i)
+    {
+        rc = PackedFreeExtent(pPacked, &pPacked->aBlock[i].extent);
+    }
+
+    pPacked->nBlock = nBlock;
+    aBuf = (unsigned char*)sqlite3_malloc(MAX(PACKED_INDEX_BLOCK_ENTRIES, nBlock) * PACKED_INDEX_ENTRY_SIZE);
+    if (aBuf == NULL)
+    {
+        return SQLITE_NOMEM;
+    }
+
+    for (i = 0; rc == SQLITE_OK && i < nBlock; ++i)
+    {
+        vfsc_block *pBlock = &pPacked->aBlock[i];
+        int first = i * PACKED_INDEX_BLOCK_ENTRIES;
+        int nEntry = MIN(PACKED_INDEX_BLOCK_ENTRIES, pPacked->nIndex - first);
+        int nByte = nEntry * PACKED_INDEX_ENTRY_SIZE;
+        if (pBlock->extent.offset != 0)
+        {
+            continue;
+        }
+
+        for (j = 0; j < nEntry; ++j)
+        {
+            unsigned char *aEntry = &aBuf[j * PACKED_INDEX_ENTRY_SIZE];
+            Put8byte(aEntry, pPacked->aIndex[first + j].offset);
+            sqlite3Put4byte(&aEntry[8], pPacked->aIndex[first + j].compSize);
+            sqlite3Put4byte(&aEntry[12], pPacked->aIndex[first + j].origSize);
+        }
+
+        pBlock->extent.offset = PackedAllocExtent(pPacked, nByte);
+        pBlock->extent.compSize = nByte;
+        pBlock->checksum = (u32)crc32(0, aBuf, nByte);
+        rc = pFile->pReal->pMethods->xWrite(pFile->pReal, aBuf, nByte, pBlock->extent.offset);
+        if (rc != SQLITE_OK)
+        {
+            // Written again by the next commit.
+            PackedFreeExtent(pPacked, &pBlock->extent);
+        }
+
+        changed = 1;
+    }
+
+    // The root is only rewritten when a block moved.
+    if (rc == SQLITE_OK && changed)
+    {
+        int nByte = nBlock * PACKED_INDEX_ENTRY_SIZE;
+        memset(aBuf, 0, nByte);
+        for (i = 0; i < nBlock; ++i)
+        {
+            unsigned char *aEntry = &aBuf[i * PACKED_INDEX_ENTRY_SIZE];
+            Put8byte(aEntry, pPacked->aBlock[i].extent.offset);
+            sqlite3Put4byte(&aEntry[8], pPacked->aBlock[i].checksum);
+        }
+
+        rc = PackedFreeExtent(pPacked, &pPacked->indexExtent);
+        if (rc == SQLITE_OK && nByte > 0)
+        {
+            pPacked->indexExtent.offset = PackedAllocExtent(pPacked, nByte);
+            pPacked->indexExtent.compSize = nByte;
+            pPacked->indexChecksum = (u32)crc32(0, aBuf, nByte);
+            rc = pFile->pReal->pMethods->xWrite(pFile->pReal, aBuf, nByte, pPacked->indexExtent.offset);
+            if (rc != SQLITE_OK)
+            {
+                PackedFreeExtent(pPacked, &pPacked->indexExtent);
+            }
+        }
+    }
+
+    sqlite3_free(aBuf);
+    return rc;
+}
+
+/*
+** Makes the extents that only the headers before the last one refer to
+** free, once the last header is synced, and gives the free tail back to
+** the file-system. Until then a crash may leave the previous header the
+** valid one, so its extents must stay as they are.
+** The caller must hold the database mutex.
+*/
+static int PackedReleaseExtents(vfsc_file *pFile)
+{
+    vfsc_packed *pPacked = &pFile->pDb->packed;
+    int rc = SQLITE_OK;
+    int i;
+
+    for (i = 0; rc == SQLITE_OK && i < pPacked->unsynced.n; ++i)
+    {
+        rc = RangesAdd(&pPacked->free, pPacked->unsynced.a[i].offset, pPacked->unsynced.a[i].size);
+    }
+
+    pPacked->unsynced.n = 0;
+    if (rc == SQLITE_OK && pPacked->free.n > 0)
+    {
+        vfsc_range *pLast = &pPacked->free.a[pPacked->free.n - 1];
+        if (pLast->offset + pLast->size == pPacked->fileEnd)
+        {
+            pPacked->fileEnd = pLast->offset;
+            --pPacked->free.n;
+            rc = pFile->pReal->pMethods->xTruncate(pFile->pReal, pPacked->fileEnd);
+        }
+    }
+
+    return rc;
+}
+
+/*
+** Syncs a packed file, then releases what its last header freed.
+*/
+static int PackedSyncHeader(vfsc_file *pFile, int syncFlags)
+{
+    int rc = pFile->pReal->pMethods->xSync(pFile->pReal, syncFlags);
+    if (rc == SQLITE_OK)
+    {
+        sqlite3_mutex_enter(pFile->pDb->mutex);
+        rc = PackedReleaseExtents(pFile);
+        sqlite3_mutex_leave(pFile->pDb->mutex);
+    }
+
+    return rc;
+}
+
+/*
+** Writes the index and the header, making all the chunks flushed since the
+** last commit part of the file. When syncFlags is non-zero the new extents
+** are synced before the header refers to them. The extents the header no
+** longer refers to are only released once it's synced too, see
+** PackedReleaseExtents.
+** The caller must hold the database mutex.
+*/
+static int PackedCommit(vfsc_file *pFile, int syncFlags)
+{
+    vfsc_packed *pPacked = &pFile->pDb->packed;
+    int i;
+    int rc;
+
+    if (!pPacked->dirty)
+    {
+        return SQLITE_OK;
+    }
+
+    rc = PackedWriteIndex(pFile);
+    if (rc == SQLITE_OK && syncFlags != 0)
+    {
+        // This syncs the previous header as well.
+        rc = pFile->pReal->pMethods->xSync(pFile->pReal, syncFlags);
+        if (rc == SQLITE_OK)
+        {
+            rc = PackedReleaseExtents(pFile);
+        }
+    }
+
+    if (rc != SQLITE_OK)
+    {
+        return rc;
+    }
+
+    ++pPacked->generation;
+    rc = PackedWriteHeader(pFile);
+    if (rc != SQLITE_OK)
+    {
+        return rc;
+    }
+
+    pPacked->dirty = 0;
+    vfsc_printf(pFile->pInfo, Compression, "> Packed commit(%s) generation=%lld, chunks=%d, size=%lld, end=%lld.\n",
+        pFile->zFName, pPacked->generation, pPacked->nIndex, pPacked->logicalSize, pPacked->fileEnd);
+
+    // Only the previous header refers to the pending extents anymore.
+    for (i = 0; rc == SQLITE_OK && i < pPacked->pending.n; ++i)
+    {
+        rc = RangesAdd(&pPacked->unsynced, pPacked->pending.a[i].offset, pPacked->pending.a[i].size);
+    }
+
+    pPacked->pending.n = 0;
+    return rc;
+}
+
+/*
+** Reads the dictionary of a packed file. Without dictionary support its
+** chunks can't be read, like those of a codec that isn't compiled in.
+*/
+static int PackedLoadDictionary(vfsc_file *pFile)
+{
+    vfsc_packed *pPacked = &pFile->pDb->packed;
+    char *pData;
+    int rc;
+
+    if (pPacked->dictExtent.compSize <= 0 || pPacked->dictExtent.compSize > MAX_DICTIONARY_SIZE)
+    {
+        return SQLITE_CORRUPT;
+    }
+
+    pData = (char*)sqlite3_malloc(pPacked->dictExtent.compSize);
+    if (pData == NULL)
+    {
+        return SQLITE_NOMEM;
+    }
+
+    rc = pFile->pReal->pMethods->xRead(pFile->pReal, pData, pPacked->dictExtent.compSize, pPacked->dictExtent.offset);
+    if (rc == SQLITE_OK &&
+        pPacked->dictChecksum != (u32)crc32(0, (const unsigned char*)pData, pPacked->dictExtent.compSize))
+    {
+        rc = SQLITE_CORRUPT;
+    }
+
+#ifdef VFSC_ENABLE_ZSTD
+    if (rc == SQLITE_OK)
+    {
+        pFile->pDb->pDict = DictCreate(pData, pPacked->dictExtent.compSize, pFile->pDb->level);
+        if (pFile->pDb->pDict == NULL)
+        {
+            rc = SQLITE_NOMEM;
+        }
+        else if (pFile->pDb->pDict->id != pPacked->dictId)
+        {
+            rc = SQLITE_CORRUPT;
+        }
+    }
+#else
+    vfsc_printf(pFile->pInfo, OpenClose, "> %s.xOpen(%s) -> The dictionary %u needs VFSC_ENABLE_ZSTD.\n",
+        pFile->pInfo->zVfsName, pFile->zFName, pPacked->dictId);
+#endif
+
+    sqlite3_free(pData);
+    return rc == SQLITE_IOERR_SHORT_READ ? SQLITE_CORRUPT : rc;
+}
+
+static int ExtentCompare(const void *a, const void *b)
+{
+    sqlite_int64 x = (*(const vfsc_extent**)a)->offset;
+    sqlite_int64 y = (*(const vfsc_extent**)b)->offset;
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+/*
+** Reads nEntry index entries, starting with that of chunk iFirst, from
+** the given offset of the file and checks them against their checksum.
+*/
+static int PackedReadEntries(vfsc_file *pFile, int iFirst, int nEntry, sqlite_int64 offset, u32 checksum)
+{
+    vfsc_packed *pPacked = &pFile->pDb->packed;
+    int nByte = nEntry * PACKED_INDEX_ENTRY_SIZE;
+    unsigned char *aBuf;
+    int i;
+    int rc;
+
+    aBuf = (unsigned char*)sqlite3_malloc(nByte);
+    if (aBuf == NULL)
+    {
+        return SQLITE_NOMEM;
+    }
+
+    rc = pFile->pReal->pMethods->xRead(pFile->pReal, aBuf, nByte, offset);
+    if (rc == SQLITE_OK && checksum != (u32)crc32(0, aBuf, nByte))
+    {
+        rc = SQLITE_CORRUPT;
+    }
+
+    for (i = 0; rc == SQLITE_OK && i < nEntry; ++i)
+    {
+        unsigned char *aEntry = &aBuf[i * PACKED_INDEX_ENTRY_SIZE];
+        vfsc_extent *pExtent = &pPacked->aIndex[iFirst + i];
+        pExtent->offset = Get8byte(aEntry);
+        pExtent->compSize = (int)sqlite3Get4byte(&aEntry[8]);
+        pExtent->origSize = (int)sqlite3Get4byte(&aEntry[12]);
+    }
+
+    sqlite3_free(aBuf);
+    return rc == SQLITE_IOERR_SHORT_READ ? SQLITE_CORRUPT : rc;
+}
+
+/*
+** Reads the root of a blocked index, then its blocks.
+*/
+static int PackedReadBlocks(vfsc_file *pFile)
+{
+    vfsc_packed *pPacked = &pFile->pDb->packed;
+    int nBlock = (pPacked->nIndex + PACKED_INDEX_BLOCK_ENTRIES - 1) / PACKED_INDEX_BLOCK_ENTRIES;
+    int nByte = nBlock * PACKED_INDEX_ENTRY_SIZE;
+    unsigned char *aRoot;
+    int i;
+    int rc;
+
+    pPacked->aBlock = (vfsc_block*)sqlite3_malloc(nBlock * sizeof(vfsc_block));
+    aRoot = (unsigned char*)sqlite3_malloc(nByte);
+    if (pPacked->aBlock == NULL || aRoot == NULL)
+    {
+        sqlite3_free(aRoot);
+        return SQLITE_NOMEM;
+    }
+
+    memset(pPacked->aBlock, 0, nBlock * sizeof(vfsc_block));
+    pPacked->nBlock = nBlock;
+    pPacked->nBlockAlloc = nBlock;
+    pPacked->indexExtent.compSize = nByte;
+    rc = pFile->pReal->pMethods->xRead(pFile->pReal, aRoot, nByte, pPacked->indexExtent.offset);
+    if (rc == SQLITE_OK && pPacked->indexChecksum != (u32)crc32(0, aRoot, nByte))
+    {
+        rc = SQLITE_CORRUPT;
+    }
+
+    for (i = 0; rc == SQLITE_OK && i < nBlock; ++i)
+    {
+        vfsc_block *pBlock = &pPacked->aBlock[i];
+        int first = i * PACKED_INDEX_BLOCK_ENTRIES;
+        int nEntry = MIN(PACKED_INDEX_BLOCK_ENTRIES, pPacked->nIndex - first);
+        pBlock->extent.offset = Get8byte(&aRoot[i * PACKED_INDEX_ENTRY_SIZE]);
+        pBlock->extent.compSize = nEntry * PACKED_INDEX_ENTRY_SIZE;
+        pBlock->checksum = sqlite3Get4byte(&aRoot[i * PACKED_INDEX_ENTRY_SIZE + 8]);
+        rc = PackedReadEntries(pFile, first, nEntry, pBlock->extent.offset, pBlock->checksum);
+    }
+
+    sqlite3_free(aRoot);
+    return rc == SQLITE_IOERR_SHORT_READ ? SQLITE_CORRUPT : rc;
+}
+
+/*
+** Loads the header and the index of a packed file and rebuilds the free
+** list from the gaps between the extents. A new file gets a header, and a
+** chunk per page if pageChunks is set.
+*/
+static int PackedOpen(vfsc_file *pFile, int isNew, int pageChunks)
+{
+    vfsc_packed *pPacked = &pFile->pDb->packed;
+    unsigned char aBuf[PACKED_DATA_START];
+    unsigned char *aSlot = NULL;
+    vfsc_extent **apSorted;
+    sqlite_int64 fileSize = 0;
+    sqlite_int64 end;
+    u32 chunkSize;
+    u32 flags;
+    int nIndex;
+    int nExtent;
+    int i;
+    int rc;
+
+    memset(pPacked, 0, sizeof(*pPacked));
+    pPacked->fileEnd = PACKED_DATA_START;
+    if (isNew)
+    {
+        if (pageChunks)
+        {
+            // Until the first write tells the page size.
+            pPacked->pageChunks = 1;
+            pFile->pDb->chunkSize = SQLITE_DEFAULT_PAGE_SIZE;
+        }
+
+        pPacked->dirty = 1;
+        return PackedCommit(pFile, 0);
+    }
+
+    rc = pFile->pReal->pMethods->xFileSize(pFile->pReal, &fileSize);
+    if (rc != SQLITE_OK)
+    {
+        return rc;
+    }
+
+    memset(aBuf, 0, sizeof(aBuf));
+    rc = pFile->pReal->pMethods->xRead(pFile->pReal, aBuf, PACKED_DATA_START, 0);
+    if (rc != SQLITE_OK && rc != SQLITE_IOERR_SHORT_READ)
+    {
+        return rc;
+    }
+
+    // Use the valid slot with the highest generation.
+    for (i = 0; i < 2; ++i)
+    {
+        unsigned char *aCandidate = &aBuf[i * PACKED_SLOT_SIZE];
+        if (PackedIsHeader(aCandidate) &&
+            (aSlot == NULL || Get8byte(&aCandidate[32]) > Get8byte(&aSlot[32])))
+        {
+            aSlot = aCandidate;
+        }
+    }
+
+    if (aSlot == NULL)
+    {
+        return SQLITE_CORRUPT;
+    }
+
+    // The file keeps the chunk size it was created with, or its page size.
+    chunkSize = sqlite3Get4byte(&aSlot[16]);
+    flags = sqlite3Get4byte(&aSlot[20]);
+    pPacked->pageChunks = (flags & PACKED_FLAG_PAGES) != 0;
+    if (pPacked->pageChunks
+        ? (chunkSize < MIN_PAGE_CHUNK_SIZE || chunkSize > SQLITE_MAX_PAGE_SIZE || (chunkSize & (chunkSize - 1)) != 0)
+        : (chunkSize == 0 || chunkSize % COMPRESION_UNIT_SIZE_BYTES != 0 || chunkSize > MAX_CHUNK_SIZE_BYTES))
+    {
+        vfsc_printf(pFile->pInfo, Error, "> %s.xOpen(%s) -> Invalid chunk size: %u.\n",
+            pFile->pInfo->zVfsName, pFile->zFName, chunkSize);
+        return SQLITE_CORRUPT;
+    }
+
+    pFile->pDb->chunkSize = (int)chunkSize;
+
+    pPacked->logicalSize = Get8byte(&aSlot[24]);
+    pPacked->generation = Get8byte(&aSlot[32]);
+    pPacked->indexExtent.offset = Get8byte(&aSlot[40]);
+    nIndex = (int)sqlite3Get4byte(&aSlot[48]);
+    pPacked->indexExtent.compSize = nIndex * PACKED_INDEX_ENTRY_SIZE;
+    pPacked->indexChecksum = sqlite3Get4byte(&aSlot[52]);
+    if (flags & PACKED_FLAG_DICTIONARY)
+    {
+        pPacked->dictExtent.offset = Get8byte(&aSlot[60]);
+        pPacked->dictExtent.compSize = (int)sqlite3Get4byte(&aSlot[68]);
+        pPacked->dictId = sqlite3Get4byte(&aSlot[72]);
+        pPacked->dictChecksum = sqlite3Get4byte(&aSlot[76]);
+    }
+
+    // Each chunk takes an index entry in the file, at least.
+    if (nIndex < 0 || (sqlite_int64)nIndex * PACKED_INDEX_ENTRY_SIZE > fileSize)
+    {
+        vfsc_printf(pFile->pInfo, Error, "> %s.xOpen(%s) -> Invalid index size: %d.\n",
+            pFile->pInfo->zVfsName, pFile->zFName, nIndex);
+        return SQLITE_CORRUPT;
+    }
+
+    if (nIndex > 0)
+    {
+        if (PackedGetExtent(pPacked, nIndex - 1) == NULL)
+        {
+            return SQLITE_NOMEM;
+        }
+
+        if (flags & PACKED_FLAG_INDEX_BLOCKS)
+        {
+            rc = PackedReadBlocks(pFile);
+        }
+        else
+        {
+            // The first commit converts it to blocks.
+            rc = PackedReadEntries(pFile, 0, nIndex, pPacked->indexExtent.offset, pPacked->indexChecksum);
+        }
+
+        if (rc != SQLITE_OK)
+        {
+            return rc;
+        }
+    }
+
+    // Everything not used by an extent is free.
+    nExtent = nIndex + pPacked->nBlock + 2;
+    apSorted = (vfsc_extent**)sqlite3_malloc(nExtent * sizeof(vfsc_extent*));
+    if (apSorted == NULL)
+    {
+        return SQLITE_NOMEM;
+    }
+
+    apSorted[0] = &pPacked->indexExtent;
+    apSorted[1] = &pPacked->dictExtent;
+    for (i = 0; i < pPacked->nBlock; ++i)
+    {
+        apSorted[i + 2] = &pPacked->aBlock[i].extent;
+    }
+
+    for (i = 0; i < nIndex; ++i)
+    {
+        apSorted[i + pPacked->nBlock + 2] = &pPacked->aIndex[i];
+    }
+
+    qsort(apSorted, nExtent, sizeof(vfsc_extent*), ExtentCompare);
+    end = PACKED_DATA_START;
+    for (i = 0; rc == SQLITE_OK && i < nExtent; ++i)
+    {
+        if (apSorted[i]->offset == 0)
+        {
+            continue;
+        }
+
+        // Overlapping, or past the end of the file.
+        if (apSorted[i]->offset < end || apSorted[i]->compSize < 0 ||
+            apSorted[i]->offset + apSorted[i]->compSize > fileSize)
+        {
+            rc = SQLITE_CORRUPT;
+            break;
+        }
+
+        rc = RangesAdd(&pPacked->free, end, apSorted[i]->offset - end);
+        end = apSorted[i]->offset + PACKED_ROUND(apSorted[i]->compSize);
+    }
+
+    sqlite3_free(apSorted);
+    pPacked->fileEnd = end;
+    if (rc == SQLITE_OK && pPacked->dictExtent.offset != 0)
+    {
+        rc = PackedLoadDictionary(pFile);
+    }
+
+    return rc;
+}
+
+static void PackedClose(vfsc_packed *pPacked)
+{
+    sqlite3_free(pPacked->aIndex);
+    sqlite3_free(pPacked->aBlock);
+    RangesClear(&pPacked->free);
+    RangesClear(&pPacked->pending);
+    RangesClear(&pPacked->unsynced);
+    memset(pPacked, 0, sizeof(*pPacked));
+}
+
+/*
+** Writes a compressed chunk into a new extent and updates the index.
+** The old extent stays referenced until the write succeeds, so the write
+** itself doesn't need the database mutex.
+*/
+static int PackedWriteChunk(vfsc_file *pFile, vfsc_chunk *pChunk, const char *pCompData)
+{
+    vfsc_db *pDb = pFile->pDb;
+    vfsc_packed *pPacked = &pDb->packed;
+    vfsc_extent *pExtent;
+    vfsc_extent written;
+    int rc;
+
+    memset(&written, 0, sizeof(written));
+    written.compSize = pChunk->compSize;
+    written.origSize = pChunk->origSize;
+    sqlite3_mutex_enter(pDb->mutex);
+    written.offset = PackedAllocExtent(pPacked, pChunk->compSize);
+    sqlite3_mutex_leave(pDb->mutex);
+
+    rc = pFile->pReal->pMethods->xWrite(pFile->pReal, pCompData, pChunk->compSize, written.offset);
+
+    sqlite3_mutex_enter(pDb->mutex);
+    pExtent = rc == SQLITE_OK ? PackedGetExtent(pPacked, (int)(pChunk->offset / pDb->chunkSize)) : NULL;
+    if (pExtent == NULL)
+    {
+        PackedFreeExtent(pPacked, &written);
+        rc = rc == SQLITE_OK ? SQLITE_NOMEM : rc;
+    }
+    else
+    {
+        rc = PackedFreeExtent(pPacked, pExtent);
+        *pExtent = written;
+        pPacked->dirty = 1;
+    }
+    sqlite3_mutex_leave(pDb->mutex);
+
+    return rc;
+}
+
+#ifdef VFSC_ENABLE_ZSTD
+/*
+** Writes a dictionary into a new extent and makes it the current one of
+** the database, switching to a codec that can use it. The replaced one
+** stays in the file until the next header write.
+** pDict is freed if it can't be written.
+*/
+static int PackedSetDictionary(vfsc_file *pFile, vfsc_dict *pDict)
+{
+    vfsc_db *pDb = pFile->pDb;
+    vfsc_packed *pPacked = &pDb->packed;
+    vfsc_extent written;
+    int rc = SQLITE_OK;
+
+    memset(&written, 0, sizeof(written));
+    if (pDict->nData > 0)
+    {
+        written.compSize = pDict->nData;
+        sqlite3_mutex_enter(pDb->mutex);
+        written.offset = PackedAllocExtent(pPacked, pDict->nData);
+        sqlite3_mutex_leave(pDb->mutex);
+
+        rc = pFile->pReal->pMethods->xWrite(pFile->pReal, pDict->pData, pDict->nData, written.offset);
+    }
+
+    sqlite3_mutex_enter(pDb->mutex);
+    if (rc != SQLITE_OK)
+    {
+        PackedFreeExtent(pPacked, &written);
+        DictFree(pDict);
+    }
+    else
+    {
+        rc = PackedFreeExtent(pPacked, &pPacked->dictExtent);
+        pPacked->dictExtent = written;
+        pPacked->dictId = pDict->id;
+        pPacked->dictChecksum = (u32)crc32(0, (const unsigned char*)pDict->pData, pDict->nData);
+        pPacked->dirty = 1;
+        pDict->pNext = pDb->pDict;
+        pDb->pDict = pDict;
+        if (pDict->id != 0)
+        {
+            pDb->codec = FindCodec("zstd");
+        }
+    }
+    sqlite3_mutex_leave(pDb->mutex);
+
+    return rc;
+}
+#endif /* VFSC_ENABLE_ZSTD */
+
+/*
+** Moves the extents that fit in the free space before them there, the
+** dictionary included, so that the next commit gives the tail of the file
+** back. Rewriting all the chunks leaves all their old extents free at the
+** front. An extent that's replaced meanwhile isn't moved.
+** Sets *pnMoved to the number of extents moved.
+*/
+static int PackedMoveExtents(vfsc_file *pFile, int *pnMoved)
+{
+    vfsc_db *pDb = pFile->pDb;
+    vfsc_packed *pPacked = &pDb->packed;
+    char *pBuf = NULL;
+    int rc = SQLITE_OK;
+    int i;
+
+    for (i = -1; rc == SQLITE_OK; ++i)
+    {
+        vfsc_extent *pExtent;
+        vfsc_extent from;
+        vfsc_extent moved;
+        int j;
+
+        sqlite3_mutex_enter(pDb->mutex);
+        if (i >= pPacked->nIndex)
+        {
+            sqlite3_mutex_leave(pDb->mutex);
+            break;
+        }
+
+        pExtent = i < 0 ? &pPacked->dictExtent : &pPacked->aIndex[i];
+        from = *pExtent;
+        moved = from;
+        moved.offset = 0;
+        for (j = 0; from.offset != 0 && j < pPacked->free.n && pPacked->free.a[j].offset < from.offset; ++j)
+        {
+            if (pPacked->free.a[j].size >= PACKED_ROUND(from.compSize))
+            {
+                // First-fit allocates this range.
+                moved.offset = PackedAllocExtent(pPacked, from.compSize);
+                break;
+            }
+        }
+        sqlite3_mutex_leave(pDb->mutex);
+
+        if (moved.offset == 0)
+        {
+            continue;
+        }
+
+        pBuf = (char*)sqlite3_realloc(pBuf, from.compSize);
+        rc = pBuf != NULL ? SQLITE_OK : SQLITE_NOMEM;
+        if (rc == SQLITE_OK)
+        {
+            rc = pFile->pReal->pMethods->xRead(pFile->pReal, pBuf, from.compSize, from.offset);
+        }
+
+        if (rc == SQLITE_OK)
+        {
+            rc = pFile->pReal->pMethods->xWrite(pFile->pReal, pBuf, from.compSize, moved.offset);
+        }
+
+        sqlite3_mutex_enter(pDb->mutex);
+        pExtent = i < 0 ? &pPacked->dictExtent : &pPacked->aIndex[i];
+        if (rc != SQLITE_OK || pExtent->offset != from.offset)
+        {
+            PackedFreeExtent(pPacked, &moved);
+        }
+        else
+        {
+            rc = PackedFreeExtent(pPacked, pExtent);
+            *pExtent = moved;
+            if (i >= 0)
+            {
+                PackedTouchBlock(pPacked, i);
+            }
+
+            pPacked->dirty = 1;
+            ++*pnMoved;
+        }
+        sqlite3_mutex_leave(pDb->mutex);
+    }
+
+    sqlite3_free(pBuf);
+    return rc;
+}
+
+/*
+** Checks whether most of a packed file is free since it was truncated,
+** and worth compacting. The caller must hold the database mutex.
+*/
+static int PackedShouldCompact(vfsc_packed *pPacked)
+{
+    sqlite_int64 nFree = 0;
+    int i;
+
+    if (!pPacked->truncated)
+    {
+        return 0;
+    }
+
+    pPacked->truncated = 0;
+    for (i = 0; i < pPacked->free.n; ++i)
+    {
+        nFree += pPacked->free.a[i].size;
+    }
+
+    return nFree > (pPacked->fileEnd - PACKED_DATA_START) / 2;
+}
+
+/*
+** Gives the free space of a packed file back. The extents are moved into
+** the free space before them and committed, a few times since the space
+** of the moved ones is only free after the commit is synced.
+*/
+static int PackedCompact(vfsc_file *pFile, int syncFlags)
+{
+    vfsc_db *pDb = pFile->pDb;
+    int rc = SQLITE_OK;
+    int i;
+
+    for (i = 0; rc == SQLITE_OK && i < PACKED_COMPACT_PASSES; ++i)
+    {
+        int nMoved = 0;
+        rc = PackedMoveExtents(pFile, &nMoved);
+        if (rc != SQLITE_OK || nMoved == 0)
+        {
+            break;
+        }
+
+        sqlite3_mutex_enter(pDb->mutex);
+        rc = PackedCommit(pFile, syncFlags);
+        sqlite3_mutex_leave(pDb->mutex);
+        if (rc == SQLITE_OK)
+        {
+            rc = PackedSyncHeader(pFile, syncFlags);
+        }
+    }
+
+    vfsc_printf(pFile->pInfo, Compression, "> Packed compact(%s) passes=%d, end=%lld.\n",
+        pFile->zFName, i, pDb->packed.fileEnd);
+    return rc;
+}
+
+/*
+** Shared database state.
+*/
+
+static void vfscEnterMutex(void)
+{
+    sqlite3_mutex_enter(sqlite3MutexAlloc(SQLITE_MUTEX_STATIC_MASTER));
+}
+
+static void vfscLeaveMutex(void)
+{
+    sqlite3_mutex_leave(sqlite3MutexAlloc(SQLITE_MUTEX_STATIC_MASTER));
+}
+
+/*
+** Finds an open database by its full path.
+** The caller must hold the master mutex.
+*/
+static vfsc_db *FindDb(const char *zPath)
+{
+    vfsc_db *pDb;
+    for (pDb = DbList; pDb != NULL; pDb = pDb->pNext)
+    {
+        if (strcmp(pDb->zPath, zPath) == 0)
+        {
+            return pDb;
+        }
+    }
+
+    return NULL;
+}
+
+/*
+** Counts the files open on the main database of pFile in this process:
+** those of the shim, and where the OS layer can tell, those opened through
+** other VFSes too.
+** The caller must hold the master mutex.
+*/
+static int CountOpenFiles(vfsc_file *pFile)
+{
+    vfsc_file *p;
+    int nShim = 0;
+    int nOs = 0;
+
+    if (pFile->pDb != NULL)
+    {
+        nShim = pFile->pDb->nRef;
+    }
+    else
+    {
+        for (p = PlainList; p != NULL; p = p->pNextPlain)
+        {
+            if (strcmp(p->zPath, pFile->zPath) == 0)
+            {
+                ++nShim;
+            }
+        }
+    }
+
+    if (pFile->pReal->pMethods->xFileControl(pFile->pReal, SQLITE_FCNTL_OPEN_COUNT, &nOs) != SQLITE_OK)
+    {
+        nOs = 0;
+    }
+
+    return MAX(nShim, nOs);
+}
+
+/*
+** Finds the open database of a journal or WAL file by the name of the file.
+** The caller must hold the master mutex.
+*/
+static vfsc_db *FindMainDb(const char *zName, int flags)
+{
+    const char *zSuffix = (flags & SQLITE_OPEN_WAL) ? "-wal" : "-journal";
+    int nName = strlen(zName);
+    int nPath = nName - strlen(zSuffix);
+    vfsc_db *pDb;
+
+    if (nPath <= 0 || strcmp(zName + nPath, zSuffix) != 0)
+    {
+        return NULL;
+    }
+
+    for (pDb = DbList; pDb != NULL; pDb = pDb->pNext)
+    {
+        if (pDb->layout != LayoutLog && strncmp(pDb->zPath, zName, nPath) == 0 &&
+            pDb->zPath[nPath] == '\0')
+        {
+            return pDb;
+        }
+    }
+
+    return NULL;
+}
+
+static void FreeCodec(vfsc_codec *pCodec)
+{
+    int i;
+    for (i = 0; i < CODEC_COUNT; ++i)
+    {
+        if (pCodec->apCtx[i] != NULL)
+        {
+            aCodec[i].xDestroy(pCodec->apCtx[i]);
+        }
+    }
+
+    sqlite3_free(pCodec->pCompData);
+    sqlite3_free(pCodec);
+}
+
+/*
+** Takes a codec from the pool of a database, creating one if they are
+** all in use. Returns NULL if out of memory.
+*/
+static vfsc_codec *GetCodec(vfsc_db *pDb)
+{
+    vfsc_codec *pCodec;
+    int i;
+
+    sqlite3_mutex_enter(pDb->mutex);
+    pCodec = pDb->pFreeCodec;
+    if (pCodec != NULL)
+    {
+        pDb->pFreeCodec = pCodec->pNext;
+        pCodec->codec = pDb->codec;
+        pCodec->level = pDb->level;
+        pCodec->pDict = pDb->pDict;
+    }
+    sqlite3_mutex_leave(pDb->mutex);
+
+    if (pCodec != NULL)
+    {
+        return pCodec;
+    }
+
+    pCodec = (vfsc_codec*)sqlite3_malloc(sizeof(vfsc_codec));
+    if (pCodec == NULL)
+    {
+        return NULL;
+    }
+
+    // Room for the worst case of any codec, the chunks may be mixed,
+    // and for the header of a log record in front.
+    memset(pCodec, 0, sizeof(vfsc_codec));
+    for (i = 0; i < CODEC_COUNT; ++i)
+    {
+        if (aCodec[i].id != 0)
+        {
+            int nBound = aCodec[i].xBound(pDb->chunkSize);
+            if (pDb->blockShift > 0)
+            {
+                // Each block may grow, and has its size in front.
+                int nBlock = (pDb->chunkSize + (1 << pDb->blockShift) - 1) >> pDb->blockShift;
+                nBound = MAX(nBound, nBlock * (4 + aCodec[i].xBound(1 << pDb->blockShift)));
+            }
+
+            pCodec->compDataSize = MAX(pCodec->compDataSize, CHUNK_HEADER_SIZE + nBound);
+        }
+    }
+
+    pCodec->compDataSize += LOG_RECORD_HEADER_SIZE;
+
+    pCodec->pCompData = (char*)sqlite3_malloc(pCodec->compDataSize);
+    if (pCodec->pCompData == NULL)
+    {
+        FreeCodec(pCodec);
+        return NULL;
+    }
+
+    sqlite3_mutex_enter(pDb->mutex);
+    pCodec->codec = pDb->codec;
+    pCodec->level = pDb->level;
+    pCodec->pDict = pDb->pDict;
+    sqlite3_mutex_leave(pDb->mutex);
+    return pCodec;
+}
+
+/*
+** Returns a codec to the pool of a database.
+*/
+static void PutCodec(vfsc_db *pDb, vfsc_codec *pCodec)
+{
+    sqlite3_mutex_enter(pDb->mutex);
+    pCodec->pNext = pDb->pFreeCodec;
+    pDb->pFreeCodec = pCodec;
+    sqlite3_mutex_leave(pDb->mutex);
+}
+
+/*
+** Log Layout.
+**
+** Header slot (LOG_SLOT_SIZE bytes, big-endian):
+**    0  16  Magic: LOG_MAGIC
+**   16   8  Generation, the slot with the highest valid one is current
+**   24   8  Offset of the first record
+**   32   8  Sequence number of the first record
+**   40   4  Header checksum (crc32 of bytes 0-39)
+**
+** Record header (LOG_RECORD_HEADER_SIZE bytes), followed by the payload:
+**    0   1  Magic: LOG_RECORD_MAGIC
+**    1   1  Type: RecordRaw, RecordEncoded or RecordTruncate
+**    2   2  Reserved, 0
+**    4   4  Checksum (crc32 of bytes 8-31 and the payload)
+**    8   8  Sequence number, one more than the previous record
+**   16   8  Logical offset, the new file size for RecordTruncate
+**   24   4  Size of the data
+**   28   4  Size of the payload
+**
+** Every write appends a record right away, so the journal and the WAL
+** reach the file in the same order as when they are plain, and a sync
+** makes them durable the same way. A WAL frame becomes a raw record for
+** its header and a compressed one for its page, the page of a journal
+** record likewise.
+** On open the records are replayed up to the first torn or out of
+** sequence one, which then behaves as a torn append to a plain file.
+** Records only move when the log is compacted, see LogCompact.
+*/
+
+typedef enum RecordType
+{
+    RecordRaw = 1,
+    RecordEncoded,
+    RecordTruncate
+
+} RecordType;
+
+/*
+** Writes the header into the slot of the current generation.
+*/
+static int LogWriteHeader(vfsc_file *pFile)
+{
+    vfsc_log *pLog = &pFile->pDb->log;
+    unsigned char aSlot[LOG_SLOT_SIZE];
+
+    memset(aSlot, 0, sizeof(aSlot));
+    memcpy(aSlot, LOG_MAGIC, LOG_MAGIC_SIZE);
+    Put8byte(&aSlot[16], pLog->generation);
+    Put8byte(&aSlot[24], pLog->start);
+    Put8byte(&aSlot[32], pLog->startSeq);
+    sqlite3Put4byte(&aSlot[40], (u32)crc32(0, aSlot, 40));
+
+    return pFile->pReal->pMethods->xWrite(pFile->pReal, aSlot, LOG_SLOT_SIZE,
+                        (pLog->generation & 1) * LOG_SLOT_SIZE);
+}
+
+/*
+** Returns the index of the first extent that ends after offset.
+*/
+static int LogFind(vfsc_log *pLog, sqlite_int64 offset)
+{
+    int lo = 0;
+    int hi = pLog->nExt;
+    while (lo < hi)
+    {
+        int mid = (lo + hi) / 2;
+        if (pLog->aExt[mid].offset + pLog->aExt[mid].length <= offset)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+
+    return lo;
+}
+
+/*
+** Makes room in the index for the two extents LogMap may add.
+*/
+static int LogReserve(vfsc_log *pLog)
+{
+    if (pLog->nExt + 2 > pLog->nExtAlloc)
+    {
+        int nAlloc = MAX(16, 2 * pLog->nExtAlloc);
+        vfsc_logext *aExt = (vfsc_logext*)sqlite3_realloc(pLog->aExt, nAlloc * sizeof(vfsc_logext));
+        if (aExt == NULL)
+        {
+            return SQLITE_NOMEM;
+        }
+
+        pLog->aExt = aExt;
+        pLog->nExtAlloc = nAlloc;
+    }
+
+    return SQLITE_OK;
+}
+
+/*
+** Makes an extent the live data of its range, trimming or splitting the
+** extents it overwrites. LogReserve must have been called.
+*/
+static void LogMap(vfsc_log *pLog, const vfsc_logext *pExt)
+{
+    sqlite_int64 end = pExt->offset + pExt->length;
+    vfsc_logext aNew[3];
+    int nNew = 0;
+    int i = LogFind(pLog, pExt->offset);
+    int j = i;
+
+    while (j < pLog->nExt && pLog->aExt[j].offset < end)
+    {
+        ++j;
+    }
+
+    // Keep what the first and last overwritten extents have outside.
+    if (i < j && pLog->aExt[i].offset < pExt->offset)
+    {
+        aNew[nNew] = pLog->aExt[i];
+        aNew[nNew].length = (int)(pExt->offset - pLog->aExt[i].offset);
+        ++nNew;
+    }
+
+    aNew[nNew++] = *pExt;
+    if (i < j && pLog->aExt[j - 1].offset + pLog->aExt[j - 1].length > end)
+    {
+        int cut = (int)(end - pLog->aExt[j - 1].offset);
+        aNew[nNew] = pLog->aExt[j - 1];
+        aNew[nNew].offset = end;
+        aNew[nNew].skip += cut;
+        aNew[nNew].length -= cut;
+        ++nNew;
+    }
+
+    memmove(&pLog->aExt[i + nNew], &pLog->aExt[j], (pLog->nExt - j) * sizeof(vfsc_logext));
+    memcpy(&pLog->aExt[i], aNew, nNew * sizeof(vfsc_logext));
+    pLog->nExt += nNew - (j - i);
+}
+
+/*
+** Drops the data at and after size, which becomes the file size.
+*/
+static void LogCut(vfsc_log *pLog, sqlite_int64 size)
+{
+    int i = LogFind(pLog, size);
+    if (i < pLog->nExt && pLog->aExt[i].offset < size)
+    {
+        pLog->aExt[i].length = (int)(size - pLog->aExt[i].offset);
+        ++i;
+    }
+
+    pLog->nExt = i;
+    pLog->logicalSize = size;
+}
+
+/*
+** Stores n bytes of data as the payload of a record in aRec, after the
+** room for its header, compressed unless that saves too little (see
+** CHUNK_RAW_SAVING).
+** Returns the record type and sets *pStored to the payload size.
+*/
+static int LogEncode(vfsc_db *pDb, vfsc_codec *pCodec, const char *pData, int n, int *pStored)
+{
+    char *pPayload = pCodec->pCompData + LOG_RECORD_HEADER_SIZE;
+    if (n >= LOG_MIN_COMPRESS)
+    {
+        sqlite3_int64 start = StatTimer();
+        int nComp = EncodeChunk(pCodec, 0, NULL, pData, n, pPayload,
+                                pCodec->compDataSize - LOG_RECORD_HEADER_SIZE);
+        int isEncoded = nComp > 0 && nComp <= n - n / CHUNK_RAW_SAVING;
+
+        StatCompress(pDb, n, isEncoded ? nComp : -1, start);
+        if (isEncoded)
+        {
+            *pStored = nComp;
+            return RecordEncoded;
+        }
+    }
+
+    memcpy(pPayload, pData, n);
+    *pStored = n;
+    return RecordRaw;
+}
+
+/*
+** Fills the header of the record in aRec and writes it at offset pos.
+*/
+static int LogPutRecord(vfsc_file *pFile, unsigned char *aRec, int type, sqlite_int64 seq,
+                        sqlite_int64 offset, int origSize, int stored, sqlite_int64 pos)
+{
+    int rc;
+
+    memset(aRec, 0, 8);
+    aRec[0] = LOG_RECORD_MAGIC;
+    aRec[1] = (unsigned char)type;
+    Put8byte(&aRec[8], seq);
+    Put8byte(&aRec[16], offset);
+    sqlite3Put4byte(&aRec[24], origSize);
+    sqlite3Put4byte(&aRec[28], stored);
+    sqlite3Put4byte(&aRec[4], (u32)crc32(0, aRec + 8, LOG_RECORD_HEADER_SIZE - 8 + stored));
+
+    rc = pFile->pReal->pMethods->xWrite(pFile->pReal, aRec, LOG_RECORD_HEADER_SIZE + stored, pos);
+
+#ifdef ENABLE_STATISTICS
+	AtomicAdd(pFile->pDb->aStatus[SQLITE_COMPRESS_STATUS_WRITES], 1);
+	AtomicAdd(pFile->pDb->aStatus[SQLITE_COMPRESS_STATUS_WRITE_BYTES], LOG_RECORD_HEADER_SIZE + stored);
+#endif
+
+    return rc;
+}
+
+/*
+** Appends a record whose payload is in aRec and adds it to the index,
+** writing the header of an empty log first.
+** The caller must hold the database mutex.
+*/
+static int LogAppend(vfsc_file *pFile, unsigned char *aRec, int type,
+                     sqlite_int64 offset, int origSize, int stored)
+{
+    vfsc_log *pLog = &pFile->pDb->log;
+    vfsc_logext ext;
+    int rc;
+
+    rc = LogReserve(pLog);
+    if (rc == SQLITE_OK && pLog->end == 0)
+    {
+        ++pLog->generation;
+        pLog->start = LOG_DATA_START;
+        pLog->startSeq = pLog->seq;
+        pLog->end = LOG_DATA_START;
+        rc = LogWriteHeader(pFile);
+    }
+    else if (rc == SQLITE_OK && pLog->trim)
+    {
+        // A stale record after end could otherwise pass for the next one.
+        rc = pFile->pReal->pMethods->xTruncate(pFile->pReal, pLog->end);
+        pLog->trim = (rc != SQLITE_OK);
+    }
+
+    if (rc == SQLITE_OK)
+    {
+        rc = LogPutRecord(pFile, aRec, type, pLog->seq, offset, origSize, stored, pLog->end);
+    }
+
+    if (rc != SQLITE_OK)
+    {
+        // The next record overwrites whatever made it to the file.
+        return rc;
+    }
+
+    if (type == RecordTruncate)
+    {
+        LogCut(pLog, offset);
+    }
+    else
+    {
+        ext.offset = offset;
+        ext.record = pLog->end;
+        ext.length = origSize;
+        ext.skip = 0;
+        ext.origSize = origSize;
+        ext.stored = stored;
+        ext.raw = (type == RecordRaw);
+        LogMap(pLog, &ext);
+        pLog->logicalSize = MAX(pLog->logicalSize, offset + origSize);
+    }
+
+    ++pLog->seq;
+    pLog->end += LOG_RECORD_HEADER_SIZE + stored;
+    return SQLITE_OK;
+}
+
+/*
+** Reads n bytes of an extent, skip bytes into it.
+** The caller doesn't need the database mutex, but must check that the
+** epoch didn't change before using the data.
+*/
+static int LogReadExtent(vfsc_file *pFile, vfsc_codec *pCodec, const vfsc_logext *pExt,
+                         int skip, int n, char *pOut)
+{
+    sqlite3_file *pReal = pFile->pReal;
+    char *pData = pOut;
+    int nIn = pExt->stored;
+    int rc;
+
+    if (pExt->raw)
+    {
+        rc = pReal->pMethods->xRead(pReal, pOut, n, pExt->record + LOG_RECORD_HEADER_SIZE + pExt->skip + skip);
+    }
+    else
+    {
+        rc = pReal->pMethods->xRead(pReal, pCodec->pCompData, nIn, pExt->record + LOG_RECORD_HEADER_SIZE);
+        if (rc == SQLITE_OK && (pExt->skip + skip != 0 || n != pExt->origSize))
+        {
+            // Only part of the record is needed.
+            pData = (char*)sqlite3_malloc(pExt->origSize);
+            rc = pData != NULL ? SQLITE_OK : SQLITE_NOMEM;
+        }
+
+        if (rc == SQLITE_OK)
+        {
+            sqlite3_int64 start = StatTimer();
+            if (DecodeChunk(pCodec, pCodec->pCompData, &nIn, pData, pExt->origSize) != pExt->origSize)
+            {
+                rc = SQLITE_CORRUPT;
+            }
+            else
+            {
+                StatDecompress(pFile->pDb, nIn, pExt->origSize, start);
+                if (pData != pOut)
+                {
+                    memcpy(pOut, pData + pExt->skip + skip, n);
+                }
+            }
+        }
+
+        if (pData != pOut)
+        {
+            sqlite3_free(pData);
+        }
+    }
+
+#ifdef ENABLE_STATISTICS
+	AtomicAdd(pFile->pDb->aStatus[SQLITE_COMPRESS_STATUS_READS], 1);
+	AtomicAdd(pFile->pDb->aStatus[SQLITE_COMPRESS_STATUS_READ_BYTES], pExt->raw ? n : pExt->stored);
+#endif
+
+    // The records are all within the file.
+    return rc == SQLITE_IOERR_SHORT_READ ? SQLITE_CORRUPT : rc;
+}
+
+/*
+** Reads from a file in the log layout. Zero-fills what's past the end
+** and the holes that were never written.
+*/
+static int LogRead(vfsc_file *pFile, char *zBuf, int iAmt, sqlite_int64 iOfst)
+{
+    vfsc_db *pDb = pFile->pDb;
+    vfsc_log *pLog = &pDb->log;
+    vfsc_codec *pCodec = GetCodec(pDb);
+    int done = 0;
+    int rc = SQLITE_OK;
+
+    if (pCodec == NULL)
+    {
+        return SQLITE_NOMEM;
+    }
+
+    while (done < iAmt && rc == SQLITE_OK)
+    {
+        sqlite_int64 pos = iOfst + done;
+        vfsc_logext ext;
+        int found = 0;
+        int epoch;
+        int n;
+        int i;
+
+        sqlite3_mutex_enter(pDb->mutex);
+        epoch = pLog->epoch;
+        if (pos >= pLog->logicalSize)
+        {
+            sqlite3_mutex_leave(pDb->mutex);
+            break;
+        }
+
+        n = (int)MIN(iAmt - done, pLog->logicalSize - pos);
+        i = LogFind(pLog, pos);
+        if (i < pLog->nExt && pLog->aExt[i].offset <= pos)
+        {
+            ext = pLog->aExt[i];
+            n = (int)MIN(n, ext.offset + ext.length - pos);
+            found = 1;
+        }
+        else if (i < pLog->nExt)
+        {
+            n = (int)MIN(n, pLog->aExt[i].offset - pos);
+        }
+        sqlite3_mutex_leave(pDb->mutex);
+
+        if (!found)
+        {
+            memset(zBuf + done, 0, n);
+            done += n;
+            continue;
+        }
+
+        // Read without the mutex, then check the record didn't move.
+        rc = LogReadExtent(pFile, pCodec, &ext, (int)(pos - ext.offset), n, zBuf + done);
+        sqlite3_mutex_enter(pDb->mutex);
+        if (pLog->epoch != epoch)
+        {
+            rc = SQLITE_OK;
+            n = 0;
+        }
+        sqlite3_mutex_leave(pDb->mutex);
+        done += n;
+    }
+
+    PutCodec(pDb, pCodec);
+    if (rc == SQLITE_OK && done < iAmt)
+    {
+        memset(zBuf + done, 0, iAmt - done);
+        rc = SQLITE_IOERR_SHORT_READ;
+    }
+
+    return rc;
+}
+
+/*
+** Copies the live data of the log into records from offset pos, which
+** must not reach limit unless it's 0, and sets the index of the copy in
+** pCopy. The copied records keep their boundaries, so reads stay as
+** small as they were.
+** The caller must hold the database mutex.
+*/
+static int LogRewrite(vfsc_file *pFile, vfsc_codec *pCodec, sqlite_int64 pos,
+                      sqlite_int64 limit, vfsc_log *pCopy)
+{
+    vfsc_log *pLog = &pFile->pDb->log;
+    unsigned char *aRec = (unsigned char*)pCodec->pCompData;
+    char *pData = (char*)sqlite3_malloc(LOG_RECORD_MAX);
+    int rc = pData != NULL ? SQLITE_OK : SQLITE_NOMEM;
+    int i;
+
+    pCopy->startSeq = pLog->seq;
+    pCopy->end = pos;
+    for (i = 0; i < pLog->nExt && rc == SQLITE_OK; ++i)
+    {
+        vfsc_logext *pExt = &pLog->aExt[i];
+        vfsc_logext ext;
+        int type;
+        int stored;
+
+        if (pExt->skip == 0 && pExt->length == pExt->origSize)
+        {
+            // Copy the whole record as it is.
+            type = pExt->raw ? RecordRaw : RecordEncoded;
+            stored = pExt->stored;
+            rc = pFile->pReal->pMethods->xRead(pFile->pReal, aRec + LOG_RECORD_HEADER_SIZE, stored,
+                                               pExt->record + LOG_RECORD_HEADER_SIZE);
+        }
+        else
+        {
+            rc = LogReadExtent(pFile, pCodec, pExt, 0, pExt->length, pData);
+            type = LogEncode(pFile->pDb, pCodec, pData, pExt->length, &stored);
+        }
+
+        if (rc == SQLITE_OK && limit != 0 && pCopy->end + LOG_RECORD_HEADER_SIZE + stored > limit)
+        {
+            rc = SQLITE_FULL;
+        }
+
+        if (rc == SQLITE_OK)
+        {
+            rc = LogReserve(pCopy);
+        }
+
+        if (rc == SQLITE_OK)
+        {
+            rc = LogPutRecord(pFile, aRec, type, pLog->seq++, pExt->offset, pExt->length, stored, pCopy->end);
+        }
+
+        if (rc == SQLITE_OK)
+        {
+            ext.offset = pExt->offset;
+            ext.record = pCopy->end;
+            ext.length = pExt->length;
+            ext.skip = 0;
+            ext.origSize = pExt->length;
+            ext.stored = stored;
+            ext.raw = (type == RecordRaw);
+            LogMap(pCopy, &ext);
+            pCopy->end += LOG_RECORD_HEADER_SIZE + stored;
+        }
+    }
+
+    // The size may extend past the data.
+    pCopy->logicalSize = pCopy->nExt > 0 ? pCopy->aExt[pCopy->nExt - 1].offset + pCopy->aExt[pCopy->nExt - 1].length : 0;
+    if (rc == SQLITE_OK && pCopy->logicalSize != pLog->logicalSize)
+    {
+        if (limit != 0 && pCopy->end + LOG_RECORD_HEADER_SIZE > limit)
+        {
+            rc = SQLITE_FULL;
+        }
+        else
+        {
+            rc = LogPutRecord(pFile, aRec, RecordTruncate, pLog->seq++, pLog->logicalSize, 0, 0, pCopy->end);
+            pCopy->end += LOG_RECORD_HEADER_SIZE;
+            pCopy->logicalSize = pLog->logicalSize;
+        }
+    }
+
+    sqlite3_free(pData);
+    return rc;
+}
+
+/*
+** Compacts a log that grew well past its live records, which happens as
+** SQLite keeps overwriting the journal or WAL from the start.
+** The live records are copied to the unused space before the first
+** record if they fit, otherwise after the last one, and synced before
+** the header points at them, so a crash leaves either copy intact.
+** The space before the first record is reclaimed on the next compaction,
+** or right away when the copy is written there.
+** The caller must hold the database mutex.
+*/
+static int LogCompact(vfsc_file *pFile, vfsc_codec *pCodec)
+{
+    vfsc_log *pLog = &pFile->pDb->log;
+    sqlite3_file *pReal = pFile->pReal;
+    vfsc_log saved = *pLog;
+    vfsc_log copy;
+    sqlite_int64 live = 0;
+    sqlite_int64 pos;
+    int rc;
+    int i;
+
+    for (i = 0; i < pLog->nExt; ++i)
+    {
+        live += LOG_RECORD_HEADER_SIZE + (pLog->aExt[i].raw ? pLog->aExt[i].length : pLog->aExt[i].stored);
+    }
+
+    if (pLog->end - pLog->start <= LOG_COMPACT_FACTOR * live + LOG_COMPACT_MIN)
+    {
+        pLog->checkAt = pLog->start + LOG_COMPACT_FACTOR * live + LOG_COMPACT_MIN + 1;
+        return SQLITE_OK;
+    }
+
+    vfsc_printf(pFile->pInfo, Compression, "> Compacting log %s: %lld bytes, %lld live.\n",
+                pFile->zFName, pLog->end - pLog->start, live);
+
+    memset(&copy, 0, sizeof(copy));
+    pos = (pLog->start - LOG_DATA_START >= live) ? LOG_DATA_START : pLog->end;
+    rc = LogRewrite(pFile, pCodec, pos, pos == LOG_DATA_START ? pLog->start : 0, &copy);
+    if (rc == SQLITE_FULL)
+    {
+        // Compressed worse than estimated, append it instead.
+        copy.nExt = 0;
+        pos = pLog->end;
+        rc = LogRewrite(pFile, pCodec, pos, 0, &copy);
+    }
+
+    if (rc == SQLITE_OK)
+    {
+        rc = pReal->pMethods->xSync(pReal, SQLITE_SYNC_NORMAL);
+    }
+
+    if (rc == SQLITE_OK)
+    {
+        ++pLog->generation;
+        pLog->start = pos;
+        pLog->startSeq = copy.startSeq;
+        rc = LogWriteHeader(pFile);
+    }
+
+    if (rc == SQLITE_OK)
+    {
+        rc = pReal->pMethods->xSync(pReal, SQLITE_SYNC_NORMAL);
+    }
+
+    if (rc != SQLITE_OK)
+    {
+        // Keep the old records, the next header write replaces ours.
+        sqlite3_free(copy.aExt);
+        *pLog = saved;
+        pLog->trim = pLog->trim || pos == pLog->end;
+        pLog->checkAt = pLog->end + LOG_COMPACT_MIN;
+        return rc;
+    }
+
+    // The old records are garbage now, readers must look them up again.
+    sqlite3_free(pLog->aExt);
+    pLog->aExt = copy.aExt;
+    pLog->nExt = copy.nExt;
+    pLog->nExtAlloc = copy.nExtAlloc;
+    pLog->end = copy.end;
+    pLog->trim = 0;
+    ++pLog->epoch;
+    if (pos == LOG_DATA_START)
+    {
+        pLog->trim = (pReal->pMethods->xTruncate(pReal, pLog->end) != SQLITE_OK);
+    }
+
+    pLog->checkAt = pLog->end + LOG_COMPACT_MIN;
+    return SQLITE_OK;
+}
+
+/*
+** Writes to a file in the log layout, a record per LOG_RECORD_MAX bytes.
+*/
+static int LogWrite(vfsc_file *pFile, const char *zBuf, int iAmt, sqlite_int64 iOfst)
+{
+    vfsc_db *pDb = pFile->pDb;
+    vfsc_codec *pCodec = GetCodec(pDb);
+    int done = 0;
+    int rc = SQLITE_OK;
+
+    if (pCodec == NULL)
+    {
+        return SQLITE_NOMEM;
+    }
+
+    while (done < iAmt && rc == SQLITE_OK)
+    {
+        int n = MIN(iAmt - done, LOG_RECORD_MAX);
+        int stored;
+        int type = LogEncode(pDb, pCodec, zBuf + done, n, &stored);
+
+        sqlite3_mutex_enter(pDb->mutex);
+        rc = LogAppend(pFile, (unsigned char*)pCodec->pCompData, type, iOfst + done, n, stored);
+        sqlite3_mutex_leave(pDb->mutex);
+        done += n;
+    }
+
+    sqlite3_mutex_enter(pDb->mutex);
+    if (rc == SQLITE_OK && pDb->log.end >= pDb->log.checkAt)
+    {
+        rc = LogCompact(pFile, pCodec);
+    }
+    sqlite3_mutex_leave(pDb->mutex);
+
+    PutCodec(pDb, pCodec);
+    return rc;
+}
+
+/*
+** Truncates a file in the log layout. Emptying it truncates the file,
+** any other size is recorded.
+*/
+static int LogTruncate(vfsc_file *pFile, sqlite_int64 size)
+{
+    vfsc_db *pDb = pFile->pDb;
+    vfsc_log *pLog = &pDb->log;
+    unsigned char aRec[LOG_RECORD_HEADER_SIZE];
+    int rc = SQLITE_OK;
+
+    sqlite3_mutex_enter(pDb->mutex);
+    if (size == 0)
+    {
+        rc = pFile->pReal->pMethods->xTruncate(pFile->pReal, 0);
+        if (rc == SQLITE_OK)
+        {
+            // The header is written again with the next record.
+            pLog->nExt = 0;
+            pLog->logicalSize = 0;
+            pLog->end = 0;
+            pLog->trim = 0;
+            pLog->checkAt = LOG_DATA_START + LOG_COMPACT_MIN;
+            ++pLog->epoch;
+        }
+    }
+    else if (size != pLog->logicalSize)
+    {
+        rc = LogAppend(pFile, aRec, RecordTruncate, size, 0, 0);
+    }
+    sqlite3_mutex_leave(pDb->mutex);
+
+    return rc;
+}
+
+/*
+** Replays the records of a file in the log layout to rebuild its index.
+** A new file gets its header with the first record.
+** The caller must hold the master mutex.
+*/
+static int LogOpen(vfsc_file *pFile, int isNew)
+{
+    vfsc_db *pDb = pFile->pDb;
+    vfsc_log *pLog = &pDb->log;
+    sqlite3_file *pReal = pFile->pReal;
+    unsigned char aBuf[LOG_DATA_START];
+    unsigned char *aSlot = NULL;
+    unsigned char *aRec;
+    vfsc_codec *pCodec;
+    sqlite_int64 size;
+    int rc;
+    int i;
+
+    memset(pLog, 0, sizeof(*pLog));
+    pLog->seq = 1;
+    pLog->checkAt = LOG_DATA_START + LOG_COMPACT_MIN;
+    if (isNew)
+    {
+        return SQLITE_OK;
+    }
+
+    rc = pReal->pMethods->xFileSize(pReal, &size);
+    if (rc == SQLITE_OK)
+    {
+        memset(aBuf, 0, sizeof(aBuf));
+        rc = pReal->pMethods->xRead(pReal, aBuf, LOG_DATA_START, 0);
+    }
+
+    if (rc != SQLITE_OK && rc != SQLITE_IOERR_SHORT_READ)
+    {
+        return rc;
+    }
+
+    // Use the valid slot with the highest generation.
+    for (i = 0; i < 2; ++i)
+    {
+        unsigned char *aCandidate = &aBuf[i * LOG_SLOT_SIZE];
+        if (LogIsHeader(aCandidate) &&
+            (aSlot == NULL || Get8byte(&aCandidate[16]) > Get8byte(&aSlot[16])))
+        {
+            aSlot = aCandidate;
+        }
+    }
+
+    if (aSlot == NULL)
+    {
+        return SQLITE_CORRUPT;
+    }
+
+    pLog->generation = Get8byte(&aSlot[16]);
+    pLog->start = Get8byte(&aSlot[24]);
+    pLog->startSeq = Get8byte(&aSlot[32]);
+    pLog->seq = pLog->startSeq;
+    pLog->end = pLog->start;
+
+    pCodec = GetCodec(pDb);
+    if (pCodec == NULL)
+    {
+        return SQLITE_NOMEM;
+    }
+
+    // Replay the records up to the first that doesn't check out.
+    aRec = (unsigned char*)pCodec->pCompData;
+    rc = SQLITE_OK;
+    while (rc == SQLITE_OK)
+    {
+        vfsc_logext ext;
+        int type;
+        int origSize;
+        int stored;
+
+        if (pLog->end + LOG_RECORD_HEADER_SIZE > size ||
+            pReal->pMethods->xRead(pReal, aRec, LOG_RECORD_HEADER_SIZE, pLog->end) != SQLITE_OK)
+        {
+            break;
+        }
+
+        type = aRec[1];
+        origSize = (int)sqlite3Get4byte(&aRec[24]);
+        stored = (int)sqlite3Get4byte(&aRec[28]);
+        if (aRec[0] != LOG_RECORD_MAGIC || Get8byte(&aRec[8]) != pLog->seq ||
+            type < RecordRaw || type > RecordTruncate ||
+            origSize < 0 || origSize > LOG_RECORD_MAX ||
+            stored < 0 || stored > pCodec->compDataSize - LOG_RECORD_HEADER_SIZE ||
+            (type == RecordRaw && stored != origSize) ||
+            (type == RecordTruncate && stored != 0) ||
+            pLog->end + LOG_RECORD_HEADER_SIZE + stored > size)
+        {
+            break;
+        }
+
+        if ((stored > 0 && pReal->pMethods->xRead(pReal, aRec + LOG_RECORD_HEADER_SIZE, stored,
+                                                  pLog->end + LOG_RECORD_HEADER_SIZE) != SQLITE_OK) ||
+            sqlite3Get4byte(&aRec[4]) != (u32)crc32(0, aRec + 8, LOG_RECORD_HEADER_SIZE - 8 + stored))
+        {
+            break;
+        }
+
+        rc = LogReserve(pLog);
+        if (rc != SQLITE_OK)
+        {
+            break;
+        }
+
+        if (type == RecordTruncate)
+        {
+            LogCut(pLog, Get8byte(&aRec[16]));
+        }
+        else
+        {
+            ext.offset = Get8byte(&aRec[16]);
+            ext.record = pLog->end;
+            ext.length = origSize;
+            ext.skip = 0;
+            ext.origSize = origSize;
+            ext.stored = stored;
+            ext.raw = (type == RecordRaw);
+            LogMap(pLog, &ext);
+            pLog->logicalSize = MAX(pLog->logicalSize, ext.offset + origSize);
+        }
+
+        ++pLog->seq;
+        pLog->end += LOG_RECORD_HEADER_SIZE + stored;
+    }
+
+    PutCodec(pDb, pCodec);
+    if (rc != SQLITE_OK)
+    {
+        return rc;
+    }
+
+    // What follows the last record was torn or is left from before.
+    pLog->trim = (pLog->end < size);
+    pLog->checkAt = pLog->end;
+    vfsc_printf(pFile->pInfo, OpenClose, "> Log %s: %lld bytes in %lld records.\n",
+                pFile->zFName, pLog->logicalSize, pLog->seq - pLog->startSeq);
+    return SQLITE_OK;
+}
+
+static void LogClose(vfsc_log *pLog)
+{
+    sqlite3_free(pLog->aExt);
+    memset(pLog, 0, sizeof(*pLog));
+}
+
+static sqlite_int64 LogLogicalSize(vfsc_db *pDb)
+{
+    sqlite_int64 size;
+    sqlite3_mutex_enter(pDb->mutex);
+    size = pDb->log.logicalSize;
+    sqlite3_mutex_leave(pDb->mutex);
+    return size;
+}
+
+/*
+** Allocates a slot of nByte from the chunk arena, from the free slots of
+** its size or else from the last segment, mapping a new one if it's full.
+** The slots of a size past the ARENA_CLASSES first ones, and those the
+** arena can't map, come from the heap instead.
+** Returns NULL if out of memory.
+*/
+static void *ArenaAlloc(int nByte)
+{
+    int size = (nByte + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+    vfsc_segment *pSegment;
+    void *p = NULL;
+    int i;
+
+    sqlite3_mutex_enter(Arena.mutex);
+    for (i = 0; i < ARENA_CLASSES && Arena.aClass[i].size != size; ++i);
+    if (i == ARENA_CLASSES)
+    {
+        for (i = 0; i < ARENA_CLASSES && Arena.aClass[i].size != 0; ++i);
+    }
+
+    if (i < ARENA_CLASSES && Arena.aClass[i].pFree != NULL)
+    {
+        p = Arena.aClass[i].pFree;
+        Arena.aClass[i].pFree = *(void**)p;
+    }
+    else if (i < ARENA_CLASSES)
+    {
+        pSegment = Arena.pSegment;
+        if (pSegment == NULL || pSegment->size - pSegment->used < (size_t)size)
+        {
+            // Each segment as large as all the others, rounded to huge pages.
+            sqlite3_int64 nMap = MIN(MAX(Arena.nMapped, ARENA_HUGE_PAGE), ARENA_SEGMENT_MAX);
+            nMap = (MAX(nMap, size) + ARENA_HUGE_PAGE - 1) & ~(sqlite3_int64)(ARENA_HUGE_PAGE - 1);
+            pSegment = (vfsc_segment*)sqlite3_malloc(sizeof(vfsc_segment));
+            if (pSegment != NULL)
+            {
+                pSegment->pBase = (char*)MapArena((size_t)nMap, Arena.eHugePages, &pSegment->isHuge);
+                if (pSegment->pBase == NULL)
+                {
+                    sqlite3_free(pSegment);
+                    pSegment = NULL;
+                }
+            }
+
+            if (pSegment != NULL)
+            {
+                pSegment->size = (size_t)nMap;
+                pSegment->used = 0;
+                pSegment->pNext = Arena.pSegment;
+                Arena.pSegment = pSegment;
+                Arena.nMapped += nMap;
+            }
+        }
+
+        if (pSegment != NULL)
+        {
+            p = pSegment->pBase + pSegment->used;
+            pSegment->used += size;
+        }
+    }
+
+    if (p != NULL)
+    {
+        Arena.aClass[i].size = size;
+        ++Arena.nSlot;
+    }
+    sqlite3_mutex_leave(Arena.mutex);
+
+    return p != NULL ? p : sqlite3_malloc(nByte);
+}
+
+/*
+** Frees a slot of nByte returned by ArenaAlloc. Once no slot is used, the
+** segments are unmapped, and the size classes are free for other sizes.
+*/
+static void ArenaFree(void *p, int nByte)
+{
+    int size = (nByte + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+    vfsc_segment *pSegment;
+    int i;
+
+    if (p == NULL)
+    {
+        return;
+    }
+
+    sqlite3_mutex_enter(Arena.mutex);
+    for (pSegment = Arena.pSegment;
+         pSegment != NULL && ((char*)p < pSegment->pBase || (char*)p >= pSegment->pBase + pSegment->size);
+         pSegment = pSegment->pNext);
+    if (pSegment == NULL)
+    {
+        sqlite3_mutex_leave(Arena.mutex);
+        sqlite3_free(p);
+        return;
+    }
+
+    for (i = 0; i < ARENA_CLASSES && Arena.aClass[i].size != size; ++i);
+    assert(i < ARENA_CLASSES);
+    *(void**)p = Arena.aClass[i].pFree;
+    Arena.aClass[i].pFree = p;
+    if (--Arena.nSlot == 0)
+    {
+        while (Arena.pSegment != NULL)
+        {
+            pSegment = Arena.pSegment;
+            Arena.pSegment = pSegment->pNext;
+            UnmapArena(pSegment->pBase, pSegment->size);
+            sqlite3_free(pSegment);
+        }
+
+        memset(Arena.aClass, 0, sizeof(Arena.aClass));
+        Arena.nMapped = 0;
+    }
+    sqlite3_mutex_leave(Arena.mutex);
+}
+
+/*
+** Frees a database that no file refers to anymore.
+** The caller must hold the master mutex.
+*/
+static void FreeDb(vfsc_db *pDb)
+{
+    if (pDb->pPrev)
+    {
+        pDb->pPrev->pNext = pDb->pNext;
+    }
+    else if (DbList == pDb)
+    {
+        DbList = pDb->pNext;
+    }
+
+    if (pDb->pNext)
+    {
+        pDb->pNext->pPrev = pDb->pPrev;
+    }
+
+    while (pDb->pLruFirst != NULL)
+    {
+        vfsc_chunk *pChunk = pDb->pLruFirst;
+        pDb->pLruFirst = pChunk->pLruNext;
+        sqlite3_free(pChunk->pCompData);
+        sqlite3_mutex_free(pChunk->mutex);
+        ArenaFree(pChunk, (int)sizeof(vfsc_chunk) + pDb->chunkSize);
+    }
+
+    AtomicAdd(CacheMemoryUsed, -pDb->nCache * (sqlite3_int64)(sizeof(vfsc_chunk) + pDb->chunkSize));
+    sqlite3_free(pDb->apHash);
+    while (pDb->pFreeCodec != NULL)
+    {
+        vfsc_codec *pCodec = pDb->pFreeCodec;
+        pDb->pFreeCodec = pCodec->pNext;
+        FreeCodec(pCodec);
+    }
+
+    PackedClose(&pDb->packed);
+    LogClose(&pDb->log);
+    DictFree(pDb->pDict);
+    sqlite3_free(pDb->aPagePolicy);
+    sqlite3_free(pDb->aWriteTime);
+    if (pDb->mutex != NULL)
+    {
+        sqlite3_mutex_free(pDb->mutex);
+    }
+
+    sqlite3_free(pDb);
+}
+
+/*
+** Finds the size of a sparse file. The file ends with the slot of its last
+** chunk, whose header has the uncompressed size of the chunk. The size of
+** older files, whose chunks have no header, is that of the file.
+*/
+static int SparseOpen(vfsc_file *pFile, int isNew)
+{
+    vfsc_db *pDb = pFile->pDb;
+    unsigned char aHeader[CHUNK_HEADER_SIZE];
+    sqlite_int64 fileSize = 0;
+    sqlite_int64 lastOffset;
+    int rc;
+
+    pDb->sparse.readSize = pDb->chunkSize / 4;
+    if (isNew)
+    {
+        pDb->sparse.logicalSize = 0;
+        return SQLITE_OK;
+    }
+
+    rc = pFile->pReal->pMethods->xFileSize(pFile->pReal, &fileSize);
+    if (rc != SQLITE_OK || fileSize == 0)
+    {
+        pDb->sparse.logicalSize = 0;
+        return rc;
+    }
+
+    pDb->sparse.logicalSize = fileSize;
+    lastOffset = (fileSize - 1) / pDb->chunkSize * pDb->chunkSize;
+    rc = pFile->pReal->pMethods->xRead(pFile->pReal, aHeader, CHUNK_HEADER_SIZE, lastOffset);
+    if (rc == SQLITE_OK && aHeader[0] == CHUNK_MAGIC)
+    {
+        u32 origSize = sqlite3Get4byte(&aHeader[8]);
+        if (origSize > 0 && origSize <= (u32)pDb->chunkSize)
+        {
+            pDb->sparse.logicalSize = lastOffset + origSize;
+        }
+    }
+
+    return rc == SQLITE_IOERR_SHORT_READ ? SQLITE_OK : rc;
+}
+
+/*
+** Returns the uncompressed size of a sparse file.
+*/
+static sqlite_int64 SparseLogicalSize(vfsc_db *pDb)
+{
+    sqlite_int64 size;
+    sqlite3_mutex_enter(pDb->mutex);
+    size = pDb->sparse.logicalSize;
+    sqlite3_mutex_leave(pDb->mutex);
+    return size;
+}
+
+/*
+** Creates the shared state of a database that isn't open yet, loading the
+** packed header and index, replaying the log or finding the size of a
+** sparse file if needed, and attaches it to pFile.
+** The caller must hold the master mutex.
+*/
+static int NewDb(vfsc_file *pFile, const char *zPath, Layout layout, int isEmpty)
+{
+    int nPath = strlen(zPath);
+    const char *zCodec = NULL;
+    const char *zJournal = NULL;
+    const char *zLayout = NULL;
+    vfsc_db *pDb;
+    int rc = SQLITE_OK;
+
+    pDb = (vfsc_db*)sqlite3_malloc(sizeof(vfsc_db) + nPath + 1);
+    if (pDb == NULL)
+    {
+        return SQLITE_NOMEM;
+    }
+
+    memset(pDb, 0, sizeof(vfsc_db));
+    pDb->zPath = (char*)&pDb[1];
+    memcpy(pDb->zPath, zPath, nPath + 1);
+    pDb->nRef = 1;
+    pDb->layout = layout;
+    pDb->chunkSize = ChunkSizeBytes;
+    pDb->cacheBytes = CacheSizeBytes;
+    pDb->level = CompressionLevel;
+    if (layout == LayoutLog)
+    {
+        // Journal names have no URI parameters, the caller sets the codec.
+        pDb->chunkSize = LOG_RECORD_MAX;
+    }
+    else
+    {
+        zCodec = sqlite3_uri_parameter(zPath, "compress_codec");
+        zJournal = sqlite3_uri_parameter(zPath, "compress_journal");
+        zLayout = sqlite3_uri_parameter(zPath, "compress_layout");
+    }
+
+    pDb->compressLogs = zJournal == NULL || sqlite3GetBoolean(zJournal);
+    pDb->codec = zCodec != NULL ? FindCodec(zCodec) : 0;
+    if (pDb->codec < 0)
+    {
+        vfsc_printf(pFile->pInfo, OpenClose, "> Codec %s isn't available, using %s.\n", zCodec, aCodec[0].zName);
+        pDb->codec = 0;
+    }
+
+    pDb->mutex = sqlite3_mutex_alloc(SQLITE_MUTEX_FAST);
+    pFile->pDb = pDb;
+    if (Arena.mutex == NULL)
+    {
+        Arena.mutex = sqlite3_mutex_alloc(SQLITE_MUTEX_FAST);
+    }
+
+    if (pDb->mutex == NULL || Arena.mutex == NULL)
+    {
+        rc = SQLITE_NOMEM;
+    }
+
+    if (rc == SQLITE_OK && layout == LayoutPacked)
+    {
+        // May change the chunk size to that of the file.
+        rc = PackedOpen(pFile, isEmpty, zLayout != NULL && sqlite3StrICmp(zLayout, "page") == 0);
+
+        // Keep using the dictionary, unless asked for another codec.
+        if (rc == SQLITE_OK && zCodec == NULL && pDb->pDict != NULL && FindCodec("zstd") >= 0)
+        {
+            pDb->codec = FindCodec("zstd");
+        }
+    }
+    else if (rc == SQLITE_OK && layout == LayoutLog)
+    {
+        rc = LogOpen(pFile, isEmpty);
+    }
+    else if (rc == SQLITE_OK && layout == LayoutSparse)
+    {
+        rc = SparseOpen(pFile, isEmpty);
+    }
+
+    if (rc == SQLITE_OK)
+    {
+        // Chunks are allocated as needed, only the hash table is upfront.
+        sqlite3_int64 cacheSize = 1 + pDb->cacheBytes / pDb->chunkSize;
+        pDb->cacheSize = (int)MIN(MAX(cacheSize, MIN_CACHE_SIZE), 0x7fffffff);
+        pDb->nHash = MIN_HASH_SIZE;
+
+        // Chunks of a page are read whole anyway, larger ones by blocks.
+        if (layout != LayoutLog && !pDb->packed.pageChunks)
+        {
+            pDb->blockShift = CHUNK_BLOCK_SHIFT;
+            while (((pDb->chunkSize - 1) >> pDb->blockShift) >= CHUNK_MAX_BLOCKS)
+            {
+                ++pDb->blockShift;
+            }
+
+            if (pDb->chunkSize <= (1 << pDb->blockShift))
+            {
+                pDb->blockShift = 0;
+            }
+        }
+
+        pDb->apHash = (vfsc_chunk**)sqlite3_malloc(pDb->nHash * sizeof(vfsc_chunk*));
+        if (pDb->apHash == NULL)
+        {
+            rc = SQLITE_NOMEM;
+        }
+        else
+        {
+            memset(pDb->apHash, 0, pDb->nHash * sizeof(vfsc_chunk*));
+        }
+    }
+
+    if (rc != SQLITE_OK)
+    {
+        FreeDb(pDb);
+        pFile->pDb = NULL;
+        return rc;
+    }
+
+    pDb->pNext = DbList;
+    if (DbList)
+    {
+        DbList->pPrev = pDb;
+    }
+
+    DbList = pDb;
+    return SQLITE_OK;
+}
+
+/*
+** Returns the hash bucket of a chunk offset.
+*/
+static int ChunkHash(vfsc_db *pDb, sqlite_int64 offset)
+{
+    return (int)((offset / pDb->chunkSize) % pDb->nHash);
+}
+
+/*
+** Returns the chunk cached at offset, or NULL.
+** The caller must hold the database mutex.
+*/
+static vfsc_chunk *HashFind(vfsc_db *pDb, sqlite_int64 offset)
+{
+    vfsc_chunk *pChunk = pDb->apHash[ChunkHash(pDb, offset)];
+    while (pChunk != NULL && pChunk->offset != offset)
+    {
+        pChunk = pChunk->pHashNext;
+    }
+
+    return pChunk;
+}
+
+/*
+** Sets the offset of a chunk, moving it to the matching hash bucket.
+** An offset of -1 takes the chunk out of the hash table.
+** The caller must hold the database mutex.
+*/
+static void HashSetOffset(vfsc_db *pDb, vfsc_chunk *pChunk, sqlite_int64 offset)
+{
+    if (pChunk->offset >= 0)
+    {
+        vfsc_chunk **pp = &pDb->apHash[ChunkHash(pDb, pChunk->offset)];
+        while (*pp != pChunk)
+        {
+            pp = &(*pp)->pHashNext;
+        }
+
+        *pp = pChunk->pHashNext;
+        pChunk->pHashNext = NULL;
+    }
+
+    pChunk->offset = offset;
+    if (offset >= 0)
+    {
+        int h = ChunkHash(pDb, offset);
+        pChunk->pHashNext = pDb->apHash[h];
+        pDb->apHash[h] = pChunk;
+    }
+}
+
+/*
+** Rehashes the cached chunks into nHash buckets.
+** The caller must hold the database mutex.
+*/
+static void ResizeHash(vfsc_db *pDb, int nHash)
+{
+    vfsc_chunk **apNew;
+    vfsc_chunk *pChunk;
+
+    apNew = (vfsc_chunk**)sqlite3_malloc(nHash * sizeof(vfsc_chunk*));
+    if (apNew == NULL)
+    {
+        return;
+    }
+
+    memset(apNew, 0, nHash * sizeof(vfsc_chunk*));
+    sqlite3_free(pDb->apHash);
+    pDb->apHash = apNew;
+    pDb->nHash = nHash;
+    for (pChunk = pDb->pLruFirst; pChunk != NULL; pChunk = pChunk->pLruNext)
+    {
+        if (pChunk->offset >= 0)
+        {
+            int h = ChunkHash(pDb, pChunk->offset);
+            pChunk->pHashNext = apNew[h];
+            apNew[h] = pChunk;
+        }
+    }
+}
+
+/*
+** Removes a chunk from the LRU list.
+** The caller must hold the database mutex.
+*/
+static void LruRemove(vfsc_db *pDb, vfsc_chunk *pChunk)
+{
+    if (pChunk->pLruPrev)
+    {
+        pChunk->pLruPrev->pLruNext = pChunk->pLruNext;
+    }
+    else
+    {
+        pDb->pLruFirst = pChunk->pLruNext;
+    }
+
+    if (pChunk->pLruNext)
+    {
+        pChunk->pLruNext->pLruPrev = pChunk->pLruPrev;
+    }
+    else
+    {
+        pDb->pLruLast = pChunk->pLruPrev;
+    }
+
+    pChunk->pLruNext = NULL;
+    pChunk->pLruPrev = NULL;
+}
+
+/*
+** Adds a chunk to the LRU list, as the most recently used one if recent
+** is set, otherwise as the least recently used, to be reused first.
+** The caller must hold the database mutex.
+*/
+static void LruInsert(vfsc_db *pDb, vfsc_chunk *pChunk, int recent)
+{
+    if (recent)
+    {
+        pChunk->pLruNext = pDb->pLruFirst;
+        if (pDb->pLruFirst)
+        {
+            pDb->pLruFirst->pLruPrev = pChunk;
+        }
+        else
+        {
+            pDb->pLruLast = pChunk;
+        }
+
+        pDb->pLruFirst = pChunk;
+    }
+    else
+    {
+        pChunk->pLruPrev = pDb->pLruLast;
+        if (pDb->pLruLast)
+        {
+            pDb->pLruLast->pLruNext = pChunk;
+        }
+        else
+        {
+            pDb->pLruFirst = pChunk;
+        }
+
+        pDb->pLruLast = pChunk;
+    }
+}
+
+/*
+** Marks a chunk as the most recently used.
+** The caller must hold the database mutex.
+*/
+static void LruTouch(vfsc_db *pDb, vfsc_chunk *pChunk)
+{
+    if (pDb->pLruFirst != pChunk)
+    {
+        LruRemove(pDb, pChunk);
+        LruInsert(pDb, pChunk, 1);
+    }
+}
+
+/*
+** Adds a chunk to the cache of a database if it's below its size and
+** the global memory limit allows it. With force set the limits are
+** ignored, for when every cached chunk is in use.
+** Returns the new chunk, or NULL if the cache can't grow.
+** The caller must hold the database mutex.
+*/
+static vfsc_chunk *GrowCache(vfsc_db *pDb, int force)
+{
+    sqlite3_int64 nByte = sizeof(vfsc_chunk) + pDb->chunkSize;
+    sqlite3_int64 used;
+    vfsc_chunk *pChunk;
+
+    if (!force && pDb->nCache >= pDb->cacheSize)
+    {
+        return NULL;
+    }
+
+    used = AtomicAdd(CacheMemoryUsed, nByte);
+    if (!force && pDb->nCache >= MIN_CACHE_SIZE &&
+        CacheMemoryLimit > 0 && used > CacheMemoryLimit)
+    {
+        AtomicAdd(CacheMemoryUsed, -nByte);
+        return NULL;
+    }
+
+    pChunk = (vfsc_chunk*)ArenaAlloc((int)nByte);
+    if (pChunk == NULL)
+    {
+        AtomicAdd(CacheMemoryUsed, -nByte);
+        return NULL;
+    }
+
+    memset(pChunk, 0, sizeof(vfsc_chunk));
+    pChunk->offset = -1;
+    pChunk->state = Empty;
+    pChunk->pOrigData = (char*)&pChunk[1];
+    pChunk->mutex = sqlite3_mutex_alloc(SQLITE_MUTEX_FAST);
+    if (pChunk->mutex == NULL)
+    {
+        ArenaFree(pChunk, (int)nByte);
+        AtomicAdd(CacheMemoryUsed, -nByte);
+        return NULL;
+    }
+
+    // A new chunk is free, so it's the first to reuse.
+    LruInsert(pDb, pChunk, 0);
+    ++pDb->nCache;
+    pDb->aStatus[SQLITE_COMPRESS_STATUS_CACHE_USED] = MAX(pDb->aStatus[SQLITE_COMPRESS_STATUS_CACHE_USED], pDb->nCache * nByte);
+    if (pDb->nCache > pDb->nHash)
+    {
+        // Keep the chains short. If this fails the old table still works.
+        ResizeHash(pDb, pDb->nHash * 2);
+    }
+
+    return pChunk;
+}
+
+/*
+** Frees the least recently used chunks past the size of the cache of a
+** database, unless they are in use or dirty, see SetCacheSize. It stops
+** at the first such chunk unless all is set.
+** The caller must hold the database mutex.
+*/
+static void ShrinkCache(vfsc_db *pDb, int all)
+{
+    vfsc_chunk *pChunk = pDb->pLruLast;
+    while (pChunk != NULL && pDb->nCache > pDb->cacheSize)
+    {
+        vfsc_chunk *pPrev = pChunk->pLruPrev;
+        if (pChunk->nPin == 0 && pChunk->state != Uncompressed && pChunk->state != Unwritten)
+        {
+            HashSetOffset(pDb, pChunk, -1);
+            LruRemove(pDb, pChunk);
+            sqlite3_free(pChunk->pCompData);
+            sqlite3_mutex_free(pChunk->mutex);
+            ArenaFree(pChunk, (int)sizeof(vfsc_chunk) + pDb->chunkSize);
+            --pDb->nCache;
+            AtomicAdd(CacheMemoryUsed, -(sqlite3_int64)(sizeof(vfsc_chunk) + pDb->chunkSize));
+        }
+        else if (!all)
+        {
+            break;
+        }
+
+        pChunk = pPrev;
+    }
+}
+
+/*
+** Releases the disk blocks of a range of a sparse file, or adds it to
+** pHoles to release along with others after the writes, if not NULL.
+*/
+static int SparsePunch(vfsc_file *pFile, sqlite_int64 offset, sqlite_int64 size, vfsc_ranges *pHoles)
+{
+    if (pHoles != NULL)
+    {
+        return RangesAdd(pHoles, offset, size);
+    }
+
+    vfsc_printf(pFile->pInfo, Trace, "> Sparse Range(%s, ofst=%lld, sz=%lld)\n",
+                pFile->zFName, offset, size);
+    SetSparseRange(pFile->hFile, offset, size);
+    return SQLITE_OK;
+}
+
+/*
+** Finds or adds the compression policy zSpec, CODEC[:LEVEL], "none" or
+** "default", setting *pPolicy to its id.
+** Returns SQLITE_ERROR if it's not valid, or if there are too many.
+*/
+static int SetPolicy(vfsc_db *pDb, const char *zSpec, int *pPolicy)
+{
+    const char *zLevel = strchr(zSpec, ':');
+    int nName = zLevel != NULL ? (int)(zLevel - zSpec) : (int)strlen(zSpec);
+    vfsc_policy policy;
+    char zName[16];
+    int rc = SQLITE_OK;
+    int i;
+
+    if (sqlite3StrICmp(zSpec, "default") == 0)
+    {
+        *pPolicy = 0;
+        return SQLITE_OK;
+    }
+
+    if (nName >= (int)sizeof(zName))
+    {
+        return SQLITE_ERROR;
+    }
+
+    memcpy(zName, zSpec, nName);
+    zName[nName] = '\0';
+    policy.level = zLevel != NULL ? atoi(&zLevel[1]) : CompressionLevel;
+    policy.codec = sqlite3StrICmp(zName, "none") == 0 ? pDb->codec : FindCodec(zName);
+    if (sqlite3StrICmp(zName, "none") == 0)
+    {
+        policy.level = 0;
+    }
+
+    if (policy.codec < 0 || policy.level < -1)
+    {
+        return SQLITE_ERROR;
+    }
+
+    sqlite3_mutex_enter(pDb->mutex);
+    for (i = 1; i < pDb->nPolicy; ++i)
+    {
+        if (pDb->aPolicy[i].codec == policy.codec && pDb->aPolicy[i].level == policy.level)
+        {
+            break;
+        }
+    }
+
+    if (i == POLICY_COUNT)
+    {
+        rc = SQLITE_ERROR;
+    }
+    else
+    {
+        // The first one is the database's own.
+        pDb->aPolicy[i] = policy;
+        pDb->nPolicy = MAX(pDb->nPolicy, i + 1);
+        *pPolicy = i;
+    }
+    sqlite3_mutex_leave(pDb->mutex);
+
+    return rc;
+}
+
+/*
+** Records the policy of a page the pager is writing, from aArg: its page
+** number, the page size and the policy id. See SQLITE_FCNTL_COMPRESS_PAGE.
+*/
+static int HintPage(vfsc_db *pDb, const int *aArg)
+{
+    int iPage = aArg[0] - 1;
+    int policy = aArg[2];
+    int rc = SQLITE_OK;
+
+    sqlite3_mutex_enter(pDb->mutex);
+    if (aArg[1] != pDb->policyPageSize)
+    {
+        // The page size changed, the pages were all rewritten.
+        sqlite3_free(pDb->aPagePolicy);
+        pDb->aPagePolicy = NULL;
+        pDb->nPagePolicy = 0;
+        pDb->policyPageSize = aArg[1];
+    }
+
+    if (policy < 0 || policy >= pDb->nPolicy)
+    {
+        policy = 0;
+    }
+
+    if (iPage >= pDb->nPagePolicy && policy != 0)
+    {
+        int nNew = MAX(iPage + 1, 2 * pDb->nPagePolicy);
+        u8 *aNew = (u8*)sqlite3_realloc(pDb->aPagePolicy, nNew);
+        if (aNew == NULL)
+        {
+            rc = SQLITE_NOMEM;
+        }
+        else
+        {
+            memset(&aNew[pDb->nPagePolicy], 0, nNew - pDb->nPagePolicy);
+            pDb->aPagePolicy = aNew;
+            pDb->nPagePolicy = nNew;
+        }
+    }
+
+    if (iPage >= 0 && iPage < pDb->nPagePolicy)
+    {
+        pDb->aPagePolicy[iPage] = (u8)policy;
+    }
+    sqlite3_mutex_leave(pDb->mutex);
+
+    return rc;
+}
+
+/*
+** Returns the policy of the page of the chunk at offset, see HintPage.
+** Only the page layout has policies, so the chunk is that page.
+** The caller must hold the mutex of the database.
+*/
+static int ChunkPolicy(vfsc_db *pDb, sqlite_int64 offset)
+{
+    int iPage;
+
+    if (pDb->nPagePolicy == 0)
+    {
+        return 0;
+    }
+
+    iPage = (int)(offset / pDb->policyPageSize);
+    return iPage < pDb->nPagePolicy ? pDb->aPagePolicy[iPage] : 0;
+}
+
+/*
+** Compresses a chunk into pCodec->pCompData with EncodeChunk, storing raw
+** the blocks that don't compress. A sparse chunk must fit its slot, so the
+** blocks that don't fit raw are compressed, and if that fails the whole
+** chunk is. The chunk is compressed as its policy says, see ChunkPolicy.
+** Returns the size, or -1 on failure, or if it doesn't fit the slot.
+** The caller must have the chunk locked.
+*/
+static int PackChunk(vfsc_db *pDb, vfsc_codec *pCodec, vfsc_chunk *pChunk)
+{
+    int nOut = pDb->layout == LayoutSparse ? MIN(pCodec->compDataSize, pDb->chunkSize) : pCodec->compDataSize;
+    sqlite3_int64 start;
+    int policy;
+    int n;
+
+    sqlite3_mutex_enter(pDb->mutex);
+    policy = ChunkPolicy(pDb, pChunk->offset);
+    if (policy != 0)
+    {
+        // The dictionary goes with the codec and level of the database.
+        pCodec->codec = pDb->aPolicy[policy].codec;
+        pCodec->level = pDb->aPolicy[policy].level;
+        pCodec->pDict = NULL;
+    }
+    sqlite3_mutex_leave(pDb->mutex);
+
+    start = StatTimer();
+    n = EncodeChunk(pCodec, pDb->blockShift, &pChunk->raw, pChunk->pOrigData, pChunk->origSize,
+                    pCodec->pCompData, nOut);
+    if (n < 0 && nOut < pCodec->compDataSize)
+    {
+        // A sparse slot has no room for a whole raw chunk and its header,
+        // so compress it after all.
+        pChunk->raw = 0;
+        pCodec->level = pCodec->level == 0 ? -1 : pCodec->level;
+        n = EncodeChunk(pCodec, pDb->blockShift, NULL, pChunk->pOrigData, pChunk->origSize,
+                        pCodec->pCompData, pCodec->compDataSize);
+    }
+
+    if (pDb->layout == LayoutSparse && n > pDb->chunkSize)
+    {
+        n = -1;
+    }
+
+    StatCompress(pDb, pChunk->origSize, n, start);
+    return n;
+}
+
+/*
+** Records the time a chunk was written, in seconds since 1970, for the
+** compress_chunks table. The times are only kept while the database is
+** open. The caller must hold the database mutex.
+*/
+static void StampChunk(vfsc_db *pDb, sqlite_int64 offset)
+{
+    int iChunk = (int)(offset / pDb->chunkSize);
+    if (iChunk >= pDb->nWriteTime)
+    {
+        int nNew = MAX(iChunk + 1, pDb->nWriteTime * 2);
+        u32 *aNew = (u32*)sqlite3_realloc(pDb->aWriteTime, nNew * sizeof(u32));
+        if (aNew == NULL)
+        {
+            // The times are only informative.
+            return;
+        }
+
+        memset(&aNew[pDb->nWriteTime], 0, (nNew - pDb->nWriteTime) * sizeof(u32));
+        pDb->aWriteTime = aNew;
+        pDb->nWriteTime = nNew;
+    }
+
+    pDb->aWriteTime[iChunk] = (u32)time(NULL);
+}
+
+/*
+** Compresses and writes a chunk, unless a worker compressed it already.
+** A sparse chunk writes only its compressed bytes, and the rest of the
+** slot is released if it was in use (see SparsePunch). Nothing is synced.
+** The caller must have the chunk locked.
+*/
+static int FlushChunk(vfsc_file *pFile, vfsc_chunk *pChunk, vfsc_ranges *pHoles)
+{
+    vfsc_info *pInfo = pFile->pInfo;
+    vfsc_db *pDb = pFile->pDb;
+    vfsc_codec *pCodec = NULL;
+    const char *pCompData = pChunk->pCompData;
+    sqlite3_int64 start;
+    int rc = SQLITE_OK;
+
+	assert(pChunk != NULL);
+    if (pChunk->origSize > 0 && pChunk->state != Empty && pChunk->state != Cached)
+    {
+        if (pChunk->state != Unwritten || pCompData == NULL)
+        {
+            pCodec = GetCodec(pDb);
+            if (pCodec == NULL)
+            {
+                return SQLITE_NOMEM;
+            }
+
+            // Compress...
+            pChunk->compSize = PackChunk(pDb, pCodec, pChunk);
+            pCompData = pCodec->pCompData;
+            if (pChunk->compSize < 0)
+            {
+                PutCodec(pDb, pCodec);
+                return SQLITE_IOERR_WRITE;
+            }
+
+            vfsc_printf(pInfo, Compression, "Compressed %d into %d bytes from offset %lld.\n", pChunk->origSize, pChunk->compSize, pChunk->offset);
+        }
+
+        // Write the chunk.
+        vfsc_printf(pInfo, Compression, "> %s.Flush(%s,n=%d,ofst=%lld)  Chunk=%lld",
+            pInfo->zVfsName, pFile->zFName, pChunk->compSize, pChunk->offset, pChunk->offset);
+        start = TraceStart();
+        if (pFile->layout == LayoutPacked)
+        {
+            rc = PackedWriteChunk(pFile, pChunk, pCompData);
+        }
+        else
+        {
+            // The rest of the slot is a hole already, unless it had more.
+            rc = pFile->pReal->pMethods->xWrite(pFile->pReal, pCompData, pChunk->compSize, pChunk->offset);
+        }
+
+        if (pCodec != NULL)
+        {
+            PutCodec(pDb, pCodec);
+        }
+
+        sqlite3_free(pChunk->pCompData);
+        pChunk->pCompData = NULL;
+        vfsc_print_errcode(pInfo, Compression, " -> %s\n", rc);
+        TraceEvent(pFile, TraceFlush, pChunk->offset, pChunk->compSize, start, rc);
+
+#ifdef ENABLE_STATISTICS
+		AtomicAdd(pDb->aStatus[SQLITE_COMPRESS_STATUS_WRITES], 1);
+		AtomicAdd(pDb->aStatus[SQLITE_COMPRESS_STATUS_WRITE_BYTES], pChunk->compSize);
+#endif
+
+        if (rc != SQLITE_OK)
+        {
+            // The compressed data is gone.
+            pChunk->state = Uncompressed;
+            return rc;
+        }
+
+        pChunk->state = Cached;
+        sqlite3_mutex_enter(pDb->mutex);
+        StampChunk(pDb, pChunk->offset);
+        sqlite3_mutex_leave(pDb->mutex);
+        if (pFile->layout == LayoutSparse && pChunk->compSize < pChunk->diskSize)
+        {
+            rc = SparsePunch(pFile, pChunk->offset + pChunk->compSize, pChunk->diskSize - pChunk->compSize, pHoles);
+        }
+
+        pChunk->diskSize = pChunk->compSize;
+    }
+    else
+    {
+        //vfsc_printf(pInfo, Trace, "> SKIPPED %s.Flush(%s,n=%d,ofst=%lld)\n",
+            //pInfo->zVfsName, pFile->zFName, pChunk->compSize, pChunk->offset);
+    }
+
+    return rc;
+}
+
+/*
+** Unlocks and unpins a chunk returned by GetCache.
+*/
+static void ReleaseCache(vfsc_db *pDb, vfsc_chunk *pChunk)
+{
+    sqlite3_mutex_leave(pChunk->mutex);
+    sqlite3_mutex_enter(pDb->mutex);
+    --pChunk->nPin;
+    sqlite3_mutex_leave(pDb->mutex);
+}
+
+/*
+** Decompresses the blocks of a chunk that hold n bytes at offset, unless
+** they were already. ReadCache leaves the blocks of a chunk compressed,
+** so that reads decompress only what they need, and the chunk fills as
+** it is read. Writers fill the whole chunk first.
+** The caller must have the chunk locked.
+*/
+static int FillChunk(vfsc_db *pDb, vfsc_chunk *pChunk, int offset, int n)
+{
+    const unsigned char *aHdr = (const unsigned char*)pChunk->pCompData;
+    vfsc_codec *pCodec;
+    sqlite3_int64 start;
+    u32 mask = 0;
+    int rc = SQLITE_OK;
+    int i;
+
+    if (pChunk->missing == 0)
+    {
+        return SQLITE_OK;
+    }
+
+    for (i = offset >> aHdr[3]; i < CHUNK_MAX_BLOCKS && i <= (offset + MAX(n, 1) - 1) >> aHdr[3]; ++i)
+    {
+        mask |= 1u << i;
+    }
+
+    mask &= pChunk->missing;
+    if (mask == 0)
+    {
+        return SQLITE_OK;
+    }
+
+    pCodec = GetCodec(pDb);
+    if (pCodec == NULL)
+    {
+        return SQLITE_NOMEM;
+    }
+
+    start = StatTimer();
+    if (DecodeBlocks(pCodec, pChunk->pCompData, pChunk->pOrigData, mask) != 0)
+    {
+        rc = SQLITE_CORRUPT;
+    }
+    else
+    {
+        // The sizes of the blocks follow the header.
+        int blockSize = 1 << aHdr[3];
+        int nIn = 0;
+        int nOut = 0;
+        for (i = 0; i < CHUNK_MAX_BLOCKS && (mask >> i) != 0; ++i)
+        {
+            if (mask & (1u << i))
+            {
+                nIn += (int)(sqlite3Get4byte(&aHdr[CHUNK_HEADER_SIZE + 4 * i]) & ~CHUNK_BLOCK_RAW);
+                nOut += MIN(blockSize, pChunk->origSize - i * blockSize);
+            }
+        }
+
+        StatDecompress(pDb, nIn, nOut, start);
+    }
+
+    PutCodec(pDb, pCodec);
+    if (rc == SQLITE_OK)
+    {
+        pChunk->missing &= ~mask;
+        if (pChunk->missing == 0)
+        {
+            sqlite3_free(pChunk->pCompData);
+            pChunk->pCompData = NULL;
+        }
+    }
+
+    return rc;
+}
+
+#if SQLITE_THREADSAFE
+
+/*
+** Compresses a dirty chunk into memory, to be written by FlushChunk.
+** The caller must have the chunk locked.
+*/
+static int CompressChunk(vfsc_db *pDb, vfsc_chunk *pChunk)
+{
+    vfsc_codec *pCodec;
+
+    if (pChunk->state != Uncompressed || pChunk->origSize <= 0)
+    {
+        return SQLITE_OK;
+    }
+
+    pCodec = GetCodec(pDb);
+    if (pCodec == NULL)
+    {
+        return SQLITE_NOMEM;
+    }
+
+    sqlite3_free(pChunk->pCompData);
+    pChunk->pCompData = NULL;
+    pChunk->compSize = PackChunk(pDb, pCodec, pChunk);
+    if (pChunk->compSize < 0)
+    {
+        PutCodec(pDb, pCodec);
+        return SQLITE_IOERR_WRITE;
+    }
+
+    pChunk->pCompData = (char*)sqlite3_malloc(pChunk->compSize);
+    if (pChunk->pCompData != NULL)
+    {
+        memcpy(pChunk->pCompData, pCodec->pCompData, pChunk->compSize);
+        pChunk->state = Unwritten;
+    }
+
+    PutCodec(pDb, pCodec);
+    return pChunk->pCompData != NULL ? SQLITE_OK : SQLITE_NOMEM;
+}
+
+/*
+** Compresses, or decompresses, the chunk of a job, then unpins it and
+** frees the job.
+*/
+static void RunJob(vfsc_job *pJob)
+{
+    vfsc_db *pDb = pJob->pDb;
+
+    sqlite3_mutex_enter(pJob->pChunk->mutex);
+    if (pJob->fill)
+    {
+        // A failure is left for the reader to find.
+        FillChunk(pDb, pJob->pChunk, 0, pDb->chunkSize);
+    }
+    else
+    {
+        CompressChunk(pDb, pJob->pChunk);
+    }
+
+    ReleaseCache(pDb, pJob->pChunk);
+    sqlite3_free(pJob);
+
+    // Once the count drops the database may be freed.
+    NativeLock(&Pool.lock);
+    --pDb->nJob;
+    NativeCondBroadcast(&Pool.done);
+    NativeUnlock(&Pool.lock);
+}
+
+/*
+** Removes the next job from the queue, if any.
+** The caller must hold the pool lock.
+*/
+static vfsc_job *PopJob(void)
+{
+    vfsc_job *pJob = Pool.pFirst;
+    if (pJob != NULL)
+    {
+        Pool.pFirst = pJob->pNext;
+        if (Pool.pFirst == NULL)
+        {
+            Pool.pLast = NULL;
+        }
+    }
+
+    return pJob;
+}
+
+/*
+** The main loop of a background compression thread.
+*/
+#if SQLITE_OS_WIN
+static DWORD WINAPI WorkerMain(void *pArg)
+#else
+static void *WorkerMain(void *pArg)
+#endif
+{
+    vfsc_job *pJob;
+
+    UNUSED_PARAMETER(pArg);
+    NativeLock(&Pool.lock);
+    for (;;)
+    {
+        pJob = PopJob();
+        if (pJob != NULL)
+        {
+            NativeUnlock(&Pool.lock);
+            RunJob(pJob);
+            NativeLock(&Pool.lock);
+        }
+        else if (Pool.shutdown)
+        {
+            break;
+        }
+        else
+        {
+            NativeCondWait(&Pool.work, &Pool.lock);
+        }
+    }
+
+    NativeUnlock(&Pool.lock);
+    return 0;
+}
+
+/*
+** Returns the number of background threads to use.
+*/
+static int PoolSize(void)
+{
+    int nCpu = WorkerThreads;
+    if (nCpu < 0)
+    {
+#if SQLITE_OS_WIN
+        SYSTEM_INFO info;
+        GetSystemInfo(&info);
+        nCpu = (int)info.dwNumberOfProcessors - 1;
+#else
+        nCpu = (int)sysconf(_SC_NPROCESSORS_ONLN) - 1;
+#endif
+    }
+
+    return MIN(MAX(nCpu, 0), MAX_WORKER_THREADS);
+}
+
+/*
+** Starts the background threads if they aren't running.
+** Returns the number of running threads.
+** The caller must hold the master mutex.
+*/
+static int StartPool(void)
+{
+    int nThread;
+
+    if (!Pool.isInit)
+    {
+        NativeLockInit(&Pool.lock);
+        NativeCondInit(&Pool.work);
+        NativeCondInit(&Pool.done);
+        Pool.isInit = 1;
+    }
+
+    nThread = PoolSize();
+    NativeLock(&Pool.lock);
+    while (Pool.nThread < nThread)
+    {
+#if SQLITE_OS_WIN
+        Pool.aThread[Pool.nThread] = CreateThread(NULL, 0, WorkerMain, NULL, 0, NULL);
+        if (Pool.aThread[Pool.nThread] == NULL)
+#else
+        if (pthread_create(&Pool.aThread[Pool.nThread], NULL, WorkerMain, NULL) != 0)
+#endif
+        {
+            break;
+        }
+
+        ++Pool.nThread;
+    }
+
+    nThread = Pool.nThread;
+    NativeUnlock(&Pool.lock);
+    return nThread;
+}
+
+/*
+** Stops the background threads, once the queue is empty.
+** The caller must hold the master mutex.
+*/
+static void StopPool(void)
+{
+    int i;
+
+    if (Pool.nThread == 0)
+    {
+        return;
+    }
+
+    NativeLock(&Pool.lock);
+    Pool.shutdown = 1;
+    NativeCondBroadcast(&Pool.work);
+    NativeUnlock(&Pool.lock);
+    for (i = 0; i < Pool.nThread; ++i)
+    {
+#if SQLITE_OS_WIN
+        WaitForSingleObject(Pool.aThread[i], INFINITE);
+        CloseHandle(Pool.aThread[i]);
+#else
+        pthread_join(Pool.aThread[i], NULL);
+#endif
+    }
+
+    NativeLock(&Pool.lock);
+    Pool.nThread = 0;
+    Pool.shutdown = 0;
+    NativeUnlock(&Pool.lock);
+}
+
+/*
+** Queues a pinned chunk to be compressed in the background, or to be
+** decompressed if fill is set.
+** Returns zero if there are no threads, and the caller keeps the pin.
+** The caller must hold the database mutex.
+*/
+static int QueueJob(vfsc_db *pDb, vfsc_chunk *pChunk, int fill)
+{
+    vfsc_job *pJob;
+
+    pJob = (vfsc_job*)sqlite3_malloc(sizeof(vfsc_job));
+    if (pJob == NULL)
+    {
+        return 0;
+    }
+
+    pJob->pNext = NULL;
+    pJob->pDb = pDb;
+    pJob->pChunk = pChunk;
+    pJob->fill = fill;
+    NativeLock(&Pool.lock);
+    if (Pool.nThread == 0 || Pool.shutdown)
+    {
+        NativeUnlock(&Pool.lock);
+        sqlite3_free(pJob);
+        return 0;
+    }
+
+    if (Pool.pLast)
+    {
+        Pool.pLast->pNext = pJob;
+    }
+    else
+    {
+        Pool.pFirst = pJob;
+    }
+
+    Pool.pLast = pJob;
+    ++pDb->nJob;
+    NativeCondBroadcast(&Pool.work);
+    NativeUnlock(&Pool.lock);
+    return 1;
+}
+
+/*
+** Waits for the queued jobs of a database, running queued jobs meanwhile.
+*/
+static void WaitJobs(vfsc_db *pDb)
+{
+    vfsc_job *pJob;
+
+    if (!Pool.isInit)
+    {
+        return;
+    }
+
+    NativeLock(&Pool.lock);
+    while (pDb->nJob > 0)
+    {
+        pJob = PopJob();
+        if (pJob != NULL)
+        {
+            NativeUnlock(&Pool.lock);
+            RunJob(pJob);
+            NativeLock(&Pool.lock);
+        }
+        else
+        {
+            NativeCondWait(&Pool.done, &Pool.lock);
+        }
+    }
+
+    NativeUnlock(&Pool.lock);
+}
+
+/*
+** Returns the number of running background threads.
+*/
+static int PoolThreads(void)
+{
+    int nThread;
+
+    if (!Pool.isInit)
+    {
+        return 0;
+    }
+
+    NativeLock(&Pool.lock);
+    nThread = Pool.nThread;
+    NativeUnlock(&Pool.lock);
+    return nThread;
+}
+
+#else
+
+# define QueueJob(pDb, pChunk, fill)  0
+# define WaitJobs(pDb)
+# define StartPool()                  ((void)0)
+# define StopPool()
+# define PoolThreads()                0
+
+#endif /* SQLITE_THREADSAFE */
+
+/*
+** Compresses the chunks the least recently used end of the cache ahead
+** of their eviction, so the eviction only has to write them.
+** The caller must hold the database mutex.
+*/
+static void WriteBehind(vfsc_db *pDb)
+{
+    vfsc_chunk *pChunk = pDb->pLruLast;
+    int n;
+
+    if (pDb->nCache < 2 * WRITE_BEHIND_CHUNKS)
+    {
+        // Too small to tell the chunks in use from the old ones.
+        return;
+    }
+
+    for (n = 0; pChunk != NULL && n < WRITE_BEHIND_CHUNKS; ++n, pChunk = pChunk->pLruPrev)
+    {
+        // Only unpinned chunks, whose state is stable.
+        if (pChunk->nPin == 0 && pChunk->state == Uncompressed)
+        {
+            ++pChunk->nPin;
+            if (!QueueJob(pDb, pChunk, 0))
+            {
+                --pChunk->nPin;
+                return;
+            }
+        }
+    }
+}
+
+static int ChunkCompare(const void *a, const void *b)
+{
+    sqlite_int64 x = (*(vfsc_chunk* const*)a)->offset;
+    sqlite_int64 y = (*(vfsc_chunk* const*)b)->offset;
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+/*
+** Writes out the dirty chunks, compressing them in parallel on the
+** background threads and the calling thread. The writes are made in
+** file order and left for xSync to sync once.
+*/
+static int FlushCache(vfsc_file *pFile)
+{
+    vfsc_db *pDb = pFile->pDb;
+    vfsc_ranges holes;
+    vfsc_chunk **apDirty;
+    vfsc_chunk *pChunk;
+    int nDirty = 0;
+    int rc = SQLITE_OK;
+    int i;
+
+    if (pFile->layout == LayoutPlain || pFile->layout == LayoutLog)
+    {
+        return SQLITE_OK;
+    }
+
+    // Pin the dirty chunks, then flush them without the database mutex.
+    sqlite3_mutex_enter(pDb->mutex);
+    apDirty = (vfsc_chunk**)sqlite3_malloc(MAX(pDb->nCache, 1) * sizeof(vfsc_chunk*));
+    if (apDirty == NULL)
+    {
+        sqlite3_mutex_leave(pDb->mutex);
+        return SQLITE_NOMEM;
+    }
+
+    // The dirty chunks peak here, between syncs.
+    StatDirty(pDb);
+    for (pChunk = pDb->pLruFirst; pChunk != NULL; pChunk = pChunk->pLruNext)
+    {
+        // A pinned chunk may be getting dirty, FlushChunk checks it locked.
+        if (pChunk->nPin > 0 || pChunk->state == Uncompressed || pChunk->state == Unwritten)
+        {
+            ++pChunk->nPin;
+            apDirty[nDirty++] = pChunk;
+
+            // The job takes its own pin.
+            ++pChunk->nPin;
+            if (!QueueJob(pDb, pChunk, 0))
+            {
+                --pChunk->nPin;
+            }
+        }
+    }
+
+    // The offsets of pinned chunks don't change.
+    qsort(apDirty, nDirty, sizeof(vfsc_chunk*), ChunkCompare);
+    sqlite3_mutex_leave(pDb->mutex);
+
+    // Help compressing, then write them all out in file order, and only
+    // then release the unused parts of their slots.
+    WaitJobs(pDb);
+
+    memset(&holes, 0, sizeof(holes));
+    for (i = 0; i < nDirty; ++i)
+    {
+        sqlite3_mutex_enter(apDirty[i]->mutex);
+        if (rc == SQLITE_OK)
+        {
+            rc = FlushChunk(pFile, apDirty[i], &holes);
+        }
+        ReleaseCache(pDb, apDirty[i]);
+    }
+
+    for (i = 0; i < holes.n; ++i)
+    {
+        SparsePunch(pFile, holes.a[i].offset, holes.a[i].size, NULL);
+    }
+
+    if (pFile->layout == LayoutSparse && nDirty > 0)
+    {
+        // The last slot ends the file, as older versions expect.
+        sqlite_int64 end = (SparseLogicalSize(pDb) + pDb->chunkSize - 1) / pDb->chunkSize * pDb->chunkSize;
+        sqlite_int64 fileSize = 0;
+        if (rc == SQLITE_OK)
+        {
+            rc = pFile->pReal->pMethods->xFileSize(pFile->pReal, &fileSize);
+        }
+
+        if (rc == SQLITE_OK && fileSize < end)
+        {
+            rc = pFile->pReal->pMethods->xTruncate(pFile->pReal, end);
+        }
+
+        LogSparseFileSize(pFile);
+        LogSparseRanges(pFile);
+    }
+
+    RangesClear(&holes);
+    sqlite3_free(apDirty);
+    return rc;
+}
+
+/*
+** Loads a chunk from the file.
+** The caller must have the chunk locked.
+*/
+static int ReadCache(vfsc_file *pFile, sqlite_int64 chunkOffset, vfsc_chunk* pChunk)
+{
+    vfsc_db *pDb = pFile->pDb;
+    vfsc_codec *pCodec;
+    sqlite_int64 readOffset = chunkOffset;
+    int readSize = pDb->chunkSize;
+    int rc = SQLITE_OK;
+
+    if (pFile->layout == LayoutPacked)
+    {
+        // Read only the compressed extent, if the chunk was ever written.
+        vfsc_packed *pPacked = &pDb->packed;
+        int iChunk = (int)(chunkOffset / pDb->chunkSize);
+        readSize = 0;
+        sqlite3_mutex_enter(pDb->mutex);
+        if (iChunk < pPacked->nIndex && pPacked->aIndex[iChunk].offset != 0)
+        {
+            readOffset = pPacked->aIndex[iChunk].offset;
+            readSize = pPacked->aIndex[iChunk].compSize;
+        }
+        sqlite3_mutex_leave(pDb->mutex);
+    }
+    else if (pFile->layout == LayoutSparse)
+    {
+        // Guess the compressed size, the chunk header tells if it's more.
+        sqlite3_mutex_enter(pDb->mutex);
+        readSize = (MAX(pDb->sparse.readSize, 1) + SPARSE_READ_ALIGN - 1) & ~(SPARSE_READ_ALIGN - 1);
+        readSize = MIN(pDb->chunkSize, readSize);
+        sqlite3_mutex_leave(pDb->mutex);
+    }
+
+    pCodec = GetCodec(pDb);
+    if (pCodec == NULL)
+    {
+        return SQLITE_NOMEM;
+    }
+
+    if (readSize > pCodec->compDataSize)
+    {
+        PutCodec(pDb, pCodec);
+        return SQLITE_CORRUPT;
+    }
+
+    pCodec->pCompData[0] = 0;
+    if (readSize > 0)
+    {
+        rc = pFile->pReal->pMethods->xRead(pFile->pReal, pCodec->pCompData, readSize, readOffset);
+        if (rc == SQLITE_IOERR_READ || rc == SQLITE_FULL)
+        {
+            PutCodec(pDb, pCodec);
+            return rc;
+        }
+
+        if (rc == SQLITE_IOERR_SHORT_READ && pFile->layout == LayoutPacked)
+        {
+            // The index refers to bytes past the end of the file.
+            PutCodec(pDb, pCodec);
+            return SQLITE_CORRUPT;
+        }
+
+#ifdef ENABLE_STATISTICS
+        AtomicAdd(pDb->aStatus[SQLITE_COMPRESS_STATUS_READS], 1);
+        AtomicAdd(pDb->aStatus[SQLITE_COMPRESS_STATUS_READ_BYTES], readSize);
+#endif
+    }
+
+    if (pFile->layout == LayoutSparse && pCodec->pCompData[0] != 0)
+    {
+        // Read the rest of the chunk, all of it if it has no header.
+        const unsigned char *aHdr = (const unsigned char*)pCodec->pCompData;
+        int needed = pDb->chunkSize;
+        if (aHdr[0] == CHUNK_MAGIC)
+        {
+            needed = MIN(needed, CHUNK_HEADER_SIZE + (int)MIN(sqlite3Get4byte(&aHdr[4]), (u32)pDb->chunkSize));
+        }
+
+        if (needed > readSize)
+        {
+            rc = pFile->pReal->pMethods->xRead(pFile->pReal, pCodec->pCompData + readSize, needed - readSize, readOffset + readSize);
+            if (rc == SQLITE_IOERR_READ || rc == SQLITE_FULL)
+            {
+                PutCodec(pDb, pCodec);
+                return rc;
+            }
+
+#ifdef ENABLE_STATISTICS
+            AtomicAdd(pDb->aStatus[SQLITE_COMPRESS_STATUS_READS], 1);
+            AtomicAdd(pDb->aStatus[SQLITE_COMPRESS_STATUS_READ_BYTES], needed - readSize);
+#endif
+            readSize = needed;
+        }
+    }
+
+    if (pCodec->pCompData[0] == 0)
+    {
+        // The first byte should contain the length, hence can't be zero for compressed streams.
+        pChunk->compSize = 0;
+        pChunk->origSize = 0;
+        pChunk->diskSize = 0;
+        pChunk->state = Empty;
+        //memset(pChunk->pCompData, 0, ChunkSizeBytes);
+    }
+    else
+    {
+        const unsigned char *aHdr = (const unsigned char*)pCodec->pCompData;
+        int nComp = (int)sqlite3Get4byte(&aHdr[4]);
+        int nOrig = (int)sqlite3Get4byte(&aHdr[8]);
+
+        // Decoding sets it to the bytes the chunk really uses.
+        pChunk->compSize = readSize;
+        if (aHdr[0] == CHUNK_MAGIC && (aHdr[2] & CHUNK_FLAG_BLOCKS) != 0 &&
+            readSize >= CHUNK_HEADER_SIZE && nComp >= 0 && nComp <= readSize - CHUNK_HEADER_SIZE &&
+            nOrig > 0 && nOrig <= pDb->chunkSize && aHdr[3] >= CHUNK_BLOCK_SHIFT && aHdr[3] <= 30 &&
+            ((nOrig - 1) >> aHdr[3]) < CHUNK_MAX_BLOCKS)
+        {
+            // Keep the blocks for FillChunk to decompress as they are read.
+            int nBlock = ((nOrig - 1) >> aHdr[3]) + 1;
+            int i;
+            pChunk->compSize = CHUNK_HEADER_SIZE + nComp;
+            pChunk->origSize = nOrig;
+            pChunk->pCompData = (char*)sqlite3_malloc(pChunk->compSize);
+            if (pChunk->pCompData == NULL)
+            {
+                PutCodec(pDb, pCodec);
+                pChunk->origSize = 0;
+                return SQLITE_NOMEM;
+            }
+
+            memcpy(pChunk->pCompData, pCodec->pCompData, pChunk->compSize);
+            pChunk->missing = nBlock < 32 ? (1u << nBlock) - 1 : ~(u32)0;
+
+            // Rewriting the chunk probes the raw blocks before compressing them.
+            pChunk->raw = 0;
+            for (i = 0; i < nBlock && CHUNK_HEADER_SIZE + 4 * (i + 1) <= pChunk->compSize; ++i)
+            {
+                if (sqlite3Get4byte(&aHdr[CHUNK_HEADER_SIZE + 4 * i]) & CHUNK_BLOCK_RAW)
+                {
+                    pChunk->raw |= 1u << i;
+                }
+            }
+        }
+        else
+        {
+            sqlite3_int64 start = StatTimer();
+            pChunk->origSize = DecodeChunk(pCodec, pCodec->pCompData, &pChunk->compSize, pChunk->pOrigData, pDb->chunkSize);
+            pChunk->raw = aHdr[0] == CHUNK_MAGIC && (aHdr[2] & CHUNK_FLAG_RAW) != 0 ? 1 : 0;
+            if (pChunk->origSize >= 0)
+            {
+                StatDecompress(pDb, pChunk->compSize, pChunk->origSize, start);
+            }
+        }
+
+        if (pChunk->origSize < 0)
+        {
+            // Corrupt, or written by a codec that isn't compiled in.
+            PutCodec(pDb, pCodec);
+            pChunk->origSize = 0;
+            return SQLITE_CORRUPT;
+        }
+
+        pChunk->state = Cached;
+        pChunk->diskSize = pChunk->compSize;
+        if (pFile->layout == LayoutSparse)
+        {
+            // The next guess, a running average of the sizes read.
+            sqlite3_mutex_enter(pDb->mutex);
+            pDb->sparse.readSize += (pChunk->compSize - pDb->sparse.readSize) / 4;
+            sqlite3_mutex_leave(pDb->mutex);
+        }
+
+        vfsc_printf(pFile->pInfo, Compression, "> Decompressed %d bytes from offset %d.\n", pChunk->origSize, chunkOffset);
+    }
+
+    PutCodec(pDb, pCodec);
+    pChunk->offset = chunkOffset;
+    memset(pChunk->pOrigData + pChunk->origSize, 0, pDb->chunkSize - pChunk->origSize);
+
+    return rc;
+}
+
+/*
+** Finds the chunk in cache or reads from disk.
+** On success (SQLITE_OK or SQLITE_IOERR_SHORT_READ) the chunk is returned
+** pinned and locked, and must be given back with ReleaseCache.
+*/
+static int GetCache(vfsc_file *pFile, sqlite_int64 chunkOffset, vfsc_chunk** ppChunk)
+{
+    vfsc_db *pDb = pFile->pDb;
+    vfsc_chunk *pChunk;
+    sqlite3_int64 start;
+    int rc;
+
+    for (;;)
+    {
+        sqlite3_mutex_enter(pDb->mutex);
+        if (pDb->nCache > pDb->cacheSize)
+        {
+            // The cache was made smaller, give back what was written out.
+            ShrinkCache(pDb, 0);
+        }
+
+        pChunk = HashFind(pDb, chunkOffset);
+
+        // A pinned chunk may be loading, so it's a match even if empty.
+        // The state of a chunk is only stable when it isn't pinned.
+        if (pChunk != NULL && (pChunk->nPin > 0 || pChunk->state != Empty))
+        {
+            // Found.
+            ++pChunk->nPin;
+            LruTouch(pDb, pChunk);
+            sqlite3_mutex_leave(pDb->mutex);
+            sqlite3_mutex_enter(pChunk->mutex);
+            if (pChunk->offset == chunkOffset)
+            {
+#ifdef ENABLE_STATISTICS
+                AtomicAdd(pDb->aStatus[SQLITE_COMPRESS_STATUS_CACHE_HIT], 1);
+#endif
+                vfsc_printf(pFile->pInfo, Trace, "> Cache hit @ %lld.\n", chunkOffset);
+                *ppChunk = pChunk;
+                return SQLITE_OK;
+            }
+
+            // Its load failed, try again.
+            ReleaseCache(pDb, pChunk);
+            continue;
+        }
+
+        // Not cached. An empty chunk of this offset is free to reuse,
+        // otherwise take a free one, grow the cache if we may, or evict.
+        if (pChunk == NULL)
+        {
+            pChunk = pDb->pLruLast;
+            if (pChunk == NULL || pChunk->nPin > 0 || pChunk->state != Empty)
+            {
+                pChunk = GrowCache(pDb, 0);
+            }
+        }
+
+        if (pChunk == NULL)
+        {
+            // The least recently used chunk that isn't in use.
+            pChunk = pDb->pLruLast;
+            while (pChunk != NULL && pChunk->nPin > 0)
+            {
+                pChunk = pChunk->pLruPrev;
+            }
+
+            if (pChunk == NULL)
+            {
+                // Every chunk is in use by another file.
+                pChunk = GrowCache(pDb, 1);
+                if (pChunk == NULL)
+                {
+                    sqlite3_mutex_leave(pDb->mutex);
+                    return SQLITE_NOMEM;
+                }
+            }
+        }
+
+        if (pChunk->state == Uncompressed || pChunk->state == Unwritten)
+        {
+            // Flush it before it's reused, then look again.
+            vfsc_printf(pFile->pInfo, Trace, "> Cache miss @ %lld.\n", chunkOffset);
+#ifdef ENABLE_STATISTICS
+            AtomicAdd(pDb->aStatus[SQLITE_COMPRESS_STATUS_EVICTED_DIRTY], 1);
+#endif
+            ++pChunk->nPin;
+            sqlite3_mutex_leave(pDb->mutex);
+            sqlite3_mutex_enter(pChunk->mutex);
+            rc = FlushChunk(pFile, pChunk, NULL);
+            ReleaseCache(pDb, pChunk);
+            if (rc != SQLITE_OK)
+            {
+                return rc;
+            }
+
+            continue;
+        }
+
+        // Claim the target chunk, nobody can have it locked.
+#ifdef ENABLE_STATISTICS
+        if (pChunk->offset >= 0 && pChunk->offset != chunkOffset)
+        {
+            AtomicAdd(pDb->aStatus[SQLITE_COMPRESS_STATUS_EVICTED], 1);
+        }
+#endif
+        HashSetOffset(pDb, pChunk, chunkOffset);
+        LruTouch(pDb, pChunk);
+        sqlite3_free(pChunk->pCompData);
+        pChunk->pCompData = NULL;
+        pChunk->missing = 0;
+        pChunk->raw = 0;
+        pChunk->state = Empty;
+        pChunk->origSize = 0;
+        pChunk->compSize = 0;
+        ++pChunk->nPin;
+        sqlite3_mutex_enter(pChunk->mutex);
+        WriteBehind(pDb);
+        sqlite3_mutex_leave(pDb->mutex);
+        break;
+    }
+
+    // Load it, files looking for it wait on the chunk mutex.
+	vfsc_printf(pFile->pInfo, Trace, "> Cache load @ %lld.\n", chunkOffset);
+#ifdef ENABLE_STATISTICS
+    AtomicAdd(pDb->aStatus[SQLITE_COMPRESS_STATUS_CACHE_MISS], 1);
+#endif
+    start = TraceStart();
+    rc = ReadCache(pFile, chunkOffset, pChunk);
+    TraceEvent(pFile, TraceLoad, chunkOffset, pChunk->compSize, start, rc);
+    if (rc != SQLITE_OK && rc != SQLITE_IOERR_SHORT_READ)
+    {
+        // Make it free again, so those waiting for it look again.
+        sqlite3_mutex_enter(pDb->mutex);
+        HashSetOffset(pDb, pChunk, -1);
+        LruRemove(pDb, pChunk);
+        LruInsert(pDb, pChunk, 0);
+        pChunk->state = Empty;
+        sqlite3_mutex_leave(pDb->mutex);
+        ReleaseCache(pDb, pChunk);
+        return rc;
+    }
+
+    *ppChunk = pChunk;
+    return rc;
+}
+
+/*
+** Drops the cached chunks past a new end of the file, and trims the one
+** that straddles it, so that none of them is written back. The jobs of
+** the database are waited for, since they pin the chunks they compress.
+** The file is locked exclusively, so no other file uses those chunks.
+*/
+static int TruncateCache(vfsc_file *pFile, sqlite_int64 size)
+{
+    vfsc_db *pDb = pFile->pDb;
+    int tailSize = (int)(size % pDb->chunkSize);
+    vfsc_chunk *pChunk;
+    vfsc_chunk *pNext;
+    int rc;
+
+    if (tailSize > 0)
+    {
+        rc = GetCache(pFile, size - tailSize, &pChunk);
+        if (rc != SQLITE_OK && rc != SQLITE_IOERR_SHORT_READ)
+        {
+            return rc;
+        }
+
+        rc = FillChunk(pDb, pChunk, 0, pDb->chunkSize);
+        if (rc == SQLITE_OK && pChunk->origSize > tailSize)
+        {
+            memset(pChunk->pOrigData + tailSize, 0, pChunk->origSize - tailSize);
+            pChunk->origSize = tailSize;
+            pChunk->state = Uncompressed;
+        }
+
+        ReleaseCache(pDb, pChunk);
+        if (rc != SQLITE_OK)
+        {
+            return rc;
+        }
+    }
+
+    WaitJobs(pDb);
+    sqlite3_mutex_enter(pDb->mutex);
+    for (pChunk = pDb->pLruFirst; pChunk != NULL; pChunk = pNext)
+    {
+        pNext = pChunk->pLruNext;
+        if (pChunk->offset >= size && pChunk->nPin == 0)
+        {
+            // Free it to be reused first.
+            HashSetOffset(pDb, pChunk, -1);
+            LruRemove(pDb, pChunk);
+            LruInsert(pDb, pChunk, 0);
+            sqlite3_free(pChunk->pCompData);
+            pChunk->pCompData = NULL;
+            pChunk->missing = 0;
+            pChunk->state = Empty;
+            pChunk->origSize = 0;
+            pChunk->compSize = 0;
+        }
+    }
+    sqlite3_mutex_leave(pDb->mutex);
+
+    return SQLITE_OK;
+}
+
+/*
+** Truncates a packed file. The chunks past the new end are dropped from
+** the cache and the index, and the one that straddles it is trimmed.
+*/
+static int PackedTruncate(vfsc_file *pFile, sqlite_int64 size)
+{
+    vfsc_db *pDb = pFile->pDb;
+    vfsc_packed *pPacked = &pDb->packed;
+    int nChunk = (int)((size + pDb->chunkSize - 1) / pDb->chunkSize);
+    int rc;
+    int i;
+
+    if (size >= pPacked->logicalSize)
+    {
+        sqlite3_mutex_enter(pDb->mutex);
+        pPacked->logicalSize = size;
+        pPacked->dirty = 1;
+        sqlite3_mutex_leave(pDb->mutex);
+        return SQLITE_OK;
+    }
+
+    rc = TruncateCache(pFile, size);
+    if (rc != SQLITE_OK)
+    {
+        return rc;
+    }
+
+    sqlite3_mutex_enter(pDb->mutex);
+    for (i = nChunk; rc == SQLITE_OK && i < pPacked->nIndex; ++i)
+    {
+        rc = PackedFreeExtent(pPacked, &pPacked->aIndex[i]);
+    }
+
+    if (nChunk < pPacked->nIndex)
+    {
+        // The last block gets shorter, those past it are freed on commit.
+        pPacked->nIndex = nChunk;
+        pPacked->truncated = 1;
+        PackedTouchBlock(pPacked, nChunk);
+    }
+
+    pPacked->logicalSize = size;
+    pPacked->dirty = 1;
+    sqlite3_mutex_leave(pDb->mutex);
+    return rc;
+}
+
+/*
+** Truncates a sparse file. The chunks past the new end are dropped from
+** the cache and their slots from the file, the one that straddles it is
+** trimmed, and the rest of its slot is released when it's written back.
+*/
+static int SparseTruncate(vfsc_file *pFile, sqlite_int64 size)
+{
+    vfsc_db *pDb = pFile->pDb;
+    sqlite_int64 end = (size + pDb->chunkSize - 1) / pDb->chunkSize * pDb->chunkSize;
+    int rc = SQLITE_OK;
+
+    if (size < SparseLogicalSize(pDb))
+    {
+        rc = TruncateCache(pFile, size);
+        if (rc == SQLITE_OK)
+        {
+            rc = pFile->pReal->pMethods->xTruncate(pFile->pReal, end);
+        }
+    }
+
+    if (rc == SQLITE_OK)
+    {
+        sqlite3_mutex_enter(pDb->mutex);
+        pDb->sparse.logicalSize = size;
+        sqlite3_mutex_leave(pDb->mutex);
+    }
+
+    return rc;
+}
+
+/*
+** Returns the uncompressed size of a packed file.
+*/
+static sqlite_int64 PackedLogicalSize(vfsc_db *pDb)
+{
+    sqlite_int64 size;
+    sqlite3_mutex_enter(pDb->mutex);
+    size = pDb->packed.logicalSize;
+    sqlite3_mutex_leave(pDb->mutex);
+    return size;
+}
+
+/*
+** A new file in page mode takes its chunk size from the first write, a
+** whole page at a page boundary since only the pager writes to it.
+** Nothing else can use the chunk size while the file is empty and locked
+** for the write.
+*/
+static void PackedAdoptPageSize(vfsc_file *pFile, int iAmt, sqlite_int64 iOfst)
+{
+    vfsc_db *pDb = pFile->pDb;
+    vfsc_packed *pPacked = &pDb->packed;
+
+    sqlite3_mutex_enter(pDb->mutex);
+    if (iAmt != pDb->chunkSize && pPacked->logicalSize == 0 && pPacked->nIndex == 0 && pDb->nCache == 0 &&
+        iAmt >= MIN_PAGE_CHUNK_SIZE && iAmt <= SQLITE_MAX_PAGE_SIZE && (iAmt & (iAmt - 1)) == 0 &&
+        iOfst % iAmt == 0)
+    {
+        sqlite3_int64 cacheSize = 1 + pDb->cacheBytes / iAmt;
+        pDb->chunkSize = iAmt;
+        pDb->cacheSize = (int)MIN(MAX(cacheSize, MIN_CACHE_SIZE), 0x7fffffff);
+        pPacked->dirty = 1;
+        vfsc_printf(pFile->pInfo, Compression, "> Packed(%s) page size %d.\n", pFile->zFName, iAmt);
+    }
+    sqlite3_mutex_leave(pDb->mutex);
+}
+
+#ifdef VFSC_ENABLE_ZSTD
+/*
+** Trains a dictionary of up to nDict bytes on the pages of the first
+** nChunk chunks. The chunks are sampled evenly over the file, up to
+** DICTIONARY_SAMPLE_FACTOR times nDict bytes, and each page is a sample.
+*/
+static int SampleDictionary(vfsc_file *pFile, int nChunk, int pageSize, int nDict, vfsc_dict **ppDict)
+{
+    vfsc_db *pDb = pFile->pDb;
+    sqlite_int64 nBudget = (sqlite_int64)nDict * DICTIONARY_SAMPLE_FACTOR;
+    int nTake = (int)MIN(nChunk, (nBudget + pDb->chunkSize - 1) / pDb->chunkSize);
+    char *pSamples = (char*)sqlite3_malloc(nTake * pDb->chunkSize);
+    size_t *aSize = (size_t*)sqlite3_malloc(nTake * (pDb->chunkSize / pageSize + 1) * sizeof(size_t));
+    char *pData = (char*)sqlite3_malloc(nDict);
+    size_t nBytes = 0;
+    unsigned nSample = 0;
+    size_t n;
+    int rc = SQLITE_OK;
+    int i;
+
+    if (pSamples == NULL || aSize == NULL || pData == NULL)
+    {
+        rc = SQLITE_NOMEM;
+    }
+
+    for (i = 0; rc == SQLITE_OK && i < nTake; ++i)
+    {
+        vfsc_chunk *pChunk;
+        int done;
+
+        rc = GetCache(pFile, (sqlite_int64)i * nChunk / nTake * pDb->chunkSize, &pChunk);
+        if (rc != SQLITE_OK && rc != SQLITE_IOERR_SHORT_READ)
+        {
+            break;
+        }
+
+        rc = FillChunk(pDb, pChunk, 0, pDb->chunkSize);
+        if (rc != SQLITE_OK)
+        {
+            ReleaseCache(pDb, pChunk);
+            break;
+        }
+
+        for (done = 0; done < pChunk->origSize; done += pageSize)
+        {
+            aSize[nSample++] = MIN(pageSize, pChunk->origSize - done);
+        }
+
+        memcpy(pSamples + nBytes, pChunk->pOrigData, pChunk->origSize);
+        nBytes += pChunk->origSize;
+        ReleaseCache(pDb, pChunk);
+        rc = SQLITE_OK;
+    }
+
+    if (rc == SQLITE_OK)
+    {
+        n = ZDICT_trainFromBuffer(pData, nDict, pSamples, aSize, nSample);
+        if (ZDICT_isError(n))
+        {
+            // Typically too few samples.
+            vfsc_printf(pFile->pInfo, Error, "> %s.Train(%s) -> %s, %u samples.\n",
+                pFile->pInfo->zVfsName, pFile->zFName, ZDICT_getErrorName(n), nSample);
+            rc = SQLITE_ERROR;
+        }
+        else
+        {
+            int level;
+            sqlite3_mutex_enter(pDb->mutex);
+            level = pDb->level;
+            sqlite3_mutex_leave(pDb->mutex);
+            *ppDict = DictCreate(pData, (int)n, level);
+            rc = *ppDict != NULL ? SQLITE_OK : SQLITE_NOMEM;
+        }
+    }
+
+    sqlite3_free(pSamples);
+    sqlite3_free(aSize);
+    sqlite3_free(pData);
+    return rc;
+}
+#endif /* VFSC_ENABLE_ZSTD */
+
+/*
+** Compresses the chunks iFirst to iEnd - 1 of a database again, with the
+** codec, level and dictionary it writes with now, writes them out and
+** syncs, committing a packed file. The content doesn't change, only how
+** it's stored, so the caller only needs to keep other writers out. With
+** compact set the extents of a packed file are then moved into the space
+** the old ones left, see PackedCompact.
+*/
+static int RewriteChunks(vfsc_file *pFile, int iFirst, int iEnd, int compact)
+{
+    vfsc_db *pDb = pFile->pDb;
+    int rc = SQLITE_OK;
+    int i;
+
+    for (i = iFirst; rc == SQLITE_OK && i < iEnd; ++i)
+    {
+        vfsc_chunk *pChunk;
+        rc = GetCache(pFile, (sqlite_int64)i * pDb->chunkSize, &pChunk);
+        if (rc != SQLITE_OK && rc != SQLITE_IOERR_SHORT_READ)
+        {
+            break;
+        }
+
+        rc = FillChunk(pDb, pChunk, 0, pDb->chunkSize);
+        if (rc == SQLITE_OK && pChunk->state != Empty)
+        {
+            pChunk->state = Uncompressed;
+        }
+
+        ReleaseCache(pDb, pChunk);
+    }
+
+    if (rc == SQLITE_OK)
+    {
+        rc = FlushCache(pFile);
+    }
+
+    if (rc == SQLITE_OK && pFile->layout == LayoutPacked)
+    {
+        sqlite3_mutex_enter(pDb->mutex);
+        rc = PackedCommit(pFile, SQLITE_SYNC_NORMAL);
+        sqlite3_mutex_leave(pDb->mutex);
+        if (rc == SQLITE_OK)
+        {
+            rc = PackedSyncHeader(pFile, SQLITE_SYNC_NORMAL);
+        }
+    }
+    else if (rc == SQLITE_OK)
+    {
+        rc = pFile->pReal->pMethods->xSync(pFile->pReal, SQLITE_SYNC_NORMAL);
+    }
+
+    if (rc == SQLITE_OK && compact && pFile->layout == LayoutPacked)
+    {
+        rc = PackedCompact(pFile, SQLITE_SYNC_NORMAL);
+    }
+
+    return rc;
+}
+
+/*
+** Trains a dictionary for a packed database (see SampleDictionary), then
+** compresses all its chunks again with it and commits, so the file no
+** longer needs the dictionary it replaced.
+** aArg[0] is the page size, and aArg[1] the size of the dictionary, -1
+** for the default or 0 to drop the dictionary. It's set to the size of
+** the new one.
+** Returns SQLITE_NOTFOUND if the database can't have a dictionary.
+*/
+static int TrainDictionary(vfsc_file *pFile, int *aArg)
+{
+#ifdef VFSC_ENABLE_ZSTD
+    vfsc_db *pDb = pFile->pDb;
+    vfsc_dict *pDict = NULL;
+    int pageSize = aArg[0];
+    int nDict = aArg[1] < 0 ? DEF_DICTIONARY_SIZE : MIN(MAX(aArg[1], MIN_DICTIONARY_SIZE), MAX_DICTIONARY_SIZE);
+    int hasDict;
+    int nChunk;
+    int rc;
+
+    if (pFile->layout != LayoutPacked)
+    {
+        return SQLITE_NOTFOUND;
+    }
+
+    if (pageSize <= 0 || pageSize > pDb->chunkSize)
+    {
+        pageSize = pDb->chunkSize;
+    }
+
+    sqlite3_mutex_enter(pDb->mutex);
+    nChunk = (int)((pDb->packed.logicalSize + pDb->chunkSize - 1) / pDb->chunkSize);
+    hasDict = pDb->pDict != NULL && pDb->pDict->id != 0;
+    sqlite3_mutex_leave(pDb->mutex);
+
+    if (aArg[1] == 0)
+    {
+        // Drop the dictionary.
+        if (!hasDict)
+        {
+            return SQLITE_OK;
+        }
+
+        pDict = DictCreate(NULL, 0, 0);
+        rc = pDict != NULL ? SQLITE_OK : SQLITE_NOMEM;
+    }
+    else
+    {
+        rc = SampleDictionary(pFile, nChunk, pageSize, nDict, &pDict);
+    }
+
+    if (rc == SQLITE_OK)
+    {
+        rc = PackedSetDictionary(pFile, pDict);
+    }
+
+    // The workers compress with the new dictionary from now on.
+    if (rc == SQLITE_OK)
+    {
+        rc = RewriteChunks(pFile, 0, nChunk, 1);
+    }
+
+    if (rc == SQLITE_OK)
+    {
+        aArg[1] = pDict->nData;
+        vfsc_printf(pFile->pInfo, Compression, "> %s.Train(%s) dictionary=%u, size=%d, chunks=%d.\n",
+            pFile->pInfo->zVfsName, pFile->zFName, pDict->id, pDict->nData, nChunk);
+    }
+
+    return rc;
+#else
+    UNUSED_PARAMETER(pFile);
+    UNUSED_PARAMETER(aArg);
+    return SQLITE_NOTFOUND;
+#endif
+}
+
+/*
+** Sets the compression level of a database, and of its open journal and
+** WAL, to *pLevel unless it's below -1, then sets *pLevel to the level.
+** The chunks compressed from then on use it. A dictionary is digested
+** again for it, the old digest is kept for the codecs still using it,
+** like a replaced dictionary.
+*/
+static int SetLevel(vfsc_file *pFile, int *pLevel)
+{
+    vfsc_db *pDb = pFile->pDb;
+    int nPath = strlen(pDb->zPath);
+    int level = *pLevel;
+    vfsc_dict *pOld;
+    vfsc_dict *pDict = NULL;
+    vfsc_db *pLog;
+
+    if (level < -1)
+    {
+        sqlite3_mutex_enter(pDb->mutex);
+        *pLevel = pDb->level;
+        sqlite3_mutex_leave(pDb->mutex);
+        return SQLITE_OK;
+    }
+
+    // Digesting may take a while, so do it without the mutex.
+    sqlite3_mutex_enter(pDb->mutex);
+    pOld = pDb->pDict;
+    sqlite3_mutex_leave(pDb->mutex);
+    if (pOld != NULL && pOld->id != 0 && pOld->level != level)
+    {
+        pDict = DictCreate(pOld->pData, pOld->nData, level);
+        if (pDict == NULL)
+        {
+            return SQLITE_NOMEM;
+        }
+    }
+
+    sqlite3_mutex_enter(pDb->mutex);
+    pDb->level = level;
+    if (pDict != NULL && pDb->pDict == pOld)
+    {
+        pDict->pNext = pDb->pDict;
+        pDb->pDict = pDict;
+        pDict = NULL;
+    }
+    sqlite3_mutex_leave(pDb->mutex);
+
+    // Unless another replaced the dictionary meanwhile.
+    DictFree(pDict);
+
+    vfscEnterMutex();
+    for (pLog = DbList; pLog != NULL; pLog = pLog->pNext)
+    {
+        if (pLog->layout == LayoutLog && strncmp(pLog->zPath, pDb->zPath, nPath) == 0 &&
+            (strcmp(&pLog->zPath[nPath], "-journal") == 0 || strcmp(&pLog->zPath[nPath], "-wal") == 0))
+        {
+            sqlite3_mutex_enter(pLog->mutex);
+            pLog->level = level;
+            sqlite3_mutex_leave(pLog->mutex);
+        }
+    }
+    vfscLeaveMutex();
+
+    vfsc_printf(pFile->pInfo, Compression, "> %s.SetLevel(%s) level=%d.\n",
+        pFile->pInfo->zVfsName, pFile->zFName, level);
+    return SQLITE_OK;
+}
+
+/*
+** Sets the cache of a database to *pSize KBytes unless it's negative,
+** then sets *pSize to the size. A smaller cache frees the chunks it no
+** longer has room for, and those in use or dirty once written out, see
+** GetCache. The cache always has room for MIN_CACHE_SIZE chunks.
+*/
+static int SetCacheSize(vfsc_file *pFile, sqlite3_int64 *pSize)
+{
+    vfsc_db *pDb = pFile->pDb;
+
+    sqlite3_mutex_enter(pDb->mutex);
+    if (*pSize >= 0)
+    {
+        sqlite3_int64 cacheSize;
+        pDb->cacheBytes = MIN(*pSize, LARGEST_INT64 / 1024) * 1024;
+        cacheSize = 1 + pDb->cacheBytes / pDb->chunkSize;
+        pDb->cacheSize = (int)MIN(MAX(cacheSize, MIN_CACHE_SIZE), 0x7fffffff);
+        ShrinkCache(pDb, 1);
+        vfsc_printf(pFile->pInfo, Compression, "> %s.SetCacheSize(%s) chunks=%d, cached=%d.\n",
+            pFile->pInfo->zVfsName, pFile->zFName, pDb->cacheSize, pDb->nCache);
+    }
+
+    *pSize = pDb->cacheBytes / 1024;
+    sqlite3_mutex_leave(pDb->mutex);
+    return SQLITE_OK;
+}
+
+/*
+** Reads a SQLITE_COMPRESS_STATUS counter of a database, see
+** sqlite3_compress_status. Returns SQLITE_ERROR if op is unknown.
+*/
+static int ReadStatus(vfsc_db *pDb, int op, sqlite3_int64 *pCurrent, sqlite3_int64 *pHighwater, int reset)
+{
+  sqlite3_int64 cur;
+  sqlite3_int64 hi;
+
+  if (op < 0 || op >= VFSC_STATUS_SIZE ||
+      (op >= SQLITE_COMPRESS_STATUS_COUNT && op < SQLITE_COMPRESS_STATUS_RATIO_HISTOGRAM) ||
+      (op >= SQLITE_COMPRESS_STATUS_RATIO_HISTOGRAM + SQLITE_COMPRESS_RATIO_BUCKETS &&
+       op < SQLITE_COMPRESS_STATUS_COMPRESS_HISTOGRAM))
+  {
+    return SQLITE_ERROR;
+  }
+
+  if (op == SQLITE_COMPRESS_STATUS_CACHE_USED || op == SQLITE_COMPRESS_STATUS_CACHE_DIRTY)
+  {
+    // The gauges, their highwater is kept under the mutex.
+    sqlite3_mutex_enter(pDb->mutex);
+    if (op == SQLITE_COMPRESS_STATUS_CACHE_USED)
+    {
+      cur = pDb->nCache * (sqlite3_int64)(sizeof(vfsc_chunk) + pDb->chunkSize);
+      pDb->aStatus[op] = MAX(pDb->aStatus[op], cur);
+    }
+    else
+    {
+      cur = StatDirty(pDb);
+    }
+
+    hi = pDb->aStatus[op];
+    if (reset)
+    {
+      pDb->aStatus[op] = cur;
+    }
+    sqlite3_mutex_leave(pDb->mutex);
+  }
+  else
+  {
+    cur = AtomicGet(pDb->aStatus[op]);
+    hi = cur;
+    if (reset)
+    {
+      AtomicAdd(pDb->aStatus[op], -cur);
+    }
+  }
+
+  *pCurrent = cur;
+  *pHighwater = hi;
+  return SQLITE_OK;
+}
+
+/*
+** Close an vfsc-file.
+*/
+static int vfscClose(sqlite3_file *pFile){
+  vfsc_file *p = (vfsc_file *)pFile;
+  vfsc_info *pInfo = p->pInfo;
+  vfsc_db *pDb = p->pDb;
+  int rc;
+  sqlite3_int64 start = TraceStart();
+
+  if (pDb != NULL)
+  {
+	  vfscEnterMutex();
+
+	  // The last file of the database writes everything out.
+	  // A log has nothing pending, its records are written right away.
+	  if (pDb->nRef == 1 && p->layout != LayoutLog)
+	  {
+		  FlushCache(p);
+		  if (p->layout == LayoutPacked)
+		  {
+			  sqlite3_mutex_enter(pDb->mutex);
+			  rc = PackedCommit(p, SQLITE_SYNC_NORMAL);
+			  sqlite3_mutex_leave(pDb->mutex);
+
+			  // The header is synced before the space it freed is given back.
+			  if (rc == SQLITE_OK && pDb->packed.unsynced.n > 0)
+			  {
+				  PackedSyncHeader(p, SQLITE_SYNC_NORMAL);
+			  }
+		  }
+		  else
+		  {
+			  SyncSparseFile(p->hFile);
+		  }
+	  }
+
+#ifdef ENABLE_STATISTICS
+	  // See sqlite3_compress_status for the counters of a database.
+	  if (pInfo->trace != None && pInfo->trace >= Compression)
+	  {
+		sqlite3_int64 sparseFileSize;
+		sqlite3_int64 sparseFileCompressedSize;
+		if (p->layout == LayoutPacked)
+		{
+			sparseFileSize = pDb->packed.logicalSize;
+			sparseFileCompressedSize = pDb->packed.fileEnd;
+		}
+		else if (p->layout == LayoutLog)
+		{
+			sparseFileSize = pDb->log.logicalSize;
+			sparseFileCompressedSize = pDb->log.end;
+		}
+		else
+		{
+			sparseFileCompressedSize = GetSparseFileSize(p->hFile, p->zFName, &sparseFileSize);
+		}
+
+		vfsc_printf(pInfo, Compression, "Compression Chunk Size: %d KBytes, Level: %d, Cache: %d Chunks.\n", pDb->chunkSize / 1024, pDb->level, pDb->nCache);
+		sqlite3_int64 *aStatus = pDb->aStatus;
+		sqlite3_int64 nHit = AtomicGet(aStatus[SQLITE_COMPRESS_STATUS_CACHE_HIT]);
+		sqlite3_int64 nTotal = nHit + AtomicGet(aStatus[SQLITE_COMPRESS_STATUS_CACHE_MISS]);
+		vfsc_printf(pInfo, Compression, "Cache Hits: %lld, Cache Misses: %lld, Total: %lld, Ratio: %.3f%%\n", nHit, nTotal - nHit, nTotal, 100.0 * nHit / (double)MAX(nTotal, 1));
+		vfsc_printf(pInfo, Compression, "Compressed: %lld KBytes in %lld Chunks, Decompressed: %lld KBytes in %lld Chunks\n", AtomicGet(aStatus[SQLITE_COMPRESS_STATUS_COMPRESSED_IN]) / 1024, AtomicGet(aStatus[SQLITE_COMPRESS_STATUS_COMPRESSED]), AtomicGet(aStatus[SQLITE_COMPRESS_STATUS_DECOMPRESSED_IN]) / 1024, AtomicGet(aStatus[SQLITE_COMPRESS_STATUS_DECOMPRESSED]));
+		vfsc_printf(pInfo, Compression, "Wrote: %lld KBytes in %lld Chunks, Read: %lld KBytes in %lld Chunks\n", AtomicGet(aStatus[SQLITE_COMPRESS_STATUS_WRITE_BYTES]) / 1024, AtomicGet(aStatus[SQLITE_COMPRESS_STATUS_WRITES]), AtomicGet(aStatus[SQLITE_COMPRESS_STATUS_READ_BYTES]) / 1024, AtomicGet(aStatus[SQLITE_COMPRESS_STATUS_READS]));
+		vfsc_printf(pInfo, Compression, "File total size: %lld KB (%lld chunks), Actual size on disk: %lld KB, Compression Ratio: %.2f%%\n",
+			sparseFileSize / 1024,
+			sparseFileSize / pDb->chunkSize,
+			sparseFileCompressedSize / 1024,
+			100.0 * sparseFileCompressedSize / (double)MAX(sparseFileSize, 1));
+	  }
+#endif
+
+	  if (--pDb->nRef == 0)
+	  {
+		  WaitJobs(pDb);
+		  FreeDb(pDb);
+		  if (DbList == NULL)
+		  {
+			  StopPool();
+		  }
+	  }
+
+	  p->pDb = NULL;
+	  vfscLeaveMutex();
+  }
+  else if (p->zPath != NULL)
+  {
+	  vfsc_file **pp;
+	  vfscEnterMutex();
+	  for (pp = &PlainList; *pp != p; pp = &(*pp)->pNextPlain)
+	  {
+	  }
+
+	  *pp = p->pNextPlain;
+	  p->zPath = NULL;
+	  vfscLeaveMutex();
+  }
+
+  vfsc_printf(pInfo, OpenClose, "%s.xClose(%s)", pInfo->zVfsName, p->zFName);
+  CloseSparseFile(p->hFile);
+  p->hFile = VFSC_INVALID_HANDLE;
+  rc = p->pReal->pMethods->xClose(p->pReal);
+  vfsc_print_errcode(pInfo, OpenClose, " -> %s\n", rc);
+  if( rc==SQLITE_OK ){
+    sqlite3_free((void*)p->base.pMethods);
+    p->base.pMethods = 0;
+  }
+
+  TraceEvent(p, TraceClose, 0, 0, start, rc);
+  return rc;
+}
+
+/*
+** Reads a chunk that isn't cached yet and, if it's left compressed in
+** blocks, queues it for the background threads to decompress.
+*/
+static int PrefetchChunk(vfsc_file *pFile, sqlite_int64 offset)
+{
+    vfsc_db *pDb = pFile->pDb;
+    vfsc_chunk *pChunk;
+    int isCached;
+    int rc;
+
+    sqlite3_mutex_enter(pDb->mutex);
+    pChunk = HashFind(pDb, offset);
+    isCached = pChunk != NULL && (pChunk->nPin > 0 || pChunk->state != Empty);
+    sqlite3_mutex_leave(pDb->mutex);
+    if (isCached)
+    {
+        return SQLITE_OK;
+    }
+
+    rc = GetCache(pFile, offset, &pChunk);
+    if (rc != SQLITE_OK && rc != SQLITE_IOERR_SHORT_READ)
+    {
+        return rc;
+    }
+
+    if (pChunk->missing != 0)
+    {
+        // The job takes its own pin.
+        sqlite3_mutex_enter(pDb->mutex);
+        ++pChunk->nPin;
+        if (!QueueJob(pDb, pChunk, 1))
+        {
+            --pChunk->nPin;
+        }
+        sqlite3_mutex_leave(pDb->mutex);
+    }
+
+    ReleaseCache(pDb, pChunk);
+    return SQLITE_OK;
+}
+
+/*
+** Tracks the chunks a file reads and, once it reads them in order, reads
+** the next ones ahead of time. They are left compressed in blocks for the
+** background threads to decompress, so a scan finds them ready instead of
+** stalling on each chunk in turn. The reads themselves stay on the calling
+** thread, like the writes.
+*/
+static void ReadAhead(vfsc_file *pFile, sqlite_int64 chunkOffset, sqlite_int64 logicalSize)
+{
+    vfsc_db *pDb = pFile->pDb;
+    int nAhead;
+    int i;
+
+    // The cache may be resized meanwhile, see SetCacheSize.
+    sqlite3_mutex_enter(pDb->mutex);
+    nAhead = MIN(READ_AHEAD_CHUNKS, pDb->cacheSize / 4);
+    sqlite3_mutex_leave(pDb->mutex);
+
+    if (chunkOffset <= pFile->lastChunk && chunkOffset >= pFile->lastChunk - nAhead * (sqlite_int64)pDb->chunkSize)
+    {
+        // The same chunk, or a look back, such as at the b-tree interior
+        // pages of a scan.
+        return;
+    }
+
+    pFile->nSequential = chunkOffset == pFile->lastChunk + pDb->chunkSize ? pFile->nSequential + 1 : 0;
+    pFile->lastChunk = chunkOffset;
+
+    // Chunks not in blocks are decompressed as they are read anyway.
+    if (pFile->nSequential < READ_AHEAD_TRIGGER || pDb->blockShift == 0 || PoolThreads() == 0)
+    {
+        return;
+    }
+
+    for (i = 1; i <= nAhead; ++i)
+    {
+        sqlite_int64 offset = chunkOffset + (sqlite_int64)i * pDb->chunkSize;
+        if (offset >= logicalSize || PrefetchChunk(pFile, offset) != SQLITE_OK)
+        {
+            break;
+        }
+    }
+}
+
+/*
+** Reads a page of a file with a chunk per page straight into the pager's
+** buffer, if the only file of the database reads it and it isn't cached.
+** The pager keeps its own copy of the page, so the cache would only hold
+** it twice, and copy it once more: its memory is better given to the
+** pager's cache_size. The chunks of other files, and those being written,
+** still go through the cache.
+** Returns SQLITE_DONE if the caller should read the page from the cache.
+*/
+static int ReadPage(vfsc_file *pFile, char *zBuf, int iAmt, sqlite_int64 iOfst)
+{
+    vfsc_db *pDb = pFile->pDb;
+    vfsc_packed *pPacked = &pDb->packed;
+    int iChunk = (int)(iOfst / pDb->chunkSize);
+    sqlite_int64 readOffset = 0;
+    vfsc_codec *pCodec;
+    sqlite3_int64 start;
+    int readSize = 0;
+    int n;
+    int rc;
+
+    sqlite3_mutex_enter(pDb->mutex);
+    if (pDb->nRef > 1 || HashFind(pDb, iOfst) != NULL)
+    {
+        sqlite3_mutex_leave(pDb->mutex);
+        return SQLITE_DONE;
+    }
+
+    if (iChunk < pPacked->nIndex && pPacked->aIndex[iChunk].offset != 0)
+    {
+        readOffset = pPacked->aIndex[iChunk].offset;
+        readSize = pPacked->aIndex[iChunk].compSize;
+    }
+    sqlite3_mutex_leave(pDb->mutex);
+
+    if (readSize == 0)
+    {
+        // Never written.
+        memset(zBuf, 0, iAmt);
+        return SQLITE_OK;
+    }
+
+    pCodec = GetCodec(pDb);
+    if (pCodec == NULL)
+    {
+        return SQLITE_NOMEM;
+    }
+
+    if (readSize > pCodec->compDataSize)
+    {
+        PutCodec(pDb, pCodec);
+        return SQLITE_CORRUPT;
+    }
+
+    rc = pFile->pReal->pMethods->xRead(pFile->pReal, pCodec->pCompData, readSize, readOffset);
+    if (rc != SQLITE_OK)
+    {
+        // A short read means the index refers past the end of the file.
+        PutCodec(pDb, pCodec);
+        return rc == SQLITE_IOERR_SHORT_READ ? SQLITE_CORRUPT : rc;
+    }
+
+#ifdef ENABLE_STATISTICS
+    AtomicAdd(pDb->aStatus[SQLITE_COMPRESS_STATUS_READS], 1);
+    AtomicAdd(pDb->aStatus[SQLITE_COMPRESS_STATUS_READ_BYTES], readSize);
+#endif
+
+    start = StatTimer();
+    n = DecodeChunk(pCodec, pCodec->pCompData, &readSize, zBuf, iAmt);
+    PutCodec(pDb, pCodec);
+    if (n < 0)
+    {
+        // Corrupt, or written by a codec that isn't compiled in.
+        return SQLITE_CORRUPT;
+    }
+
+    StatDecompress(pDb, readSize, n, start);
+    memset(zBuf + n, 0, iAmt - n);
+    return SQLITE_OK;
+}
+
+/*
+** Read data from an vfsc-file.
+*/
+static int vfscRead(
+  sqlite3_file *pFile,
+  void *zBuf,
+  int iAmt,
+  sqlite_int64 iOfst
+){
+  vfsc_file *p = (vfsc_file *)pFile;
+  vfsc_info *pInfo = p->pInfo;
+  int rc = 0;
+  sqlite_int64 chunkOffset;
+  sqlite_int64 logicalSize = p->layout == LayoutPacked ? PackedLogicalSize(p->pDb)
+                           : p->layout == LayoutSparse ? SparseLogicalSize(p->pDb) : 0;
+  sqlite3_int64 start = TraceStart();
+
+  if (p->layout == LayoutLog)
+  {
+      rc = LogRead(p, (char*)zBuf, iAmt, iOfst);
+      vfsc_printf(pInfo, IoOps, "> %s.xRead(%s,n=%d,ofst=%lld)  Log",
+					pInfo->zVfsName, p->zFName, iAmt, iOfst);
+      vfsc_print_errcode(pInfo, IoOps, " -> %s\n", rc);
+      TraceEvent(p, TraceRead, iOfst, iAmt, start, rc);
+      return rc;
+  }
+
+  if ((p->layout == LayoutPacked || p->layout == LayoutSparse) && iOfst + iAmt > logicalSize)
+  {
+      // Reading past the end, zero-fill what's missing.
+      int avail = (int)MAX(0, logicalSize - iOfst);
+      if (avail > 0)
+      {
+          rc = vfscRead(pFile, zBuf, avail, iOfst);
+      }
+
+      memset((char*)zBuf + avail, 0, iAmt - avail);
+      return rc == SQLITE_OK ? SQLITE_IOERR_SHORT_READ : rc;
+  }
+
+  if (p->layout != LayoutPlain)
+  {
+      vfsc_chunk *pChunk;
+      int offsetInChunk = (int)(iOfst % p->pDb->chunkSize);
+      int rc2;
+      if (iAmt > p->pDb->chunkSize - offsetInChunk)
+      {
+          // Pages larger than the chunks, after a change of page size.
+          int nFirst = p->pDb->chunkSize - offsetInChunk;
+          rc = vfscRead(pFile, zBuf, nFirst, iOfst);
+          if (rc == SQLITE_OK || rc == SQLITE_IOERR_SHORT_READ)
+          {
+              rc2 = vfscRead(pFile, (char*)zBuf + nFirst, iAmt - nFirst, iOfst + nFirst);
+              rc = rc2 != SQLITE_OK ? rc2 : rc;
+          }
+
+          return rc;
+      }
+
+      chunkOffset = iOfst - offsetInChunk;
+      rc2 = SQLITE_DONE;
+      if (p->layout == LayoutPacked && p->pDb->packed.pageChunks && iAmt == p->pDb->chunkSize)
+      {
+          rc = rc2 = ReadPage(p, (char*)zBuf, iAmt, iOfst);
+      }
+
+      if (rc2 == SQLITE_DONE)
+      {
+          rc = GetCache(p, chunkOffset, &pChunk);
+          if (rc != SQLITE_OK && rc != SQLITE_IOERR_SHORT_READ)
+          {
+              return rc;
+          }
+
+          // Copy the data from the cache, decompressing only what's needed.
+          rc2 = FillChunk(p->pDb, pChunk, offsetInChunk, iAmt);
+          if (rc2 == SQLITE_OK)
+          {
+              memcpy(zBuf, pChunk->pOrigData + offsetInChunk, iAmt);
+          }
+
+          ReleaseCache(p->pDb, pChunk);
+          rc = rc2 != SQLITE_OK ? rc2 : rc;
+      }
+
+      if (rc2 == SQLITE_OK)
+      {
+          ReadAhead(p, chunkOffset, logicalSize);
+      }
+
+      vfsc_printf(pInfo, IoOps, "> %s.xRead(%s,n=%d,ofst=%lld)  Chunk=%lld",
+					pInfo->zVfsName, p->zFName, iAmt, iOfst, chunkOffset);
+      vfsc_print_errcode(pInfo, IoOps, " -> %s\n", rc);
+  }
+  else
+  {
+      vfsc_printf(pInfo, IoOps, "%s.xRead(%s,n=%d,ofst=%lld)",
+          pInfo->zVfsName, p->zFName, iAmt, iOfst);
+      rc = p->pReal->pMethods->xRead(p->pReal, zBuf, iAmt, iOfst);
+      vfsc_print_errcode(pInfo, IoOps, " -> %s\n", rc);
+  }
+
+  TraceEvent(p, TraceRead, iOfst, iAmt, start, rc);
+  return rc;
+}
+
+/*
+** Write data to an vfsc-file.
+*/
+static int vfscWrite(
+  sqlite3_file *pFile,
+  const void *zBuf,
+  int iAmt,
+  sqlite_int64 iOfst
+){
+  vfsc_file *p = (vfsc_file *)pFile;
+  vfsc_info *pInfo = p->pInfo;
+  int rc = SQLITE_OK;
+  sqlite_int64 chunkOffset;
+  sqlite3_int64 start = TraceStart();
+
+  if (p->layout == LayoutLog)
+  {
+      rc = LogWrite(p, (const char*)zBuf, iAmt, iOfst);
+      vfsc_printf(pInfo, IoOps, "> %s.xWrite(%s,n=%d,ofst=%lld)  Log",
+          pInfo->zVfsName, p->zFName, iAmt, iOfst);
+      vfsc_print_errcode(pInfo, IoOps, " -> %s\n", rc);
+  }
+  else if (p->layout != LayoutPlain)
+  {
+      // Get the cache chunk.
+      vfsc_chunk *pChunk;
+      int offsetInChunk;
+      if (p->layout == LayoutPacked && p->pDb->packed.pageChunks)
+      {
+          PackedAdoptPageSize(p, iAmt, iOfst);
+      }
+
+      offsetInChunk = (int)(iOfst % p->pDb->chunkSize);
+      if (iAmt > p->pDb->chunkSize - offsetInChunk)
+      {
+          // Pages larger than the chunks, after a change of page size.
+          int nFirst = p->pDb->chunkSize - offsetInChunk;
+          rc = vfscWrite(pFile, zBuf, nFirst, iOfst);
+          if (rc == SQLITE_OK)
+          {
+              rc = vfscWrite(pFile, (const char*)zBuf + nFirst, iAmt - nFirst, iOfst + nFirst);
+          }
+
+          return rc;
+      }
+
+      chunkOffset = iOfst - offsetInChunk;
+      rc = GetCache(p, chunkOffset, &pChunk);
+      if (rc != SQLITE_OK && rc != SQLITE_IOERR_SHORT_READ)
+      {
+          return rc;
+      }
+
+      // Write the new data over the whole chunk, to be compressed again.
+      rc = FillChunk(p->pDb, pChunk, 0, p->pDb->chunkSize);
+      if (rc != SQLITE_OK)
+      {
+          ReleaseCache(p->pDb, pChunk);
+          return rc;
+      }
+
+      // Writes across chunks were split above.
+      assert(offsetInChunk + iAmt <= p->pDb->chunkSize);
+      if (offsetInChunk + iAmt > p->pDb->chunkSize)
+      {
+          ReleaseCache(p->pDb, pChunk);
+          return SQLITE_CORRUPT;
+      }
+
+      memcpy(pChunk->pOrigData + offsetInChunk, zBuf, iAmt);
+#ifdef ENABLE_STATISTICS
+      if (pChunk->state != Uncompressed && pChunk->state != Unwritten)
+      {
+          AtomicAdd(p->pDb->aStatus[SQLITE_COMPRESS_STATUS_DIRTIED], 1);
+      }
+#endif
+      pChunk->state = Uncompressed;
+      pChunk->origSize = MAX(pChunk->origSize, offsetInChunk + iAmt);
+
+      vfsc_printf(pInfo, IoOps, "> %s.xWrite(%s,n=%d,ofst=%lld)  Chunk=%lld, Data=%d bytes",
+          pInfo->zVfsName, p->zFName, iAmt, iOfst, chunkOffset, pChunk->origSize);
+      ReleaseCache(p->pDb, pChunk);
+      rc = SQLITE_OK;
+
+      sqlite3_mutex_enter(p->pDb->mutex);
+      if (p->layout == LayoutPacked && iOfst + iAmt > p->pDb->packed.logicalSize)
+      {
+          p->pDb->packed.logicalSize = iOfst + iAmt;
+          p->pDb->packed.dirty = 1;
+      }
+      else if (p->layout == LayoutSparse && iOfst + iAmt > p->pDb->sparse.logicalSize)
+      {
+          p->pDb->sparse.logicalSize = iOfst + iAmt;
+      }
+      sqlite3_mutex_leave(p->pDb->mutex);
+
+      vfsc_print_errcode(pInfo, IoOps, " -> %s\n", rc);
+  }
+  else
+  {
+      vfsc_printf(pInfo, IoOps, "%s.xWrite(%s,n=%d,ofst=%lld)",
+          pInfo->zVfsName, p->zFName, iAmt, iOfst);
+      rc = p->pReal->pMethods->xWrite(p->pReal, zBuf, iAmt, iOfst);
+      vfsc_print_errcode(pInfo, IoOps, " -> %s\n", rc);
+  }
+
+  TraceEvent(p, TraceWrite, iOfst, iAmt, start, rc);
+  return rc;
+}
+
+/*
+** Truncate an vfsc-file.
+*/
+static int vfscTruncate(sqlite3_file *pFile, sqlite_int64 size){
+  vfsc_file *p = (vfsc_file *)pFile;
+  vfsc_info *pInfo = p->pInfo;
+  int rc;
+  sqlite3_int64 start = TraceStart();
+  vfsc_printf(pInfo, NonIoOps, "%s.xTruncate(%s,%lld)", pInfo->zVfsName, p->zFName,
+                  size);
+  if (p->layout == LayoutPacked)
+  {
+    rc = PackedTruncate(p, size);
+  }
+  else if (p->layout == LayoutLog)
+  {
+    rc = LogTruncate(p, size);
+  }
+  else if (p->layout == LayoutSparse)
+  {
+    rc = SparseTruncate(p, size);
+  }
+  else
+  {
+    rc = p->pReal->pMethods->xTruncate(p->pReal, size);
+  }
+  vfsc_printf(pInfo, NonIoOps, " -> %d\n", rc);
+  TraceEvent(p, TraceTruncate, size, 0, start, rc);
+  return rc;
+}
+
+/*
+** Sync an vfsc-file.
+*/
+static int vfscSync(sqlite3_file *pFile, int flags){
+  vfsc_file *p = (vfsc_file *)pFile;
+  vfsc_info *pInfo = p->pInfo;
+  int rc;
+  int i;
+  char zBuf[100];
+  sqlite3_int64 start = TraceStart();
+
+  rc = FlushCache(p);
+  if (rc == SQLITE_OK && p->layout == LayoutPacked)
+  {
+    sqlite3_mutex_enter(p->pDb->mutex);
+    rc = PackedCommit(p, flags);
+    sqlite3_mutex_leave(p->pDb->mutex);
+  }
+
+  if (rc != SQLITE_OK)
+  {
+    TraceEvent(p, TraceSync, 0, flags, start, rc);
+    return rc;
+  }
+
+  memcpy(zBuf, "|0", 3);
+  i = 0;
+  if( flags & SQLITE_SYNC_FULL )        strappend(zBuf, &i, "|FULL");
+  else if( flags & SQLITE_SYNC_NORMAL ) strappend(zBuf, &i, "|NORMAL");
+  if( flags & SQLITE_SYNC_DATAONLY )    strappend(zBuf, &i, "|DATAONLY");
+  if( flags & ~(SQLITE_SYNC_FULL|SQLITE_SYNC_DATAONLY) ){
+    sqlite3_snprintf(sizeof(zBuf)-i, &zBuf[i], "|0x%x", flags);
+  }
+  vfsc_printf(pInfo, NonIoOps, "%s.xSync(%s,%s)", pInfo->zVfsName, p->zFName,
+                  &zBuf[1]);
+  rc = p->pReal->pMethods->xSync(p->pReal, flags);
+  vfsc_printf(pInfo, NonIoOps, " -> %d\n", rc);
+  if (rc == SQLITE_OK && p->layout == LayoutPacked)
+  {
+    int compact;
+    sqlite3_mutex_enter(p->pDb->mutex);
+    rc = PackedReleaseExtents(p);
+    compact = rc == SQLITE_OK && PackedShouldCompact(&p->pDb->packed);
+    sqlite3_mutex_leave(p->pDb->mutex);
+
+    // After a VACUUM, the pages it rewrote may be left at the tail.
+    if (compact)
+    {
+      rc = PackedCompact(p, flags);
+    }
+  }
+  TraceEvent(p, TraceSync, 0, flags, start, rc);
+  return rc;
+}
+
+/*
+** Return the current file-size of an vfsc-file.
+*/
+static int vfscFileSize(sqlite3_file *pFile, sqlite_int64 *pSize){
+  vfsc_file *p = (vfsc_file *)pFile;
+  vfsc_info *pInfo = p->pInfo;
+  int rc;
+  vfsc_printf(pInfo, NonIoOps, "%s.xFileSize(%s)", pInfo->zVfsName, p->zFName);
+  if (p->layout == LayoutPacked)
+  {
+    *pSize = PackedLogicalSize(p->pDb);
+    rc = SQLITE_OK;
+  }
+  else if (p->layout == LayoutLog)
+  {
+    *pSize = LogLogicalSize(p->pDb);
+    rc = SQLITE_OK;
+  }
+  else if (p->layout == LayoutSparse)
+  {
+    *pSize = SparseLogicalSize(p->pDb);
+    rc = SQLITE_OK;
+  }
+  else
+  {
+    rc = p->pReal->pMethods->xFileSize(p->pReal, pSize);
+  }
+  vfsc_print_errcode(pInfo, NonIoOps, " -> %s,", rc);
+  vfsc_printf(pInfo, NonIoOps, " size=%lld\n", *pSize);
+  return rc;
+}
+
+/*
+** Return the name of a lock.
+*/
+static const char *lockName(int eLock){
+  const char *azLockNames[] = {
+     "NONE", "SHARED", "RESERVED", "PENDING", "EXCLUSIVE"
+  };
+  if( eLock<0 || eLock>=sizeof(azLockNames)/sizeof(azLockNames[0]) ){
+    return "???";
+  }else{
+    return azLockNames[eLock];
+  }
+}
+
+/*
+** Lock an vfsc-file.
+*/
+static int vfscLock(sqlite3_file *pFile, int eLock){
+  vfsc_file *p = (vfsc_file *)pFile;
+  vfsc_info *pInfo = p->pInfo;
+  int rc;
+  vfsc_printf(pInfo, NonIoOps, "%s.xLock(%s,%s)", pInfo->zVfsName, p->zFName,
+                  lockName(eLock));
+  rc = p->pReal->pMethods->xLock(p->pReal, eLock);
+  vfsc_print_errcode(pInfo, NonIoOps, " -> %s\n", rc);
+  return rc;
+}
+
+/*
+** Unlock an vfsc-file.
+*/
+static int vfscUnlock(sqlite3_file *pFile, int eLock){
+  vfsc_file *p = (vfsc_file *)pFile;
+  vfsc_info *pInfo = p->pInfo;
+  int rc;
+  vfsc_printf(pInfo, NonIoOps, "%s.xUnlock(%s,%s)", pInfo->zVfsName, p->zFName,
+                  lockName(eLock));
+  rc = p->pReal->pMethods->xUnlock(p->pReal, eLock);
+  vfsc_print_errcode(pInfo, NonIoOps, " -> %s\n", rc);
+  return rc;
+}
+
+/*
+** Check if another file-handle holds a RESERVED lock on an vfsc-file.
+*/
+static int vfscCheckReservedLock(sqlite3_file *pFile, int *pResOut){
+  vfsc_file *p = (vfsc_file *)pFile;
+  vfsc_info *pInfo = p->pInfo;
+  int rc;
+  vfsc_printf(pInfo, NonIoOps, "%s.xCheckReservedLock(%s,%d)",
+                  pInfo->zVfsName, p->zFName);
+  rc = p->pReal->pMethods->xCheckReservedLock(p->pReal, pResOut);
+  vfsc_print_errcode(pInfo, NonIoOps, " -> %s", rc);
+  vfsc_printf(pInfo, NonIoOps, ", out=%d\n", *pResOut);
+  return rc;
+}
+
+/*
+** File control method. For custom operations on an vfsc-file.
+*/
+static int vfscFileControl(sqlite3_file *pFile, int op, void *pArg){
+  vfsc_file *p = (vfsc_file *)pFile;
+  vfsc_info *pInfo = p->pInfo;
+  int rc;
+  char zBuf[100];
+  char *zOp;
+  switch( op ){
+    case SQLITE_FCNTL_LOCKSTATE:    zOp = "LOCKSTATE";          break;
+    case SQLITE_GET_LOCKPROXYFILE:  zOp = "GET_LOCKPROXYFILE";  break;
+    case SQLITE_SET_LOCKPROXYFILE:  zOp = "SET_LOCKPROXYFILE";  break;
+    case SQLITE_LAST_ERRNO:         zOp = "LAST_ERRNO";         break;
+    case SQLITE_FCNTL_SIZE_HINT: {
+      sqlite3_snprintf(sizeof(zBuf), zBuf, "SIZE_HINT,%lld",
+                       *(sqlite3_int64*)pArg);
+      zOp = zBuf;
+      break;
+    }
+    case SQLITE_FCNTL_CHUNK_SIZE: {
+      sqlite3_snprintf(sizeof(zBuf), zBuf, "CHUNK_SIZE,%d", *(int*)pArg);
+      zOp = zBuf;
+      break;
+    }
+    case SQLITE_FCNTL_FILE_POINTER: zOp = "FILE_POINTER";       break;
+    case SQLITE_FCNTL_SYNC_OMITTED: {
+        FlushCache(p);
+        if (p->layout == LayoutPacked)
+        {
+            // Without syncs the header can't be synced first either.
+            sqlite3_mutex_enter(p->pDb->mutex);
+            if (PackedCommit(p, 0) == SQLITE_OK)
+            {
+                PackedReleaseExtents(p);
+            }
+            sqlite3_mutex_leave(p->pDb->mutex);
+        }
+        zOp = "SYNC_OMITTED";
+        break;
+    }
+    case 0xca093fa0:                zOp = "DB_UNCHANGED";       break;
+    case SQLITE_FCNTL_COMPRESS_DICTIONARY: zOp = "COMPRESS_DICTIONARY"; break;
+    case SQLITE_FCNTL_COMPRESS_POLICY: {
+      sqlite3_snprintf(sizeof(zBuf), zBuf, "COMPRESS_POLICY,%s",
+                       (const char*)((void**)pArg)[0]);
+      zOp = zBuf;
+      break;
+    }
+    case SQLITE_FCNTL_COMPRESS_PAGE: {
+      sqlite3_snprintf(sizeof(zBuf), zBuf, "COMPRESS_PAGE,%d,%d",
+                       ((int*)pArg)[0], ((int*)pArg)[2]);
+      zOp = zBuf;
+      break;
+    }
+    case SQLITE_FCNTL_COMPRESS_LEVEL: {
+      sqlite3_snprintf(sizeof(zBuf), zBuf, "COMPRESS_LEVEL,%d", *(int*)pArg);
+      zOp = zBuf;
+      break;
+    }
+    case SQLITE_FCNTL_COMPRESS_CACHE_SIZE: {
+      sqlite3_snprintf(sizeof(zBuf), zBuf, "COMPRESS_CACHE_SIZE,%lld",
+                       *(sqlite3_int64*)pArg);
+      zOp = zBuf;
+      break;
+    }
+    case SQLITE_FCNTL_COMPRESS_STATS: zOp = "COMPRESS_STATS";   break;
+    default: {
+      sqlite3_snprintf(sizeof zBuf, zBuf, "%d", op);
+      zOp = zBuf;
+      break;
+    }
+  }
+  vfsc_printf(pInfo, NonIoOps, "%s.xFileControl(%s,%s)",
+                  pInfo->zVfsName, p->zFName, zOp);
+  if ((p->layout == LayoutPacked || p->layout == LayoutLog) &&
+      (op == SQLITE_FCNTL_SIZE_HINT || op == SQLITE_FCNTL_CHUNK_SIZE))
+  {
+    // The physical size has nothing to do with the logical one.
+    rc = SQLITE_OK;
+  }
+  else if (p->layout != LayoutPlain && op == SQLITE_FCNTL_COMPRESS_DICTIONARY)
+  {
+    rc = TrainDictionary(p, (int*)pArg);
+  }
+  else if (p->layout == LayoutPacked && p->pDb->packed.pageChunks && op == SQLITE_FCNTL_COMPRESS_POLICY)
+  {
+    // The arguments are the policy and where to put its id.
+    void **apArg = (void**)pArg;
+    rc = SetPolicy(p->pDb, (const char*)apArg[0], (int*)apArg[1]);
+  }
+  else if (p->layout == LayoutPacked && p->pDb->packed.pageChunks && op == SQLITE_FCNTL_COMPRESS_PAGE)
+  {
+    rc = HintPage(p->pDb, (const int*)pArg);
+  }
+  else if (p->pDb != NULL && p->layout != LayoutLog && op == SQLITE_FCNTL_COMPRESS_LEVEL)
+  {
+    rc = SetLevel(p, (int*)pArg);
+  }
+  else if (p->pDb != NULL && p->layout != LayoutLog && op == SQLITE_FCNTL_COMPRESS_CACHE_SIZE)
+  {
+    rc = SetCacheSize(p, (sqlite3_int64*)pArg);
+  }
+  else if (p->pDb != NULL && p->layout != LayoutLog && op == SQLITE_FCNTL_COMPRESS_STATS)
+  {
+    // The arguments are the counter, then where to put it and its highwater.
+    sqlite3_int64 *aArg = (sqlite3_int64*)pArg;
+    rc = ReadStatus(p->pDb, (int)aArg[0], &aArg[1], &aArg[2], 0);
+  }
+  else
+  {
+    rc = p->pReal->pMethods->xFileControl(p->pReal, op, pArg);
+  }
+  vfsc_print_errcode(pInfo, NonIoOps, " -> %s\n", rc);
+  return rc;
+}
+
+/*
+** Return the sector-size in bytes for an vfsc-file.
+*/
 static int vfscSectorSize(sqlite3_file *pFile){
   vfsc_file *p = (vfsc_file *)pFile;
   vfsc_info *pInfo = p->pInfo;
   int rc;
-  vfsc_printf(pInfo, NonIoOps, "%s.xSectorSize(%s)", pInfo->zVfsName, p->zFName);
-  rc = p->pReal->pMethods->xSectorSize(p->pReal);
-  vfsc_printf(pInfo, NonIoOps, " -> %d\n", rc);
+  vfsc_printf(pInfo, NonIoOps, "%s.xSectorSize(%s)", pInfo->zVfsName, p->zFName);
+  rc = p->pReal->pMethods->xSectorSize(p->pReal);
+  vfsc_printf(pInfo, NonIoOps, " -> %d\n", rc);
+  return rc;
+}
+
+/*
+** Return the device characteristic flags supported by an vfsc-file.
+*/
+static int vfscDeviceCharacteristics(sqlite3_file *pFile){
+  vfsc_file *p = (vfsc_file *)pFile;
+  vfsc_info *pInfo = p->pInfo;
+  int rc;
+  vfsc_printf(pInfo, NonIoOps, "%s.xDeviceCharacteristics(%s)",
+                  pInfo->zVfsName, p->zFName);
+  rc = p->pReal->pMethods->xDeviceCharacteristics(p->pReal);
+  vfsc_printf(pInfo, NonIoOps, " -> 0x%08x\n", rc);
+  return rc;
+}
+
+/*
+** Shared-memory operations.
+*/
+static int vfscShmLock(sqlite3_file *pFile, int ofst, int n, int flags){
+  vfsc_file *p = (vfsc_file *)pFile;
+  vfsc_info *pInfo = p->pInfo;
+  int rc;
+  char zLck[100];
+  int i = 0;
+  memcpy(zLck, "|0", 3);
+  if( flags & SQLITE_SHM_UNLOCK )    strappend(zLck, &i, "|UNLOCK");
+  if( flags & SQLITE_SHM_LOCK )      strappend(zLck, &i, "|LOCK");
+  if( flags & SQLITE_SHM_SHARED )    strappend(zLck, &i, "|SHARED");
+  if( flags & SQLITE_SHM_EXCLUSIVE ) strappend(zLck, &i, "|EXCLUSIVE");
+  if( flags & ~(0xf) ){
+     sqlite3_snprintf(sizeof(zLck)-i, &zLck[i], "|0x%x", flags);
+  }
+  vfsc_printf(pInfo, NonIoOps, "%s.xShmLock(%s,ofst=%d,n=%d,%s)",
+                  pInfo->zVfsName, p->zFName, ofst, n, &zLck[1]);
+  rc = p->pReal->pMethods->xShmLock(p->pReal, ofst, n, flags);
+  vfsc_print_errcode(pInfo, NonIoOps, " -> %s\n", rc);
+  return rc;
+}
+static int vfscShmMap(
+  sqlite3_file *pFile,
+  int iRegion,
+  int szRegion,
+  int isWrite,
+  void volatile **pp
+){
+  vfsc_file *p = (vfsc_file *)pFile;
+  vfsc_info *pInfo = p->pInfo;
+  int rc;
+  vfsc_printf(pInfo, NonIoOps, "%s.xShmMap(%s,iRegion=%d,szRegion=%d,isWrite=%d,*)",
+                  pInfo->zVfsName, p->zFName, iRegion, szRegion, isWrite);
+  rc = p->pReal->pMethods->xShmMap(p->pReal, iRegion, szRegion, isWrite, pp);
+  vfsc_print_errcode(pInfo, NonIoOps, " -> %s\n", rc);
+  return rc;
+}
+static void vfscShmBarrier(sqlite3_file *pFile){
+  vfsc_file *p = (vfsc_file *)pFile;
+  vfsc_info *pInfo = p->pInfo;
+  vfsc_printf(pInfo, NonIoOps, "%s.xShmBarrier(%s)\n", pInfo->zVfsName, p->zFName);
+  p->pReal->pMethods->xShmBarrier(p->pReal);
+}
+static int vfscShmUnmap(sqlite3_file *pFile, int delFlag){
+  vfsc_file *p = (vfsc_file *)pFile;
+  vfsc_info *pInfo = p->pInfo;
+  int rc;
+  vfsc_printf(pInfo, NonIoOps, "%s.xShmUnmap(%s,delFlag=%d)",
+                  pInfo->zVfsName, p->zFName, delFlag);
+  rc = p->pReal->pMethods->xShmUnmap(p->pReal, delFlag);
+  vfsc_print_errcode(pInfo, NonIoOps, " -> %s\n", rc);
+  return rc;
+}
+
+/*
+** Open an vfsc file handle.
+*/
+static int vfscOpen(
+  sqlite3_vfs *pVfs,
+  const char *zName,
+  sqlite3_file *pFile,
+  int flags,
+  int *pOutFlags
+){
+  int rc;
+  vfsc_file *p = (vfsc_file *)pFile;
+  vfsc_info *pInfo = (vfsc_info*)pVfs->pAppData;
+  sqlite3_vfs *pRoot = pInfo->pRootVfs;
+  sqlite3_int64 start = TraceStart();
+  p->pInfo = pInfo;
+  p->zFName = zName ? fileTail(zName) : "<temp>";
+  p->pReal = (sqlite3_file *)&p[1];
+  p->hFile = VFSC_INVALID_HANDLE;
+  p->layout = LayoutPlain;
+  p->pDb = NULL;
+  p->lastChunk = -1;
+  p->nSequential = 0;
+  p->traceId = AtomicAdd(TraceFiles, 1) & 0xffff;
+  p->zPath = NULL;
+  p->pNextPlain = NULL;
+  rc = pRoot->xOpen(pRoot, zName, p->pReal, flags, pOutFlags);
+
+  vfsc_printf(pInfo, OpenClose, "%s.xOpen(%s,flags=0x%x)",
+      pInfo->zVfsName, p->zFName, flags);
+
+  if( p->pReal->pMethods ){
+    sqlite3_io_methods *pNew = (sqlite3_io_methods*)sqlite3_malloc( sizeof(*pNew) );
+    const sqlite3_io_methods *pSub = p->pReal->pMethods;
+    memset(pNew, 0, sizeof(*pNew));
+    pNew->iVersion = pSub->iVersion;
+    pNew->xClose = vfscClose;
+    pNew->xRead = vfscRead;
+    pNew->xWrite = vfscWrite;
+    pNew->xTruncate = vfscTruncate;
+    pNew->xSync = vfscSync;
+    pNew->xFileSize = vfscFileSize;
+    pNew->xLock = vfscLock;
+    pNew->xUnlock = vfscUnlock;
+    pNew->xCheckReservedLock = vfscCheckReservedLock;
+    pNew->xFileControl = vfscFileControl;
+    pNew->xSectorSize = vfscSectorSize;
+    pNew->xDeviceCharacteristics = vfscDeviceCharacteristics;
+    if( pNew->iVersion>=2 ){
+      pNew->xShmMap = pSub->xShmMap ? vfscShmMap : 0;
+      pNew->xShmLock = pSub->xShmLock ? vfscShmLock : 0;
+      pNew->xShmBarrier = pSub->xShmBarrier ? vfscShmBarrier : 0;
+      pNew->xShmUnmap = pSub->xShmUnmap ? vfscShmUnmap : 0;
+    }
+    pFile->pMethods = pNew;
+  }
+  vfsc_print_errcode(pInfo, OpenClose, " -> %s", rc);
+  if( pOutFlags ){
+    vfsc_printf(pInfo, OpenClose, ", outFlags=0x%x\n", *pOutFlags);
+  }else{
+    vfsc_printf(pInfo, OpenClose, "\n");
+  }
+
+  p->flags = flags;
+  if (rc == SQLITE_OK && CompressionLevel != 0 && zName != NULL &&
+      ((flags & 0xFFFFFF00) == SQLITE_OPEN_MAIN_DB))
+  {
+      Layout layout;
+      vfscEnterMutex();
+      p->pDb = FindDb(zName);
+      if (p->pDb != NULL)
+      {
+          // Already open, share its state.
+          ++p->pDb->nRef;
+          layout = p->pDb->layout;
+          if (layout == LayoutSparse)
+          {
+              p->hFile = OpenSparseFile(p->pReal, zName);
+              if (p->hFile == VFSC_INVALID_HANDLE)
+              {
+                  rc = SQLITE_CANTOPEN;
+              }
+          }
+      }
+      else
+      {
+          int isEmpty;
+          const char *zLayout = sqlite3_uri_parameter(zName, "compress_layout");
+          layout = DetectLayout(p->pReal, &isEmpty);
+          if (isEmpty)
+          {
+              layout = (zLayout && (sqlite3StrICmp(zLayout, "packed") == 0 ||
+                                    sqlite3StrICmp(zLayout, "page") == 0)) ? LayoutPacked : LayoutSparse;
+          }
+
+          if (layout == LayoutSparse)
+          {
+              // Now reopen the file and mark it sparse.
+              if (SparseFileSuppored(zName))
+              {
+                  p->hFile = OpenSparseFile(p->pReal, zName);
+              }
+
+              if (p->hFile == VFSC_INVALID_HANDLE)
+              {
+                  vfsc_printf(pInfo, OpenClose, "> %s.xOpen(%s) -> Failed to open/create sparse file! Last Error: 0x%x.\n", pInfo->zVfsName, p->zFName, vfscLastError());
+
+                  // New files can still be compressed without sparse support.
+                  layout = isEmpty ? LayoutPacked : LayoutPlain;
+              }
+          }
+
+          if (layout != LayoutPlain)
+          {
+              rc = NewDb(p, zName, layout, isEmpty);
+              StartPool();
+          }
+      }
+
+      if (rc != SQLITE_OK)
+      {
+          vfsc_print_errcode(pInfo, Error, "> Failed to open compressed file -> %s\n", rc);
+          if (p->pDb != NULL && --p->pDb->nRef == 0)
+          {
+              FreeDb(p->pDb);
+          }
+
+          vfscLeaveMutex();
+          p->pDb = NULL;
+          CloseSparseFile(p->hFile);
+          p->hFile = VFSC_INVALID_HANDLE;
+          p->pReal->pMethods->xClose(p->pReal);
+          sqlite3_free((void*)pFile->pMethods);
+          pFile->pMethods = 0;
+          return rc;
+      }
+
+      vfscLeaveMutex();
+      p->layout = layout;
+      vfsc_printf(pInfo, OpenClose, "> %s.xOpen(%s) -> %s\n", pInfo->zVfsName, p->zFName,
+          layout == LayoutPacked ? "Compressed (Packed)" : (layout == LayoutSparse ? "Compressed (Sparse)" : "Plain"));
+  }
+  else if (rc == SQLITE_OK && zName != NULL &&
+      ((flags & 0xFFFFFF00) == SQLITE_OPEN_MAIN_JOURNAL || (flags & 0xFFFFFF00) == SQLITE_OPEN_WAL))
+  {
+      // The journal and the WAL of a compressed database are compressed
+      // logs, and so is any file that already is one, say a hot journal.
+      vfscEnterMutex();
+      p->pDb = FindDb(zName);
+      if (p->pDb != NULL)
+      {
+          ++p->pDb->nRef;
+      }
+      else
+      {
+          int isEmpty;
+          vfsc_db *pMain = FindMainDb(zName, flags);
+          if (DetectLayout(p->pReal, &isEmpty) == LayoutLog ||
+              (isEmpty && pMain != NULL && pMain->compressLogs))
+          {
+              rc = NewDb(p, zName, LayoutLog, isEmpty);
+              if (rc == SQLITE_OK && pMain != NULL)
+              {
+                  sqlite3_mutex_enter(pMain->mutex);
+                  p->pDb->codec = pMain->codec;
+                  p->pDb->level = pMain->level;
+                  sqlite3_mutex_leave(pMain->mutex);
+              }
+          }
+      }
+      vfscLeaveMutex();
+
+      if (rc != SQLITE_OK)
+      {
+          vfsc_print_errcode(pInfo, Error, "> Failed to open compressed log -> %s\n", rc);
+          p->pReal->pMethods->xClose(p->pReal);
+          sqlite3_free((void*)pFile->pMethods);
+          pFile->pMethods = 0;
+          return rc;
+      }
+
+      if (p->pDb != NULL)
+      {
+          p->layout = LayoutLog;
+          vfsc_printf(pInfo, OpenClose, "> %s.xOpen(%s) -> Compressed (Log)\n", pInfo->zVfsName, p->zFName);
+      }
+  }
+
+  if (rc == SQLITE_OK && p->pDb == NULL && zName != NULL &&
+      ((flags & 0xFFFFFF00) == SQLITE_OPEN_MAIN_DB))
+  {
+      vfscEnterMutex();
+      p->zPath = zName;
+      p->pNextPlain = PlainList;
+      PlainList = p;
+      vfscLeaveMutex();
+  }
+
+  TraceEvent(p, TraceOpen, 0, flags, start, rc);
+  return rc;
+}
+
+/*
+** Delete the file located at zPath. If the dirSync argument is true,
+** ensure the file-system modifications are synced to disk before
+** returning.
+*/
+static int vfscDelete(sqlite3_vfs *pVfs, const char *zPath, int dirSync){
+  vfsc_info *pInfo = (vfsc_info*)pVfs->pAppData;
+  sqlite3_vfs *pRoot = pInfo->pRootVfs;
+  int rc;
+  vfsc_printf(pInfo, NonIoOps, "%s.xDelete(\"%s\",%d)",
+                  pInfo->zVfsName, zPath, dirSync);
+  rc = pRoot->xDelete(pRoot, zPath, dirSync);
+  vfsc_print_errcode(pInfo, NonIoOps, " -> %s\n", rc);
+  return rc;
+}
+
+/*
+** Test for access permissions. Return true if the requested permission
+** is available, or false otherwise.
+*/
+static int vfscAccess(
+  sqlite3_vfs *pVfs,
+  const char *zPath,
+  int flags,
+  int *pResOut
+){
+  vfsc_info *pInfo = (vfsc_info*)pVfs->pAppData;
+  sqlite3_vfs *pRoot = pInfo->pRootVfs;
+  int rc;
+  vfsc_printf(pInfo, NonIoOps, "%s.xAccess(\"%s\",%d)",
+                  pInfo->zVfsName, zPath, flags);
+  rc = pRoot->xAccess(pRoot, zPath, flags, pResOut);
+  vfsc_print_errcode(pInfo, NonIoOps, " -> %s", rc);
+  vfsc_printf(pInfo, NonIoOps, ", out=%d\n", *pResOut);
+  return rc;
+}
+
+/*
+** Populate buffer zOut with the full canonical pathname corresponding
+** to the pathname in zPath. zOut is guaranteed to point to a buffer
+** of at least (DEVSYM_MAX_PATHNAME+1) bytes.
+*/
+static int vfscFullPathname(
+  sqlite3_vfs *pVfs,
+  const char *zPath,
+  int nOut,
+  char *zOut
+){
+  vfsc_info *pInfo = (vfsc_info*)pVfs->pAppData;
+  sqlite3_vfs *pRoot = pInfo->pRootVfs;
+  int rc;
+  vfsc_printf(pInfo, NonIoOps, "%s.xFullPathname(\"%s\")",
+                  pInfo->zVfsName, zPath);
+  rc = pRoot->xFullPathname(pRoot, zPath, nOut, zOut);
+  vfsc_print_errcode(pInfo, NonIoOps, " -> %s", rc);
+  vfsc_printf(pInfo, NonIoOps, ", out=\"%.*s\"\n", nOut, zOut);
   return rc;
 }
 
 /*
-** Return the device characteristic flags supported by an vfsc-file.
+** Open the dynamic library located at zPath and return a handle.
+*/
+static void *vfscDlOpen(sqlite3_vfs *pVfs, const char *zPath){
+  vfsc_info *pInfo = (vfsc_info*)pVfs->pAppData;
+  sqlite3_vfs *pRoot = pInfo->pRootVfs;
+  vfsc_printf(pInfo, NonIoOps, "%s.xDlOpen(\"%s\")\n", pInfo->zVfsName, zPath);
+  return pRoot->xDlOpen(pRoot, zPath);
+}
+
+/*
+** Populate the buffer zErrMsg (size nByte bytes) with a human readable
+** utf-8 string describing the most recent error encountered associated
+** with dynamic libraries.
+*/
+static void vfscDlError(sqlite3_vfs *pVfs, int nByte, char *zErrMsg){
+  vfsc_info *pInfo = (vfsc_info*)pVfs->pAppData;
+  sqlite3_vfs *pRoot = pInfo->pRootVfs;
+  vfsc_printf(pInfo, NonIoOps, "%s.xDlError(%d)", pInfo->zVfsName, nByte);
+  pRoot->xDlError(pRoot, nByte, zErrMsg);
+  vfsc_printf(pInfo, NonIoOps, " -> \"%s\"", zErrMsg);
+}
+
+/*
+** Return a pointer to the symbol zSymbol in the dynamic library pHandle.
+*/
+static void (*vfscDlSym(sqlite3_vfs *pVfs,void *p,const char *zSym))(void){
+  vfsc_info *pInfo = (vfsc_info*)pVfs->pAppData;
+  sqlite3_vfs *pRoot = pInfo->pRootVfs;
+  vfsc_printf(pInfo, NonIoOps, "%s.xDlSym(\"%s\")\n", pInfo->zVfsName, zSym);
+  return pRoot->xDlSym(pRoot, p, zSym);
+}
+
+/*
+** Close the dynamic library handle pHandle.
+*/
+static void vfscDlClose(sqlite3_vfs *pVfs, void *pHandle){
+  vfsc_info *pInfo = (vfsc_info*)pVfs->pAppData;
+  sqlite3_vfs *pRoot = pInfo->pRootVfs;
+  vfsc_printf(pInfo, NonIoOps, "%s.xDlClose()\n", pInfo->zVfsName);
+  pRoot->xDlClose(pRoot, pHandle);
+}
+
+/*
+** Populate the buffer pointed to by zBufOut with nByte bytes of
+** random data.
+*/
+static int vfscRandomness(sqlite3_vfs *pVfs, int nByte, char *zBufOut){
+  vfsc_info *pInfo = (vfsc_info*)pVfs->pAppData;
+  sqlite3_vfs *pRoot = pInfo->pRootVfs;
+  vfsc_printf(pInfo, NonIoOps, "%s.xRandomness(%d)\n", pInfo->zVfsName, nByte);
+  return pRoot->xRandomness(pRoot, nByte, zBufOut);
+}
+
+/*
+** Sleep for nMicro microseconds. Return the number of microseconds
+** actually slept.
+*/
+static int vfscSleep(sqlite3_vfs *pVfs, int nMicro){
+  vfsc_info *pInfo = (vfsc_info*)pVfs->pAppData;
+  sqlite3_vfs *pRoot = pInfo->pRootVfs;
+  return pRoot->xSleep(pRoot, nMicro);
+}
+
+/*
+** Return the current time as a Julian Day number in *pTimeOut.
+*/
+static int vfscCurrentTime(sqlite3_vfs *pVfs, double *pTimeOut){
+  vfsc_info *pInfo = (vfsc_info*)pVfs->pAppData;
+  sqlite3_vfs *pRoot = pInfo->pRootVfs;
+  return pRoot->xCurrentTime(pRoot, pTimeOut);
+}
+static int vfscCurrentTimeInt64(sqlite3_vfs *pVfs, sqlite3_int64 *pTimeOut){
+  vfsc_info *pInfo = (vfsc_info*)pVfs->pAppData;
+  sqlite3_vfs *pRoot = pInfo->pRootVfs;
+  return pRoot->xCurrentTimeInt64(pRoot, pTimeOut);
+}
+
+/*
+** Return th3 emost recent error code and message
+*/
+static int vfscGetLastError(sqlite3_vfs *pVfs, int iErr, char *zErr){
+  vfsc_info *pInfo = (vfsc_info*)pVfs->pAppData;
+  sqlite3_vfs *pRoot = pInfo->pRootVfs;
+  return pRoot->xGetLastError(pRoot, iErr, zErr);
+}
+
+/*
+** Override system calls.
+*/
+static int vfscSetSystemCall(
+  sqlite3_vfs *pVfs,
+  const char *zName,
+  sqlite3_syscall_ptr pFunc
+){
+  vfsc_info *pInfo = (vfsc_info*)pVfs->pAppData;
+  sqlite3_vfs *pRoot = pInfo->pRootVfs;
+  return pRoot->xSetSystemCall(pRoot, zName, pFunc);
+}
+static sqlite3_syscall_ptr vfscGetSystemCall(
+  sqlite3_vfs *pVfs,
+  const char *zName
+){
+  vfsc_info *pInfo = (vfsc_info*)pVfs->pAppData;
+  sqlite3_vfs *pRoot = pInfo->pRootVfs;
+  return pRoot->xGetSystemCall(pRoot, zName);
+}
+static const char *vfscNextSystemCall(sqlite3_vfs *pVfs, const char *zName){
+  vfsc_info *pInfo = (vfsc_info*)pVfs->pAppData;
+  sqlite3_vfs *pRoot = pInfo->pRootVfs;
+  return pRoot->xNextSystemCall(pRoot, zName);
+}
+
+/*
+** Clients invoke this routine to construct a new vfs-compress shim.
+** Calling it again only changes the settings of the registered shim;
+** databases that are already open keep theirs.
+**
+** Return SQLITE_OK on success.
+**
+** SQLITE_NOMEM is returned in the case of a memory allocation error.
+** SQLITE_NOTFOUND is returned if zOldVfsName does not exist.
+*/
+SQLITE_API int sqlite3_compress(
+   int trace,                  /* See TraceLevel. 0 to disable. */
+   int compressionLevel,       /* The compression level: -1 for default, 0 to disable, 1 fastest, 9 best */
+   int chunkSizeKBytes,        /* The size of the compression chunk in KBytes: -1 for default */
+   int cacheSizeKBytes         /* The size of the cache in KBytes: -1 for default. */
+){
+  sqlite3_vfs *pNew;
+  sqlite3_vfs *pRoot;
+  vfsc_info *pInfo;
+  int nName;
+  int nByte;
+
+  int chunkSize = chunkSizeKBytes * 1024 / COMPRESION_UNIT_SIZE_BYTES;
+  ChunkSizeBytes = chunkSize <= 0 ? DEF_CHUNK_SIZE_BYTES : (chunkSize * COMPRESION_UNIT_SIZE_BYTES);
+  ChunkSizeBytes = MIN(ChunkSizeBytes, MAX_CHUNK_SIZE_BYTES);
+  CacheSizeBytes = cacheSizeKBytes <= 0
+				? DEF_CACHE_KBYTES * (sqlite3_int64)1024
+				: cacheSizeKBytes * (sqlite3_int64)1024;
+
+  CompressionLevel = compressionLevel;
+  if (CompressionLevel == 0)
+  {
+	  ChunkSizeBytes = 0;
+	  CacheSizeBytes = 0;
+  }
+
+  // Find the native VFS.
+#if SQLITE_OS_WIN
+  pRoot = sqlite3_vfs_find("win32");
+#else
+  pRoot = sqlite3_vfs_find("unix");
+#endif
+  if( pRoot==0 ) return SQLITE_NOTFOUND;
+
+  // Reuse the shim if it's already registered.
+  pNew = sqlite3_vfs_find("vfscompress");
+  if (pNew != NULL && pNew->xOpen == vfscOpen)
+  {
+    pInfo = (vfsc_info*)pNew->pAppData;
+    pInfo->trace = trace >= Maximum ? Maximum : (trace < None ? DEFAULT_TRACE_LEVEL : trace);
+    return sqlite3_vfs_register(pNew, 1);
+  }
+
+  nName = strlen("vfscompress");
+  nByte = sizeof(*pNew) + sizeof(*pInfo) + nName + 1;
+  pNew = (sqlite3_vfs*)sqlite3_malloc( nByte );
+  if( pNew==0 ) return SQLITE_NOMEM;
+  memset(pNew, 0, nByte);
+  pInfo = (vfsc_info*)&pNew[1];
+  pNew->iVersion = pRoot->iVersion;
+  pNew->szOsFile = pRoot->szOsFile + sizeof(vfsc_file);
+  pNew->mxPathname = pRoot->mxPathname;
+  pNew->zName = (char*)&pInfo[1];
+  memcpy((char*)&pInfo[1], "vfscompress", nName+1);
+  pNew->pAppData = pInfo;
+  pNew->xOpen = vfscOpen;
+  pNew->xDelete = vfscDelete;
+  pNew->xAccess = vfscAccess;
+  pNew->xFullPathname = vfscFullPathname;
+  pNew->xDlOpen = pRoot->xDlOpen==0 ? 0 : vfscDlOpen;
+  pNew->xDlError = pRoot->xDlError==0 ? 0 : vfscDlError;
+  pNew->xDlSym = pRoot->xDlSym==0 ? 0 : vfscDlSym;
+  pNew->xDlClose = pRoot->xDlClose==0 ? 0 : vfscDlClose;
+  pNew->xRandomness = vfscRandomness;
+  pNew->xSleep = vfscSleep;
+  pNew->xCurrentTime = vfscCurrentTime;
+  pNew->xGetLastError = pRoot->xGetLastError==0 ? 0 : vfscGetLastError;
+  if( pNew->iVersion>=2 ){
+    pNew->xCurrentTimeInt64 = pRoot->xCurrentTimeInt64==0 ? 0 :
+                                   vfscCurrentTimeInt64;
+    if( pNew->iVersion>=3 ){
+      pNew->xSetSystemCall = pRoot->xSetSystemCall==0 ? 0 :
+                                   vfscSetSystemCall;
+      pNew->xGetSystemCall = pRoot->xGetSystemCall==0 ? 0 :
+                                   vfscGetSystemCall;
+      pNew->xNextSystemCall = pRoot->xNextSystemCall==0 ? 0 :
+                                   vfscNextSystemCall;
+    }
+  }
+
+  pInfo->pRootVfs = pRoot;
+  pInfo->xOut = (int(*)(const char*,void*))fputs;
+  pInfo->pOutArg = stderr;
+  pInfo->zVfsName = pNew->zName;
+  pInfo->pTraceVfs = pNew;
+  pInfo->trace = trace >= Maximum ? Maximum : (trace < None ? DEFAULT_TRACE_LEVEL : trace);
+
+  vfsc_printf(pInfo, Registeration, "%s.enabled_for(\"%s\") - Compression Chunk Size: %d KBytes, Level: %d, Cache: %lld KBytes per database.\n",
+      pInfo->zVfsName, pRoot->zName, ChunkSizeBytes / 1024, CompressionLevel, CacheSizeBytes / 1024);
+
+  return sqlite3_vfs_register(pNew, 1);
+}
+
+/*
+** Sets the number of background threads that compress the chunks of all
+** the compressed databases. Zero compresses on the calling threads, -1
+** uses one thread less than the number of processors (the default), and
+** any other negative value only queries the setting.
+**
+** Returns the previous setting.
+*/
+SQLITE_API int sqlite3_compress_threads(int nThread){
+  int prev;
+#ifndef SQLITE_OMIT_AUTOINIT
+  sqlite3_initialize();
+#endif
+  vfscEnterMutex();
+  prev = WorkerThreads;
+  if (nThread >= -1)
+  {
+    WorkerThreads = MIN(nThread, MAX_WORKER_THREADS);
+    if (DbList != NULL)
+    {
+      // Drain and restart the threads.
+      StopPool();
+      StartPool();
+    }
+  }
+  vfscLeaveMutex();
+  return prev;
+}
+
+/*
+** Limits the memory used by the chunk caches of all the compressed
+** databases together. Zero removes the limit, a negative value only
+** queries it. Caches don't shrink, they stop growing at the limit.
+**
+** Returns the previous limit in bytes.
+*/
+SQLITE_API sqlite3_int64 sqlite3_compress_memory_limit(sqlite3_int64 nByte){
+  sqlite3_int64 prev;
+#ifndef SQLITE_OMIT_AUTOINIT
+  sqlite3_initialize();
+#endif
+  vfscEnterMutex();
+  prev = CacheMemoryLimit;
+  if (nByte >= 0)
+  {
+    CacheMemoryLimit = nByte;
+  }
+  vfscLeaveMutex();
+  return prev;
+}
+
+/*
+** Sets the pages the chunk caches are mapped in, one of the
+** SQLITE_COMPRESS_HUGE_PAGES values, for the memory mapped from then on.
+** A negative value only queries the setting.
+**
+** Returns the previous setting.
+*/
+SQLITE_API int sqlite3_compress_huge_pages(int eMode){
+  int prev;
+#ifndef SQLITE_OMIT_AUTOINIT
+  sqlite3_initialize();
+#endif
+  vfscEnterMutex();
+  sqlite3_mutex_enter(Arena.mutex);
+  prev = Arena.eHugePages;
+  if (eMode >= SQLITE_COMPRESS_HUGE_PAGES_OFF && eMode <= SQLITE_COMPRESS_HUGE_PAGES_RESERVED)
+  {
+    Arena.eHugePages = eMode;
+  }
+  sqlite3_mutex_leave(Arena.mutex);
+  vfscLeaveMutex();
+  return prev;
+}
+
+/*
+** An online recompression, see sqlite3_recompress_init.
+*/
+struct sqlite3_recompress {
+  sqlite3 *db;              /* The database connection */
+  Btree *pBt;               /* The b-tree of the database */
+  int iNext;                /* The next chunk to compress again */
+  int nRemaining;           /* Chunks left as of the last step */
+  int nChunkCount;          /* Chunks in the database as of the last step */
+  int rc;                   /* The error that stopped it, or SQLITE_DONE */
+};
+
+/*
+** Returns the compressed main file of a b-tree, or NULL.
+*/
+static vfsc_file *CompressedFile(Btree *pBt)
+{
+  sqlite3_file *fd = sqlite3PagerFile(sqlite3BtreePager(pBt));
+  vfsc_file *p = (vfsc_file*)fd;
+  if (fd->pMethods == NULL || fd->pMethods->xRead != vfscRead ||
+      p->pDb == NULL || p->layout == LayoutLog)
+  {
+    return NULL;
+  }
+
+  return p;
+}
+
+/*
+** Starts compressing a database again with the codec zCodec, or the one it
+** has if NULL, at level, or the one it has if below -1. The database
+** writes with them from then on.
+**
+** Returns NULL on error, leaving it in the connection.
+*/
+SQLITE_API sqlite3_recompress *sqlite3_recompress_init(
+  sqlite3 *db,
+  const char *zDb,
+  const char *zCodec,
+  int level
+){
+  sqlite3_recompress *p = NULL;
+  vfsc_file *pFile = NULL;
+  Btree *pBt = NULL;
+  int codec = -1;
+  int i;
+
+  sqlite3_mutex_enter(db->mutex);
+  i = sqlite3FindDbName(db, zDb ? zDb : "main");
+  if (i >= 0)
+  {
+    pBt = db->aDb[i].pBt;
+  }
+
+  if (pBt != NULL)
+  {
+    sqlite3BtreeEnter(pBt);
+    pFile = CompressedFile(pBt);
+    sqlite3BtreeLeave(pBt);
+  }
+
+  if (zCodec != NULL)
+  {
+    codec = FindCodec(zCodec);
+  }
+
+  if (i < 0)
+  {
+    sqlite3Error(db, SQLITE_ERROR, "unknown database %s", zDb);
+  }
+  else if (pFile == NULL)
+  {
+    sqlite3Error(db, SQLITE_ERROR, "database is not compressed");
+  }
+  else if (zCodec != NULL && codec < 0)
+  {
+    sqlite3Error(db, SQLITE_ERROR, "unknown codec %s", zCodec);
+  }
+  else if ((p = (sqlite3_recompress*)sqlite3_malloc(sizeof(sqlite3_recompress))) == NULL)
+  {
+    sqlite3Error(db, SQLITE_NOMEM, 0);
+  }
+  else
+  {
+    memset(p, 0, sizeof(sqlite3_recompress));
+    p->db = db;
+    p->pBt = pBt;
+    p->nRemaining = -1;
+    if (codec >= 0)
+    {
+      sqlite3_mutex_enter(pFile->pDb->mutex);
+      pFile->pDb->codec = codec;
+      sqlite3_mutex_leave(pFile->pDb->mutex);
+    }
+
+    p->rc = SetLevel(pFile, &level);
+    if (p->rc != SQLITE_OK)
+    {
+      sqlite3Error(db, p->rc, 0);
+      sqlite3_free(p);
+      p = NULL;
+    }
+  }
+
+  sqlite3_mutex_leave(db->mutex);
+  return p;
+}
+
+/*
+** Compresses the next nChunk chunks again, or all of them if negative,
+** under a write lock taken for the step, unless the connection has a write
+** transaction already. The last step also compacts a packed file.
+**
+** Returns SQLITE_OK if chunks remain, SQLITE_DONE once there are none, and
+** SQLITE_BUSY or SQLITE_LOCKED if the database couldn't be locked, after
+** which the step may be retried. The connection can't be reading meanwhile.
+** Other errors are final.
 */
-static int vfscDeviceCharacteristics(sqlite3_file *pFile){
-  vfsc_file *p = (vfsc_file *)pFile;
-  vfsc_info *pInfo = p->pInfo;
+SQLITE_API int sqlite3_recompress_step(sqlite3_recompress *p, int nChunk){
   int rc;
-  vfsc_printf(pInfo, NonIoOps, "%s.xDeviceCharacteristics(%s)",
-                  pInfo->zVfsName, p->zFName);
-  rc = p->pReal->pMethods->xDeviceCharacteristics(p->pReal);
-  vfsc_printf(pInfo, NonIoOps, " -> 0x%08x\n", rc);
+
+  sqlite3_mutex_enter(p->db->mutex);
+  sqlite3BtreeEnter(p->pBt);
+  rc = p->rc;
+  if (rc == SQLITE_OK || rc == SQLITE_BUSY || rc == SQLITE_LOCKED)
+  {
+    vfsc_file *pFile = CompressedFile(p->pBt);
+    int inTrans = sqlite3BtreeIsInTrans(p->pBt);
+    sqlite_int64 size;
+    int iEnd;
+
+    // A read transaction can't be upgraded and committed under a statement.
+    rc = SQLITE_OK;
+    if (pFile == NULL)
+    {
+      rc = SQLITE_ERROR;
+    }
+    else if (!inTrans && sqlite3BtreeIsInReadTrans(p->pBt))
+    {
+      rc = SQLITE_BUSY;
+    }
+    else if (!inTrans)
+    {
+      rc = sqlite3BtreeBeginTrans(p->pBt, 1);
+    }
+
+    if (rc == SQLITE_OK)
+    {
+      size = pFile->layout == LayoutPacked ? PackedLogicalSize(pFile->pDb) : SparseLogicalSize(pFile->pDb);
+      p->nChunkCount = (int)((size + pFile->pDb->chunkSize - 1) / pFile->pDb->chunkSize);
+      iEnd = nChunk < 0 ? p->nChunkCount : (int)MIN(p->nChunkCount, (sqlite_int64)p->iNext + nChunk);
+      rc = RewriteChunks(pFile, p->iNext, iEnd, iEnd >= p->nChunkCount);
+      if (rc == SQLITE_OK)
+      {
+        vfsc_printf(pFile->pInfo, Compression, "> %s.Recompress(%s) chunks=%d-%d of %d.\n",
+            pFile->pInfo->zVfsName, pFile->zFName, p->iNext, iEnd, p->nChunkCount);
+        p->iNext = MAX(p->iNext, iEnd);
+        p->nRemaining = p->nChunkCount - p->iNext;
+        rc = p->nRemaining > 0 ? SQLITE_OK : SQLITE_DONE;
+      }
+
+      if (!inTrans)
+      {
+        int rc2 = sqlite3BtreeCommit(p->pBt);
+        rc = rc2 != SQLITE_OK && (rc == SQLITE_OK || rc == SQLITE_DONE) ? rc2 : rc;
+      }
+    }
+
+    p->rc = rc;
+  }
+
+  sqlite3BtreeLeave(p->pBt);
+  sqlite3_mutex_leave(p->db->mutex);
   return rc;
 }
 
 /*
-** Shared-memory operations.
+** Frees a recompression. Returns the error that stopped it, also left in
+** the connection, or SQLITE_OK.
 */
-static int vfscShmLock(sqlite3_file *pFile, int ofst, int n, int flags){
-  vfsc_file *p = (vfsc_file *)pFile;
-  vfsc_info *pInfo = p->pInfo;
+SQLITE_API int sqlite3_recompress_finish(sqlite3_recompress *p){
+  sqlite3 *db;
   int rc;
-  char zLck[100];
-  int i = 0;
-  memcpy(zLck, "|0", 3);
-  if( flags & SQLITE_SHM_UNLOCK )    strappend(zLck, &i, "|UNLOCK");
-  if( flags & SQLITE_SHM_LOCK )      strappend(zLck, &i, "|LOCK");
-  if( flags & SQLITE_SHM_SHARED )    strappend(zLck, &i, "|SHARED");
-  if( flags & SQLITE_SHM_EXCLUSIVE ) strappend(zLck, &i, "|EXCLUSIVE");
-  if( flags & ~(0xf) ){
-     sqlite3_snprintf(sizeof(zLck)-i, &zLck[i], "|0x%x", flags);
+
+  if (p == NULL)
+  {
+    return SQLITE_OK;
   }
-  vfsc_printf(pInfo, NonIoOps, "%s.xShmLock(%s,ofst=%d,n=%d,%s)",
-                  pInfo->zVfsName, p->zFName, ofst, n, &zLck[1]);
-  rc = p->pReal->pMethods->xShmLock(p->pReal, ofst, n, flags);
-  vfsc_print_errcode(pInfo, NonIoOps, " -> %s\n", rc);
+
+  db = p->db;
+  sqlite3_mutex_enter(db->mutex);
+  rc = (p->rc == SQLITE_DONE || p->rc == SQLITE_BUSY || p->rc == SQLITE_LOCKED) ? SQLITE_OK : p->rc;
+  sqlite3Error(db, rc, 0);
+  sqlite3_free(p);
+  sqlite3_mutex_leave(db->mutex);
   return rc;
 }
-static int vfscShmMap(
-  sqlite3_file *pFile,
-  int iRegion,
-  int szRegion,
-  int isWrite,
-  void volatile **pp
-){
-  vfsc_file *p = (vfsc_file *)pFile;
-  vfsc_info *pInfo = p->pInfo;
-  int rc;
-  vfsc_printf(pInfo, NonIoOps, "%s.xShmMap(%s,iRegion=%d,szRegion=%d,isWrite=%d,*)",
-                  pInfo->zVfsName, p->zFName, iRegion, szRegion, isWrite);
-  rc = p->pReal->pMethods->xShmMap(p->pReal, iRegion, szRegion, isWrite, pp);
-  vfsc_print_errcode(pInfo, NonIoOps, " -> %s\n", rc);
-  return rc;
+
+/*
+** Returns the number of chunks left to compress as of the last step, or
+** -1 before the first.
+*/
+SQLITE_API int sqlite3_recompress_remaining(sqlite3_recompress *p){
+  return p->nRemaining;
 }
-static void vfscShmBarrier(sqlite3_file *pFile){
-  vfsc_file *p = (vfsc_file *)pFile;
-  vfsc_info *pInfo = p->pInfo;
-  vfsc_printf(pInfo, NonIoOps, "%s.xShmBarrier(%s)\n", pInfo->zVfsName, p->zFName);
-  p->pReal->pMethods->xShmBarrier(p->pReal);
+
+/*
+** Returns the number of chunks of the database as of the last step.
+*/
+SQLITE_API int sqlite3_recompress_chunkcount(sqlite3_recompress *p){
+  return p->nChunkCount;
 }
-static int vfscShmUnmap(sqlite3_file *pFile, int delFlag){
-  vfsc_file *p = (vfsc_file *)pFile;
-  vfsc_info *pInfo = p->pInfo;
-  int rc;
-  vfsc_printf(pInfo, NonIoOps, "%s.xShmUnmap(%s,delFlag=%d)",
-                  pInfo->zVfsName, p->zFName, delFlag);
-  rc = p->pReal->pMethods->xShmUnmap(p->pReal, delFlag);
-  vfsc_print_errcode(pInfo, NonIoOps, " -> %s\n", rc);
-  return rc;
+
+/*
+** A conversion, see sqlite3_compress_convert.
+*/
+typedef struct vfsc_convert vfsc_convert;
+struct vfsc_convert {
+  sqlite3_file *pSrc;       /* The database, through the shim */
+  sqlite3_file *pDest;      /* The converted copy */
+  sqlite3_file *pState;     /* The progress, see CONVERT_MAGIC */
+  int compress;             /* 1 if compressing, 0 if decompressing */
+  int isWal;                /* The database used a WAL before */
+  int pageSize;             /* The page size of the database */
+  u32 headerCrc;            /* The checksum of the database header */
+  sqlite_int64 size;        /* The size of the database */
+  sqlite_int64 done;        /* The bytes converted and synced */
+  sqlite_int64 stepStart;   /* The offset of the last step */
+  u32 stepCrc;              /* The checksum of the last step */
+  int nStep;                /* The bytes of a step, whole chunks */
+  char *aBuf;               /* A step of data */
+};
+
+/*
+** Returns zPath, a database name followed by its URI parameters, with
+** zSuffix appended and the parameters kept if withParams, or NULL.
+*/
+static char *ConvertName(const char *zPath, const char *zSuffix, int withParams)
+{
+    int nPath = (int)strlen(zPath);
+    int nSuffix = (int)strlen(zSuffix);
+    const char *zParams = zPath + nPath + 1;
+    const char *z = zParams;
+    int nParams;
+    char *zName;
+
+    // The parameters are pairs of strings, the value may be empty.
+    while (withParams && *z)
+    {
+        z += strlen(z) + 1;
+        z += strlen(z) + 1;
+    }
+
+    nParams = (int)(z - zParams);
+    zName = (char*)sqlite3_malloc(nPath + nSuffix + nParams + 3);
+    if (zName != NULL)
+    {
+        memcpy(zName, zPath, nPath);
+        memcpy(zName + nPath, zSuffix, nSuffix + 1);
+        memcpy(zName + nPath + nSuffix + 1, zParams, nParams);
+        zName[nPath + nSuffix + 1 + nParams] = '\0';
+        zName[nPath + nSuffix + 2 + nParams] = '\0';
+    }
+
+    return zName;
+}
+
+/*
+** Runs a journal_mode pragma and sets *pIsWal if the mode is WAL.
+*/
+static int ConvertJournalMode(sqlite3 *db, const char *zSql, int *pIsWal)
+{
+    sqlite3_stmt *pStmt = NULL;
+    int rc = sqlite3_prepare_v2(db, zSql, -1, &pStmt, NULL);
+    if (rc == SQLITE_OK)
+    {
+        if (sqlite3_step(pStmt) == SQLITE_ROW)
+        {
+            const char *zMode = (const char*)sqlite3_column_text(pStmt, 0);
+            *pIsWal = zMode != NULL && sqlite3StrICmp(zMode, "wal") == 0;
+        }
+
+        rc = sqlite3_finalize(pStmt);
+    }
+
+    return rc;
+}
+
+/*
+** Reads or writes n bytes of a file being converted, a chunk at a time if
+** it's compressed, or all at once.
+*/
+static int ConvertIo(sqlite3_file *pFile, int isWrite, char *aBuf, int n, sqlite_int64 offset)
+{
+    vfsc_file *p = (vfsc_file*)pFile;
+    int isChunked = pFile->pMethods->xRead == vfscRead && p->pDb != NULL;
+    int rc = SQLITE_OK;
+    int i = 0;
+
+    while (rc == SQLITE_OK && i < n)
+    {
+        int nPiece = n - i;
+        if (isChunked)
+        {
+            // The chunk size of a new file in page mode is set by its first write.
+            int chunkSize = p->pDb->chunkSize;
+            nPiece = MIN(nPiece, chunkSize - (int)((offset + i) % chunkSize));
+        }
+
+        rc = isWrite ? pFile->pMethods->xWrite(pFile, aBuf + i, nPiece, offset + i)
+                     : pFile->pMethods->xRead(pFile, aBuf + i, nPiece, offset + i);
+        i += nPiece;
+    }
+
+    return rc;
+}
+
+/*
+** Records the progress of a conversion and syncs it.
+*/
+static int ConvertSaveState(vfsc_convert *pConv)
+{
+    unsigned char aState[CONVERT_STATE_SIZE];
+    int rc;
+
+    memset(aState, 0, sizeof(aState));
+    memcpy(aState, CONVERT_MAGIC, CONVERT_MAGIC_SIZE);
+    sqlite3Put4byte(&aState[16], (pConv->compress ? CONVERT_FLAG_COMPRESS : 0) |
+                                 (pConv->isWal ? CONVERT_FLAG_WAL : 0));
+    sqlite3Put4byte(&aState[20], pConv->headerCrc);
+    Put8byte(&aState[24], pConv->size);
+    Put8byte(&aState[32], pConv->done);
+    Put8byte(&aState[40], pConv->stepStart);
+    sqlite3Put4byte(&aState[48], pConv->stepCrc);
+    sqlite3Put4byte(&aState[52], (u32)crc32(0, aState, 52));
+
+    rc = pConv->pState->pMethods->xWrite(pConv->pState, aState, CONVERT_STATE_SIZE, 0);
+    if (rc == SQLITE_OK)
+    {
+        rc = pConv->pState->pMethods->xSync(pConv->pState, SQLITE_SYNC_NORMAL);
+    }
+
+    return rc;
+}
+
+/*
+** Resumes a conversion from the progress recorded, if it's one in the same
+** direction of the same database, and the database header, its size and
+** the data of the last step are unchanged. Otherwise starts from scratch.
+** A database that used a WAL before the conversion started uses it again
+** once it completes.
+*/
+static int ConvertLoadState(vfsc_convert *pConv)
+{
+    unsigned char aState[CONVERT_STATE_SIZE];
+    sqlite_int64 done;
+    sqlite_int64 stepStart;
+    int rc;
+
+    pConv->done = 0;
+    rc = pConv->pState->pMethods->xRead(pConv->pState, aState, CONVERT_STATE_SIZE, 0);
+    if (rc == SQLITE_IOERR_SHORT_READ)
+    {
+        return SQLITE_OK;
+    }
+
+    done = Get8byte(&aState[32]);
+    stepStart = Get8byte(&aState[40]);
+    if (rc != SQLITE_OK ||
+        memcmp(aState, CONVERT_MAGIC, CONVERT_MAGIC_SIZE) != 0 ||
+        sqlite3Get4byte(&aState[52]) != (u32)crc32(0, aState, 52) ||
+        (int)(sqlite3Get4byte(&aState[16]) & CONVERT_FLAG_COMPRESS) != pConv->compress ||
+        sqlite3Get4byte(&aState[20]) != pConv->headerCrc ||
+        Get8byte(&aState[24]) != pConv->size ||
+        done > pConv->size || stepStart < 0 || stepStart > done ||
+        done - stepStart > CONVERT_STEP_BYTES)
+    {
+        return rc;
+    }
+
+    rc = ConvertIo(pConv->pSrc, 0, pConv->aBuf, (int)(done - stepStart), stepStart);
+    if (rc == SQLITE_OK &&
+        sqlite3Get4byte(&aState[48]) == (u32)crc32(0, (const Bytef*)pConv->aBuf, (uInt)(done - stepStart)))
+    {
+        pConv->done = done;
+        pConv->stepStart = stepStart;
+        pConv->stepCrc = sqlite3Get4byte(&aState[48]);
+        pConv->isWal |= (sqlite3Get4byte(&aState[16]) & CONVERT_FLAG_WAL) != 0;
+    }
+
+    return rc;
+}
+
+/*
+** Converts the next step of a database: reads it whole, decompressing its
+** chunks in parallel, writes it out, leaving its chunks to be compressed
+** in parallel by the sync, and records the progress.
+*/
+static int ConvertStep(vfsc_convert *pConv)
+{
+    vfsc_file *pSrc = (vfsc_file*)pConv->pSrc;
+    int n = (int)MIN(pConv->nStep, pConv->size - pConv->done);
+    int nFirst = 0;
+    int rc = SQLITE_OK;
+
+    if (!pConv->compress)
+    {
+        sqlite_int64 offset;
+        for (offset = pConv->done; rc == SQLITE_OK && offset < pConv->done + n; offset += pSrc->pDb->chunkSize)
+        {
+            rc = PrefetchChunk(pSrc, offset);
+        }
+    }
+
+    if (rc == SQLITE_OK)
+    {
+        rc = ConvertIo(pConv->pSrc, 0, pConv->aBuf, n, pConv->done);
+    }
+
+    // A new file in page mode takes its page size from the first write.
+    if (pConv->compress && pConv->done == 0)
+    {
+        nFirst = MIN(n, pConv->pageSize);
+    }
+
+    if (rc == SQLITE_OK)
+    {
+        rc = ConvertIo(pConv->pDest, 1, pConv->aBuf, nFirst, pConv->done);
+    }
+
+    if (rc == SQLITE_OK)
+    {
+        rc = ConvertIo(pConv->pDest, 1, pConv->aBuf + nFirst, n - nFirst, pConv->done + nFirst);
+    }
+
+    if (rc == SQLITE_OK)
+    {
+        rc = pConv->pDest->pMethods->xSync(pConv->pDest, SQLITE_SYNC_NORMAL);
+    }
+
+    if (rc == SQLITE_OK)
+    {
+        pConv->stepStart = pConv->done;
+        pConv->stepCrc = (u32)crc32(0, (const Bytef*)pConv->aBuf, (uInt)n);
+        pConv->done += n;
+        rc = ConvertSaveState(pConv);
+    }
+
+    return rc;
 }
 
-/*
-** Open an vfsc file handle.
-*/
-static int vfscOpen(
-  sqlite3_vfs *pVfs,
-  const char *zName,
-  sqlite3_file *pFile,
-  int flags,
-  int *pOutFlags
-){
-  int rc;
-  vfsc_file *p = (vfsc_file *)pFile;
-  vfsc_info *pInfo = (vfsc_info*)pVfs->pAppData;
-  sqlite3_vfs *pRoot = pInfo->pRootVfs;
-  p->pInfo = pInfo;
-  p->zFName = zName ? fileTail(zName) : "<temp>";
-  p->pReal = (sqlite3_file *)&p[1];
-  p->hFile = INVALID_HANDLE_VALUE;
-  rc = pRoot->xOpen(pRoot, zName, p->pReal, flags, pOutFlags);
+/*
+** Converts a database in place, see sqlite.h. The database is opened and
+** locked exclusively, which rolls back a hot journal, after switching a
+** WAL database to a rollback journal, and back once converted. The files
+** open on it in this process are detected, see CountOpenFiles, other
+** processes must have closed it, as the converted copy replaces the file.
+*/
+SQLITE_API int sqlite3_compress_convert(
+  const char *zFilename,
+  int compress,
+  int (*xProgress)(void*,sqlite3_int64,sqlite3_int64),
+  void *pArg
+){
+  sqlite3_vfs *pVfs = sqlite3_vfs_find("vfscompress");
+  sqlite3_vfs *pRoot;
+  vfsc_info *pInfo;
+  vfsc_file *pSrc = NULL;
+  vfsc_file *pCompressed;
+  vfsc_convert conv;
+  sqlite3 *db = NULL;
+  const char *zPath = NULL;
+  char *zDest = NULL;
+  char *zState = NULL;
+  unsigned char aHdr[100];
+  sqlite3_int64 cacheKBytes;
+  sqlite_int64 destSize = 0;
+  int rc;
+
+  if (pVfs == NULL || pVfs->xOpen != vfscOpen || CompressionLevel == 0)
+  {
+    return SQLITE_MISUSE;
+  }
+
+  pInfo = (vfsc_info*)pVfs->pAppData;
+  pRoot = pInfo->pRootVfs;
+  memset(&conv, 0, sizeof(conv));
+  conv.compress = compress != 0;
+
+  rc = sqlite3_open_v2(zFilename, &db, SQLITE_OPEN_READWRITE|SQLITE_OPEN_URI, pVfs->zName);
+  if (rc == SQLITE_OK)
+  {
+    sqlite3_file_control(db, "main", SQLITE_FCNTL_FILE_POINTER, &conv.pSrc);
+    pSrc = (vfsc_file*)conv.pSrc;
+    zPath = sqlite3PagerFilename(sqlite3BtreePager(db->aDb[0].pBt));
+    if (pSrc == NULL || pSrc->base.pMethods == NULL || pSrc->base.pMethods->xRead != vfscRead)
+    {
+      rc = SQLITE_MISUSE;
+    }
+    else if ((pSrc->layout != LayoutPlain) == conv.compress)
+    {
+      // Already in the format asked.
+      sqlite3_close(db);
+      return SQLITE_OK;
+    }
+  }
+
+  // The pager rolls back a hot journal as it locks the database. A WAL
+  // can only be left once no other connection uses it.
+  if (rc == SQLITE_OK)
+  {
+    rc = ConvertJournalMode(db, "PRAGMA main.journal_mode", &conv.isWal);
+  }
+
+  if (rc == SQLITE_OK && conv.isWal)
+  {
+    int stillWal = 1;
+    rc = ConvertJournalMode(db, "PRAGMA main.journal_mode=DELETE", &stillWal);
+    rc = rc == SQLITE_OK && stillWal ? SQLITE_BUSY : rc;
+  }
+
+  if (rc == SQLITE_OK)
+  {
+    rc = sqlite3_exec(db, "BEGIN EXCLUSIVE", NULL, NULL, NULL);
+  }
+
+  if (rc == SQLITE_OK)
+  {
+    // The converted copy replaces the file, any other file open on it
+    // would keep the old one.
+    vfscEnterMutex();
+    rc = CountOpenFiles(pSrc) > 1 ? SQLITE_BUSY : SQLITE_OK;
+    vfscLeaveMutex();
+  }
+
+  if (rc == SQLITE_OK)
+  {
+    rc = conv.pSrc->pMethods->xFileSize(conv.pSrc, &conv.size);
+  }
+
+  if (rc != SQLITE_OK || conv.size == 0)
+  {
+    sqlite3_close(db);
+    return rc == SQLITE_LOCKED ? SQLITE_BUSY : rc;
+  }
+
+  // The header identifies the database and the version of its content.
+  memset(aHdr, 0, sizeof(aHdr));
+  rc = ConvertIo(conv.pSrc, 0, (char*)aHdr, (int)MIN(conv.size, sizeof(aHdr)), 0);
+  conv.headerCrc = (u32)crc32(0, aHdr, sizeof(aHdr));
+  conv.pageSize = (aHdr[16] << 8) | aHdr[17];
+  conv.pageSize = conv.pageSize == 1 ? 65536 : conv.pageSize;
+
+  zDest = ConvertName(zPath, CONVERT_SUFFIX, 1);
+  zState = ConvertName(zPath, CONVERT_STATE_SUFFIX, 0);
+  conv.aBuf = (char*)sqlite3_malloc(CONVERT_STEP_BYTES);
+  if (rc == SQLITE_OK && (zDest == NULL || zState == NULL || conv.aBuf == NULL))
+  {
+    rc = SQLITE_NOMEM;
+  }
+
+  if (rc == SQLITE_OK)
+  {
+    rc = sqlite3OsOpenMalloc(pRoot, zState, &conv.pState,
+        SQLITE_OPEN_READWRITE|SQLITE_OPEN_CREATE|SQLITE_OPEN_MAIN_DB, NULL);
+  }
+
+  if (rc == SQLITE_OK)
+  {
+    rc = ConvertLoadState(&conv);
+  }
+
+  // Start from scratch with a new file, in the layout asked.
+  if (rc == SQLITE_OK && conv.done == 0)
+  {
+    pRoot->xDelete(pRoot, zDest, 0);
+  }
+
+  if (rc == SQLITE_OK)
+  {
+    rc = sqlite3OsOpenMalloc(conv.compress ? pVfs : pRoot, zDest, &conv.pDest,
+        SQLITE_OPEN_READWRITE|SQLITE_OPEN_CREATE|SQLITE_OPEN_MAIN_DB, NULL);
+  }
+
+  if (rc == SQLITE_OK && conv.compress && ((vfsc_file*)conv.pDest)->layout == LayoutPlain)
+  {
+    rc = SQLITE_CANTOPEN;
+  }
+
+  // Drop what was written after the last step recorded.
+  if (rc == SQLITE_OK)
+  {
+    rc = conv.pDest->pMethods->xFileSize(conv.pDest, &destSize);
+  }
 
-  vfsc_printf(pInfo, OpenClose, "%s.xOpen(%s,flags=0x%x)",
-      pInfo->zVfsName, p->zFName, flags);
+  if (rc == SQLITE_OK)
+  {
+    conv.done = destSize < conv.done ? 0 : conv.done;
+    rc = conv.pDest->pMethods->xTruncate(conv.pDest, conv.done);
+  }
 
-  if( p->pReal->pMethods ){
-    sqlite3_io_methods *pNew = (sqlite3_io_methods*)sqlite3_malloc( sizeof(*pNew) );
-    const sqlite3_io_methods *pSub = p->pReal->pMethods;
-    memset(pNew, 0, sizeof(*pNew));
-    pNew->iVersion = pSub->iVersion;
-    pNew->xClose = vfscClose;
-    pNew->xRead = vfscRead;
-    pNew->xWrite = vfscWrite;
-    pNew->xTruncate = vfscTruncate;
-    pNew->xSync = vfscSync;
-    pNew->xFileSize = vfscFileSize;
-    pNew->xLock = vfscLock;
-    pNew->xUnlock = vfscUnlock;
-    pNew->xCheckReservedLock = vfscCheckReservedLock;
-    pNew->xFileControl = vfscFileControl;
-    pNew->xSectorSize = vfscSectorSize;
-    pNew->xDeviceCharacteristics = vfscDeviceCharacteristics;
-    if( pNew->iVersion>=2 ){
-      pNew->xShmMap = pSub->xShmMap ? vfscShmMap : 0;
-      pNew->xShmLock = pSub->xShmLock ? vfscShmLock : 0;
-      pNew->xShmBarrier = pSub->xShmBarrier ? vfscShmBarrier : 0;
-      pNew->xShmUnmap = pSub->xShmUnmap ? vfscShmUnmap : 0;
+  // A step is whole chunks, all cached until the sync compresses them.
+  if (rc == SQLITE_OK)
+  {
+    pCompressed = conv.compress ? (vfsc_file*)conv.pDest : pSrc;
+    conv.nStep = MAX(CONVERT_STEP_BYTES / pCompressed->pDb->chunkSize, 1) * pCompressed->pDb->chunkSize;
+    cacheKBytes = 2 * (sqlite3_int64)conv.nStep / 1024;
+    rc = SetCacheSize(pCompressed, &cacheKBytes);
+  }
+
+  while (rc == SQLITE_OK && conv.done < conv.size)
+  {
+    rc = ConvertStep(&conv);
+    vfsc_printf(pInfo, Compression, "> %s.Convert(%s) %s %lld of %lld bytes.\n",
+        pInfo->zVfsName, fileTail(zPath), conv.compress ? "compressed" : "decompressed", conv.done, conv.size);
+    if (rc == SQLITE_OK && xProgress != NULL && xProgress(pArg, conv.done, conv.size) != 0)
+    {
+      rc = SQLITE_INTERRUPT;
     }
-    pFile->pMethods = pNew;
   }
-  vfsc_print_errcode(pInfo, OpenClose, " -> %s", rc);
-  if( pOutFlags ){
-    vfsc_printf(pInfo, OpenClose, ", outFlags=0x%x\n", *pOutFlags);
-  }else{
-    vfsc_printf(pInfo, OpenClose, "\n");
+
+  if (conv.pDest != NULL)
+  {
+    int rc2 = sqlite3OsCloseFree(conv.pDest);
+    rc = rc == SQLITE_OK ? rc2 : rc;
   }
 
-  p->flags = flags;
-  if (rc == SQLITE_OK && CompressionLevel != 0 &&
-      ((flags & 0xFFFFFF00) == SQLITE_OPEN_MAIN_DB) &&
-	  SparseFileSuppored(zName))
+  if (conv.pState != NULL)
   {
-      // Now reopen the file and mark it sparse.
-      p->hFile = OpenSparseFile(zName);
-      if (p->hFile != INVALID_HANDLE_VALUE)
-      {
-          int compressed = IsCompressed(p->hFile);
-	      vfsc_printf(pInfo, OpenClose, "> %s.xOpen(%s) -> %x", pInfo->zVfsName, p->zFName, GetLastError());
-          vfsc_printf(pInfo, OpenClose, " -> %s\n", compressed ? "Compressed" : "Plain");
-          if (!compressed)
-          {
-              CloseHandle(p->hFile);
-              p->hFile = INVALID_HANDLE_VALUE;
-          }
-      }
+    sqlite3OsCloseFree(conv.pState);
+  }
 
-      if (p->hFile == INVALID_HANDLE_VALUE)
-	  {
-			vfsc_printf(pInfo, OpenClose, "> %s.xOpen(%s) -> Failed to open/create sparse file! Last Error: 0x%x.\n", pInfo->zVfsName, p->zFName, GetLastError());
-	  }
+  if (rc == SQLITE_OK)
+  {
+    int err;
+
+    // Windows can't replace a file that's open.
+#if SQLITE_OS_WIN
+    sqlite3_close(db);
+    db = NULL;
+#endif
+    err = ReplaceFileByName(zDest, zPath);
+    if (err != 0)
+    {
+      vfsc_printf(pInfo, Error, "> %s.Convert(%s) -> Failed to replace the database! Last Error: 0x%x.\n",
+          pInfo->zVfsName, fileTail(zPath), err);
+      rc = SQLITE_IOERR;
+    }
+    else
+    {
+      pRoot->xDelete(pRoot, zState, 0);
+    }
   }
 
-  return rc;
-}
+  sqlite3_close(db);
+  if (rc == SQLITE_OK && conv.isWal)
+  {
+    rc = sqlite3_open_v2(zFilename, &db, SQLITE_OPEN_READWRITE|SQLITE_OPEN_URI, pVfs->zName);
+    if (rc == SQLITE_OK)
+    {
+      rc = ConvertJournalMode(db, "PRAGMA main.journal_mode=WAL", &conv.isWal);
+    }
+    sqlite3_close(db);
+  }
 
-/*
-** Delete the file located at zPath. If the dirSync argument is true,
-** ensure the file-system modifications are synced to disk before
-** returning.
-*/
-static int vfscDelete(sqlite3_vfs *pVfs, const char *zPath, int dirSync){
-  vfsc_info *pInfo = (vfsc_info*)pVfs->pAppData;
-  sqlite3_vfs *pRoot = pInfo->pRootVfs;
-  int rc;
-  vfsc_printf(pInfo, NonIoOps, "%s.xDelete(\"%s\",%d)",
-                  pInfo->zVfsName, zPath, dirSync);
-  rc = pRoot->xDelete(pRoot, zPath, dirSync);
-  vfsc_print_errcode(pInfo, NonIoOps, " -> %s\n", rc);
+  sqlite3_free(conv.aBuf);
+  sqlite3_free(zDest);
+  sqlite3_free(zState);
   return rc;
 }
 
 /*
-** Test for access permissions. Return true if the requested permission
-** is available, or false otherwise.
+** Reads a counter of a compressed database. The counters are those of the
+** database file, see sqlite3_compress_status in sqlite.h.
 */
-static int vfscAccess(
-  sqlite3_vfs *pVfs,
-  const char *zPath,
-  int flags,
-  int *pResOut
+SQLITE_API int sqlite3_compress_status(
+  sqlite3 *db,
+  const char *zDb,
+  int op,
+  sqlite3_int64 *pCurrent,
+  sqlite3_int64 *pHighwater,
+  int resetFlag
 ){
-  vfsc_info *pInfo = (vfsc_info*)pVfs->pAppData;
-  sqlite3_vfs *pRoot = pInfo->pRootVfs;
-  int rc;
-  vfsc_printf(pInfo, NonIoOps, "%s.xAccess(\"%s\",%d)",
-                  pInfo->zVfsName, zPath, flags);
-  rc = pRoot->xAccess(pRoot, zPath, flags, pResOut);
-  vfsc_print_errcode(pInfo, NonIoOps, " -> %s", rc);
-  vfsc_printf(pInfo, NonIoOps, ", out=%d\n", *pResOut);
-  return rc;
-}
+  Btree *pBt = NULL;
+  int rc = SQLITE_ERROR;
+  int i;
 
-/*
-** Populate buffer zOut with the full canonical pathname corresponding
-** to the pathname in zPath. zOut is guaranteed to point to a buffer
-** of at least (DEVSYM_MAX_PATHNAME+1) bytes.
-*/
-static int vfscFullPathname(
-  sqlite3_vfs *pVfs,
-  const char *zPath,
-  int nOut,
-  char *zOut
-){
-  vfsc_info *pInfo = (vfsc_info*)pVfs->pAppData;
-  sqlite3_vfs *pRoot = pInfo->pRootVfs;
-  int rc;
-  vfsc_printf(pInfo, NonIoOps, "%s.xFullPathname(\"%s\")",
-                  pInfo->zVfsName, zPath);
-  rc = pRoot->xFullPathname(pRoot, zPath, nOut, zOut);
-  vfsc_print_errcode(pInfo, NonIoOps, " -> %s", rc);
-  vfsc_printf(pInfo, NonIoOps, ", out=\"%.*s\"\n", nOut, zOut);
+  sqlite3_mutex_enter(db->mutex);
+  i = sqlite3FindDbName(db, zDb ? zDb : "main");
+  if (i >= 0)
+  {
+    pBt = db->aDb[i].pBt;
+  }
+
+  if (pBt != NULL)
+  {
+    vfsc_file *pFile;
+    sqlite3BtreeEnter(pBt);
+    pFile = CompressedFile(pBt);
+    if (pFile != NULL)
+    {
+      rc = ReadStatus(pFile->pDb, op, pCurrent, pHighwater, resetFlag);
+    }
+    sqlite3BtreeLeave(pBt);
+  }
+
+  sqlite3_mutex_leave(db->mutex);
   return rc;
 }
 
 /*
-** Open the dynamic library located at zPath and return a handle.
+** Turns the binary trace of the compressed files on, with a ring of at
+** least nEvent events, or off with zero. A negative value only queries it.
+** The ring is allocated the first time and kept, its size doesn't change.
+**
+** Returns the size of the ring if the trace was on, else zero.
 */
-static void *vfscDlOpen(sqlite3_vfs *pVfs, const char *zPath){
-  vfsc_info *pInfo = (vfsc_info*)pVfs->pAppData;
-  sqlite3_vfs *pRoot = pInfo->pRootVfs;
-  vfsc_printf(pInfo, NonIoOps, "%s.xDlOpen(\"%s\")\n", pInfo->zVfsName, zPath);
-  return pRoot->xDlOpen(pRoot, zPath);
-}
+SQLITE_API int sqlite3_compress_trace(int nEvent){
+  int prev;
+#ifndef SQLITE_OMIT_AUTOINIT
+  sqlite3_initialize();
+#endif
+  vfscEnterMutex();
+  prev = TraceEnabled ? TraceMask + 1 : 0;
+  if (nEvent == 0)
+  {
+    TraceEnabled = 0;
+  }
+  else if (nEvent > 0)
+  {
+    if (TraceRing == NULL)
+    {
+      int n = 1;
+      while (n < nEvent && n < TRACE_MAX_EVENTS)
+      {
+        n <<= 1;
+      }
 
-/*
-** Populate the buffer zErrMsg (size nByte bytes) with a human readable
-** utf-8 string describing the most recent error encountered associated
-** with dynamic libraries.
-*/
-static void vfscDlError(sqlite3_vfs *pVfs, int nByte, char *zErrMsg){
-  vfsc_info *pInfo = (vfsc_info*)pVfs->pAppData;
-  sqlite3_vfs *pRoot = pInfo->pRootVfs;
-  vfsc_printf(pInfo, NonIoOps, "%s.xDlError(%d)", pInfo->zVfsName, nByte);
-  pRoot->xDlError(pRoot, nByte, zErrMsg);
-  vfsc_printf(pInfo, NonIoOps, " -> \"%s\"", zErrMsg);
-}
+      TraceRing = (vfsc_event*)sqlite3_malloc(n * sizeof(vfsc_event));
+      if (TraceRing != NULL)
+      {
+        memset(TraceRing, 0, n * sizeof(vfsc_event));
+        TraceMask = n - 1;
+      }
+    }
 
-/*
-** Return a pointer to the symbol zSymbol in the dynamic library pHandle.
-*/
-static void (*vfscDlSym(sqlite3_vfs *pVfs,void *p,const char *zSym))(void){
-  vfsc_info *pInfo = (vfsc_info*)pVfs->pAppData;
-  sqlite3_vfs *pRoot = pInfo->pRootVfs;
-  vfsc_printf(pInfo, NonIoOps, "%s.xDlSym(\"%s\")\n", pInfo->zVfsName, zSym);
-  return pRoot->xDlSym(pRoot, p, zSym);
+    AtomicBarrier();
+    TraceEnabled = TraceRing != NULL;
+  }
+  vfscLeaveMutex();
+  return prev;
 }
 
 /*
-** Close the dynamic library handle pHandle.
+** Writes the events of the trace ring to a file, see TRACE_MAGIC for the
+** format. The trace goes on while it's copied, the events being written
+** are left out.
 */
-static void vfscDlClose(sqlite3_vfs *pVfs, void *pHandle){
-  vfsc_info *pInfo = (vfsc_info*)pVfs->pAppData;
-  sqlite3_vfs *pRoot = pInfo->pRootVfs;
-  vfsc_printf(pInfo, NonIoOps, "%s.xDlClose()\n", pInfo->zVfsName);
-  pRoot->xDlClose(pRoot, pHandle);
+SQLITE_API int sqlite3_compress_trace_dump(const char *zFilename){
+  sqlite3_vfs *pVfs;
+  sqlite3_int64 next;
+  sqlite3_int64 seq;
+  sqlite3_int64 now = 0;
+  unsigned char *aBuf;
+  unsigned char *p;
+  int nSlot;
+  int nEvent = 0;
+  FILE *f;
+  int rc = SQLITE_OK;
+
+#ifndef SQLITE_OMIT_AUTOINIT
+  sqlite3_initialize();
+#endif
+  vfscEnterMutex();
+  nSlot = TraceRing != NULL ? TraceMask + 1 : 0;
+  vfscLeaveMutex();
+
+  next = AtomicGet(TraceNext);
+  aBuf = (unsigned char*)sqlite3_malloc(TRACE_HEADER_SIZE + nSlot * TRACE_EVENT_SIZE);
+  if (aBuf == NULL)
+  {
+    return SQLITE_NOMEM;
+  }
+
+  // Copy the events oldest first, each between two reads of its number.
+  p = &aBuf[TRACE_HEADER_SIZE];
+  for (seq = MAX(1, next - nSlot + 1); seq <= next; ++seq)
+  {
+    vfsc_event *pSlot = &TraceRing[(seq - 1) & TraceMask];
+    vfsc_event e;
+    if (pSlot->seq != seq)
+    {
+      continue;
+    }
+
+    AtomicBarrier();
+    e = *pSlot;
+    AtomicBarrier();
+    if (pSlot->seq != seq)
+    {
+      continue;
+    }
+
+    Put8byte(&p[0], e.seq);
+    Put8byte(&p[8], e.time);
+    Put8byte(&p[16], e.offset);
+    sqlite3Put4byte(&p[24], (u32)e.length);
+    sqlite3Put4byte(&p[28], (u32)e.chunk);
+    sqlite3Put4byte(&p[32], (u32)e.latency);
+    p[36] = e.op;
+    p[37] = e.rc;
+    p[38] = (unsigned char)(e.file >> 8);
+    p[39] = (unsigned char)e.file;
+    p += TRACE_EVENT_SIZE;
+    ++nEvent;
+  }
+
+  // The wall clock of the dump, to date the monotonic times of the events.
+  pVfs = sqlite3_vfs_find(0);
+  if (pVfs != NULL && pVfs->iVersion >= 2 && pVfs->xCurrentTimeInt64 != NULL)
+  {
+    pVfs->xCurrentTimeInt64(pVfs, &now);
+  }
+  else if (pVfs != NULL)
+  {
+    double r;
+    pVfs->xCurrentTime(pVfs, &r);
+    now = (sqlite3_int64)(r * 86400000.0);
+  }
+
+  memset(aBuf, 0, TRACE_HEADER_SIZE);
+  memcpy(aBuf, TRACE_MAGIC, sizeof(TRACE_MAGIC));
+  sqlite3Put4byte(&aBuf[16], TRACE_EVENT_SIZE);
+  sqlite3Put4byte(&aBuf[20], (u32)nEvent);
+  Put8byte(&aBuf[24], now - 210866760000000LL);
+  Put8byte(&aBuf[32], GetTimerMicros());
+
+  f = fopen(zFilename, "wb");
+  if (f == NULL)
+  {
+    rc = SQLITE_CANTOPEN;
+  }
+  else
+  {
+    size_t n = TRACE_HEADER_SIZE + (size_t)nEvent * TRACE_EVENT_SIZE;
+    if (fwrite(aBuf, 1, n, f) != n)
+    {
+      rc = SQLITE_IOERR_WRITE;
+    }
+
+    if (fclose(f) != 0 && rc == SQLITE_OK)
+    {
+      rc = SQLITE_IOERR_WRITE;
+    }
+  }
+
+  sqlite3_free(aBuf);
+  return rc;
 }
 
+#ifndef SQLITE_OMIT_VIRTUALTABLE
+
 /*
-** Populate the buffer pointed to by zBufOut with nByte bytes of
-** random data.
+** The compress_stats virtual table, the counters of sqlite3_compress_status
+** for each compressed database of the connection, a row per counter and
+** per histogram bucket:
+**
+**   CREATE VIRTUAL TABLE temp.compress_stats USING compress_stats;
+**   SELECT * FROM compress_stats WHERE name='compress_latency';
+**
+** The bucket column is NULL for the counters. The rows are read when the
+** scan starts, so a scan is a consistent enough snapshot to scrape.
 */
-static int vfscRandomness(sqlite3_vfs *pVfs, int nByte, char *zBufOut){
-  vfsc_info *pInfo = (vfsc_info*)pVfs->pAppData;
-  sqlite3_vfs *pRoot = pInfo->pRootVfs;
-  vfsc_printf(pInfo, NonIoOps, "%s.xRandomness(%d)\n", pInfo->zVfsName, nByte);
-  return pRoot->xRandomness(pRoot, nByte, zBufOut);
-}
+#define STATS_VTAB_SCHEMA                                                    \
+  "CREATE TABLE x( "                                                         \
+  "  db        TEXT,             /* The database name */"                    \
+  "  name      TEXT,             /* The counter */"                          \
+  "  bucket    INTEGER,          /* The histogram bucket, or NULL */"        \
+  "  value     INTEGER,          /* The value of the counter */"             \
+  "  highwater INTEGER           /* Its highest value */"                    \
+  ");"
 
 /*
-** Sleep for nMicro microseconds. Return the number of microseconds
-** actually slept.
+** The counters by name, and the histograms with their number of buckets.
 */
-static int vfscSleep(sqlite3_vfs *pVfs, int nMicro){
-  vfsc_info *pInfo = (vfsc_info*)pVfs->pAppData;
-  sqlite3_vfs *pRoot = pInfo->pRootVfs;
-  return pRoot->xSleep(pRoot, nMicro);
-}
+static const struct {
+  const char *zName;                  /* The name column */
+  int op;                             /* The SQLITE_COMPRESS_STATUS value */
+  int nBucket;                        /* Buckets of a histogram, or 0 */
+} aStatusName[] = {
+  { "cache_hits",           SQLITE_COMPRESS_STATUS_CACHE_HIT,            0 },
+  { "cache_misses",         SQLITE_COMPRESS_STATUS_CACHE_MISS,           0 },
+  { "cache_used",           SQLITE_COMPRESS_STATUS_CACHE_USED,           0 },
+  { "cache_dirty",          SQLITE_COMPRESS_STATUS_CACHE_DIRTY,          0 },
+  { "dirtied_chunks",       SQLITE_COMPRESS_STATUS_DIRTIED,              0 },
+  { "evicted_chunks",       SQLITE_COMPRESS_STATUS_EVICTED,              0 },
+  { "evicted_dirty_chunks", SQLITE_COMPRESS_STATUS_EVICTED_DIRTY,        0 },
+  { "compressed_chunks",    SQLITE_COMPRESS_STATUS_COMPRESSED,           0 },
+  { "compress_bytes_in",    SQLITE_COMPRESS_STATUS_COMPRESSED_IN,        0 },
+  { "compress_bytes_out",   SQLITE_COMPRESS_STATUS_COMPRESSED_OUT,       0 },
+  { "compress_us",          SQLITE_COMPRESS_STATUS_COMPRESS_TIME,        0 },
+  { "decompressed_chunks",  SQLITE_COMPRESS_STATUS_DECOMPRESSED,         0 },
+  { "decompress_bytes_in",  SQLITE_COMPRESS_STATUS_DECOMPRESSED_IN,      0 },
+  { "decompress_bytes_out", SQLITE_COMPRESS_STATUS_DECOMPRESSED_OUT,     0 },
+  { "decompress_us",        SQLITE_COMPRESS_STATUS_DECOMPRESS_TIME,      0 },
+  { "reads",                SQLITE_COMPRESS_STATUS_READS,                0 },
+  { "read_bytes",           SQLITE_COMPRESS_STATUS_READ_BYTES,           0 },
+  { "writes",               SQLITE_COMPRESS_STATUS_WRITES,               0 },
+  { "write_bytes",          SQLITE_COMPRESS_STATUS_WRITE_BYTES,          0 },
+  { "compress_ratio",       SQLITE_COMPRESS_STATUS_RATIO_HISTOGRAM,      SQLITE_COMPRESS_RATIO_BUCKETS },
+  { "compress_latency",     SQLITE_COMPRESS_STATUS_COMPRESS_HISTOGRAM,   SQLITE_COMPRESS_LATENCY_BUCKETS },
+  { "decompress_latency",   SQLITE_COMPRESS_STATUS_DECOMPRESS_HISTOGRAM, SQLITE_COMPRESS_LATENCY_BUCKETS },
+};
+
+typedef struct vfsc_stats_row vfsc_stats_row;
+struct vfsc_stats_row {
+  int iDb;                            /* The database, in db->aDb */
+  int iName;                          /* The counter, in aStatusName */
+  int bucket;                         /* The histogram bucket, or -1 */
+  sqlite3_int64 value;                /* The value column */
+  sqlite3_int64 highwater;            /* The highwater column */
+};
+
+typedef struct vfsc_stats_vtab vfsc_stats_vtab;
+struct vfsc_stats_vtab {
+  sqlite3_vtab base;
+  sqlite3 *db;
+};
+
+typedef struct vfsc_stats_cursor vfsc_stats_cursor;
+struct vfsc_stats_cursor {
+  sqlite3_vtab_cursor base;
+  vfsc_stats_row *aRow;               /* The rows, read by xFilter */
+  int nRow;                           /* Number of rows in aRow */
+  int iRow;                           /* The current row */
+};
 
 /*
-** Return the current time as a Julian Day number in *pTimeOut.
+** Connects to or creates a compress_stats virtual table.
 */
-static int vfscCurrentTime(sqlite3_vfs *pVfs, double *pTimeOut){
-  vfsc_info *pInfo = (vfsc_info*)pVfs->pAppData;
-  sqlite3_vfs *pRoot = pInfo->pRootVfs;
-  return pRoot->xCurrentTime(pRoot, pTimeOut);
+static int vfscStatsConnect(
+  sqlite3 *db,
+  void *pAux,
+  int argc, const char *const*argv,
+  sqlite3_vtab **ppVtab,
+  char **pzErr
+){
+  vfsc_stats_vtab *pTab;
+  int rc;
+
+  rc = sqlite3_declare_vtab(db, STATS_VTAB_SCHEMA);
+  if( rc!=SQLITE_OK ) return rc;
+
+  pTab = (vfsc_stats_vtab*)sqlite3_malloc(sizeof(vfsc_stats_vtab));
+  if( pTab==0 ) return SQLITE_NOMEM;
+  memset(pTab, 0, sizeof(vfsc_stats_vtab));
+  pTab->db = db;
+  *ppVtab = &pTab->base;
+  return SQLITE_OK;
 }
-static int vfscCurrentTimeInt64(sqlite3_vfs *pVfs, sqlite3_int64 *pTimeOut){
-  vfsc_info *pInfo = (vfsc_info*)pVfs->pAppData;
-  sqlite3_vfs *pRoot = pInfo->pRootVfs;
-  return pRoot->xCurrentTimeInt64(pRoot, pTimeOut);
+
+static int vfscStatsDisconnect(sqlite3_vtab *pVtab){
+  sqlite3_free(pVtab);
+  return SQLITE_OK;
 }
 
 /*
-** Return th3 emost recent error code and message
+** There is no index, the table is small and always scanned.
 */
-static int vfscGetLastError(sqlite3_vfs *pVfs, int iErr, char *zErr){
-  vfsc_info *pInfo = (vfsc_info*)pVfs->pAppData;
-  sqlite3_vfs *pRoot = pInfo->pRootVfs;
-  return pRoot->xGetLastError(pRoot, iErr, zErr);
+static int vfscStatsBestIndex(sqlite3_vtab *pVtab, sqlite3_index_info *pIdxInfo){
+  pIdxInfo->estimatedCost = 100.0;
+  return SQLITE_OK;
+}
+
+static int vfscStatsOpen(sqlite3_vtab *pVtab, sqlite3_vtab_cursor **ppCursor){
+  vfsc_stats_cursor *pCsr;
+
+  pCsr = (vfsc_stats_cursor*)sqlite3_malloc(sizeof(vfsc_stats_cursor));
+  if( pCsr==0 ) return SQLITE_NOMEM;
+  memset(pCsr, 0, sizeof(vfsc_stats_cursor));
+  *ppCursor = &pCsr->base;
+  return SQLITE_OK;
+}
+
+static int vfscStatsClose(sqlite3_vtab_cursor *pCursor){
+  vfsc_stats_cursor *pCsr = (vfsc_stats_cursor*)pCursor;
+  sqlite3_free(pCsr->aRow);
+  sqlite3_free(pCsr);
+  return SQLITE_OK;
 }
 
 /*
-** Override system calls.
+** Reads the counters of all the compressed databases of the connection.
 */
-static int vfscSetSystemCall(
-  sqlite3_vfs *pVfs,
-  const char *zName,
-  sqlite3_syscall_ptr pFunc
+static int vfscStatsFilter(
+  sqlite3_vtab_cursor *pCursor,
+  int idxNum, const char *idxStr,
+  int argc, sqlite3_value **argv
 ){
-  vfsc_info *pInfo = (vfsc_info*)pVfs->pAppData;
-  sqlite3_vfs *pRoot = pInfo->pRootVfs;
-  return pRoot->xSetSystemCall(pRoot, zName, pFunc);
+  vfsc_stats_cursor *pCsr = (vfsc_stats_cursor*)pCursor;
+  sqlite3 *db = ((vfsc_stats_vtab*)pCursor->pVtab)->db;
+  int nPerDb = 0;
+  int i;
+
+  for (i = 0; i < (int)(sizeof(aStatusName) / sizeof(aStatusName[0])); ++i)
+  {
+    nPerDb += MAX(aStatusName[i].nBucket, 1);
+  }
+
+  sqlite3_free(pCsr->aRow);
+  pCsr->nRow = 0;
+  pCsr->iRow = 0;
+  pCsr->aRow = (vfsc_stats_row*)sqlite3_malloc(db->nDb * nPerDb * sizeof(vfsc_stats_row));
+  if( pCsr->aRow==0 ) return SQLITE_NOMEM;
+
+  for (i = 0; i < db->nDb; ++i)
+  {
+    Btree *pBt = db->aDb[i].pBt;
+    vfsc_file *pFile;
+    int j;
+
+    if (pBt == NULL)
+    {
+      continue;
+    }
+
+    sqlite3BtreeEnter(pBt);
+    pFile = CompressedFile(pBt);
+    for (j = 0; pFile != NULL && j < (int)(sizeof(aStatusName) / sizeof(aStatusName[0])); ++j)
+    {
+      int b = 0;
+      do
+      {
+        vfsc_stats_row *pRow = &pCsr->aRow[pCsr->nRow++];
+        pRow->iDb = i;
+        pRow->iName = j;
+        pRow->bucket = aStatusName[j].nBucket > 0 ? b : -1;
+        ReadStatus(pFile->pDb, aStatusName[j].op + b, &pRow->value, &pRow->highwater, 0);
+      } while (++b < aStatusName[j].nBucket);
+    }
+    sqlite3BtreeLeave(pBt);
+  }
+
+  return SQLITE_OK;
 }
-static sqlite3_syscall_ptr vfscGetSystemCall(
-  sqlite3_vfs *pVfs,
-  const char *zName
+
+static int vfscStatsNext(sqlite3_vtab_cursor *pCursor){
+  vfsc_stats_cursor *pCsr = (vfsc_stats_cursor*)pCursor;
+  pCsr->iRow++;
+  return SQLITE_OK;
+}
+
+static int vfscStatsEof(sqlite3_vtab_cursor *pCursor){
+  vfsc_stats_cursor *pCsr = (vfsc_stats_cursor*)pCursor;
+  return pCsr->iRow >= pCsr->nRow;
+}
+
+static int vfscStatsColumn(
+  sqlite3_vtab_cursor *pCursor,
+  sqlite3_context *ctx,
+  int i
 ){
-  vfsc_info *pInfo = (vfsc_info*)pVfs->pAppData;
-  sqlite3_vfs *pRoot = pInfo->pRootVfs;
-  return pRoot->xGetSystemCall(pRoot, zName);
+  vfsc_stats_cursor *pCsr = (vfsc_stats_cursor*)pCursor;
+  sqlite3 *db = ((vfsc_stats_vtab*)pCursor->pVtab)->db;
+  vfsc_stats_row *pRow = &pCsr->aRow[pCsr->iRow];
+  switch( i ){
+    case 0:            /* db */
+      sqlite3_result_text(ctx, db->aDb[pRow->iDb].zName, -1, SQLITE_TRANSIENT);
+      break;
+    case 1:            /* name */
+      sqlite3_result_text(ctx, aStatusName[pRow->iName].zName, -1, SQLITE_STATIC);
+      break;
+    case 2:            /* bucket */
+      if( pRow->bucket>=0 ) sqlite3_result_int(ctx, pRow->bucket);
+      break;
+    case 3:            /* value */
+      sqlite3_result_int64(ctx, pRow->value);
+      break;
+    case 4:            /* highwater */
+      sqlite3_result_int64(ctx, pRow->highwater);
+      break;
+  }
+  return SQLITE_OK;
 }
-static const char *vfscNextSystemCall(sqlite3_vfs *pVfs, const char *zName){
-  vfsc_info *pInfo = (vfsc_info*)pVfs->pAppData;
-  sqlite3_vfs *pRoot = pInfo->pRootVfs;
-  return pRoot->xNextSystemCall(pRoot, zName);
+
+static int vfscStatsRowid(sqlite3_vtab_cursor *pCursor, sqlite_int64 *pRowid){
+  vfsc_stats_cursor *pCsr = (vfsc_stats_cursor*)pCursor;
+  *pRowid = pCsr->iRow;
+  return SQLITE_OK;
 }
 
 /*
-** Clients invoke this routine to construct a new vfs-compress shim.
+** The compress_chunks virtual table, a row per chunk of each compressed
+** database of the connection, to see where the space goes:
 **
-** Return SQLITE_OK on success.
+**   CREATE VIRTUAL TABLE temp.compress_chunks USING compress_chunks;
+**   SELECT codec, count(*), sum(size), sum(stored) FROM compress_chunks GROUP BY 1;
 **
-** SQLITE_NOMEM is returned in the case of a memory allocation error.
-** SQLITE_NOTFOUND is returned if zOldVfsName does not exist.
+** The size, stored and codec columns describe the chunk as it is in the
+** file, read from its header, so a dirty chunk shows what it was before.
+** The size of the chunks of the first versions, which have no header, is
+** NULL, and so is their stored size in the sparse layout. The written
+** column is when the chunk was last written since the database was
+** opened, in seconds since 1970, or NULL. The cache column is the state of
+** the chunk in cache, or NULL if it isn't cached.
+**
+** A constraint on the chunk column reads only that chunk, so the table
+** can be joined with the pages of the dbstat table (see test_stat.c).
+** For 4 KByte pages in 64 KByte chunks, the disk each b-tree takes is:
+**
+**   SELECT s.name, sum(c.stored * 4096.0 / c.size) AS stored
+**     FROM dbstat s JOIN compress_chunks c ON c.chunk = (s.pageno - 1) / 16
+**     WHERE c.db = 'main' GROUP BY s.name ORDER BY stored DESC;
 */
-SQLITE_API int sqlite3_compress(
-   int trace,                  /* See TraceLevel. 0 to disable. */
-   int compressionLevel,       /* The compression level: -1 for default, 0 to disable, 1 fastest, 9 best */
-   int chunkSizeKBytes,        /* The size of the compression chunk in KBytes: -1 for default */
-   int cacheSizeKBytes         /* The size of the cache in KBytes: -1 for default. */
-){
-  sqlite3_vfs *pNew;
-  sqlite3_vfs *pRoot;
-  vfsc_info *pInfo;
-  int nName;
-  int nByte;
+#define CHUNKS_VTAB_SCHEMA                                                   \
+  "CREATE TABLE x( "                                                         \
+  "  db        TEXT,             /* The database name */"                    \
+  "  chunk     INTEGER,          /* The chunk number */"                     \
+  "  offset    INTEGER,          /* Its offset in the database */"           \
+  "  size      INTEGER,          /* Its uncompressed size */"                \
+  "  stored    INTEGER,          /* Its compressed size, with the header */" \
+  "  codec     TEXT,             /* Its codec, 'raw' or NULL if empty */"    \
+  "  written   INTEGER,          /* When it was last written, or NULL */"    \
+  "  cache     TEXT              /* Its state in cache, or NULL */"          \
+  ");"
+
+typedef struct vfsc_chunks_row vfsc_chunks_row;
+struct vfsc_chunks_row {
+  sqlite_int64 offset;                /* The offset column */
+  int size;                           /* The size column, or -1 */
+  int stored;                         /* The stored column, or -1 */
+  const char *zCodec;                 /* The codec column, or NULL */
+  u32 written;                        /* The written column, or 0 */
+  const char *zCache;                 /* The cache column, or NULL */
+};
+
+typedef struct vfsc_chunks_cursor vfsc_chunks_cursor;
+struct vfsc_chunks_cursor {
+  sqlite3_vtab_cursor base;
+  int iDb;                            /* The database, in db->aDb */
+  int iChunk;                         /* The chunk of the current row */
+  int iOnly;                          /* The chunk constrained, or -1 */
+  int isEof;                          /* Past the last row */
+  vfsc_chunks_row row;                /* The current row */
+};
+
+/*
+** Reads the row of a chunk of a compressed file.
+*/
+static int ReadChunkRow(vfsc_file *pFile, int iChunk, vfsc_chunks_row *pRow)
+{
+  static const char *const azCache[] = { "empty", "dirty", "unwritten", "clean" };
+  vfsc_db *pDb = pFile->pDb;
+  unsigned char aHdr[CHUNK_HEADER_SIZE];
+  sqlite_int64 diskOffset;
+  vfsc_chunk *pChunk;
+  int nRead = CHUNK_HEADER_SIZE;
+  int rc = SQLITE_OK;
   int i;
 
-  int chunkSize = chunkSizeKBytes * 1024 / COMPRESION_UNIT_SIZE_BYTES;
-  ChunkSizeBytes = chunkSize <= 0 ? DEF_CHUNK_SIZE_BYTES : (chunkSize * COMPRESION_UNIT_SIZE_BYTES);
-  CacheSize = cacheSizeKBytes <= 0
-				? 1 + (DEF_CACHE_KBYTES * 1024 / ChunkSizeBytes)
-				: 1 + (cacheSizeKBytes * 1024 / ChunkSizeBytes);
-  CacheSize = min(max(CacheSize, MIN_CACHE_SIZE), MAX_CACHE_SIZE);
+  memset(pRow, 0, sizeof(vfsc_chunks_row));
+  memset(aHdr, 0, sizeof(aHdr));
+  pRow->stored = -1;
 
-  CompressionLevel = compressionLevel;
-  if (CompressionLevel == 0)
+  sqlite3_mutex_enter(pDb->mutex);
+  pRow->offset = (sqlite_int64)iChunk * pDb->chunkSize;
+  diskOffset = pRow->offset;
+  if (pFile->layout == LayoutPacked)
   {
-	  ChunkSizeBytes = 0;
-	  CacheSize = 0;
+    // A chunk that was never written has no extent.
+    vfsc_packed *pPacked = &pDb->packed;
+    int hasExtent = iChunk < pPacked->nIndex && pPacked->aIndex[iChunk].offset != 0;
+    diskOffset = hasExtent ? pPacked->aIndex[iChunk].offset : 0;
+    pRow->stored = hasExtent ? pPacked->aIndex[iChunk].compSize : 0;
+    nRead = MIN(nRead, pRow->stored);
   }
 
-  // Find the windows VFS.
-  pRoot = sqlite3_vfs_find("win32");
-  if( pRoot==0 ) return SQLITE_NOTFOUND;
-  nName = strlen("vfscompress");
-  nByte = sizeof(*pNew) + sizeof(*pInfo) + nName + 1;
-  pNew = (sqlite3_vfs*)sqlite3_malloc( nByte );
-  if( pNew==0 ) return SQLITE_NOMEM;
-  memset(pNew, 0, nByte);
-  pInfo = (vfsc_info*)&pNew[1];
-  pNew->iVersion = pRoot->iVersion;
-  pNew->szOsFile = pRoot->szOsFile + sizeof(vfsc_file);
-  pNew->mxPathname = pRoot->mxPathname;
-  pNew->zName = (char*)&pInfo[1];
-  memcpy((char*)&pInfo[1], "vfscompress", nName+1);
-  pNew->pAppData = pInfo;
-  pNew->xOpen = vfscOpen;
-  pNew->xDelete = vfscDelete;
-  pNew->xAccess = vfscAccess;
-  pNew->xFullPathname = vfscFullPathname;
-  pNew->xDlOpen = pRoot->xDlOpen==0 ? 0 : vfscDlOpen;
-  pNew->xDlError = pRoot->xDlError==0 ? 0 : vfscDlError;
-  pNew->xDlSym = pRoot->xDlSym==0 ? 0 : vfscDlSym;
-  pNew->xDlClose = pRoot->xDlClose==0 ? 0 : vfscDlClose;
-  pNew->xRandomness = vfscRandomness;
-  pNew->xSleep = vfscSleep;
-  pNew->xCurrentTime = vfscCurrentTime;
-  pNew->xGetLastError = pRoot->xGetLastError==0 ? 0 : vfscGetLastError;
-  if( pNew->iVersion>=2 ){
-    pNew->xCurrentTimeInt64 = pRoot->xCurrentTimeInt64==0 ? 0 :
-                                   vfscCurrentTimeInt64;
-    if( pNew->iVersion>=3 ){
-      pNew->xSetSystemCall = pRoot->xSetSystemCall==0 ? 0 :
-                                   vfscSetSystemCall;
-      pNew->xGetSystemCall = pRoot->xGetSystemCall==0 ? 0 :
-                                   vfscGetSystemCall;
-      pNew->xNextSystemCall = pRoot->xNextSystemCall==0 ? 0 :
-                                   vfscNextSystemCall;
+  pChunk = HashFind(pDb, pRow->offset);
+  pRow->zCache = pChunk != NULL ? azCache[(int)pChunk->state] : NULL;
+  pRow->written = iChunk < pDb->nWriteTime ? pDb->aWriteTime[iChunk] : 0;
+  sqlite3_mutex_leave(pDb->mutex);
+
+  if (nRead > 0)
+  {
+    // Past the end of the file reads as zeros, an empty chunk.
+    rc = pFile->pReal->pMethods->xRead(pFile->pReal, aHdr, nRead, diskOffset);
+    if (rc != SQLITE_OK && rc != SQLITE_IOERR_SHORT_READ)
+    {
+      return rc;
     }
   }
 
-  pInfo->pRootVfs = pRoot;
-  pInfo->xOut = (int(*)(const char*,void*))fputs;
-  pInfo->pOutArg = stderr;
-  pInfo->zVfsName = pNew->zName;
-  pInfo->pTraceVfs = pNew;
-  pInfo->trace = trace >= Maximum ? Maximum : (trace < None ? DEFAULT_TRACE_LEVEL : trace);
- 
-  pInfo->pCacheChunks = sqlite3_malloc(CacheSize * sizeof(vfsc_chunk));
-  if(pInfo->pCacheChunks == NULL)
+  if (aHdr[0] == 0)
   {
-    return SQLITE_NOMEM;
+    // A hole, or never written.
+    pRow->size = 0;
+    pRow->stored = 0;
   }
-
-  memset(pInfo->pCache, 0, sizeof(pInfo->pCache));
-  for (i = 0; i < CacheSize; ++i)
+  else if (aHdr[0] == CHUNK_MAGIC && nRead == CHUNK_HEADER_SIZE)
   {
-      pInfo->pCache[i] = (vfsc_chunk*)((char*)pInfo->pCacheChunks + sizeof(vfsc_chunk) * i);
-
-      memset(pInfo->pCache[i], 0, sizeof(vfsc_chunk));
-      pInfo->pCache[i]->state = Empty;
-      pInfo->pCache[i]->offset = 0;
-      pInfo->pCache[i]->origSize = 0;
-      pInfo->pCache[i]->pOrigData = (char*)sqlite3_malloc(ChunkSizeBytes);
+    pRow->size = (int)sqlite3Get4byte(&aHdr[8]);
+    pRow->stored = pRow->stored < 0 ? CHUNK_HEADER_SIZE + (int)sqlite3Get4byte(&aHdr[4]) : pRow->stored;
+    pRow->zCodec = (aHdr[2] & CHUNK_FLAG_RAW) != 0 ? "raw" : "unknown";
+    for (i = 0; i < CODEC_COUNT && (aHdr[2] & CHUNK_FLAG_RAW) == 0; ++i)
+    {
+      if (aCodec[i].id == aHdr[1])
+      {
+        pRow->zCodec = aCodec[i].zName;
+      }
+    }
   }
-  
-  if (CompressionLevel != 0)
+  else
   {
-	  pInfo->strmDeflate.zalloc = Z_NULL;
-	  pInfo->strmDeflate.zfree = Z_NULL;
-	  pInfo->strmDeflate.opaque = Z_NULL;
-	  if (deflateInit2(&pInfo->strmDeflate, CompressionLevel, Z_DEFLATED, MAX_WBITS, MAX_MEM_LEVEL, Z_DEFAULT_STRATEGY) != Z_OK)
-	  {
-		  return SQLITE_NOMEM;
-	  }
+    // A bare zlib stream, from before the chunk headers.
+    pRow->size = -1;
+    pRow->zCodec = "zlib";
+  }
 
-	  pInfo->compDataSize = deflateBound(&pInfo->strmDeflate, ChunkSizeBytes);
-	  pInfo->pCompData = (char*)sqlite3_malloc(pInfo->compDataSize);
-	  if(pInfo->pCompData == NULL)
-	  {
-		return SQLITE_NOMEM;
-	  }
+  return SQLITE_OK;
+}
 
-	  pInfo->strmInflate.zalloc = Z_NULL;
-	  pInfo->strmInflate.zfree = Z_NULL;
-	  pInfo->strmInflate.opaque = Z_NULL;
-	  pInfo->strmInflate.avail_in = 0;
-	  pInfo->strmInflate.next_in = Z_NULL;
-	  if (inflateInit2(&pInfo->strmInflate, MAX_WBITS) != Z_OK)
-	  {
-		  return SQLITE_NOMEM;
-	  }
+/*
+** Moves the cursor to the row of its chunk, or the next database if past
+** the last chunk of its database, or the chunk constrained.
+*/
+static int vfscChunksSeek(vfsc_chunks_cursor *pCsr){
+  sqlite3 *db = ((vfsc_stats_vtab*)pCsr->base.pVtab)->db;
+  int rc = SQLITE_OK;
+
+  pCsr->isEof = 1;
+  while( pCsr->iDb<db->nDb ){
+    Btree *pBt = db->aDb[pCsr->iDb].pBt;
+    if( pBt ){
+      vfsc_file *pFile;
+      sqlite3BtreeEnter(pBt);
+      pFile = CompressedFile(pBt);
+      if( pFile ){
+        vfsc_db *pDb = pFile->pDb;
+        sqlite_int64 size = pFile->layout==LayoutPacked ? PackedLogicalSize(pDb) : SparseLogicalSize(pDb);
+        sqlite_int64 nChunk = (size + pDb->chunkSize - 1) / pDb->chunkSize;
+        if( pCsr->iOnly>=0 && pCsr->iChunk<pCsr->iOnly ){
+          pCsr->iChunk = pCsr->iOnly;
+        }
+        if( pCsr->iChunk<nChunk && (pCsr->iOnly<0 || pCsr->iChunk==pCsr->iOnly) ){
+          pCsr->isEof = 0;
+          rc = ReadChunkRow(pFile, pCsr->iChunk, &pCsr->row);
+        }
+      }
+      sqlite3BtreeLeave(pBt);
+    }
+    if( !pCsr->isEof || rc!=SQLITE_OK ) break;
+    pCsr->iDb++;
+    pCsr->iChunk = 0;
   }
-  
-#ifdef ENABLE_STATISTICS
+  return rc;
+}
+
+static int vfscChunksConnect(
+  sqlite3 *db,
+  void *pAux,
+  int argc, const char *const*argv,
+  sqlite3_vtab **ppVtab,
+  char **pzErr
+){
+  vfsc_stats_vtab *pTab;
+  int rc;
+
+  rc = sqlite3_declare_vtab(db, CHUNKS_VTAB_SCHEMA);
+  if( rc!=SQLITE_OK ) return rc;
 
-	CacheHits = 0;
-	TotalHits = 0;
+  pTab = (vfsc_stats_vtab*)sqlite3_malloc(sizeof(vfsc_stats_vtab));
+  if( pTab==0 ) return SQLITE_NOMEM;
+  memset(pTab, 0, sizeof(vfsc_stats_vtab));
+  pTab->db = db;
+  *ppVtab = &pTab->base;
+  return SQLITE_OK;
+}
+
+/*
+** An equality constraint on the chunk column reads only that chunk.
+** Otherwise all the chunks are read, a header each.
+*/
+static int vfscChunksBestIndex(sqlite3_vtab *pVtab, sqlite3_index_info *pIdxInfo){
+  int i;
 
-	WriteCount = 0;
-	ReadCount = 0;
-	WriteBytes = 0;
-	ReadBytes = 0;
+  pIdxInfo->estimatedCost = 1000000.0;
+  for(i=0; i<pIdxInfo->nConstraint; i++){
+    const struct sqlite3_index_constraint *p = &pIdxInfo->aConstraint[i];
+    if( p->usable && p->iColumn==1 && p->op==SQLITE_INDEX_CONSTRAINT_EQ ){
+      pIdxInfo->idxNum = 1;
+      pIdxInfo->aConstraintUsage[i].argvIndex = 1;
+      pIdxInfo->aConstraintUsage[i].omit = 1;
+      pIdxInfo->estimatedCost = 10.0;
+      break;
+    }
+  }
+  return SQLITE_OK;
+}
 
-	CompressCount = 0;
-	DecompressCount = 0;
-	CompressBytes = 0;
-	DecompressBytes = 0;
+static int vfscChunksOpen(sqlite3_vtab *pVtab, sqlite3_vtab_cursor **ppCursor){
+  vfsc_chunks_cursor *pCsr;
 
-#endif // ENABLE_STATISTICS
+  pCsr = (vfsc_chunks_cursor*)sqlite3_malloc(sizeof(vfsc_chunks_cursor));
+  if( pCsr==0 ) return SQLITE_NOMEM;
+  memset(pCsr, 0, sizeof(vfsc_chunks_cursor));
+  *ppCursor = &pCsr->base;
+  return SQLITE_OK;
+}
 
-  vfsc_printf(pInfo, Registeration, "%s.enabled_for(\"%s\") - Compression Chunk Size: %d KBytes, Level: %d, Cache: %d Chunks (using %d KBytes).\n",
-      pInfo->zVfsName, pRoot->zName, ChunkSizeBytes / 1024, CompressionLevel, CacheSize, ChunkSizeBytes / 1024 * CacheSize);
+static int vfscChunksClose(sqlite3_vtab_cursor *pCursor){
+  sqlite3_free(pCursor);
+  return SQLITE_OK;
+}
 
-  return sqlite3_vfs_register(pNew, 1);
+static int vfscChunksFilter(
+  sqlite3_vtab_cursor *pCursor,
+  int idxNum, const char *idxStr,
+  int argc, sqlite3_value **argv
+){
+  vfsc_chunks_cursor *pCsr = (vfsc_chunks_cursor*)pCursor;
+
+  pCsr->iDb = 0;
+  pCsr->iChunk = 0;
+  pCsr->iOnly = -1;
+  if( idxNum==1 ){
+    sqlite3_int64 iChunk = sqlite3_value_int64(argv[0]);
+    if( sqlite3_value_numeric_type(argv[0])!=SQLITE_INTEGER || iChunk<0 || iChunk>0x7fffffff ){
+      pCsr->isEof = 1;
+      return SQLITE_OK;
+    }
+    pCsr->iOnly = (int)iChunk;
+  }
+  return vfscChunksSeek(pCsr);
+}
+
+static int vfscChunksNext(sqlite3_vtab_cursor *pCursor){
+  vfsc_chunks_cursor *pCsr = (vfsc_chunks_cursor*)pCursor;
+  pCsr->iChunk++;
+  return vfscChunksSeek(pCsr);
+}
+
+static int vfscChunksEof(sqlite3_vtab_cursor *pCursor){
+  vfsc_chunks_cursor *pCsr = (vfsc_chunks_cursor*)pCursor;
+  return pCsr->isEof;
+}
+
+static int vfscChunksColumn(
+  sqlite3_vtab_cursor *pCursor,
+  sqlite3_context *ctx,
+  int i
+){
+  vfsc_chunks_cursor *pCsr = (vfsc_chunks_cursor*)pCursor;
+  sqlite3 *db = ((vfsc_stats_vtab*)pCursor->pVtab)->db;
+  vfsc_chunks_row *pRow = &pCsr->row;
+  switch( i ){
+    case 0:            /* db */
+      sqlite3_result_text(ctx, db->aDb[pCsr->iDb].zName, -1, SQLITE_TRANSIENT);
+      break;
+    case 1:            /* chunk */
+      sqlite3_result_int(ctx, pCsr->iChunk);
+      break;
+    case 2:            /* offset */
+      sqlite3_result_int64(ctx, pRow->offset);
+      break;
+    case 3:            /* size */
+      if( pRow->size>=0 ) sqlite3_result_int(ctx, pRow->size);
+      break;
+    case 4:            /* stored */
+      if( pRow->stored>=0 ) sqlite3_result_int(ctx, pRow->stored);
+      break;
+    case 5:            /* codec */
+      if( pRow->zCodec ) sqlite3_result_text(ctx, pRow->zCodec, -1, SQLITE_STATIC);
+      break;
+    case 6:            /* written */
+      if( pRow->written ) sqlite3_result_int64(ctx, pRow->written);
+      break;
+    case 7:            /* cache */
+      if( pRow->zCache ) sqlite3_result_text(ctx, pRow->zCache, -1, SQLITE_STATIC);
+      break;
+  }
+  return SQLITE_OK;
+}
+
+static int vfscChunksRowid(sqlite3_vtab_cursor *pCursor, sqlite_int64 *pRowid){
+  vfsc_chunks_cursor *pCsr = (vfsc_chunks_cursor*)pCursor;
+  *pRowid = ((sqlite_int64)pCsr->iDb << 32) | pCsr->iChunk;
+  return SQLITE_OK;
+}
+
+/*
+** Registers the virtual table modules of the compressed VFS with a
+** connection. Called by openDatabase.
+*/
+int sqlite3CompressVtabInit(sqlite3 *db){
+  static sqlite3_module stats_module = {
+    0,                            /* iVersion */
+    vfscStatsConnect,             /* xCreate */
+    vfscStatsConnect,             /* xConnect */
+    vfscStatsBestIndex,           /* xBestIndex */
+    vfscStatsDisconnect,          /* xDisconnect */
+    vfscStatsDisconnect,          /* xDestroy */
+    vfscStatsOpen,                /* xOpen - open a cursor */
+    vfscStatsClose,               /* xClose - close a cursor */
+    vfscStatsFilter,              /* xFilter - configure scan constraints */
+    vfscStatsNext,                /* xNext - advance a cursor */
+    vfscStatsEof,                 /* xEof - check for end of scan */
+    vfscStatsColumn,              /* xColumn - read data */
+    vfscStatsRowid,               /* xRowid - read data */
+    0,                            /* xUpdate */
+    0,                            /* xBegin */
+    0,                            /* xSync */
+    0,                            /* xCommit */
+    0,                            /* xRollback */
+    0,                            /* xFindMethod */
+    0,                            /* xRename */
+  };
+  static sqlite3_module chunks_module = {
+    0,                            /* iVersion */
+    vfscChunksConnect,            /* xCreate */
+    vfscChunksConnect,            /* xConnect */
+    vfscChunksBestIndex,          /* xBestIndex */
+    vfscStatsDisconnect,          /* xDisconnect */
+    vfscStatsDisconnect,          /* xDestroy */
+    vfscChunksOpen,               /* xOpen - open a cursor */
+    vfscChunksClose,              /* xClose - close a cursor */
+    vfscChunksFilter,             /* xFilter - configure scan constraints */
+    vfscChunksNext,               /* xNext - advance a cursor */
+    vfscChunksEof,                /* xEof - check for end of scan */
+    vfscChunksColumn,             /* xColumn - read data */
+    vfscChunksRowid,              /* xRowid - read data */
+    0,                            /* xUpdate */
+    0,                            /* xBegin */
+    0,                            /* xSync */
+    0,                            /* xCommit */
+    0,                            /* xRollback */
+    0,                            /* xFindMethod */
+    0,                            /* xRename */
+  };
+  int rc = sqlite3_create_module(db, "compress_stats", &stats_module, 0);
+  if( rc==SQLITE_OK ){
+    rc = sqlite3_create_module(db, "compress_chunks", &chunks_module, 0);
+  }
+  return rc;
 }
 
+#endif /* SQLITE_OMIT_VIRTUALTABLE */
+
 #else
 
 SQLITE_API int sqlite3_compress(
@@ -1699,4 +10018,76 @@ SQLITE_API int sqlite3_compress(
   return SQLITE_OK;
 }
 
-#endif /* SQLITE_OS_WIN */
+SQLITE_API sqlite3_int64 sqlite3_compress_memory_limit(sqlite3_int64 nByte){
+  return 0;
+}
+
+SQLITE_API int sqlite3_compress_huge_pages(int eMode){
+  return 0;
+}
+
+SQLITE_API int sqlite3_compress_threads(int nThread){
+  return 0;
+}
+
+SQLITE_API sqlite3_recompress *sqlite3_recompress_init(
+  sqlite3 *db,
+  const char *zDb,
+  const char *zCodec,
+  int level
+){
+  sqlite3_mutex_enter(db->mutex);
+  sqlite3Error(db, SQLITE_ERROR, "database is not compressed");
+  sqlite3_mutex_leave(db->mutex);
+  return 0;
+}
+
+SQLITE_API int sqlite3_recompress_step(sqlite3_recompress *p, int nChunk){
+  return SQLITE_MISUSE;
+}
+
+SQLITE_API int sqlite3_recompress_finish(sqlite3_recompress *p){
+  return SQLITE_OK;
+}
+
+SQLITE_API int sqlite3_recompress_remaining(sqlite3_recompress *p){
+  return 0;
+}
+
+SQLITE_API int sqlite3_recompress_chunkcount(sqlite3_recompress *p){
+  return 0;
+}
+
+SQLITE_API int sqlite3_compress_convert(
+  const char *zFilename,
+  int compress,
+  int (*xProgress)(void*,sqlite3_int64,sqlite3_int64),
+  void *pArg
+){
+  return compress ? SQLITE_MISUSE : SQLITE_OK;
+}
+
+SQLITE_API int sqlite3_compress_status(
+  sqlite3 *db,
+  const char *zDb,
+  int op,
+  sqlite3_int64 *pCurrent,
+  sqlite3_int64 *pHighwater,
+  int resetFlag
+){
+  return SQLITE_ERROR;
+}
+
+SQLITE_API int sqlite3_compress_trace(int nEvent){
+  return 0;
+}
+
+SQLITE_API int sqlite3_compress_trace_dump(const char *zFilename){
+  return SQLITE_MISUSE;
+}
+
+int sqlite3CompressVtabInit(sqlite3 *db){
+  return SQLITE_OK;
+}
+
+#endif /* SQLITE_OS_WIN || SQLITE_OS_UNIX */
@@ -0,0 +1,171 @@
+/*
+** A utility for printing the binary I/O trace of the compression VFS,
+** as written by sqlite3_compress_trace_dump().  See TRACE_MAGIC in
+** src/vfs_compress.c for the format.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define TRACE_MAGIC       "vfscompress tr1"
+#define TRACE_HEADER_SIZE 40
+#define TRACE_OPS         9
+
+typedef long long int i64;      /* Datatype for 64-bit integers */
+
+/*
+** The operations, by their TraceOp value.
+*/
+static const char *azOp[TRACE_OPS] = {
+  "?", "open", "close", "read", "write", "sync", "truncate", "load", "flush"
+};
+
+/*
+** The layouts of an open event.
+*/
+static const char *azLayout[] = { "plain", "sparse", "packed", "log" };
+
+/*
+** Per operation totals, for the summary.
+*/
+static i64 anCount[TRACE_OPS];
+static i64 anBytes[TRACE_OPS];
+static i64 anLatency[TRACE_OPS];
+static i64 anMaxLatency[TRACE_OPS];
+static i64 anError[TRACE_OPS];
+
+/* Report an out-of-memory error and die.
+*/
+static void out_of_memory(void){
+  fprintf(stderr,"Out of memory...\n");
+  exit(1);
+}
+
+/*
+** Decode big-endian integers.
+*/
+static unsigned int decode4(const unsigned char *z){
+  return ((unsigned int)z[0]<<24) | (z[1]<<16) | (z[2]<<8) | z[3];
+}
+static i64 decode8(const unsigned char *z){
+  return ((i64)decode4(z)<<32) | decode4(&z[4]);
+}
+
+/*
+** Format a time in microseconds since 1970 as local time.
+*/
+static const char *wallTime(i64 us, char *zBuf, int nBuf){
+  time_t t = (time_t)(us/1000000);
+  struct tm *pTm = localtime(&t);
+  int n;
+  if( pTm==0 ){
+    snprintf(zBuf, nBuf, "%lld", us);
+    return zBuf;
+  }
+  n = (int)strftime(zBuf, nBuf, "%Y-%m-%d %H:%M:%S", pTm);
+  snprintf(&zBuf[n], nBuf-n, ".%06d", (int)(us%1000000));
+  return zBuf;
+}
+
+/*
+** Print one event, dating it from the times of the dump.
+*/
+static void print_event(const unsigned char *a, i64 wallBase, i64 timerBase){
+  char zTime[64];
+  i64 seq = decode8(&a[0]);
+  i64 tm = decode8(&a[8]);
+  i64 ofst = decode8(&a[16]);
+  int len = (int)decode4(&a[24]);
+  int chunk = (int)decode4(&a[28]);
+  int latency = (int)decode4(&a[32]);
+  int op = a[36];
+  int rc = a[37];
+  int file = (a[38]<<8) | a[39];
+  const char *zOp = op<TRACE_OPS ? azOp[op] : "?";
+
+  wallTime(wallBase - (timerBase - tm), zTime, sizeof(zTime));
+  printf("%8lld %s file %-5d %-8s", seq, zTime, file, zOp);
+  if( op==1 ){
+    printf(" flags 0x%x %s", len,
+           chunk>=0 && chunk<4 ? azLayout[chunk] : "?");
+  }else if( op==5 ){
+    printf(" flags 0x%x", len);
+  }else if( op!=2 ){
+    printf(" ofst %-12lld n %-8d", ofst, len);
+    if( chunk>=0 ) printf(" chunk %-8d", chunk);
+  }
+  printf(" %8dus", latency);
+  if( rc ) printf(" rc %d", rc);
+  printf("\n");
+
+  if( op>=TRACE_OPS ) op = 0;
+  anCount[op]++;
+  if( op==3 || op==4 || op==7 || op==8 ) anBytes[op] += len;
+  anLatency[op] += latency;
+  if( latency>anMaxLatency[op] ) anMaxLatency[op] = latency;
+  if( rc ) anError[op]++;
+}
+
+/*
+** Print the totals of each operation.
+*/
+static void print_summary(void){
+  int i;
+  printf("\n%-8s %10s %14s %10s %10s %8s\n",
+         "op", "count", "bytes", "avg us", "max us", "errors");
+  for(i=0; i<TRACE_OPS; i++){
+    if( anCount[i]==0 ) continue;
+    printf("%-8s %10lld %14lld %10.1f %10lld %8lld\n", azOp[i], anCount[i],
+           anBytes[i], (double)anLatency[i]/anCount[i], anMaxLatency[i],
+           anError[i]);
+  }
+}
+
+int main(int argc, char **argv){
+  FILE *in;
+  unsigned char aHdr[TRACE_HEADER_SIZE];
+  unsigned char *aEvent;
+  int szEvent, nEvent, i;
+  i64 wallBase, timerBase;
+  char zTime[64];
+
+  if( argc!=2 ){
+    fprintf(stderr,"Usage: %s FILENAME\n", argv[0]);
+    exit(1);
+  }
+  in = fopen(argv[1], "rb");
+  if( in==0 ){
+    fprintf(stderr,"%s: can't open %s\n", argv[0], argv[1]);
+    exit(1);
+  }
+  if( fread(aHdr, 1, sizeof(aHdr), in)!=sizeof(aHdr)
+   || memcmp(aHdr, TRACE_MAGIC, sizeof(TRACE_MAGIC))!=0 ){
+    fprintf(stderr,"%s: not a compression trace: %s\n", argv[0], argv[1]);
+    exit(1);
+  }
+  szEvent = (int)decode4(&aHdr[16]);
+  nEvent = (int)decode4(&aHdr[20]);
+  wallBase = decode8(&aHdr[24])*1000;
+  timerBase = decode8(&aHdr[32]);
+  if( szEvent<40 ){
+    fprintf(stderr,"%s: bad event size %d\n", argv[0], szEvent);
+    exit(1);
+  }
+  printf("Dumped: %s\n", wallTime(wallBase, zTime, sizeof(zTime)));
+  printf("Events: %d of %d bytes\n", nEvent, szEvent);
+
+  aEvent = malloc(szEvent);
+  if( aEvent==0 ) out_of_memory();
+  for(i=0; i<nEvent; i++){
+    if( fread(aEvent, 1, szEvent, in)!=(size_t)szEvent ){
+      printf("truncated after %d events\n", i);
+      break;
+    }
+    print_event(aEvent, wallBase, timerBase);
+  }
+  print_summary();
+  free(aEvent);
+  fclose(in);
+  return 0;
+}